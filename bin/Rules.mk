@@ -13,6 +13,21 @@ BINS += $(d)timeserver
 
 #server
 $(d)server: $(OBJS-tapir-server) $(LIB-udptransport) \
-		$(OBJS-ir-replica) $(OBJS-tapir-store)
+		$(OBJS-ir-replica) $(OBJS-ir-client) $(OBJS-tapir-store)
 
 BINS += $(d)server
+
+#conflict benchmark
+$(d)conflict: $(OBJS-conflict) $(OBJS-tapir-store)
+
+BINS += $(d)conflict
+
+#write-ahead log benchmark
+$(d)walbench: $(OBJS-walbench) $(OBJS-tapir-store)
+
+BINS += $(d)walbench
+
+#partitioned store benchmark
+$(d)partbench: $(OBJS-partbench) $(OBJS-tapir-store)
+
+BINS += $(d)partbench
@@ -4,7 +4,7 @@ SRCS += $(addprefix $(d), \
 	lookup3.cc message.cc memory.cc \
 	latency.cc configuration.cc transport.cc \
 	udptransport.cc tcptransport.cc simtransport.cc repltransport.cc \
-	persistent_register.cc)
+	persistent_register.cc wal.cc)
 
 PROTOS += $(addprefix $(d), \
           latency-format.proto)
@@ -33,5 +33,7 @@ LIB-tcptransport := $(o)tcptransport.o $(LIB-transport)
 
 LIB-persistent_register := $(o)persistent_register.o $(LIB-message)
 
+LIB-wal := $(o)wal.o $(LIB-message)
+
 include $(d)tests/Rules.mk
 
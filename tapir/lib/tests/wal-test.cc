@@ -0,0 +1,141 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * wal-test.cc:
+ *   test cases for WriteAheadLog
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/lib/wal.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static const char *WAL_TEST_FILE = "/tmp/wal-test.wal";
+
+TEST(WriteAheadLog, AppendReplay)
+{
+    unlink(WAL_TEST_FILE);
+    {
+        WriteAheadLog log(WAL_TEST_FILE, 100);
+        EXPECT_EQ(1u, log.Append("a"));
+        EXPECT_EQ(2u, log.Append(""));
+        uint64_t seq = log.Append(string(3 * WAL_WINDOW_BYTES, 'x'));
+        log.Sync(seq);
+        EXPECT_EQ(3u, log.Durable());
+    }
+
+    vector<string> records;
+    WriteAheadLog log(WAL_TEST_FILE, 100);
+    log.Replay([&](const string &r) { records.push_back(r); });
+    ASSERT_EQ(3u, records.size());
+    EXPECT_EQ("a", records[0]);
+    EXPECT_EQ("", records[1]);
+    EXPECT_EQ(3u * WAL_WINDOW_BYTES, records[2].size());
+    unlink(WAL_TEST_FILE);
+}
+
+TEST(WriteAheadLog, TornTail)
+{
+    unlink(WAL_TEST_FILE);
+    {
+        WriteAheadLog log(WAL_TEST_FILE, 0);
+        log.Append("first");
+        log.Sync(log.Append("second"));
+    }
+    // a crash in the middle of the last record
+    ASSERT_EQ(0, truncate(WAL_TEST_FILE, 20));
+
+    vector<string> records;
+    {
+        WriteAheadLog log(WAL_TEST_FILE, 0);
+        log.Replay([&](const string &r) { records.push_back(r); });
+        ASSERT_EQ(1u, records.size());
+        EXPECT_EQ("first", records[0]);
+        log.Sync(log.Append("third"));
+    }
+
+    records.clear();
+    WriteAheadLog log(WAL_TEST_FILE, 0);
+    log.Replay([&](const string &r) { records.push_back(r); });
+    ASSERT_EQ(2u, records.size());
+    EXPECT_EQ("third", records[1]);
+    unlink(WAL_TEST_FILE);
+}
+
+TEST(WriteAheadLog, GroupCommit)
+{
+    unlink(WAL_TEST_FILE);
+    uint64_t notified = 0;
+    {
+        WriteAheadLog log(WAL_TEST_FILE, 2000);
+        log.OnDurable([&](uint64_t seq) { notified = seq; });
+
+        // writers waiting at the same time share syncs
+        vector<std::thread> writers;
+        for (int t = 0; t < 8; t++) {
+            writers.push_back(std::thread([&log]() {
+                for (int i = 0; i < 20; i++) {
+                    log.Sync(log.Append("record"));
+                }
+            }));
+        }
+        for (auto &w : writers) {
+            w.join();
+        }
+        EXPECT_EQ(160u, log.Durable());
+        EXPECT_LT(log.Syncs(), 160u);
+    }
+    // the flusher has stopped, callbacks and all
+    EXPECT_EQ(160u, notified);
+    unlink(WAL_TEST_FILE);
+}
+
+TEST(WriteAheadLog, Reset)
+{
+    unlink(WAL_TEST_FILE);
+    {
+        WriteAheadLog log(WAL_TEST_FILE, 1000);
+        log.Append("a");
+        log.Append("b");
+        // sequence numbers go on from where they were
+        EXPECT_EQ(3u, log.Reset("snapshot"));
+        EXPECT_EQ(3u, log.Durable());
+        log.Sync(log.Append("c"));
+    }
+
+    vector<string> records;
+    WriteAheadLog log(WAL_TEST_FILE, 0);
+    log.Replay([&](const string &r) { records.push_back(r); });
+    ASSERT_EQ(2u, records.size());
+    EXPECT_EQ("snapshot", records[0]);
+    EXPECT_EQ("c", records[1]);
+    unlink(WAL_TEST_FILE);
+}
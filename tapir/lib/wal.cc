@@ -0,0 +1,313 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * wal.cc: An append-only write-ahead log with group commit.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+#include "tapir/lib/wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/hash.h"
+#include "tapir/lib/message.h"
+
+namespace {
+
+// Record frame: length, checksum of the bytes, then the bytes.
+struct Frame {
+    uint32_t length;
+    uint32_t checksum;
+};
+
+const uint32_t CHECKSUM_SEED = 0x57414c31;
+
+// Calls fn on each intact record in data, and returns the length of
+// the intact prefix.
+uint64_t Scan(const char *data, uint64_t length,
+              const std::function<void (const std::string &)> &fn)
+{
+    uint64_t offset = 0;
+    while (offset + sizeof(Frame) <= length) {
+        Frame f;
+        std::memcpy(&f, data + offset, sizeof(f));
+        if (f.length > length - offset - sizeof(Frame) ||
+            hash(data + offset + sizeof(Frame), f.length, CHECKSUM_SEED) !=
+            f.checksum) {
+            break;
+        }
+        if (fn) {
+            fn(std::string(data + offset + sizeof(Frame), f.length));
+        }
+        offset += sizeof(Frame) + f.length;
+    }
+    return offset;
+}
+
+// Appends record, framed, to out.
+void Encode(const std::string &record, std::string &out)
+{
+    Frame f;
+    f.length = record.size();
+    f.checksum = hash(record.data(), record.size(), CHECKSUM_SEED);
+    out.append((const char *)&f, sizeof(f));
+    out.append(record);
+}
+
+// Writes all of data to fd.
+bool WriteAll(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Maps filename read-only; returns NULL for an empty file.
+const char *Map(const std::string &filename, int fd, uint64_t &length)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        Panic("Unable to stat %s: %s", filename.c_str(), std::strerror(errno));
+    }
+    length = st.st_size;
+    if (length == 0) {
+        return NULL;
+    }
+    void *m = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+        Panic("Unable to map %s: %s", filename.c_str(), std::strerror(errno));
+    }
+    madvise(m, length, MADV_SEQUENTIAL);
+    return (const char *)m;
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string &filename, uint64_t windowUs,
+                             size_t windowBytes)
+    : filename_(filename), windowUs_(windowUs), windowBytes_(windowBytes),
+      replayLength_(0), appended_(0), durable_(0), syncs_(0),
+      stopping_(false)
+{
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+        Panic("Unable to open %s: %s", filename.c_str(), std::strerror(errno));
+    }
+
+    // cut off a record torn by a crash, and whatever follows it
+    uint64_t length;
+    const char *data = Map(filename, fd_, length);
+    if (data != NULL) {
+        replayLength_ = Scan(data, length, nullptr);
+        munmap((void *)data, length);
+    }
+    if (replayLength_ < length) {
+        Warning("Truncating %s from %lu to %lu bytes", filename.c_str(),
+                length, replayLength_);
+        if (ftruncate(fd_, replayLength_) != 0 || fdatasync(fd_) != 0) {
+            Panic("Unable to truncate %s: %s", filename.c_str(),
+                  std::strerror(errno));
+        }
+    }
+
+    flusher_ = std::thread([this]() { Flush(); });
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    {
+        std::lock_guard<std::mutex> l(mtx_);
+        stopping_ = true;
+    }
+    work_.notify_one();
+    flusher_.join();
+    close(fd_);
+}
+
+void
+WriteAheadLog::Replay(const std::function<void (const std::string &)> &fn) const
+{
+    ASSERT(Appended() == 0);
+
+    int fd = open(filename_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        Panic("Unable to open %s: %s", filename_.c_str(), std::strerror(errno));
+    }
+    uint64_t length;
+    const char *data = Map(filename_, fd, length);
+    close(fd);
+    if (data != NULL) {
+        Scan(data, std::min(length, replayLength_), fn);
+        munmap((void *)data, length);
+    }
+}
+
+uint64_t
+WriteAheadLog::Append(const std::string &record)
+{
+    std::lock_guard<std::mutex> l(mtx_);
+    bool first = buffer_.empty();
+    Encode(record, buffer_);
+    uint64_t seq = ++appended_;
+    if (first || buffer_.size() >= windowBytes_) {
+        work_.notify_one();
+    }
+    return seq;
+}
+
+uint64_t
+WriteAheadLog::Appended() const
+{
+    std::lock_guard<std::mutex> l(mtx_);
+    return appended_;
+}
+
+uint64_t
+WriteAheadLog::Durable() const
+{
+    std::lock_guard<std::mutex> l(mtx_);
+    return durable_;
+}
+
+uint64_t
+WriteAheadLog::Syncs() const
+{
+    std::lock_guard<std::mutex> l(mtx_);
+    return syncs_;
+}
+
+void
+WriteAheadLog::Sync(uint64_t seq)
+{
+    std::unique_lock<std::mutex> l(mtx_);
+    ASSERT(seq <= appended_);
+    durableCv_.wait(l, [&]() { return durable_ >= seq; });
+}
+
+uint64_t
+WriteAheadLog::Reset(const std::string &record)
+{
+    std::unique_lock<std::mutex> l(mtx_);
+    // once all is durable the flusher is done with fd_, and it takes
+    // no new group while the lock is held
+    durableCv_.wait(l, [&]() { return durable_ >= appended_; });
+
+    std::string data;
+    Encode(record, data);
+    std::string tmpFilename = filename_ + ".tmp";
+    int fd = open(tmpFilename.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0 || !WriteAll(fd, data.data(), data.size()) ||
+        fdatasync(fd) != 0 ||
+        rename(tmpFilename.c_str(), filename_.c_str()) != 0) {
+        Panic("Unable to reset %s: %s", filename_.c_str(),
+              std::strerror(errno));
+    }
+    close(fd_);
+    fd_ = fd;
+
+    uint64_t seq = ++appended_;
+    durable_ = seq;
+    syncs_++;
+    std::function<void (uint64_t)> cb = onDurable_;
+    durableCv_.notify_all();
+    l.unlock();
+    if (cb) {
+        cb(seq);
+    }
+    return seq;
+}
+
+void
+WriteAheadLog::OnDurable(const std::function<void (uint64_t)> &cb)
+{
+    std::lock_guard<std::mutex> l(mtx_);
+    onDurable_ = cb;
+}
+
+// The flusher: collects a group for up to the window after its first
+// record (or until windowBytes are waiting), then writes and syncs it
+// while the next group builds up.
+void
+WriteAheadLog::Flush()
+{
+    std::string group;
+    std::unique_lock<std::mutex> l(mtx_);
+
+    while (true) {
+        work_.wait(l, [&]() { return stopping_ || !buffer_.empty(); });
+        if (buffer_.empty()) {
+            break;
+        }
+        if (windowUs_ > 0 && !stopping_) {
+            auto deadline = std::chrono::steady_clock::now() +
+                std::chrono::microseconds(windowUs_);
+            work_.wait_until(l, deadline, [&]() {
+                return stopping_ || buffer_.size() >= windowBytes_;
+            });
+        }
+
+        group.clear();
+        group.swap(buffer_);
+        uint64_t seq = appended_;
+        l.unlock();
+
+        if (!WriteAll(fd_, group.data(), group.size())) {
+            Panic("Unable to write %s: %s", filename_.c_str(),
+                  std::strerror(errno));
+        }
+        if (fdatasync(fd_) != 0) {
+            Panic("Unable to sync %s: %s", filename_.c_str(),
+                  std::strerror(errno));
+        }
+
+        l.lock();
+        durable_ = seq;
+        syncs_++;
+        std::function<void (uint64_t)> cb = onDurable_;
+        durableCv_.notify_all();
+        l.unlock();
+        if (cb) {
+            cb(seq);
+        }
+        l.lock();
+    }
+}
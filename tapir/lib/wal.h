@@ -0,0 +1,113 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * wal.h: An append-only write-ahead log with group commit.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+#ifndef _LIB_WAL_H_
+#define _LIB_WAL_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Flush a group early once this many bytes are waiting.
+#define WAL_WINDOW_BYTES (1 << 20)
+
+// An append-only log of opaque records, made durable in groups: a
+// flusher thread waits up to the group-commit window for more records
+// after the first one, then writes them all and issues one fdatasync
+// for the lot. Writers that share a log tell their records apart by a
+// leading tag byte. For example,
+//
+//     WriteAheadLog log("replica.wal", 200);
+//     log.Replay([](const std::string &r) { Apply(r); });
+//     ...
+//     uint64_t seq = log.Append(r);
+//     log.Sync(seq);   // or reply from an OnDurable callback
+//
+// Each record is framed by its length and a checksum, so a record torn
+// by a crash is detected; it and anything after it are cut off when
+// the log is opened.
+class WriteAheadLog {
+public:
+    WriteAheadLog(const std::string &filename, uint64_t windowUs,
+                  size_t windowBytes = WAL_WINDOW_BYTES);
+    ~WriteAheadLog();
+
+    // Calls fn on every record in the log, in order. Only before the
+    // first Append.
+    void Replay(const std::function<void (const std::string &)> &fn) const;
+
+    // Appends a record and returns its sequence number (from 1). The
+    // record is durable once Durable() reaches it.
+    uint64_t Append(const std::string &record);
+    uint64_t Appended() const;
+    uint64_t Durable() const;
+
+    // Starts the log over with just record, once what it held is kept
+    // elsewhere (e.g. in a checkpoint). Waits for the records appended
+    // so far to be durable, then writes the new log beside the old one
+    // and renames it over it, so a crash leaves one or the other.
+    // Returns the record's sequence number, durable on return.
+    uint64_t Reset(const std::string &record);
+
+    // Blocks until the record numbered seq is durable.
+    void Sync(uint64_t seq);
+
+    // Called on the flusher thread after each group is durable, with
+    // the last sequence number in it.
+    void OnDurable(const std::function<void (uint64_t)> &cb);
+
+    // Number of fdatasyncs so far.
+    uint64_t Syncs() const;
+
+    std::string Filename() const { return filename_; }
+
+private:
+    const std::string filename_;
+    const uint64_t windowUs_;
+    const size_t windowBytes_;
+    int fd_;
+    // length of the intact prefix of the file found on open
+    uint64_t replayLength_;
+
+    mutable std::mutex mtx_;
+    std::condition_variable work_;
+    std::condition_variable durableCv_;
+    std::string buffer_;
+    uint64_t appended_;
+    uint64_t durable_;
+    uint64_t syncs_;
+    bool stopping_;
+    std::function<void (uint64_t)> onDurable_;
+    std::thread flusher_;
+
+    void Flush();
+};
+
+#endif  // _LIB_WAL_H_
@@ -39,20 +39,24 @@ namespace ir {
 
 Record::Record(const proto::RecordProto &record_proto) {
     for (const proto::RecordEntryProto &entry_proto : record_proto.entry()) {
-        const view_t view = entry_proto.view();
-        const opid_t opid = std::make_pair(entry_proto.opid().clientid(),
-                                     entry_proto.opid().clientreqid());
-        Request request;
-        request.set_op(entry_proto.op());
-        request.set_clientid(entry_proto.opid().clientid());
-        request.set_clientreqid(entry_proto.opid().clientreqid());
-        proto::RecordEntryState state = entry_proto.state();
-        proto::RecordEntryType type = entry_proto.type();
-        const std::string& result = entry_proto.result();
-        Add(view, opid, request, state, type, result);
+        Add(FromProto(entry_proto));
     }
 }
 
+RecordEntry
+Record::FromProto(const proto::RecordEntryProto &entry_proto)
+{
+    const view_t view = entry_proto.view();
+    const opid_t opid = std::make_pair(entry_proto.opid().clientid(),
+                                 entry_proto.opid().clientreqid());
+    Request request;
+    request.set_op(entry_proto.op());
+    request.set_clientid(entry_proto.opid().clientid());
+    request.set_clientreqid(entry_proto.opid().clientreqid());
+    return RecordEntry(view, opid, entry_proto.state(), entry_proto.type(),
+                       request, entry_proto.result());
+}
+
 RecordEntry &
 Record::Add(const RecordEntry& entry) {
     // Make sure this isn't a duplicate
@@ -144,19 +148,22 @@ void
 Record::ToProto(proto::RecordProto *proto) const
 {
     for (const std::pair<const opid_t, RecordEntry> &p : entries) {
-        const RecordEntry &entry = p.second;
-        proto::RecordEntryProto *entry_proto = proto->add_entry();
-
-        entry_proto->set_view(entry.view);
-        entry_proto->mutable_opid()->set_clientid(entry.opid.first);
-        entry_proto->mutable_opid()->set_clientreqid(entry.opid.second);
-        entry_proto->set_state(entry.state);
-        entry_proto->set_type(entry.type);
-        entry_proto->set_op(entry.request.op());
-        entry_proto->set_result(entry.result);
+        ToProto(p.second, proto->add_entry());
     }
 }
 
+void
+Record::ToProto(const RecordEntry &entry, proto::RecordEntryProto *entry_proto)
+{
+    entry_proto->set_view(entry.view);
+    entry_proto->mutable_opid()->set_clientid(entry.opid.first);
+    entry_proto->mutable_opid()->set_clientreqid(entry.opid.second);
+    entry_proto->set_state(entry.state);
+    entry_proto->set_type(entry.type);
+    entry_proto->set_op(entry.request.op());
+    entry_proto->set_result(entry.result);
+}
+
 const std::map<opid_t, RecordEntry> &Record::Entries() const {
     return entries;
 }
@@ -110,6 +110,10 @@ public:
     void Remove(opid_t opid);
     bool Empty() const;
     void ToProto(proto::RecordProto *proto) const;
+    // A single entry, as it appears in a RecordProto.
+    static void ToProto(const RecordEntry &entry,
+                        proto::RecordEntryProto *entry_proto);
+    static RecordEntry FromProto(const proto::RecordEntryProto &entry_proto);
     const std::map<opid_t, RecordEntry> &Entries() const;
 
 private:
@@ -19,19 +19,30 @@ using namespace std;
 using namespace proto;
 
 IRReplica::IRReplica(transport::Configuration config, int myIdx,
-                     Transport *transport, IRAppReplica *app)
+                     Transport *transport, IRAppReplica *app,
+                     WriteAheadLog *log)
     : config(std::move(config)), myIdx(myIdx), transport(transport), app(app),
       status(STATUS_NORMAL), view(0), latest_normal_view(0),
       // TODO: Take these filenames in via the command line?
       persistent_view_info(config.replica(myIdx).host + ":" +
                            config.replica(myIdx).port + "_" +
                            std::to_string(myIdx) + ".bin"),
+      log(log),
+      batching(false),
       // Note that a leader waits for DO-VIEW-CHANGE messages from f other
       // replicas (as opposed to f + 1) for a total of f + 1 replicas.
       do_view_change_quorum(config.f)
 {
     transport->Register(this, config, myIdx);
 
+    if (log != nullptr) {
+        RecoverRecord();
+        // replies are sent from the transport loop, not the flusher
+        log->OnDurable([this](uint64_t seq) {
+            this->transport->Timer(0, [this]() { ReleaseReplies(); });
+        });
+    }
+
     // If our view info was previously initialized, then we are being started
     // in recovery mode. If our view info has never been initialized, then this
     // is the first time we are being run.
@@ -63,6 +74,21 @@ IRReplica::IRReplica(transport::Configuration config, int myIdx,
 
 IRReplica::~IRReplica() { }
 
+const Record &
+IRReplica::GetRecord() const
+{
+    return record;
+}
+
+void
+IRReplica::SetBatching(bool batching)
+{
+    if (!batching) {
+        ExecBatch();
+    }
+    this->batching = batching;
+}
+
 void
 IRReplica::ReceiveMessage(const TransportAddress &remote,
                           const string &type, const string &data)
@@ -82,6 +108,11 @@ IRReplica::HandleMessage(const TransportAddress &remote,
     DoViewChangeMessage doViewChange;
     StartViewMessage startView;
 
+    if (!batch.empty() && type != proposeConsensus.GetTypeName()) {
+        // keep the batch ordered before whatever comes after it
+        ExecBatch();
+    }
+
     if (type == proposeInconsistent.GetTypeName()) {
         proposeInconsistent.ParseFromString(data);
         HandleProposeInconsistent(remote, proposeInconsistent);
@@ -132,8 +163,8 @@ IRReplica::HandleProposeInconsistent(const TransportAddress &remote,
         reply.set_finalized(entry->state == RECORD_STATE_FINALIZED);
     } else {
         // Otherwise, put it in our record as tentative
-        record.Add(view, opid, msg.req(), RECORD_STATE_TENTATIVE,
-                   RECORD_TYPE_INCONSISTENT);
+        LogEntry(record.Add(view, opid, msg.req(), RECORD_STATE_TENTATIVE,
+                            RECORD_TYPE_INCONSISTENT));
 
         // 3. Return Reply
         reply.set_view(view);
@@ -144,8 +175,7 @@ IRReplica::HandleProposeInconsistent(const TransportAddress &remote,
     }
 
     // Send the reply
-    transport->SendMessage(this, remote, reply);
-
+    Reply(remote, reply);
 }
 
 void
@@ -165,16 +195,25 @@ IRReplica::HandleFinalizeInconsistent(const TransportAddress &remote,
         // Mark entry as finalized
         record.SetStatus(opid, RECORD_STATE_FINALIZED);
 
-        // Execute the operation
-        app->ExecInconsistentUpcall(entry->request.op());
+        // Execute the operation; the entry is logged after whatever the
+        // app logs for it, and the reply waits for both
+        std::shared_ptr<TransportAddress> from(remote.clone());
+        app->ExecInconsistentUpcallAsync(
+            entry->request.op(), [this, opid, from]() {
+                RecordEntry *entry = record.Find(opid);
+                if (entry != NULL) {
+                    LogEntry(*entry);
+                }
 
-        // Send the reply
-        ConfirmMessage reply;
-        reply.set_view(view);
-        reply.set_replicaidx(myIdx);
-        *reply.mutable_opid() = msg.opid();
+                // Send the reply
+                ConfirmMessage reply;
+                reply.set_view(view);
+                reply.set_replicaidx(myIdx);
+                reply.mutable_opid()->set_clientid(opid.first);
+                reply.mutable_opid()->set_clientreqid(opid.second);
 
-        transport->SendMessage(this, remote, reply);
+                Reply(*from, reply);
+            });
     } else {
         // Ignore?
     }
@@ -202,27 +241,61 @@ IRReplica::HandleProposeConsensus(const TransportAddress &remote,
         reply.mutable_opid()->set_clientreqid(clientreqid);
         reply.set_result(entry->result);
         reply.set_finalized(entry->state == RECORD_STATE_FINALIZED);
+    } else if (batching) {
+        // Execute op with the rest of the batch, once the transport has
+        // read all it can
+        if (batched.insert(opid).second) {
+            if (batch.empty()) {
+                transport->Timer(0, [this]() { ExecBatch(); });
+            }
+            batch.emplace_back();
+            BatchedOp &op = batch.back();
+            op.opid = opid;
+            op.remote.reset(remote.clone());
+            op.req = msg.req();
+        }
+        return;
     } else {
-        // Execute op
-        string result;
+        // Execute op; the app may finish it later, once it has moved on
+        // to other messages
+        if (executing.insert(opid).second) {
+            std::shared_ptr<TransportAddress> from(remote.clone());
+            std::shared_ptr<Request> req(new Request(msg.req()));
+            app->ExecConsensusUpcallAsync(
+                msg.req().op(), [this, opid, from, req](const string &result) {
+                    FinishConsensus(opid, *from, *req, result);
+                });
+        }
+        return;
+    }
 
-        app->ExecConsensusUpcall(msg.req().op(), result);
+    // Send the reply
+    Reply(remote, reply);
+}
 
-        // Put it in our record as tentative
-        record.Add(view, opid, msg.req(), RECORD_STATE_TENTATIVE,
-                   RECORD_TYPE_CONSENSUS, result);
+void
+IRReplica::FinishConsensus(const opid_t &opid, const TransportAddress &remote,
+                           const Request &req, const string &result)
+{
+    executing.erase(opid);
 
-        // 3. Return Reply
-        reply.set_view(view);
-        reply.set_replicaidx(myIdx);
-        reply.mutable_opid()->set_clientid(clientid);
-        reply.mutable_opid()->set_clientreqid(clientreqid);
-        reply.set_result(result);
-        reply.set_finalized(false);
+    RecordEntry *entry = record.Find(opid);
+    if (entry == NULL) {
+        // Put it in our record as tentative
+        LogEntry(record.Add(view, opid, req, RECORD_STATE_TENTATIVE,
+                            RECORD_TYPE_CONSENSUS, result));
+        entry = record.Find(opid);
     }
 
-    // Send the reply
-    transport->SendMessage(this, remote, reply);
+    // 3. Return Reply
+    ReplyConsensusMessage reply;
+    reply.set_view(entry->view);
+    reply.set_replicaidx(myIdx);
+    reply.mutable_opid()->set_clientid(opid.first);
+    reply.mutable_opid()->set_clientreqid(opid.second);
+    reply.set_result(entry->result);
+    reply.set_finalized(entry->state == RECORD_STATE_FINALIZED);
+    Reply(remote, reply);
 }
 
 void
@@ -239,6 +312,8 @@ IRReplica::HandleFinalizeConsensus(const TransportAddress &remote,
     // Check record for the request
     RecordEntry *entry = record.Find(opid);
     if (entry != NULL) {
+        bool finalized = (entry->state == RECORD_STATE_FINALIZED);
+
         // Mark entry as finalized
         record.SetStatus(opid, RECORD_STATE_FINALIZED);
 
@@ -246,6 +321,10 @@ IRReplica::HandleFinalizeConsensus(const TransportAddress &remote,
             // Update the result
             entry->result = msg.result();
         }
+        LogEntry(*entry);
+        if (!finalized) {
+            app->FinalizeConsensusUpcall(entry->request.op(), entry->result);
+        }
 
         // Send the reply
         ConfirmMessage reply;
@@ -253,9 +332,7 @@ IRReplica::HandleFinalizeConsensus(const TransportAddress &remote,
         reply.set_replicaidx(myIdx);
         *reply.mutable_opid() = msg.opid();
 
-        if (!transport->SendMessage(this, remote, reply)) {
-            Warning("Failed to send reply message");
-        }
+        Reply(remote, reply);
     } else {
         // Ignore?
         Warning("Finalize request for unknown consensus operation");
@@ -338,6 +415,7 @@ IRReplica::HandleDoViewChange(const TransportAddress &remote,
 
     // Update our record, status, and view.
     record = IrMergeRecords(*quorum);
+    LogRecord();
     status = STATUS_NORMAL;
     view = msg.new_view();
     latest_normal_view = view;
@@ -388,6 +466,7 @@ IRReplica::HandleStartView(const TransportAddress &remote,
 
     // Throw away our record for the new master record and call sync.
     record = Record(msg.record());
+    LogRecord();
     app->Sync(record.Entries());
 
     status = STATUS_NORMAL;
@@ -400,16 +479,18 @@ void
 IRReplica::HandleUnlogged(const TransportAddress &remote,
                     const UnloggedRequestMessage &msg)
 {
-    UnloggedReplyMessage reply;
-    string res;
-
     Debug("Received unlogged request %s", (char *)msg.req().op().c_str());
 
-    app->UnloggedUpcall(msg.req().op(), res);
-    reply.set_reply(res);
-    reply.set_clientreqid(msg.req().clientreqid());
-    if (!(transport->SendMessage(this, remote, reply)))
-        Warning("Failed to send reply message");
+    std::shared_ptr<TransportAddress> from(remote.clone());
+    uint64_t clientreqid = msg.req().clientreqid();
+    app->UnloggedUpcallAsync(msg.req().op(),
+                             [this, from, clientreqid](const string &res) {
+        UnloggedReplyMessage reply;
+        reply.set_reply(res);
+        reply.set_clientreqid(clientreqid);
+        if (!(transport->SendMessage(this, *from, reply)))
+            Warning("Failed to send reply message");
+    });
 }
 
 void IRReplica::HandleViewChangeTimeout() {
@@ -438,6 +519,131 @@ void IRReplica::RecoverViewInfo() {
     latest_normal_view = view_info.latest_normal_view();
 }
 
+void IRReplica::LogEntry(const RecordEntry &entry) {
+    if (log == nullptr) {
+        return;
+    }
+    RecordEntryProto entry_proto;
+    Record::ToProto(entry, &entry_proto);
+    std::string output(1, IR_LOG_ENTRY);
+    entry_proto.AppendToString(&output);
+    log->Append(output);
+}
+
+void IRReplica::LogRecord() {
+    if (log == nullptr) {
+        return;
+    }
+    RecordProto record_proto;
+    record.ToProto(&record_proto);
+    std::string output(1, IR_LOG_RECORD);
+    record_proto.AppendToString(&output);
+    log->Append(output);
+}
+
+void IRReplica::ResetLog() {
+    if (log == nullptr) {
+        return;
+    }
+    RecordProto record_proto;
+    record.ToProto(&record_proto);
+    std::string output(1, IR_LOG_RECORD);
+    record_proto.AppendToString(&output);
+    log->Reset(output);
+}
+
+void IRReplica::RecoverRecord() {
+    size_t n = 0;
+    log->Replay([&](const std::string &r) {
+        if (r.empty()) {
+            return;
+        }
+        if (r[0] == IR_LOG_ENTRY) {
+            RecordEntryProto entry_proto;
+            if (!entry_proto.ParseFromArray(r.data() + 1, r.size() - 1)) {
+                Panic("Corrupt record entry in %s", log->Filename().c_str());
+            }
+            RecordEntry entry = Record::FromProto(entry_proto);
+            record.Remove(entry.opid);
+            record.Add(entry);
+            n++;
+        } else if (r[0] == IR_LOG_RECORD) {
+            RecordProto record_proto;
+            if (!record_proto.ParseFromArray(r.data() + 1, r.size() - 1)) {
+                Panic("Corrupt record in %s", log->Filename().c_str());
+            }
+            record = Record(record_proto);
+            n++;
+        }
+    });
+    Notice("Recovered %lu record entries from %zu log records in %s",
+           record.Entries().size(), n, log->Filename().c_str());
+}
+
+void IRReplica::Reply(const TransportAddress &remote, const Message &msg) {
+    if (log == nullptr || log->Durable() >= log->Appended()) {
+        if (!transport->SendMessage(this, remote, msg)) {
+            Warning("Failed to send reply message");
+        }
+        return;
+    }
+
+    PendingReply reply;
+    reply.seq = log->Appended();
+    reply.remote.reset(remote.clone());
+    reply.msg.reset(msg.New());
+    reply.msg->CopyFrom(msg);
+    pending_replies.push_back(std::move(reply));
+}
+
+void IRReplica::ExecBatch() {
+    if (batch.empty()) {
+        return;
+    }
+
+    std::vector<BatchedOp> ops;
+    ops.swap(batch);
+    batched.clear();
+
+    std::vector<string> reqs;
+    reqs.reserve(ops.size());
+    for (const BatchedOp &op : ops) {
+        reqs.push_back(op.req.op());
+    }
+    std::vector<string> results;
+    app->ExecConsensusUpcallBatch(reqs, results);
+    ASSERT(results.size() == ops.size());
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        BatchedOp &op = ops[i];
+
+        // Put it in our record as tentative
+        LogEntry(record.Add(view, op.opid, op.req, RECORD_STATE_TENTATIVE,
+                            RECORD_TYPE_CONSENSUS, results[i]));
+
+        ReplyConsensusMessage reply;
+        reply.set_view(view);
+        reply.set_replicaidx(myIdx);
+        reply.mutable_opid()->set_clientid(op.opid.first);
+        reply.mutable_opid()->set_clientreqid(op.opid.second);
+        reply.set_result(results[i]);
+        reply.set_finalized(false);
+        Reply(*op.remote, reply);
+    }
+}
+
+void IRReplica::ReleaseReplies() {
+    uint64_t durable = log->Durable();
+    while (!pending_replies.empty() &&
+           pending_replies.front().seq <= durable) {
+        PendingReply &reply = pending_replies.front();
+        if (!transport->SendMessage(this, *reply.remote, *reply.msg)) {
+            Warning("Failed to send reply message");
+        }
+        pending_replies.pop_front();
+    }
+}
+
 void IRReplica::BroadcastDoViewChangeMessages() {
     // Send a DoViewChangeMessage _without_ our record to all replicas except
     // ourselves and the leader.
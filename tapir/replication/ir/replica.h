@@ -9,13 +9,18 @@
 #ifndef _IR_REPLICA_H_
 #define _IR_REPLICA_H_
 
+#include <deque>
+#include <functional>
 #include <memory>
+#include <set>
+#include <vector>
 
 #include "tapir/lib/assert.h"
 #include "tapir/lib/configuration.h"
 #include "tapir/lib/message.h"
 #include "tapir/lib/persistent_register.h"
 #include "tapir/lib/udptransport.h"
+#include "tapir/lib/wal.h"
 #include "tapir/replication/common/quorumset.h"
 #include "tapir/replication/common/replica.h"
 #include "tapir/replication/ir/ir-proto.pb.h"
@@ -32,10 +37,45 @@ public:
     virtual ~IRAppReplica() { };
     // Invoke inconsistent operation, no return value
     virtual void ExecInconsistentUpcall(const string &str1) { };
+    // Invoke inconsistent operation, calling done once it has executed.
+    // done must be called on the transport loop, as below.
+    virtual void ExecInconsistentUpcallAsync(
+        const string &str1, std::function<void ()> done) {
+        ExecInconsistentUpcall(str1);
+        done();
+    };
     // Invoke consensus operation
     virtual void ExecConsensusUpcall(const string &str1, string &str2) { };
+    // Invoke a batch of consensus operations, in order
+    virtual void ExecConsensusUpcallBatch(const std::vector<string> &ops,
+                                          std::vector<string> &results) {
+        results.resize(ops.size());
+        for (size_t i = 0; i < ops.size(); i++) {
+            ExecConsensusUpcall(ops[i], results[i]);
+        }
+    };
+    // Invoke consensus operation, calling done with its result once it
+    // has executed. done must be called on the transport loop; other
+    // messages may be handled in the meantime.
+    virtual void ExecConsensusUpcallAsync(
+        const string &str1, std::function<void (const string &)> done) {
+        string str2;
+        ExecConsensusUpcall(str1, str2);
+        done(str2);
+    };
+    // The result of a consensus operation is final: what the client
+    // decided, or what a fast quorum agreed on
+    virtual void FinalizeConsensusUpcall(const string &str1,
+                                         const string &str2) { };
     // Invoke unreplicated operation
     virtual void UnloggedUpcall(const string &str1, string &str2) { };
+    // Invoke unreplicated operation, likewise
+    virtual void UnloggedUpcallAsync(
+        const string &str1, std::function<void (const string &)> done) {
+        string str2;
+        UnloggedUpcall(str1, str2);
+        done(str2);
+    };
     // Sync
     virtual void Sync(const std::map<opid_t, RecordEntry>& record) { };
     // Merge
@@ -48,13 +88,37 @@ public:
 };
 
 
+// Tags of the records a replica writes to its log: a record entry as
+// added or updated, or a whole record replacing the current one.
+#define IR_LOG_ENTRY    'e'
+#define IR_LOG_RECORD   'r'
+
 class IRReplica : TransportReceiver
 {
 public:
+    // With a log, the record is recovered from it and kept in it, and
+    // replies to clients wait until what they answer for is durable.
+    // The log may be shared with the app. The transport's Timer must
+    // be safe to call from the log's flusher thread (as UDPTransport's
+    // is).
     IRReplica(transport::Configuration config, int myIdx,
-              Transport *transport, IRAppReplica *app);
+              Transport *transport, IRAppReplica *app,
+              WriteAheadLog *log = nullptr);
     ~IRReplica();
 
+    // In batching mode, the consensus operations received in one pass
+    // over the socket are executed together, with one batch upcall, once
+    // the transport has read all it can. Any other message executes the
+    // batch received before it first.
+    void SetBatching(bool batching);
+
+    // The record, as recovered from the log and kept since.
+    const Record &GetRecord() const;
+
+    // Start the log (if any) over with just the record, once the app
+    // keeps what else it logged elsewhere, e.g. in a checkpoint.
+    void ResetLog();
+
     // Message handlers.
     void ReceiveMessage(const TransportAddress &remote,
                         const std::string &type, const std::string &data);
@@ -87,6 +151,27 @@ private:
     // `persistent_view_info`.
     void RecoverViewInfo();
 
+    // Append a record entry, or the whole record, to the log (if any).
+    void LogEntry(const RecordEntry &entry);
+    void LogRecord();
+
+    // Rebuild the record from the log.
+    void RecoverRecord();
+
+    // Send a reply to a client once everything logged so far is
+    // durable.
+    void Reply(const TransportAddress &remote, const Message &msg);
+
+    // Send the replies whose log records are now durable.
+    void ReleaseReplies();
+
+    // Execute the consensus operations queued up in batching mode.
+    void ExecBatch();
+
+    // Record and answer a consensus operation the app has executed.
+    void FinishConsensus(const opid_t &opid, const TransportAddress &remote,
+                         const Request &req, const string &result);
+
     // Broadcast DO-VIEW-CHANGE messages to all other replicas with our record
     // included only in the message to the leader.
     void BroadcastDoViewChangeMessages();
@@ -112,6 +197,30 @@ private:
     Record record;
     std::unique_ptr<Timeout> view_change_timeout;
 
+    // Write-ahead log of the record, and the replies held back until
+    // the log is durable up to seq, oldest first.
+    struct PendingReply {
+        uint64_t seq;
+        std::unique_ptr<TransportAddress> remote;
+        std::unique_ptr<Message> msg;
+    };
+    WriteAheadLog *log;
+    std::deque<PendingReply> pending_replies;
+
+    // Consensus operations waiting for the batch to be executed, in
+    // the order received.
+    struct BatchedOp {
+        opid_t opid;
+        std::unique_ptr<TransportAddress> remote;
+        Request req;
+    };
+    bool batching;
+    std::vector<BatchedOp> batch;
+    std::set<opid_t> batched;
+
+    // Consensus operations the app is still executing.
+    std::set<opid_t> executing;
+
     // The leader of a view-change waits to receive a quorum of DO-VIEW-CHANGE
     // messages before merging and syncing and sending out START-VIEW messages.
     // do_view_change_quorum is used to wait for this quorum.
@@ -76,6 +76,29 @@ public:
         unloggedOps->push_back(req);
         reply = "unlreply: " + req;
     }
+
+    void ExecConsensusUpcallBatch(const std::vector<string> &reqs,
+                                  std::vector<string> &replies) {
+        batches.push_back(reqs.size());
+        IRAppReplica::ExecConsensusUpcallBatch(reqs, replies);
+    }
+
+    void ExecConsensusUpcallAsync(const string &req,
+                                  std::function<void (const string &)> done) {
+        if (!deferring) {
+            IRAppReplica::ExecConsensusUpcallAsync(req, done);
+            return;
+        }
+        cOps->push_back(req);
+        deferred.push_back(done);
+    }
+
+    // sizes of the batches executed
+    std::vector<size_t> batches;
+
+    // consensus ops left for the test to finish
+    bool deferring = false;
+    std::vector<std::function<void (const string &)>> deferred;
 };
 
 class IRTest : public  ::testing::Test
@@ -270,6 +293,79 @@ TEST_F(IRTest, UnloggedTimeout)
 }
 
 
+TEST_F(IRTest, BatchedConsensusOps)
+{
+    for (auto &replica : replicas) {
+        replica->SetBatching(true);
+    }
+
+    int done = 0;
+    auto upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(reply, "1");
+        if (++done == 2) {
+            transport.CancelAllTimers();
+        }
+    };
+    auto decide = [](const std::map<string, std::size_t> &results) {
+        // shouldn't ever get called
+        EXPECT_FALSE(true);
+        return "";
+    };
+
+    // two clients' ops reach each replica together
+    IRClient other(*config, &transport);
+    client->InvokeConsensus(RequestOp(0), decide, upcall);
+    other.InvokeConsensus(RequestOp(1), decide, upcall);
+    transport.Run();
+
+    EXPECT_EQ(2, done);
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(2, cOps[i].size());
+        ASSERT_EQ(1, apps[i]->batches.size());
+        EXPECT_EQ(2, apps[i]->batches[0]);
+    }
+}
+
+TEST_F(IRTest, AsyncConsensusOps)
+{
+    for (auto &app : apps) {
+        app->deferring = true;
+    }
+
+    int done = 0;
+    auto upcall = [&](const string &req, const string &reply) {
+        EXPECT_EQ(reply, "1");
+        if (++done == 2) {
+            transport.CancelAllTimers();
+        }
+    };
+    auto decide = [](const std::map<string, std::size_t> &results) {
+        // shouldn't ever get called
+        EXPECT_FALSE(true);
+        return "";
+    };
+
+    IRClient other(*config, &transport);
+    client->InvokeConsensus(RequestOp(0), decide, upcall);
+    other.InvokeConsensus(RequestOp(1), decide, upcall);
+
+    // both ops are executing at once; finish them in the opposite order
+    transport.Timer(10, [&]() {
+        for (auto &app : apps) {
+            ASSERT_EQ(2, app->deferred.size());
+            app->deferred[1]("1");
+            app->deferred[0]("1");
+            app->deferred.clear();
+        }
+    });
+    transport.Run();
+
+    EXPECT_EQ(2, done);
+    for (int i = 0; i < config->n; i++) {
+        EXPECT_EQ(2, cOps[i].size());
+    }
+}
+
 // TEST_F(IRTest, ManyOps)
 // {
 //     Client::continuation_t upcall = [&](const string &req, const string &reply) {
@@ -0,0 +1,7 @@
+d := $(dir $(lastword $(MAKEFILE_LIST)))
+
+SRCS += $(addprefix $(d), conflict.cc walbench.cc partbench.cc)
+
+OBJS-conflict := $(o)conflict.o
+OBJS-walbench := $(o)walbench.o
+OBJS-partbench := $(o)partbench.o
@@ -0,0 +1,252 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/benchmark/conflict.cc:
+ *   Conflict benchmark: abort rate and throughput of the tapirstore
+ *   isolation levels on one store, with many transactions in flight.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/tapirstore/store.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <strings.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Retries of a prepare that came back RETRY before giving up.
+#define PREPARE_RETRIES 5
+
+namespace {
+
+struct Options {
+    unsigned int nKeys = 1000;     // -k
+    unsigned int tLen = 10;        // -l ops per transaction
+    unsigned int wPer = 10;        // -w percent of ops that are writes
+    double alpha = 0.8;            // -z zipf skew of the keys
+    unsigned int concurrent = 16;  // -c transactions in flight
+    unsigned int nTxns = 50000;    // -n transactions to commit
+    unsigned int seed = 1;         // -S
+};
+
+struct Stats {
+    uint64_t commits = 0;
+    uint64_t aborts = 0;
+    uint64_t retries = 0;
+    double seconds = 0;
+};
+
+/* An in-flight transaction: it runs one op each time it is scheduled,
+ * so the others commit around it between its reads and its prepare. */
+struct Txn {
+    uint64_t id;
+    Timestamp snapshot;
+    Transaction txn;
+    unsigned int done;
+};
+
+class Zipf
+{
+public:
+    Zipf(unsigned int n, double alpha) : cdf(n) {
+        double sum = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            sum += 1.0 / pow(i + 1, alpha);
+            cdf[i] = sum;
+        }
+        for (auto &c : cdf) {
+            c /= sum;
+        }
+    }
+
+    unsigned int Next(mt19937_64 &gen) {
+        double u = uniform_real_distribution<double>(0, 1)(gen);
+        return lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    }
+
+private:
+    vector<double> cdf;
+};
+
+string
+Key(unsigned int k)
+{
+    return "key" + to_string(k);
+}
+
+Stats
+Run(Isolation isolation, const Options &opt)
+{
+    tapirstore::Store store(isolation);
+    mt19937_64 gen(opt.seed);
+    Zipf zipf(opt.nKeys, opt.alpha);
+    Stats stats;
+
+    for (unsigned int k = 0; k < opt.nKeys; k++) {
+        store.Load(Key(k), "0", Timestamp());
+    }
+
+    // logical clock: every begin and every prepare gets a fresh tick
+    // (the id is only there to make the timestamps valid)
+    uint64_t clock = 1, nextId = 1;
+    vector<Txn> txns(opt.concurrent);
+    auto begin = [&](Txn &t) {
+        t.id = nextId++;
+        t.snapshot = Timestamp(clock++, 1);
+        t.txn = Transaction();
+        if (isolation == ISOLATION_SNAPSHOT) {
+            t.txn.setSnapshot(t.snapshot);
+        }
+        t.done = 0;
+    };
+    for (auto &t : txns) {
+        begin(t);
+    }
+
+    auto start = chrono::steady_clock::now();
+    while (stats.commits < opt.nTxns) {
+        Txn &t = txns[uniform_int_distribution<unsigned int>(0, opt.concurrent - 1)(gen)];
+
+        if (t.done < opt.tLen) {
+            // run the next op
+            string key = Key(zipf.Next(gen));
+            if (uniform_int_distribution<unsigned int>(0, 99)(gen) < opt.wPer) {
+                t.txn.addWriteSet(key, to_string(t.id));
+            } else if (t.txn.getWriteSet().find(key) == t.txn.getWriteSet().end() &&
+                       t.txn.getReadSet().find(key) == t.txn.getReadSet().end()) {
+                pair<Timestamp, string> value;
+                int status;
+                if (isolation == ISOLATION_SNAPSHOT) {
+                    status = store.GetSnapshot(t.id, key, t.snapshot, value);
+                } else {
+                    status = store.Get(t.id, key, value);
+                }
+                if (status != REPLY_OK) {
+                    stats.aborts++;
+                    begin(t);
+                    continue;
+                }
+                t.txn.addReadSet(key, value.first);
+            }
+            t.done++;
+            continue;
+        }
+
+        // all ops are done: prepare, and commit right away if it is ok
+        Timestamp timestamp(clock++, 1), proposed;
+        int status = store.Prepare(t.id, t.txn, timestamp, proposed);
+        for (int r = 0; status == REPLY_RETRY && r < PREPARE_RETRIES; r++) {
+            stats.retries++;
+            clock = max(clock, proposed.getTimestamp() + 1);
+            timestamp = Timestamp(clock++, 1);
+            status = store.Prepare(t.id, t.txn, timestamp, proposed);
+        }
+        if (status == REPLY_OK) {
+            store.Commit(t.id, timestamp.getTimestamp());
+            stats.commits++;
+        } else {
+            store.Abort(t.id);
+            stats.aborts++;
+        }
+        begin(t);
+    }
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    return stats;
+}
+
+void
+Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-m txn-l|txn-s|txn-si|all] [-k keys] "
+            "[-l ops per txn] [-w write %%] [-z zipf alpha] "
+            "[-c txns in flight] [-n txns] [-S seed]\n", name);
+    exit(1);
+}
+
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    Options opt;
+    const char *mode = "all";
+
+    int o;
+    while ((o = getopt(argc, argv, "m:k:l:w:z:c:n:S:")) != -1) {
+        switch (o) {
+        case 'm': mode = optarg; break;
+        case 'k': opt.nKeys = strtoul(optarg, NULL, 10); break;
+        case 'l': opt.tLen = strtoul(optarg, NULL, 10); break;
+        case 'w': opt.wPer = strtoul(optarg, NULL, 10); break;
+        case 'z': opt.alpha = strtod(optarg, NULL); break;
+        case 'c': opt.concurrent = strtoul(optarg, NULL, 10); break;
+        case 'n': opt.nTxns = strtoul(optarg, NULL, 10); break;
+        case 'S': opt.seed = strtoul(optarg, NULL, 10); break;
+        default: Usage(argv[0]);
+        }
+    }
+    if (opt.nKeys == 0 || opt.tLen == 0 || opt.concurrent == 0) {
+        Usage(argv[0]);
+    }
+
+    const struct {
+        const char *name;
+        Isolation isolation;
+    } modes[] = {
+        { "txn-l", ISOLATION_LINEARIZABLE },
+        { "txn-s", ISOLATION_SERIALIZABLE },
+        { "txn-si", ISOLATION_SNAPSHOT },
+    };
+
+    printf("# keys %u, %u ops/txn, %u%% writes, zipf %.2f, %u in flight\n",
+           opt.nKeys, opt.tLen, opt.wPer, opt.alpha, opt.concurrent);
+    printf("%-8s %10s %10s %10s %8s %12s\n",
+           "mode", "commits", "aborts", "retries", "abort%", "commits/s");
+
+    bool ran = false;
+    for (auto &m : modes) {
+        if (strcasecmp(mode, "all") != 0 && strcasecmp(mode, m.name) != 0) {
+            continue;
+        }
+        Stats s = Run(m.isolation, opt);
+        printf("%-8s %10lu %10lu %10lu %7.2f%% %12.0f\n", m.name,
+               s.commits, s.aborts, s.retries,
+               100.0 * s.aborts / (s.commits + s.aborts),
+               s.commits / s.seconds);
+        ran = true;
+    }
+    if (!ran) {
+        Usage(argv[0]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,280 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/benchmark/partbench.cc:
+ *   Partitioning benchmark: prepare and commit throughput of
+ *   tapirstore with one store against a PartitionedStore of N.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/lib/wal.h"
+#include "tapir/store/tapirstore/partitionedstore.h"
+#include "tapir/store/tapirstore/store.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <strings.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+struct Options {
+    unsigned int nKeys = 1000000;   // -k
+    unsigned int nWrites = 4;       // -l writes per transaction
+    unsigned int valueSize = 100;   // -v
+    unsigned int concurrent = 64;   // -c transactions in flight
+    unsigned int nTxns = 200000;    // -n transactions to run
+    long window = -1;               // -d group-commit window us, no log if < 0
+    const char *path = "/tmp/partbench.wal";  // -f
+    unsigned int seed = 1;          // -S
+};
+
+struct Stats {
+    double seconds = 0;
+    uint64_t committed = 0;
+    uint64_t aborted = 0;
+    vector<double> latencies;   // us, one per committed transaction
+};
+
+/* A single loop stands in for the server's transport loop: it starts
+ * each transaction's prepare, commits it once the store has voted, and
+ * counts it done once the commit is durable, all without waiting on
+ * the store. The store's callbacks post back to the loop, as the
+ * server's go through transport timers. */
+class Loop
+{
+public:
+    void Post(function<void ()> fn) {
+        {
+            lock_guard<mutex> l(lock);
+            ready.push_back(std::move(fn));
+        }
+        cv.notify_one();
+    }
+
+    // Runs what has been posted until done returns true.
+    void Run(const function<bool ()> &done) {
+        while (!done()) {
+            deque<function<void ()>> fns;
+            {
+                unique_lock<mutex> l(lock);
+                cv.wait(l, [this]() { return !ready.empty(); });
+                fns.swap(ready);
+            }
+            for (auto &fn : fns) {
+                fn();
+            }
+        }
+    }
+
+private:
+    mutex lock;
+    condition_variable cv;
+    deque<function<void ()>> ready;
+};
+
+struct InFlight {
+    PrepareRequest request;
+    chrono::steady_clock::time_point start;
+};
+
+/* One partition runs on a plain Store, as the server does; more run on
+ * a PartitionedStore with that many workers. */
+Stats
+Run(unsigned int nPartitions, const Options &opt)
+{
+    TxnStore *store;
+    if (nPartitions > 1) {
+        store = new tapirstore::PartitionedStore(ISOLATION_SERIALIZABLE,
+                                                 nPartitions);
+    } else {
+        store = new tapirstore::Store(ISOLATION_SERIALIZABLE);
+    }
+
+    Loop loop;
+    WriteAheadLog *log = NULL;
+    // commits waiting for their record to be durable, oldest first
+    deque<pair<uint64_t, shared_ptr<InFlight>>> durable;
+    if (opt.window >= 0) {
+        unlink(opt.path);
+        log = new WriteAheadLog(opt.path, opt.window);
+        store->SetLog(log);
+    }
+
+    Stats stats;
+    mt19937 rng(opt.seed);
+    uniform_int_distribution<unsigned int> keys(0, opt.nKeys - 1);
+    string value(opt.valueSize, 'v');
+    uint64_t started = 0;
+
+    function<void ()> start;
+    auto finish = [&](const shared_ptr<InFlight> &f) {
+        stats.committed++;
+        stats.latencies.push_back(chrono::duration<double, micro>(
+            chrono::steady_clock::now() - f->start).count());
+        start();
+    };
+    auto release = [&]() {
+        uint64_t seq = log->Durable();
+        while (!durable.empty() && durable.front().first <= seq) {
+            auto f = durable.front().second;
+            durable.pop_front();
+            finish(f);
+        }
+    };
+    if (log != NULL) {
+        log->OnDurable([&](uint64_t) { loop.Post(release); });
+    }
+
+    auto prepared = [&](const shared_ptr<InFlight> &f) {
+        uint64_t id = f->request.id;
+        if (f->request.status != REPLY_OK) {
+            store->Abort(id);
+            stats.aborted++;
+            start();
+            return;
+        }
+        store->CommitAsync(id, 0, [&, f]() {
+            loop.Post([&, f]() {
+                if (log == NULL || log->Durable() >= log->Appended()) {
+                    finish(f);
+                } else {
+                    durable.push_back(make_pair(log->Appended(), f));
+                }
+            });
+        });
+    };
+
+    start = [&]() {
+        if (started == opt.nTxns) {
+            return;
+        }
+        started++;
+        auto f = make_shared<InFlight>();
+        Transaction txn;
+        for (unsigned int w = 0; w < opt.nWrites; w++) {
+            txn.addWriteSet("key" + to_string(keys(rng)), value);
+        }
+        f->request.id = started;
+        f->request.txn = TransactionView(txn);
+        f->request.timestamp = Timestamp(started, 0);
+        f->start = chrono::steady_clock::now();
+        store->PrepareAsync(f->request, [&, f]() {
+            loop.Post([&, f]() { prepared(f); });
+        });
+    };
+
+    auto begin = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < opt.concurrent; i++) {
+        start();
+    }
+    loop.Run([&]() {
+        return stats.committed + stats.aborted == opt.nTxns;
+    });
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    delete store;
+    if (log != NULL) {
+        delete log;
+        unlink(opt.path);
+    }
+    return stats;
+}
+
+void
+Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-k keys] [-l writes per txn] [-v value size] "
+            "[-c concurrent] [-n txns] [-d window us] [-f log file] "
+            "[-S seed] [-p partitions]...\n", name);
+    exit(1);
+}
+
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    Options opt;
+    vector<unsigned int> partitions;
+
+    int o;
+    while ((o = getopt(argc, argv, "k:l:v:c:n:d:f:S:p:")) != -1) {
+        switch (o) {
+        case 'k': opt.nKeys = strtoul(optarg, NULL, 10); break;
+        case 'l': opt.nWrites = strtoul(optarg, NULL, 10); break;
+        case 'v': opt.valueSize = strtoul(optarg, NULL, 10); break;
+        case 'c': opt.concurrent = strtoul(optarg, NULL, 10); break;
+        case 'n': opt.nTxns = strtoul(optarg, NULL, 10); break;
+        case 'd': opt.window = strtol(optarg, NULL, 10); break;
+        case 'f': opt.path = optarg; break;
+        case 'S': opt.seed = strtoul(optarg, NULL, 10); break;
+        case 'p': partitions.push_back(strtoul(optarg, NULL, 10)); break;
+        default: Usage(argv[0]);
+        }
+    }
+    if (opt.nKeys == 0 || opt.nTxns == 0 || opt.concurrent == 0) {
+        Usage(argv[0]);
+    }
+    if (partitions.empty()) {
+        partitions = { 1, 2, 4, 8 };
+    }
+
+    printf("# %u txns, %u in flight, %u writes of %u bytes over %u keys, %s\n",
+           opt.nTxns, opt.concurrent, opt.nWrites, opt.valueSize, opt.nKeys,
+           opt.window < 0 ? "no log" :
+           ("log window " + to_string(opt.window) + " us").c_str());
+    printf("%-10s %12s %10s %10s %10s\n",
+           "partitions", "commits/s", "aborted", "mean us", "p99 us");
+
+    for (unsigned int p : partitions) {
+        if (p == 0) {
+            Usage(argv[0]);
+        }
+        Stats s = Run(p, opt);
+        uint64_t commits = s.latencies.size();
+        double sum = 0;
+        for (double l : s.latencies) {
+            sum += l;
+        }
+        sort(s.latencies.begin(), s.latencies.end());
+        double p99 = commits ? s.latencies[min(commits - 1, commits * 99 / 100)] : 0;
+        printf("%-10u %12.0f %10lu %10.1f %10.1f\n",
+               p, s.committed / s.seconds, s.aborted,
+               commits ? sum / commits : 0.0, p99);
+    }
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/benchmark/walbench.cc:
+ *   Write-ahead log benchmark: commit throughput and latency of
+ *   tapirstore with the log on, across group-commit windows.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/lib/wal.h"
+#include "tapir/store/tapirstore/store.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <strings.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+struct Options {
+    unsigned int nThreads = 8;      // -t committing threads
+    unsigned int nTxns = 2000;      // -n transactions per thread
+    unsigned int nWrites = 4;       // -l writes per transaction
+    unsigned int valueSize = 100;   // -v
+    const char *path = "/tmp/walbench.wal";  // -f
+};
+
+struct Stats {
+    double seconds = 0;
+    uint64_t syncs = 0;
+    vector<double> latencies;   // us, one per commit
+};
+
+/* Each thread commits to its own store, as the partitions of a
+ * PartitionedStore do, and waits for its commit record to be durable
+ * before starting the next transaction, as a client waits for the
+ * reply. window < 0 runs without a log. */
+Stats
+Run(long window, const Options &opt)
+{
+    WriteAheadLog *log = NULL;
+    if (window >= 0) {
+        unlink(opt.path);
+        log = new WriteAheadLog(opt.path, window);
+    }
+
+    vector<vector<double>> latencies(opt.nThreads);
+    string value(opt.valueSize, 'v');
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (unsigned int i = 0; i < opt.nThreads; i++) {
+        threads.emplace_back([&, i]() {
+            tapirstore::Store store(ISOLATION_SERIALIZABLE);
+            if (log != NULL) {
+                store.SetLog(log);
+            }
+            for (unsigned int n = 1; n <= opt.nTxns; n++) {
+                auto begin = chrono::steady_clock::now();
+                Transaction txn;
+                for (unsigned int w = 0; w < opt.nWrites; w++) {
+                    txn.addWriteSet("key" + to_string(i) + "-" + to_string(w), value);
+                }
+                Timestamp timestamp(n, i), proposed;
+                if (store.Prepare(n, txn, timestamp, proposed) != REPLY_OK) {
+                    Panic("Prepare failed");
+                }
+                store.Commit(n, n);
+                if (log != NULL) {
+                    log->Sync(log->Appended());
+                }
+                latencies[i].push_back(chrono::duration<double, micro>(
+                    chrono::steady_clock::now() - begin).count());
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    Stats stats;
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (auto &l : latencies) {
+        stats.latencies.insert(stats.latencies.end(), l.begin(), l.end());
+    }
+    if (log != NULL) {
+        stats.syncs = log->Syncs();
+        delete log;
+        unlink(opt.path);
+    }
+    return stats;
+}
+
+void
+Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-n txns per thread] "
+            "[-l writes per txn] [-v value size] [-f log file] "
+            "[-d window us]...\n", name);
+    exit(1);
+}
+
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    Options opt;
+    vector<long> windows;
+
+    int o;
+    while ((o = getopt(argc, argv, "t:n:l:v:f:d:")) != -1) {
+        switch (o) {
+        case 't': opt.nThreads = strtoul(optarg, NULL, 10); break;
+        case 'n': opt.nTxns = strtoul(optarg, NULL, 10); break;
+        case 'l': opt.nWrites = strtoul(optarg, NULL, 10); break;
+        case 'v': opt.valueSize = strtoul(optarg, NULL, 10); break;
+        case 'f': opt.path = optarg; break;
+        case 'd': windows.push_back(strtol(optarg, NULL, 10)); break;
+        default: Usage(argv[0]);
+        }
+    }
+    if (opt.nThreads == 0 || opt.nTxns == 0) {
+        Usage(argv[0]);
+    }
+    if (windows.empty()) {
+        windows = { -1, 0, 50, 100, 200, 500, 1000, 2000 };
+    }
+
+    printf("# %u threads, %u txns each, %u writes of %u bytes, log %s\n",
+           opt.nThreads, opt.nTxns, opt.nWrites, opt.valueSize, opt.path);
+    printf("%-8s %12s %10s %12s %10s %10s\n",
+           "window", "commits/s", "syncs", "commits/sync", "mean us", "p99 us");
+
+    for (long w : windows) {
+        Stats s = Run(w, opt);
+        uint64_t commits = s.latencies.size();
+        double sum = 0;
+        for (double l : s.latencies) {
+            sum += l;
+        }
+        sort(s.latencies.begin(), s.latencies.end());
+        double p99 = s.latencies[min(commits - 1, commits * 99 / 100)];
+        printf("%-8s %12.0f %10lu %12.1f %10.1f %10.1f\n",
+               w < 0 ? "no log" : to_string(w).c_str(),
+               commits / s.seconds, s.syncs,
+               s.syncs ? (double)commits / s.syncs : 0.0,
+               sum / commits, p99);
+    }
+
+    return 0;
+}
@@ -1,8 +1,9 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
 SRCS += $(addprefix $(d), \
-				kvstore.cc lockserver.cc txnstore.cc versionstore.cc)
+				checkpoint.cc contention.cc kvstore.cc keytable.cc lockserver.cc logengine.cc \
+				txnstore.cc versionstore.cc)
 
-LIB-store-backend := $(o)kvstore.o $(o)lockserver.o $(o)txnstore.o $(o)versionstore.o
+LIB-store-backend := $(o)checkpoint.o $(o)contention.o $(o)kvstore.o $(o)keytable.o $(o)lockserver.o $(o)logengine.o $(o)txnstore.o $(o)versionstore.o
 
 include $(d)tests/Rules.mk
@@ -0,0 +1,289 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/checkpoint.cc:
+ *   Flat, memory-mappable checkpoint of a versioned key-value store
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "tapir/store/common/backend/checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char CHECKPOINT_MAGIC[8] = { 'T', 'A', 'P', 'I', 'R', 'C', 'K', '1' };
+
+Checkpoint::Checkpoint()
+    : base(NULL), length(0), header(NULL), heap(NULL), keys(NULL),
+      versionEntries(NULL) { }
+
+Checkpoint::~Checkpoint()
+{
+    if (base != NULL) {
+        munmap(base, length);
+    }
+}
+
+bool
+Checkpoint::open(const string &path)
+{
+    ASSERT(base == NULL);
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+    length = st.st_size;
+    void *m = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        Warning("Failed to map checkpoint %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    base = (char *)m;
+    // lookups jump around; don't read ahead
+    madvise(base, length, MADV_RANDOM);
+
+    header = (const Header *)base;
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+        header->keysOffset + header->nKeys * sizeof(KeyEntry) > length ||
+        header->versionsOffset + header->nVersions * sizeof(VersionEntry) > length ||
+        sizeof(Header) + header->heapSize > length) {
+        Warning("Invalid checkpoint %s", path.c_str());
+        munmap(base, length);
+        base = NULL;
+        return false;
+    }
+    heap = base + sizeof(Header);
+    keys = (const KeyEntry *)(base + header->keysOffset);
+    versionEntries = (const VersionEntry *)(base + header->versionsOffset);
+    return true;
+}
+
+size_t
+Checkpoint::size() const
+{
+    return header != NULL ? header->nKeys : 0;
+}
+
+Timestamp
+Checkpoint::floor() const
+{
+    return header != NULL ? Timestamp(header->floor, header->floorID) : Timestamp();
+}
+
+int
+Checkpoint::compare(size_t i, const string &key) const
+{
+    const KeyEntry &k = keys[i];
+    int c = memcmp(heap + k.key, key.data(), min((size_t)k.keyLength, key.size()));
+    if (c != 0) {
+        return c;
+    }
+    return (k.keyLength < key.size()) ? -1 : (k.keyLength > key.size());
+}
+
+size_t
+Checkpoint::seek(const string &key) const
+{
+    size_t lo = 0, hi = size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare(mid, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool
+Checkpoint::find(const string &key, size_t &i) const
+{
+    i = seek(key);
+    return i < size() && compare(i, key) == 0;
+}
+
+string
+Checkpoint::key(size_t i) const
+{
+    ASSERT(i < size());
+    return string(heap + keys[i].key, keys[i].keyLength);
+}
+
+void
+Checkpoint::versions(size_t i, vector<VersionedValue> &chain) const
+{
+    ASSERT(i < size());
+    const KeyEntry &k = keys[i];
+    chain.reserve(chain.size() + k.nVersions);
+    for (uint64_t n = k.firstVersion; n < k.firstVersion + k.nVersions; n++) {
+        const VersionEntry &e = versionEntries[n];
+        VersionedValue v(Timestamp(e.time, e.timeID),
+                         string(heap + e.value, e.valueLength), e.op);
+        v.lastRead = Timestamp(e.lastRead, e.lastReadID);
+        v.expires = e.expires;
+        chain.push_back(v);
+    }
+}
+
+Checkpoint::Writer::Writer() : file(NULL), keys(NULL), versions(NULL) { }
+
+Checkpoint::Writer::~Writer()
+{
+    if (file != NULL) {
+        fclose(file);
+        unlink(tmpPath.c_str());
+    }
+    if (keys != NULL) {
+        fclose(keys);
+    }
+    if (versions != NULL) {
+        fclose(versions);
+    }
+}
+
+bool
+Checkpoint::Writer::open(const string &path)
+{
+    ASSERT(file == NULL);
+    this->path = path;
+    tmpPath = path + ".tmp";
+
+    file = fopen(tmpPath.c_str(), "w");
+    keys = tmpfile();
+    versions = tmpfile();
+    if (file == NULL || keys == NULL || versions == NULL) {
+        Warning("Failed to open checkpoint %s: %s", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    // the header is written last
+    fseek(file, sizeof(Header), SEEK_SET);
+    return true;
+}
+
+void
+Checkpoint::Writer::setFloor(const Timestamp &floor)
+{
+    header.floor = floor.getTimestamp();
+    header.floorID = floor.getID();
+}
+
+/* Append bytes to the heap; returns their offset. */
+uint64_t
+Checkpoint::Writer::append(const string &bytes)
+{
+    uint64_t offset = header.heapSize;
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    header.heapSize += bytes.size();
+    return offset;
+}
+
+void
+Checkpoint::Writer::add(const string &key,
+                        vector<VersionedValue>::const_iterator begin,
+                        vector<VersionedValue>::const_iterator end)
+{
+    KeyEntry k;
+    k.key = append(key);
+    k.keyLength = key.size();
+    k.nVersions = end - begin;
+    k.firstVersion = header.nVersions;
+    fwrite(&k, sizeof(k), 1, keys);
+    header.nKeys++;
+
+    for (auto it = begin; it != end; it++) {
+        VersionEntry e;
+        memset(&e, 0, sizeof(e));
+        e.time = it->time.getTimestamp();
+        e.timeID = it->time.getID();
+        e.lastRead = it->lastRead.getTimestamp();
+        e.lastReadID = it->lastRead.getID();
+        e.expires = it->expires;
+        e.value = append(it->value);
+        e.valueLength = it->value.size();
+        e.op = it->op;
+        fwrite(&e, sizeof(e), 1, versions);
+        header.nVersions++;
+    }
+}
+
+static bool
+CopyFile(FILE *from, FILE *to)
+{
+    char buf[1 << 16];
+    size_t n;
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+        if (fwrite(buf, 1, n, to) != n) {
+            return false;
+        }
+    }
+    return !ferror(from);
+}
+
+bool
+Checkpoint::Writer::close()
+{
+    ASSERT(file != NULL);
+
+    // entries are 8-byte aligned
+    static const char pad[8] = { 0 };
+    uint64_t offset = sizeof(Header) + header.heapSize;
+    fwrite(pad, 1, (8 - offset % 8) % 8, file);
+    offset += (8 - offset % 8) % 8;
+
+    header.keysOffset = offset;
+    header.versionsOffset = offset + header.nKeys * sizeof(KeyEntry);
+    bool ok = CopyFile(keys, file) && CopyFile(versions, file);
+
+    fseek(file, 0, SEEK_SET);
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (fflush(file) == 0) && ok;
+    ok = ok && fdatasync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    file = NULL;
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        Warning("Failed to write checkpoint %s: %s", path.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
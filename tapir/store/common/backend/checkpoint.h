@@ -0,0 +1,136 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/checkpoint.h:
+ *   Flat, memory-mappable checkpoint of a versioned key-value store
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/message.h"
+#include "tapir/store/common/backend/versionstore.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+ * A checkpoint file holds keys in key order, each with its versions
+ * oldest first:
+ *
+ *   header | heap of key and value bytes | key entries | version entries
+ *
+ * Entries are fixed size and refer to the heap by offset, so a mapped
+ * checkpoint is read in place: a lookup is a binary search over the
+ * key entries, and only the pages it touches are read in.
+ */
+class Checkpoint
+{
+    struct Header {
+        char magic[8];
+        uint64_t nKeys;
+        uint64_t nVersions;
+        uint64_t heapSize;
+        uint64_t keysOffset;
+        uint64_t versionsOffset;
+        // versions below the floor may have been left out
+        uint64_t floor, floorID;
+    };
+
+    struct KeyEntry {
+        uint64_t key;           // heap offset
+        uint32_t keyLength;
+        uint32_t nVersions;
+        uint64_t firstVersion;
+    };
+
+    struct VersionEntry {
+        uint64_t time, timeID;
+        uint64_t lastRead, lastReadID;
+        uint64_t expires;
+        uint64_t value;         // heap offset
+        uint32_t valueLength;
+        uint32_t op;
+    };
+
+public:
+    Checkpoint();
+    ~Checkpoint();
+
+    // Maps the checkpoint at path; false if it is missing or invalid.
+    bool open(const std::string &path);
+
+    // Number of keys.
+    size_t size() const;
+    // Reads below the floor may miss versions that were left out.
+    Timestamp floor() const;
+
+    // Index of the first key at or after key.
+    size_t seek(const std::string &key) const;
+    bool find(const std::string &key, size_t &i) const;
+    std::string key(size_t i) const;
+
+    // Versions of the i-th key, oldest first.
+    void versions(size_t i, std::vector<VersionedValue> &chain) const;
+
+    // Writes a checkpoint, key by key in key order. Entries go to
+    // temporary files while the heap is written, and the checkpoint
+    // only replaces path once it is complete.
+    class Writer
+    {
+    public:
+        Writer();
+        ~Writer();
+
+        bool open(const std::string &path);
+        void setFloor(const Timestamp &floor);
+        void add(const std::string &key,
+                 std::vector<VersionedValue>::const_iterator begin,
+                 std::vector<VersionedValue>::const_iterator end);
+        bool close();
+
+    private:
+        std::string path, tmpPath;
+        FILE *file, *keys, *versions;
+        Header header;
+
+        uint64_t append(const std::string &bytes);
+    };
+
+private:
+    char *base;
+    size_t length;
+    const Header *header;
+    const char *heap;
+    const KeyEntry *keys;
+    const VersionEntry *versionEntries;
+
+    int compare(size_t i, const std::string &key) const;
+};
+
+#endif  /* _CHECKPOINT_H_ */
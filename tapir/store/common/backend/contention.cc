@@ -0,0 +1,134 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/contention.cc:
+ *   Heavy-hitter tracker of the keys prepares conflict on
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/backend/contention.h"
+
+#include <algorithm>
+
+using namespace std;
+
+static const char *conflictNames[CONFLICT_CLASSES] = {
+    "abort-rw", "abort-phantom", "abort-ww",
+    "abstain-rw", "abstain-wr", "abstain-ww",
+    "retry-ww", "retry-wr"
+};
+
+ContentionTracker::ContentionTracker(size_t capacity)
+    : capacity(capacity > 0 ? capacity : 1), conflicts(0) { }
+
+void
+ContentionTracker::add(const string &key, int conflict)
+{
+    size_t i;
+    auto it = index.find(key);
+    if (it != index.end()) {
+        i = it->second;
+    } else if (heap.size() < capacity) {
+        heap.push_back(ContentionEntry(key));
+        index[key] = heap.size() - 1;
+        i = siftUp(heap.size() - 1);
+    } else {
+        // the least counted key makes room; whatever it had may have
+        // been this key's
+        uint64_t floor = heap[0].count;
+        index.erase(heap[0].key);
+        heap[0] = ContentionEntry(key);
+        heap[0].count = floor;
+        heap[0].error = floor;
+        index[key] = 0;
+        i = 0;
+    }
+
+    conflicts++;
+    heap[i].count++;
+    heap[i].conflicts[conflict]++;
+    siftDown(i);
+}
+
+void
+ContentionTracker::top(vector<ContentionEntry> &entries) const
+{
+    size_t first = entries.size();
+    entries.insert(entries.end(), heap.begin(), heap.end());
+    sort(entries.begin() + first, entries.end(),
+         [](const ContentionEntry &a, const ContentionEntry &b) {
+             return a.count > b.count;
+         });
+}
+
+void
+ContentionTracker::clear()
+{
+    conflicts = 0;
+    heap.clear();
+    index.clear();
+}
+
+const char *
+ContentionTracker::name(int conflict)
+{
+    return conflictNames[conflict];
+}
+
+void
+ContentionTracker::swap(size_t i, size_t j)
+{
+    std::swap(heap[i], heap[j]);
+    index[heap[i].key] = i;
+    index[heap[j].key] = j;
+}
+
+size_t
+ContentionTracker::siftUp(size_t i)
+{
+    while (i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+        swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    return i;
+}
+
+void
+ContentionTracker::siftDown(size_t i)
+{
+    for (;;) {
+        size_t least = i;
+        size_t l = 2 * i + 1, r = 2 * i + 2;
+        if (l < heap.size() && heap[l].count < heap[least].count) {
+            least = l;
+        }
+        if (r < heap.size() && heap[r].count < heap[least].count) {
+            least = r;
+        }
+        if (least == i) {
+            return;
+        }
+        swap(i, least);
+        i = least;
+    }
+}
@@ -0,0 +1,106 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/contention.h:
+ *   Heavy-hitter tracker of the keys prepares conflict on
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _CONTENTION_H_
+#define _CONTENTION_H_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Why a prepare failed on a key.
+// the version read was overwritten, expired or collected
+#define CONFLICT_ABORT_RW 0
+// a key was written into a range that was scanned
+#define CONFLICT_ABORT_PHANTOM 1
+// the key was written after the snapshot (snapshot isolation)
+#define CONFLICT_ABORT_WW 2
+// the key read, or a key in a range scanned, has a prepared write
+#define CONFLICT_ABSTAIN_RW 3
+// the key written has a prepared read, or is in a prepared scan
+#define CONFLICT_ABSTAIN_WR 4
+// the key written has a prepared write (snapshot isolation)
+#define CONFLICT_ABSTAIN_WW 5
+// the key written has a later committed or prepared write
+#define CONFLICT_RETRY_WW 6
+// the key written was read or scanned later
+#define CONFLICT_RETRY_WR 7
+#define CONFLICT_CLASSES 8
+
+// Keys tracked by default.
+#define CONTENTION_KEYS 1024
+
+struct ContentionEntry {
+    std::string key;
+    // conflicts counted on the key; up to error of them may belong to
+    // keys it took the place of
+    uint64_t count;
+    uint64_t error;
+    uint64_t conflicts[CONFLICT_CLASSES];
+
+    ContentionEntry() : count(0), error(0), conflicts() { };
+    ContentionEntry(const std::string &key)
+        : key(key), count(0), error(0), conflicts() { };
+};
+
+/*
+ * Counts conflicts per key in bounded space, with the Space-Saving
+ * algorithm: once capacity keys are tracked, a new key takes the
+ * place of the least counted one and inherits its count as error.
+ * Any key with more than total / capacity conflicts is tracked, and
+ * no count is too low. The entries form a min-heap on count, so the
+ * key to replace is always at the top.
+ */
+class ContentionTracker
+{
+public:
+    ContentionTracker(size_t capacity = CONTENTION_KEYS);
+
+    void add(const std::string &key, int conflict);
+
+    // Tracked keys, most conflicts first.
+    void top(std::vector<ContentionEntry> &entries) const;
+    // Conflicts counted since the last clear, on any key.
+    uint64_t total() const { return conflicts; };
+    void clear();
+
+    static const char *name(int conflict);
+
+private:
+    size_t capacity;
+    uint64_t conflicts;
+    std::vector<ContentionEntry> heap;
+    std::unordered_map<std::string, size_t> index;
+
+    void swap(size_t i, size_t j);
+    size_t siftUp(size_t i);
+    void siftDown(size_t i);
+};
+
+#endif /* _CONTENTION_H_ */
@@ -0,0 +1,56 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/engine.h:
+ *   Interface to where the values of a versioned store are kept
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _STORAGE_ENGINE_H_
+#define _STORAGE_ENGINE_H_
+
+#include <stdint.h>
+#include <string>
+
+// Handle to a value held by a storage engine; 0 is no value.
+typedef uint64_t valueref_t;
+
+/*
+ * Where a VersionedKVStore keeps the values of its versions. The store
+ * keeps every version's timestamps in memory, so that it can validate
+ * transactions without reading values, and hands the value bytes to
+ * the engine. Without an engine, values stay in the version chains.
+ */
+class StorageEngine
+{
+public:
+    virtual ~StorageEngine() { };
+
+    // Stores a value and returns its handle.
+    virtual valueref_t put(const std::string &value) = 0;
+    virtual void get(valueref_t ref, std::string &value) = 0;
+    // The value is no longer used, and its space can be reclaimed.
+    virtual void release(valueref_t ref) = 0;
+};
+
+#endif  /* _STORAGE_ENGINE_H_ */
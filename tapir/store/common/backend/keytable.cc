@@ -0,0 +1,95 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/keytable.cc:
+ *   Interning table mapping keys to dense integer ids
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/backend/keytable.h"
+
+using namespace std;
+
+KeyTable::KeyTable() { }
+
+KeyTable::~KeyTable() { }
+
+keyid_t
+KeyTable::intern(const string &key)
+{
+    auto ret = ids.insert(make_pair(key, (keyid_t)keys.size()));
+    if (ret.second) {
+        if (freeIds.empty()) {
+            keys.push_back(&ret.first->first);
+        } else {
+            ret.first->second = freeIds.back();
+            freeIds.pop_back();
+            keys[ret.first->second] = &ret.first->first;
+        }
+        ordered.insert(make_pair(&ret.first->first, ret.first->second));
+    }
+    return ret.first->second;
+}
+
+void
+KeyTable::reserve(size_t n)
+{
+    ids.reserve(n);
+    keys.reserve(n);
+}
+
+void
+KeyTable::erase(keyid_t id)
+{
+    ASSERT(id < keys.size() && keys[id] != NULL);
+    const string *key = keys[id];
+    ordered.erase(key);
+    keys[id] = NULL;
+    // last, as the key's bytes live in this node
+    ids.erase(*key);
+    freeIds.push_back(id);
+}
+
+bool
+KeyTable::find(const string &key, keyid_t &id) const
+{
+    auto it = ids.find(key);
+    if (it == ids.end()) {
+        return false;
+    }
+    id = it->second;
+    return true;
+}
+
+const string &
+KeyTable::key(keyid_t id) const
+{
+    ASSERT(id < keys.size() && keys[id] != NULL);
+    return *keys[id];
+}
+
+KeyTable::OrderedKeys::const_iterator
+KeyTable::seek(const string &key) const
+{
+    return ordered.lower_bound(&key);
+}
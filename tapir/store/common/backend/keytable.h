@@ -0,0 +1,88 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/keytable.h:
+ *   Interning table mapping keys to dense integer ids
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _KEY_TABLE_H_
+#define _KEY_TABLE_H_
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/message.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t keyid_t;
+
+// Id standing for a key that has not been interned.
+#define KEY_NONE ((keyid_t)-1)
+
+class KeyTable
+{
+    struct KeyLess {
+        bool operator()(const std::string *a, const std::string *b) const {
+            return *a < *b;
+        }
+    };
+
+public:
+    // Interned keys in key order.
+    typedef std::map<const std::string *, keyid_t, KeyLess> OrderedKeys;
+
+    KeyTable();
+    ~KeyTable();
+
+    // Returns the id for key, assigning the next free one if needed.
+    keyid_t intern(const std::string &key);
+    bool find(const std::string &key, keyid_t &id) const;
+    const std::string &key(keyid_t id) const;
+    size_t size() const { return ids.size(); };
+    // Makes room for n keys without rehashing.
+    void reserve(size_t n);
+
+    // Drops the key with the given id; the id is handed out again by a
+    // later intern.
+    void erase(keyid_t id);
+
+    // The first key at or after key, in key order.
+    OrderedKeys::const_iterator seek(const std::string &key) const;
+    OrderedKeys::const_iterator end() const { return ordered.end(); };
+
+private:
+    std::unordered_map<std::string, keyid_t> ids;
+    // id -> key; points into ids, whose nodes never move, so each
+    // key's bytes are stored once.
+    std::vector<const std::string *> keys;
+    // Ordered index over the same keys, for range reads.
+    OrderedKeys ordered;
+    // Ids of erased keys, for reuse.
+    std::vector<keyid_t> freeIds;
+};
+
+#endif  /* _KEY_TABLE_H_ */
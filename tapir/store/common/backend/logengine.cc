@@ -0,0 +1,427 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/logengine.cc:
+ *   Log-structured storage engine: values in append-only segment
+ *   files, compacted in the background, with a cache of hot values
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/backend/logengine.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SEGMENT_PREFIX "segment."
+
+LogEngine::LogEngine(const string &dir, size_t cacheBytes, size_t segmentBytes)
+    : dir(dir), cacheBytes(cacheBytes), segmentBytes(segmentBytes),
+      stopping(false), locations(1), head(0), cached(0),
+      nCompactions(0), hits(0), misses(0) { }
+
+LogEngine::~LogEngine()
+{
+    {
+        lock_guard<mutex> l(mtx);
+        stopping = true;
+    }
+    work.notify_all();
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+    for (auto &s : segs) {
+        ::close(s.second.fd);
+        unlink(segmentPath(s.first).c_str());
+    }
+}
+
+string
+LogEngine::segmentPath(uint32_t id) const
+{
+    return dir + "/" SEGMENT_PREFIX + to_string(id);
+}
+
+bool
+LogEngine::open()
+{
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        Warning("Failed to create %s: %s", dir.c_str(), strerror(errno));
+        return false;
+    }
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) {
+        Warning("Failed to open %s: %s", dir.c_str(), strerror(errno));
+        return false;
+    }
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX)) == 0) {
+            unlink((dir + "/" + e->d_name).c_str());
+        }
+    }
+    closedir(d);
+
+    if (!roll()) {
+        return false;
+    }
+    compactor = thread(&LogEngine::compactLoop, this);
+    return true;
+}
+
+/* Start a new head segment. */
+bool
+LogEngine::roll()
+{
+    flush();
+    uint32_t id = head + 1;
+    int fd = ::open(segmentPath(id).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        Warning("Failed to create segment %s: %s", segmentPath(id).c_str(),
+                strerror(errno));
+        return false;
+    }
+    uint32_t sealed = head;
+    head = id;
+    segs[head] = Segment{fd, 0, 0, false};
+
+    auto it = segs.find(sealed);
+    if (it != segs.end()) {
+        if (it->second.live == 0) {
+            drop(sealed);
+        } else if (sparse(it->second)) {
+            work.notify_one();
+        }
+    }
+    return true;
+}
+
+/* Write out the buffered tail of the head segment. */
+void
+LogEngine::flush()
+{
+    if (pending.empty()) {
+        return;
+    }
+    Segment &s = segs[head];
+    uint64_t offset = s.size - pending.size();
+    size_t done = 0;
+    while (done < pending.size()) {
+        ssize_t n = pwrite(s.fd, pending.data() + done, pending.size() - done,
+                           offset + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Panic("Failed to write segment %s: %s", segmentPath(head).c_str(),
+                  strerror(errno));
+        }
+        done += n;
+    }
+    pending.clear();
+}
+
+LogEngine::Location
+LogEngine::append(valueref_t ref, const char *data, size_t length)
+{
+    size_t size = sizeof(RecordHeader) + length;
+    if (segs[head].size > 0 && segs[head].size + size > segmentBytes) {
+        if (!roll()) {
+            Panic("Failed to start a new segment in %s", dir.c_str());
+        }
+    }
+
+    Segment &s = segs[head];
+    Location loc = { head, (uint32_t)length, s.size };
+    RecordHeader h = { ref, (uint32_t)length };
+    pending.append((const char *)&h, sizeof(h));
+    pending.append(data, length);
+    s.size += size;
+    s.live += size;
+    if (pending.size() >= LOG_WRITE_BUFFER) {
+        flush();
+    }
+    return loc;
+}
+
+/* Reads a value from its segment, or from the buffered tail; a
+ * record is never split between the two. */
+void
+LogEngine::read(const Location &loc, string &value)
+{
+    const Segment &s = segs[loc.segment];
+    uint64_t offset = loc.offset + sizeof(RecordHeader);
+    if (loc.segment == head && loc.offset >= s.size - pending.size()) {
+        value.assign(pending, offset - (s.size - pending.size()), loc.length);
+        return;
+    }
+
+    value.resize(loc.length);
+    size_t done = 0;
+    while (done < loc.length) {
+        ssize_t n = pread(s.fd, &value[done], loc.length - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            Panic("Failed to read segment %s: %s", segmentPath(loc.segment).c_str(),
+                  n < 0 ? strerror(errno) : "short read");
+        }
+        done += n;
+    }
+}
+
+void
+LogEngine::drop(uint32_t id)
+{
+    ASSERT(id != head);
+    auto it = segs.find(id);
+    ::close(it->second.fd);
+    unlink(segmentPath(id).c_str());
+    segs.erase(it);
+}
+
+/* Whether a full segment is worth compacting. */
+bool
+LogEngine::sparse(const Segment &s) const
+{
+    return !s.compacting && s.live < s.size * LOG_COMPACT_LIVE;
+}
+
+valueref_t
+LogEngine::put(const string &value)
+{
+    lock_guard<mutex> l(mtx);
+    valueref_t ref;
+    if (!freeRefs.empty()) {
+        ref = freeRefs.back();
+        freeRefs.pop_back();
+    } else {
+        ref = locations.size();
+        locations.emplace_back();
+    }
+    locations[ref] = append(ref, value.data(), value.size());
+    // new versions are the likeliest to be read
+    cachePut(ref, value);
+    return ref;
+}
+
+void
+LogEngine::get(valueref_t ref, string &value)
+{
+    lock_guard<mutex> l(mtx);
+    ASSERT(ref < locations.size() && locations[ref].segment != 0);
+
+    auto it = cache.find(ref);
+    if (it != cache.end()) {
+        hits++;
+        lru.splice(lru.begin(), lru, it->second);
+        value = it->second->second;
+        return;
+    }
+    misses++;
+    read(locations[ref], value);
+    cachePut(ref, value);
+}
+
+void
+LogEngine::release(valueref_t ref)
+{
+    lock_guard<mutex> l(mtx);
+    ASSERT(ref < locations.size() && locations[ref].segment != 0);
+
+    Location loc = locations[ref];
+    locations[ref] = Location();
+    freeRefs.push_back(ref);
+    cacheErase(ref);
+
+    Segment &s = segs[loc.segment];
+    s.live -= sizeof(RecordHeader) + loc.length;
+    if (loc.segment != head && !s.compacting) {
+        if (s.live == 0) {
+            drop(loc.segment);
+        } else if (sparse(s)) {
+            work.notify_one();
+        }
+    }
+}
+
+void
+LogEngine::cachePut(valueref_t ref, const string &value)
+{
+    if (value.size() + LOG_CACHE_ENTRY_BYTES > cacheBytes) {
+        return;
+    }
+    cacheErase(ref);
+    lru.emplace_front(ref, value);
+    cache[ref] = lru.begin();
+    cached += value.size() + LOG_CACHE_ENTRY_BYTES;
+    while (cached > cacheBytes) {
+        cached -= lru.back().second.size() + LOG_CACHE_ENTRY_BYTES;
+        cache.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void
+LogEngine::cacheErase(valueref_t ref)
+{
+    auto it = cache.find(ref);
+    if (it != cache.end()) {
+        cached -= it->second->second.size() + LOG_CACHE_ENTRY_BYTES;
+        lru.erase(it->second);
+        cache.erase(it);
+    }
+}
+
+/* Compact the emptiest sparse segment, whenever there is one. */
+void
+LogEngine::compactLoop()
+{
+    unique_lock<mutex> lock(mtx);
+    while (!stopping) {
+        uint32_t victim = 0;
+        double emptiest = 1;
+        for (auto &s : segs) {
+            if (s.first != head && sparse(s.second) &&
+                (double)s.second.live / s.second.size < emptiest) {
+                victim = s.first;
+                emptiest = (double)s.second.live / s.second.size;
+            }
+        }
+        if (victim == 0) {
+            work.wait(lock);
+            continue;
+        }
+        compact(victim, lock);
+    }
+}
+
+/*
+ * Copy the live records of a full segment to the head and delete it.
+ * A full segment is never written again, so it is mapped and scanned
+ * without the lock, which is only taken, a slice at a time, to check
+ * which records are live and move them.
+ */
+void
+LogEngine::compact(uint32_t id, unique_lock<mutex> &lock)
+{
+    Segment &s = segs[id];
+    s.compacting = true;
+    uint64_t size = s.size;
+    lock.unlock();
+
+    void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, s.fd, 0);
+    if (m == MAP_FAILED) {
+        Panic("Failed to map segment %s: %s", segmentPath(id).c_str(),
+              strerror(errno));
+    }
+    const char *base = (const char *)m;
+    madvise(m, size, MADV_SEQUENTIAL);
+
+    uint64_t offset = 0;
+    while (offset < size) {
+        lock.lock();
+        uint64_t end = min(size, offset + LOG_COMPACT_SLICE);
+        while (offset < end && !stopping) {
+            RecordHeader h;
+            memcpy(&h, base + offset, sizeof(h));
+            // the handle may have been released, and even reused
+            if (h.ref < locations.size() && locations[h.ref].segment == id &&
+                locations[h.ref].offset == offset) {
+                locations[h.ref] = append(h.ref, base + offset + sizeof(h), h.length);
+                s.live -= sizeof(h) + h.length;
+            }
+            offset += sizeof(h) + h.length;
+        }
+        bool stop = stopping;
+        lock.unlock();
+        if (stop) {
+            break;
+        }
+    }
+
+    munmap(m, size);
+    lock.lock();
+    if (offset >= size) {
+        ASSERT(s.live == 0);
+        drop(id);
+        nCompactions++;
+    }
+}
+
+size_t
+LogEngine::segments() const
+{
+    lock_guard<mutex> l(mtx);
+    return segs.size();
+}
+
+uint64_t
+LogEngine::diskBytes() const
+{
+    lock_guard<mutex> l(mtx);
+    uint64_t n = 0;
+    for (auto &s : segs) {
+        n += s.second.size;
+    }
+    return n;
+}
+
+uint64_t
+LogEngine::liveBytes() const
+{
+    lock_guard<mutex> l(mtx);
+    uint64_t n = 0;
+    for (auto &s : segs) {
+        n += s.second.live;
+    }
+    return n;
+}
+
+uint64_t
+LogEngine::compactions() const
+{
+    lock_guard<mutex> l(mtx);
+    return nCompactions;
+}
+
+uint64_t
+LogEngine::cacheHits() const
+{
+    lock_guard<mutex> l(mtx);
+    return hits;
+}
+
+uint64_t
+LogEngine::cacheMisses() const
+{
+    lock_guard<mutex> l(mtx);
+    return misses;
+}
@@ -0,0 +1,152 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/logengine.h:
+ *   Log-structured storage engine: values in append-only segment
+ *   files, compacted in the background, with a cache of hot values
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _LOG_ENGINE_H_
+#define _LOG_ENGINE_H_
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/message.h"
+#include "tapir/store/common/backend/engine.h"
+
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Segments are cut at this size.
+#define LOG_SEGMENT_BYTES (64 << 20)
+// Appends are buffered up to this many bytes before they are written.
+#define LOG_WRITE_BUFFER (64 << 10)
+// A full segment is compacted once less than this share of it is live.
+#define LOG_COMPACT_LIVE 0.5
+// Bookkeeping charged to the cache for each value in it.
+#define LOG_CACHE_ENTRY_BYTES 64
+// Compaction lets go of the lock after scanning this many bytes.
+#define LOG_COMPACT_SLICE (1 << 20)
+
+/*
+ * Values are appended to the newest of a series of segment files,
+ * each framed with its handle and length. An in-memory index maps
+ * handles to where their value is, so a read is one pread, and the
+ * most recently used values are kept in an LRU cache. Released values
+ * leave holes; a background thread copies what is still live out of
+ * mostly empty segments and deletes them.
+ *
+ * The segments are scratch space for values too big to keep in
+ * memory: they are cleared on open and removed on close, and do not
+ * make the store durable.
+ */
+class LogEngine : public StorageEngine
+{
+public:
+    LogEngine(const std::string &dir, size_t cacheBytes,
+              size_t segmentBytes = LOG_SEGMENT_BYTES);
+    ~LogEngine();
+
+    // Creates dir if need be, and removes segments left in it.
+    bool open();
+
+    valueref_t put(const std::string &value) override;
+    void get(valueref_t ref, std::string &value) override;
+    void release(valueref_t ref) override;
+
+    size_t segments() const;
+    // Bytes in segments, and how many of them are still used.
+    uint64_t diskBytes() const;
+    uint64_t liveBytes() const;
+    uint64_t compactions() const;
+    uint64_t cacheHits() const;
+    uint64_t cacheMisses() const;
+
+private:
+    struct RecordHeader {
+        uint64_t ref;
+        uint32_t length;
+    } __attribute__((packed));
+
+    // Segment 0 is no segment.
+    struct Location {
+        uint32_t segment;
+        uint32_t length;
+        uint64_t offset;
+    };
+
+    struct Segment {
+        int fd;
+        uint64_t size;
+        uint64_t live;
+        bool compacting;
+    };
+
+    const std::string dir;
+    const size_t cacheBytes;
+    const size_t segmentBytes;
+
+    mutable std::mutex mtx;
+    std::condition_variable work;
+    bool stopping;
+    std::thread compactor;
+
+    // value locations by handle, and handles free for reuse
+    std::vector<Location> locations;
+    std::vector<valueref_t> freeRefs;
+
+    std::map<uint32_t, Segment> segs;
+    uint32_t head;
+    // tail of the head segment not written yet
+    std::string pending;
+
+    // most recently used first
+    std::list<std::pair<valueref_t, std::string>> lru;
+    std::unordered_map<valueref_t,
+                       std::list<std::pair<valueref_t, std::string>>::iterator> cache;
+    size_t cached;
+
+    uint64_t nCompactions;
+    uint64_t hits;
+    uint64_t misses;
+
+    std::string segmentPath(uint32_t id) const;
+    bool roll();
+    void flush();
+    Location append(valueref_t ref, const char *data, size_t length);
+    void read(const Location &loc, std::string &value);
+    void drop(uint32_t id);
+    bool sparse(const Segment &s) const;
+    void cachePut(valueref_t ref, const std::string &value);
+    void cacheErase(valueref_t ref);
+    void compactLoop();
+    void compact(uint32_t id, std::unique_lock<std::mutex> &lock);
+};
+
+#endif  /* _LOG_ENGINE_H_ */
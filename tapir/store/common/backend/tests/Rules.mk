@@ -5,6 +5,8 @@ d := $(dir $(lastword $(MAKEFILE_LIST)))
 #
 GTEST_SRCS += $(addprefix $(d), \
 		kvstore-test.cc \
+		contention-test.cc \
+		keytable-test.cc \
 		versionstore-test.cc \
 		lockserver-test.cc)
 
@@ -12,6 +14,10 @@ $(d)kvstore-test: $(o)kvstore-test.o $(LIB-transport) $(LIB-store-common) $(LIB-
 
 TEST_BINS += $(d)kvstore-test
 
+$(d)keytable-test: $(o)keytable-test.o $(LIB-transport) $(LIB-store-common) $(LIB-store-backend) $(GTEST_MAIN)
+
+TEST_BINS += $(d)keytable-test
+
 $(d)versionstore-test: $(o)versionstore-test.o $(LIB-transport) $(LIB-store-common) $(LIB-store-backend) $(GTEST_MAIN)
 
 TEST_BINS += $(d)versionstore-test
@@ -19,3 +25,7 @@ TEST_BINS += $(d)versionstore-test
 $(d)lockserver-test: $(o)lockserver-test.o $(LIB-transport) $(LIB-store-common) $(LIB-store-backend) $(GTEST_MAIN)
 
 TEST_BINS += $(d)lockserver-test
+
+$(d)contention-test: $(o)contention-test.o $(LIB-transport) $(LIB-store-common) $(LIB-store-backend) $(GTEST_MAIN)
+
+TEST_BINS += $(d)contention-test
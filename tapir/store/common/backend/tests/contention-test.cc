@@ -0,0 +1,96 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/tests/contention-test.cc
+ *   test cases for the contention tracker
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/backend/contention.h"
+
+#include <gtest/gtest.h>
+
+TEST(ContentionTracker, CountsByConflict)
+{
+    ContentionTracker tracker;
+    std::vector<ContentionEntry> top;
+
+    tracker.add("a", CONFLICT_RETRY_WR);
+    tracker.add("b", CONFLICT_ABSTAIN_RW);
+    tracker.add("a", CONFLICT_RETRY_WR);
+    tracker.add("a", CONFLICT_ABORT_RW);
+
+    tracker.top(top);
+    ASSERT_EQ(2u, top.size());
+    EXPECT_EQ("a", top[0].key);
+    EXPECT_EQ(3u, top[0].count);
+    EXPECT_EQ(0u, top[0].error);
+    EXPECT_EQ(2u, top[0].conflicts[CONFLICT_RETRY_WR]);
+    EXPECT_EQ(1u, top[0].conflicts[CONFLICT_ABORT_RW]);
+    EXPECT_EQ("b", top[1].key);
+    EXPECT_EQ(1u, top[1].conflicts[CONFLICT_ABSTAIN_RW]);
+    EXPECT_EQ(4u, tracker.total());
+
+    tracker.clear();
+    top.clear();
+    tracker.top(top);
+    EXPECT_TRUE(top.empty());
+    EXPECT_EQ(0u, tracker.total());
+}
+
+TEST(ContentionTracker, BoundedSpace)
+{
+    ContentionTracker tracker(2);
+    std::vector<ContentionEntry> top;
+
+    for (int i = 0; i < 3; i++) {
+        tracker.add("a", CONFLICT_RETRY_WW);
+    }
+    for (int i = 0; i < 2; i++) {
+        tracker.add("b", CONFLICT_RETRY_WW);
+    }
+    // c takes the place of b, the least counted key
+    tracker.add("c", CONFLICT_RETRY_WW);
+
+    tracker.top(top);
+    ASSERT_EQ(2u, top.size());
+    for (auto &e : top) {
+        EXPECT_NE("b", e.key);
+        EXPECT_EQ(3u, e.count);
+        EXPECT_EQ(e.key == "c" ? 2u : 0u, e.error);
+    }
+
+    // a key that keeps conflicting stays tracked among a stream of
+    // one-off ones
+    for (int i = 0; i < 1000; i++) {
+        tracker.add("hot", CONFLICT_ABSTAIN_WR);
+        tracker.add("cold" + std::to_string(i), CONFLICT_ABSTAIN_WR);
+    }
+    tracker.add("hot", CONFLICT_ABSTAIN_WR);
+    top.clear();
+    tracker.top(top);
+    ASSERT_EQ(2u, top.size());
+    EXPECT_EQ("hot", top[0].key);
+    EXPECT_LE(1000u, top[0].count);
+    EXPECT_EQ(2007u, tracker.total());
+}
@@ -0,0 +1,74 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/backend/tests/keytable-test.cc
+ *   test cases for the key interning table
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/backend/keytable.h"
+
+#include <gtest/gtest.h>
+
+TEST(KeyTable, Intern)
+{
+    KeyTable table;
+    keyid_t id;
+
+    EXPECT_EQ(0u, table.intern("test1"));
+    EXPECT_EQ(1u, table.intern("test2"));
+    EXPECT_EQ(0u, table.intern("test1"));
+    EXPECT_EQ(2u, table.size());
+
+    EXPECT_TRUE(table.find("test2", id));
+    EXPECT_EQ(1u, id);
+    EXPECT_FALSE(table.find("test3", id));
+
+    // ids stay valid as the table grows
+    for (int i = 0; i < 1000; i++) {
+        table.intern("key" + std::to_string(i));
+    }
+    EXPECT_EQ("test1", table.key(0));
+    EXPECT_EQ("test2", table.key(1));
+    EXPECT_EQ("key999", table.key(1001));
+}
+
+TEST(KeyTable, Erase)
+{
+    KeyTable table;
+    keyid_t id;
+
+    table.intern("a");
+    table.intern("b");
+    table.intern("c");
+    table.erase(1);
+    EXPECT_EQ(2u, table.size());
+    EXPECT_FALSE(table.find("b", id));
+    // the ordered index skips it too
+    EXPECT_EQ("c", *table.seek("b")->first);
+
+    // the free id goes to the next new key
+    EXPECT_EQ(1u, table.intern("d"));
+    EXPECT_EQ("d", table.key(1));
+    EXPECT_EQ(3u, table.intern("e"));
+}
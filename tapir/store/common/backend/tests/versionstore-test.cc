@@ -29,29 +29,404 @@
  **********************************************************************/
 
 #include "tapir/store/common/backend/versionstore.h"
+#include "tapir/store/common/backend/logengine.h"
 
 #include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
 
 TEST(VersionedKVStore, Get)
 {
     VersionedKVStore store;
-    std::pair<Timestamp, std::string> val;
+    VersionedValue val;
 
     store.put("test1", "abc", Timestamp(10));
     EXPECT_TRUE(store.get("test1", val));
-    EXPECT_EQ(val.second, "abc");
-    EXPECT_EQ(Timestamp(10), val.first); 
+    EXPECT_EQ(val.value, "abc");
+    EXPECT_EQ(Timestamp(10), val.time); 
 
     store.put("test2", "def", Timestamp(10));
     EXPECT_TRUE(store.get("test2", val));
-    EXPECT_EQ(val.second, "def");
-    EXPECT_EQ(Timestamp(10), val.first); 
+    EXPECT_EQ(val.value, "def");
+    EXPECT_EQ(Timestamp(10), val.time); 
 
     store.put("test1", "xyz", Timestamp(11));
     EXPECT_TRUE(store.get("test1", val));
-    EXPECT_EQ(val.second, "xyz");
-    EXPECT_EQ(Timestamp(11), val.first); 
+    EXPECT_EQ(val.value, "xyz");
+    EXPECT_EQ(Timestamp(11), val.time); 
     
     EXPECT_TRUE(store.get("test1", Timestamp(10), val));
-    EXPECT_EQ(val.second, "abc");
+    EXPECT_EQ(val.value, "abc");
+}
+
+TEST(VersionedKVStore, OutOfOrderPut)
+{
+    VersionedKVStore store;
+    VersionedValue val;
+    std::pair<Timestamp, Timestamp> range;
+
+    store.put("test1", "c", Timestamp(30));
+    store.put("test1", "a", Timestamp(10));
+    store.put("test1", "b", Timestamp(20));
+
+    EXPECT_TRUE(store.get("test1", val));
+    EXPECT_EQ(val.value, "c");
+    EXPECT_TRUE(store.get("test1", Timestamp(25), val));
+    EXPECT_EQ(val.value, "b");
+    EXPECT_FALSE(store.get("test1", Timestamp(5), val));
+
+    EXPECT_TRUE(store.getRange("test1", Timestamp(15), range));
+    EXPECT_EQ(Timestamp(10), range.first);
+    EXPECT_EQ(Timestamp(20), range.second);
+}
+
+TEST(VersionedKVStore, LastRead)
+{
+    VersionedKVStore store;
+    Timestamp lastRead;
+
+    store.put("test1", "abc", Timestamp(10));
+    EXPECT_FALSE(store.getLastRead("test1", lastRead));
+
+    store.commitGet("test1", Timestamp(10), Timestamp(15));
+    store.commitGet("test1", Timestamp(10), Timestamp(12));
+    EXPECT_TRUE(store.getLastRead("test1", lastRead));
+    EXPECT_EQ(Timestamp(15), lastRead);
+
+    // a newer version has not been read yet
+    store.put("test1", "xyz", Timestamp(20));
+    EXPECT_FALSE(store.getLastRead("test1", lastRead));
+    EXPECT_TRUE(store.getLastRead("test1", Timestamp(11), lastRead));
+    EXPECT_EQ(Timestamp(15), lastRead);
+}
+
+TEST(VersionedKVStore, GC)
+{
+    VersionedKVStore store;
+    VersionedValue val;
+
+    for (int i = 1; i <= 10; i++) {
+        store.put("test1", std::to_string(i), Timestamp(i * 10));
+    }
+    store.put("test2", "abc", Timestamp(10));
+
+    // keep the version valid at the safe point and everything newer
+    EXPECT_EQ(4u, store.gc(Timestamp(55), 100));
+    EXPECT_FALSE(store.get("test1", Timestamp(45), val));
+    EXPECT_TRUE(store.get("test1", Timestamp(55), val));
+    EXPECT_EQ(val.value, "5");
+    EXPECT_TRUE(store.get("test1", val));
+    EXPECT_EQ(val.value, "10");
+
+    // the latest version always survives
+    EXPECT_EQ(5u, store.gc(Timestamp(1000), 100));
+    EXPECT_TRUE(store.get("test1", val));
+    EXPECT_EQ(val.value, "10");
+    EXPECT_TRUE(store.get("test2", val));
+    EXPECT_EQ(val.value, "abc");
+}
+
+TEST(VersionedKVStore, Delete)
+{
+    VersionedKVStore store;
+    VersionedValue val;
+    std::vector<keyid_t> ids;
+    keyid_t a;
+
+    store.put("a", "1", Timestamp(10));
+    store.put("b", "2", Timestamp(10));
+    store.remove("a", Timestamp(20));
+
+    // the tombstone is a version like any other
+    EXPECT_TRUE(store.get("a", val));
+    EXPECT_TRUE(val.deleted());
+    EXPECT_TRUE(store.get("a", Timestamp(15), val));
+    EXPECT_EQ("1", val.value);
+
+    // but scans skip the key
+    store.scan("", "", 0, ids);
+    ASSERT_EQ(1u, ids.size());
+    EXPECT_EQ("b", store.key(ids[0]));
+
+    // the key stays while pinned
+    ASSERT_TRUE(store.lookup("a", a));
+    EXPECT_EQ(1u, store.gc(Timestamp(30), 100,
+                           [a](keyid_t key) { return key == a; }));
+    EXPECT_EQ(2u, store.size());
+
+    // and then goes altogether, and its id is reused
+    EXPECT_EQ(1u, store.gc(Timestamp(30), 100));
+    EXPECT_EQ(1u, store.size());
+    EXPECT_FALSE(store.get("a", val));
+    EXPECT_EQ(a, store.intern("c"));
+    EXPECT_TRUE(store.get("b", val));
+    EXPECT_EQ("2", val.value);
+}
+
+TEST(VersionedKVStore, Expiry)
+{
+    VersionedKVStore store;
+    VersionedValue val;
+    std::vector<keyid_t> ids;
+    const uint64_t sec = 1ull << 32;
+
+    store.put("a", "1", Timestamp(10 * sec), 12 * sec);
+    store.put("b", "2", Timestamp(10 * sec));
+
+    EXPECT_TRUE(store.get("a", Timestamp(11 * sec), val));
+    EXPECT_FALSE(val.expired(Timestamp(11 * sec)));
+    EXPECT_TRUE(val.expired(Timestamp(12 * sec)));
+
+    store.scan("", "", 0, ids, Timestamp(11 * sec));
+    EXPECT_EQ(2u, ids.size());
+    ids.clear();
+    store.scan("", "", 0, ids, Timestamp(13 * sec));
+    ASSERT_EQ(1u, ids.size());
+    EXPECT_EQ("b", store.key(ids[0]));
+
+    // the wheel gets to a key once the second it expires in is over
+    EXPECT_EQ(0u, store.expire(Timestamp(12 * sec), 100));
+    EXPECT_EQ(2u, store.size());
+    EXPECT_EQ(1u, store.expire(Timestamp(13 * sec), 100));
+    EXPECT_EQ(1u, store.size());
+    EXPECT_FALSE(store.get("a", val));
+
+    // a key written again without a TTL stays
+    store.put("c", "3", Timestamp(20 * sec), 21 * sec);
+    store.put("c", "4", Timestamp(20 * sec + 5));
+    EXPECT_EQ(1u, store.expire(Timestamp(30 * sec), 100));
+    EXPECT_TRUE(store.get("c", val));
+    EXPECT_EQ("4", val.value);
+}
+
+TEST(VersionedKVStore, Scan)
+{
+    VersionedKVStore store;
+    std::vector<keyid_t> ids;
+    Timestamp lastRead;
+
+    store.put("b", "1", Timestamp(10));
+    store.put("d", "2", Timestamp(10));
+    store.put("a", "3", Timestamp(10));
+    store.intern("c"); // no version
+    store.put("e", "4", Timestamp(10));
+
+    store.scan("b", "e", 0, ids);
+    ASSERT_EQ(2u, ids.size());
+    EXPECT_EQ("b", store.key(ids[0]));
+    EXPECT_EQ("d", store.key(ids[1]));
+
+    ids.clear();
+    store.scan("", "", 2, ids);
+    ASSERT_EQ(2u, ids.size());
+    EXPECT_EQ("a", store.key(ids[0]));
+    EXPECT_EQ("b", store.key(ids[1]));
+
+    // overlapping scans keep the latest read of each part of the range
+    store.commitScan("b", "d", Timestamp(20));
+    store.commitScan("c", "", Timestamp(15));
+    EXPECT_FALSE(store.getLastScan("a", lastRead));
+    EXPECT_TRUE(store.getLastScan("bb", lastRead));
+    EXPECT_EQ(Timestamp(20), lastRead);
+    EXPECT_TRUE(store.getLastScan("c", lastRead));
+    EXPECT_EQ(Timestamp(20), lastRead);
+    EXPECT_TRUE(store.getLastScan("zzz", lastRead));
+    EXPECT_EQ(Timestamp(15), lastRead);
+
+    // old scans go, but still hold back writes below them
+    store.gc(Timestamp(18), 100);
+    EXPECT_TRUE(store.getLastScan("a", lastRead));
+    EXPECT_EQ(Timestamp(15), lastRead);
+    EXPECT_TRUE(store.getLastScan("c", lastRead));
+    EXPECT_EQ(Timestamp(20), lastRead);
+}
+
+TEST(VersionedKVStore, Checkpoint)
+{
+    const std::string path = "/tmp/versionstore-test.checkpoint";
+    VersionedKVStore store;
+    VersionedValue val;
+    std::vector<keyid_t> ids;
+    Timestamp floor;
+
+    store.put("a", "1", Timestamp(10));
+    store.put("a", "2", Timestamp(20));
+    store.put("b", "3", Timestamp(10));
+    store.put("c", "4", Timestamp(10));
+    store.remove("c", Timestamp(20));
+    ASSERT_TRUE(store.writeCheckpoint(path, false));
+
+    // only the latest versions, and no deleted keys
+    VersionedKVStore restored;
+    ASSERT_TRUE(restored.loadCheckpoint(path, floor));
+    EXPECT_EQ(Timestamp(20), floor);
+    EXPECT_EQ(0u, restored.size());
+    EXPECT_TRUE(restored.get("a", val));
+    EXPECT_EQ("2", val.value);
+    EXPECT_EQ(Timestamp(20), val.time);
+    EXPECT_FALSE(restored.get("a", Timestamp(15), val));
+    EXPECT_FALSE(restored.get("c", val));
+    EXPECT_EQ(1u, restored.size());
+
+    restored.put("d", "5", Timestamp(30));
+    restored.scan("", "", 0, ids);
+    ASSERT_EQ(3u, ids.size());
+    EXPECT_EQ("b", restored.key(ids[1]));
+    EXPECT_EQ("d", restored.key(ids[2]));
+
+    // a key dropped after it was read in stays gone
+    restored.remove("b", Timestamp(40));
+    restored.gc(Timestamp(50), 100);
+    EXPECT_FALSE(restored.get("b", val));
+    ids.clear();
+    restored.scan("", "", 0, ids);
+    EXPECT_EQ(2u, ids.size());
+
+    // history keeps every version, tombstones included; keys never
+    // read in are carried over from the loaded checkpoint
+    ASSERT_TRUE(store.writeCheckpoint(path, true));
+    VersionedKVStore full;
+    ASSERT_TRUE(full.loadCheckpoint(path, floor));
+    EXPECT_EQ(Timestamp(), floor);
+    EXPECT_TRUE(full.get("a", Timestamp(15), val));
+    EXPECT_EQ("1", val.value);
+    EXPECT_TRUE(full.get("c", val));
+    EXPECT_TRUE(val.deleted());
+    ASSERT_TRUE(full.writeCheckpoint(path + ".2", false));
+    VersionedKVStore copy;
+    ASSERT_TRUE(copy.loadCheckpoint(path + ".2", floor));
+    EXPECT_TRUE(copy.get("b", val));
+    EXPECT_EQ("3", val.value);
+    EXPECT_FALSE(copy.get("c", val));
+
+    unlink(path.c_str());
+    unlink((path + ".2").c_str());
+}
+
+TEST(VersionedKVStore, Engine)
+{
+    const std::string path = "/tmp/versionstore-test.checkpoint";
+    // small segments and a cache of a few values
+    LogEngine engine("/tmp/versionstore-test.engine", 1024, 4096);
+    ASSERT_TRUE(engine.open());
+    VersionedKVStore store;
+    VersionedValue val;
+
+    store.put("early", "held in memory", Timestamp(1));
+    store.setEngine(&engine);
+    for (int t = 1; t <= 5; t++) {
+        for (int k = 0; k < 100; k++) {
+            store.put("key" + std::to_string(k),
+                      std::string(100, 'a' + t) + std::to_string(k), Timestamp(t));
+        }
+    }
+    EXPECT_GT(engine.segments(), 10u);
+
+    // old versions read back from disk
+    EXPECT_TRUE(store.get("key7", Timestamp(2), val));
+    EXPECT_EQ(std::string(100, 'c') + "7", val.value);
+    EXPECT_TRUE(store.get("early", val));
+    EXPECT_EQ("held in memory", val.value);
+    uint64_t hits = engine.cacheHits();
+    EXPECT_TRUE(store.get("early", val));
+    EXPECT_EQ(hits + 1, engine.cacheHits());
+
+    // prepare only needs the versions, not the values
+    uint64_t misses = engine.cacheMisses();
+    ASSERT_TRUE(store.peek(store.intern("key3")) != NULL);
+    EXPECT_EQ(Timestamp(5), store.peek(store.intern("key3"))->time);
+    EXPECT_EQ(misses, engine.cacheMisses());
+
+    // dropping the old versions leaves the segments mostly empty, and
+    // they are compacted away
+    uint64_t disk = engine.diskBytes();
+    store.gc(Timestamp(5), 1000);
+    for (int i = 0; i < 200 && engine.compactions() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_GT(engine.compactions(), 0u);
+    EXPECT_LT(engine.diskBytes(), disk);
+    for (int k = 0; k < 100; k++) {
+        EXPECT_TRUE(store.get("key" + std::to_string(k), val));
+        EXPECT_EQ(std::string(100, 'f') + std::to_string(k), val.value);
+    }
+
+    // checkpoints hold the values, not where the engine put them
+    Timestamp floor;
+    ASSERT_TRUE(store.writeCheckpoint(path, false));
+    VersionedKVStore restored;
+    ASSERT_TRUE(restored.loadCheckpoint(path, floor));
+    EXPECT_TRUE(restored.get("key42", val));
+    EXPECT_EQ(std::string(100, 'f') + "42", val.value);
+
+    unlink(path.c_str());
+}
+
+TEST(VersionedKVStore, History)
+{
+    LogEngine history("/tmp/versionstore-test.history", 1 << 20);
+    ASSERT_TRUE(history.open());
+    VersionedKVStore store;
+    VersionedValue val;
+    Timestamp lastRead;
+    std::pair<Timestamp, Timestamp> range;
+
+    store.setHistory(&history);
+    for (int t = 10; t <= 40; t += 10) {
+        store.put("a", std::to_string(t), Timestamp(t));
+        store.put("b", std::to_string(t), Timestamp(t));
+    }
+    store.commitGet("a", Timestamp(20), Timestamp(25));
+    store.commitGet("b", Timestamp(20), Timestamp(38));
+
+    // versions replaced before 35 go, unless read since
+    EXPECT_EQ(3u, store.tier(Timestamp(35), Timestamp(), 100));
+    EXPECT_GT(history.liveBytes(), 0u);
+
+    // and read back in transparently
+    EXPECT_TRUE(store.get("a", Timestamp(15), val));
+    EXPECT_EQ("10", val.value);
+    EXPECT_TRUE(store.getRange("a", Timestamp(20), range));
+    EXPECT_EQ(Timestamp(20), range.first);
+    EXPECT_EQ(Timestamp(30), range.second);
+    EXPECT_TRUE(store.getLastRead("a", Timestamp(20), lastRead));
+    EXPECT_EQ(Timestamp(25), lastRead);
+    EXPECT_TRUE(store.get("b", Timestamp(25), val));
+    EXPECT_EQ("20", val.value);
+    EXPECT_FALSE(store.get("a", Timestamp(5), val));
+
+    // a late read brings history back into memory
+    store.commitGet("a", Timestamp(10), Timestamp(50));
+    EXPECT_TRUE(store.getLastRead("a", Timestamp(10), lastRead));
+    EXPECT_EQ(Timestamp(50), lastRead);
+    EXPECT_EQ(0u, store.tier(Timestamp(35), Timestamp(), 100));
+
+    // as does a write older than what is in memory
+    store.put("c", "10", Timestamp(10));
+    store.put("c", "20", Timestamp(20));
+    store.put("c", "30", Timestamp(30));
+    EXPECT_EQ(2u, store.tier(Timestamp(35), Timestamp(), 100));
+    store.put("c", "15", Timestamp(15));
+    EXPECT_TRUE(store.get("c", Timestamp(17), val));
+    EXPECT_EQ("15", val.value);
+    EXPECT_TRUE(store.get("c", Timestamp(12), val));
+    EXPECT_EQ("10", val.value);
+
+    // what gc would drop below the floor is left out
+    for (int t = 10; t <= 40; t += 10) {
+        store.put("d", std::to_string(t), Timestamp(t));
+    }
+    store.tier(Timestamp(35), Timestamp(25), 100);
+    EXPECT_FALSE(store.get("d", Timestamp(12), val));
+    EXPECT_TRUE(store.get("d", Timestamp(22), val));
+    EXPECT_EQ("20", val.value);
+
+    // gc drops history along with the versions in memory
+    store.gc(Timestamp(45), 100);
+    EXPECT_FALSE(store.get("b", Timestamp(15), val));
+    EXPECT_TRUE(store.get("b", val));
+    EXPECT_EQ("40", val.value);
+    EXPECT_EQ(0u, history.liveBytes());
 }
@@ -53,6 +53,30 @@ TxnStore::Get(uint64_t id, const string &key, const Timestamp &timestamp,
     return 0;
 }
 
+int
+TxnStore::GetWithHints(uint64_t id, const string &key,
+    pair<Timestamp, string> &value, Timestamp &lastRead, Timestamp &pendingWrite)
+{
+    Panic("Unimplemented GET");
+    return 0;
+}
+
+int
+TxnStore::GetSnapshot(uint64_t id, const string &key, const Timestamp &timestamp,
+    pair<Timestamp, string> &value)
+{
+    Panic("Unimplemented GET SNAPSHOT");
+    return 0;
+}
+
+int
+TxnStore::Scan(uint64_t id, const string &start, const string &end,
+    size_t limit, KeyValues &values)
+{
+    Panic("Unimplemented SCAN");
+    return 0;
+}
+
 int
 TxnStore::Put(uint64_t id, const string &key, const string &value)
 {
@@ -60,6 +84,13 @@ TxnStore::Put(uint64_t id, const string &key, const string &value)
     return 0;
 }
 
+int
+TxnStore::Delete(uint64_t id, const string &key)
+{
+    Panic("Unimplemented DELETE");
+    return 0;
+}
+
 int
 TxnStore::Prepare(uint64_t id, const Transaction &txn)
 {
@@ -75,12 +106,74 @@ TxnStore::Prepare(uint64_t id, const Transaction &txn,
     return 0;
 }
 
+int
+TxnStore::Prepare(uint64_t id, const TransactionView &txn,
+    const Timestamp &timestamp, Timestamp &proposed)
+{
+    return Prepare(id, txn.toTransaction(), timestamp, proposed);
+}
+
+int
+TxnStore::Prepare(uint64_t id, const TransactionView &txn,
+    const Timestamp &timestamp, Isolation isolation, Timestamp &proposed)
+{
+    // stores with a single isolation level validate at their own
+    return Prepare(id, txn, timestamp, proposed);
+}
+
+void
+TxnStore::PrepareBatch(vector<PrepareRequest> &batch)
+{
+    // one at a time, in the order received
+    for (auto &r : batch) {
+        if (r.isolated) {
+            r.status = Prepare(r.id, r.txn, r.timestamp, r.isolation,
+                               r.proposed);
+        } else {
+            r.status = Prepare(r.id, r.txn, r.timestamp, r.proposed);
+        }
+    }
+}
+
+void
+TxnStore::PrepareAsync(PrepareRequest &r, function<void ()> done)
+{
+    if (r.readOnly) {
+        r.status = CommitReads(r.id, r.txn, r.timestamp);
+    } else if (r.isolated) {
+        r.status = Prepare(r.id, r.txn, r.timestamp, r.isolation, r.proposed);
+    } else {
+        r.status = Prepare(r.id, r.txn, r.timestamp, r.proposed);
+    }
+    done();
+}
+
+void
+TxnStore::ForKey(const string &key, function<void (TxnStore &)> op)
+{
+    op(*this);
+}
+
 void
 TxnStore::Commit(uint64_t id, uint64_t timestamp)
 {
     Panic("Unimplemented COMMIT");
 }
 
+void
+TxnStore::CommitAsync(uint64_t id, uint64_t timestamp, function<void ()> done)
+{
+    Commit(id, timestamp);
+    done();
+}
+
+int
+TxnStore::CommitReads(uint64_t id, const TransactionView &txn,
+    const Timestamp &timestamp)
+{
+    Panic("Unimplemented COMMIT READS");
+}
+
 void
 TxnStore::Abort(uint64_t id, const Transaction &txn)
 {
@@ -92,3 +185,93 @@ TxnStore::Load(const string &key, const string &value, const Timestamp &timestam
 {
     Panic("Unimplemented LOAD");
 }
+
+void
+TxnStore::LoadBatch(const vector<pair<string, string>> &values,
+                    const Timestamp &timestamp)
+{
+    for (auto &kv : values) {
+        Load(kv.first, kv.second, timestamp);
+    }
+}
+
+void
+TxnStore::Reserve(size_t n) { }
+
+void
+TxnStore::GC(const Timestamp &horizon, size_t slice)
+{
+    Panic("Unimplemented GC");
+}
+
+void
+TxnStore::Expire(const Timestamp &horizon, size_t slice)
+{
+    Panic("Unimplemented EXPIRE");
+}
+
+void
+TxnStore::Recover(WriteAheadLog *log)
+{
+    Panic("Unimplemented RECOVER");
+}
+
+void
+TxnStore::SetLog(WriteAheadLog *log)
+{
+    Panic("Unimplemented SET LOG");
+}
+
+bool
+TxnStore::OpenEngine(const string &dir, size_t cacheBytes)
+{
+    Panic("Unimplemented OPEN ENGINE");
+    return false;
+}
+
+bool
+TxnStore::OpenHistory(const string &dir)
+{
+    Panic("Unimplemented OPEN HISTORY");
+    return false;
+}
+
+void
+TxnStore::Tier(const Timestamp &horizon, size_t slice)
+{
+    Panic("Unimplemented TIER");
+}
+
+bool
+TxnStore::LoadCheckpoint(const string &path)
+{
+    Panic("Unimplemented LOAD CHECKPOINT");
+    return false;
+}
+
+bool
+TxnStore::WriteCheckpoint(const string &path, bool history)
+{
+    Panic("Unimplemented WRITE CHECKPOINT");
+    return false;
+}
+
+Timestamp
+TxnStore::Close(const Timestamp &bound)
+{
+    Panic("Unimplemented CLOSE");
+    return Timestamp();
+}
+
+size_t
+TxnStore::PreparedCount()
+{
+    Panic("Unimplemented PREPARED COUNT");
+    return 0;
+}
+
+void
+TxnStore::Contention(vector<ContentionEntry> &top, uint64_t &total, bool reset)
+{
+    Panic("Unimplemented CONTENTION");
+}
@@ -38,6 +38,39 @@
 #include "tapir/lib/message.h"
 #include "tapir/store/common/timestamp.h"
 #include "tapir/store/common/transaction.h"
+#include "tapir/store/common/transactionview.h"
+#include "tapir/store/common/backend/contention.h"
+
+#include <functional>
+
+class WriteAheadLog;
+
+// Isolation levels a transaction can be validated at.
+enum Isolation {
+    ISOLATION_LINEARIZABLE,
+    ISOLATION_SERIALIZABLE,
+    ISOLATION_SNAPSHOT
+};
+
+// A prepare validated as part of a batch, and its outcome.
+struct PrepareRequest {
+    uint64_t id;
+    TransactionView txn;
+    Timestamp timestamp;
+    // validated at isolation if set, else at the store's own level
+    bool isolated;
+    Isolation isolation;
+    // a read-only transaction, whose reads are validated at timestamp
+    // (its snapshot) and recorded as in CommitReads; it is not held
+    // prepared
+    bool readOnly;
+    int status;
+    Timestamp proposed;
+
+    PrepareRequest() : id(0), isolated(false),
+                       isolation(ISOLATION_SERIALIZABLE), readOnly(false),
+                       status(0) { };
+};
 
 class TxnStore
 {
@@ -53,25 +86,123 @@ public:
     virtual int Get(uint64_t id, const std::string &key,
         const Timestamp &timestamp, std::pair<Timestamp, std::string> &value);
 
+    // as above, along with what a write of key has to commit above so
+    // as not to be told to retry: the key's latest read (or scan over
+    // it) and its latest prepared write, if any
+    virtual int GetWithHints(uint64_t id, const std::string &key,
+        std::pair<Timestamp, std::string> &value,
+        Timestamp &lastRead, Timestamp &pendingWrite);
+
+    // read key in a read-only snapshot at timestamp; retry while a
+    // write below timestamp is still pending
+    virtual int GetSnapshot(uint64_t id, const std::string &key,
+        const Timestamp &timestamp, std::pair<Timestamp, std::string> &value);
+
+    // read the latest versions of up to limit keys in [start, end)
+    // (all of them if limit is 0); an empty end is unbounded
+    virtual int Scan(uint64_t id, const std::string &start,
+        const std::string &end, size_t limit, KeyValues &values);
+
     // add key to write set
     virtual int Put(uint64_t id, const std::string &key,
         const std::string &value);
 
+    // add a delete of key to write set
+    virtual int Delete(uint64_t id, const std::string &key);
+
     // check whether we can commit this transaction (and lock the read/write set)
     virtual int Prepare(uint64_t id, const Transaction &txn);
 
     virtual int Prepare(uint64_t id, const Transaction &txn,
         const Timestamp &timestamp, Timestamp &proposed);
 
+    // as above, over a transaction still in its wire format
+    virtual int Prepare(uint64_t id, const TransactionView &txn,
+        const Timestamp &timestamp, Timestamp &proposed);
+
+    // as above, at the given isolation level rather than the store's
+    virtual int Prepare(uint64_t id, const TransactionView &txn,
+        const Timestamp &timestamp, Isolation isolation, Timestamp &proposed);
+
+    // prepare the transactions of batch, setting the status (and any
+    // proposed timestamp) of each
+    virtual void PrepareBatch(std::vector<PrepareRequest> &batch);
+
+    // prepare the transaction of request, then call done once its
+    // status is set; done may run before this returns, or later on
+    // another thread, and request must outlive it
+    virtual void PrepareAsync(PrepareRequest &request,
+        std::function<void ()> done);
+
+    // run op on the store holding key, alone; op may run before this
+    // returns, or later on another thread
+    virtual void ForKey(const std::string &key,
+        std::function<void (TxnStore &)> op);
+
     // commit the transaction
     virtual void Commit(uint64_t id, uint64_t timestamp = 0);
 
+    // commit the transaction, then call done once its commit is in the
+    // log, if there is one; done may run before this returns, or later
+    // on another thread
+    virtual void CommitAsync(uint64_t id, uint64_t timestamp,
+        std::function<void ()> done);
+
+    // record the reads of a read-only transaction at timestamp, its
+    // snapshot, unless a write of a key read was committed or is
+    // prepared between the version read and timestamp
+    virtual int CommitReads(uint64_t id, const TransactionView &txn,
+        const Timestamp &timestamp);
+
     // abort a running transaction
     virtual void Abort(uint64_t id, const Transaction &txn = Transaction());
 
     // load keys
     virtual void Load(const std::string &key, const std::string &value,
         const Timestamp &timestamp);
+
+    // load a batch of keys, all at timestamp; returns once they are in
+    virtual void LoadBatch(
+        const std::vector<std::pair<std::string, std::string>> &values,
+        const Timestamp &timestamp);
+
+    // make room for about n more keys ahead of loading them
+    virtual void Reserve(size_t n);
+
+    // garbage collect state older than horizon, a slice at a time
+    virtual void GC(const Timestamp &horizon, size_t slice);
+
+    // drop keys that expired before horizon, a slice at a time
+    virtual void Expire(const Timestamp &horizon, size_t slice);
+
+    // redo the commits in log, then log commits to it from now on
+    virtual void Recover(WriteAheadLog *log);
+    virtual void SetLog(WriteAheadLog *log);
+
+    // keep values in a log-structured engine under dir, with a cache
+    // of cacheBytes, instead of in memory
+    virtual bool OpenEngine(const std::string &dir, size_t cacheBytes);
+
+    // move versions out of memory into history under dir, and move
+    // those replaced before horizon, a slice of keys at a time
+    virtual bool OpenHistory(const std::string &dir);
+    virtual void Tier(const Timestamp &horizon, size_t slice);
+
+    // start from the checkpoint at path, or write one there
+    virtual bool LoadCheckpoint(const std::string &path);
+    virtual bool WriteCheckpoint(const std::string &path, bool history);
+
+    // stop preparing at or below bound; returns the closed timestamp,
+    // below which nothing is left prepared and nothing new prepares
+    virtual Timestamp Close(const Timestamp &bound);
+
+    // number of transactions prepared and not yet decided
+    virtual size_t PreparedCount();
+
+    // keys prepares conflicted on most, and conflicts in all, since
+    // the last reset
+    virtual void Contention(std::vector<ContentionEntry> &top,
+                            uint64_t &total, bool reset);
 };
 
 #endif /* _TXN_STORE_H_ */
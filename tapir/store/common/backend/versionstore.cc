@@ -29,30 +29,590 @@
  **********************************************************************/
 
 #include "tapir/store/common/backend/versionstore.h"
+#include "tapir/store/common/backend/checkpoint.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include <string.h>
 
 using namespace std;
 
-VersionedKVStore::VersionedKVStore() { }
+VersionedKVStore::VersionedKVStore()
+    : gcCursor(0), wheel(EXPIRY_WHEEL_SLOTS), wheelSecond(0),
+      checkpoint(NULL), engine(NULL), history(NULL), tierCursor(0) { }
     
-VersionedKVStore::~VersionedKVStore() { }
+VersionedKVStore::~VersionedKVStore()
+{
+    delete checkpoint;
+}
+
+keyid_t
+VersionedKVStore::intern(const string &key)
+{
+    keyid_t id;
+    size_t i;
+    bool fresh = checkpoint != NULL && !keys.find(key, id) &&
+        checkpoint->find(key, i) && !faulted[i];
+
+    id = keys.intern(key);
+    if (id >= store.size()) {
+        store.resize(id + 1);
+    }
+    if (fresh) {
+        fault(i, id);
+    }
+    return id;
+}
+
+void
+VersionedKVStore::reserve(size_t n)
+{
+    keys.reserve(n);
+    store.reserve(n);
+}
+
+void
+VersionedKVStore::setEngine(StorageEngine *engine)
+{
+    ASSERT(this->engine == NULL);
+    this->engine = engine;
+    for (auto &chain : store) {
+        for (auto &v : chain) {
+            stash(v);
+        }
+    }
+}
+
+/* Hands the value of a version to the engine, if there is one. Empty
+ * values, as of deletes, stay. */
+void
+VersionedKVStore::stash(VersionedValue &v)
+{
+    if (engine != NULL && v.ref == 0 && !v.value.empty()) {
+        v.ref = engine->put(v.value);
+        std::string().swap(v.value);
+    }
+}
+
+/* Reads the value of a copy of a version back in. */
+void
+VersionedKVStore::unstash(VersionedValue &v) const
+{
+    if (v.ref != 0) {
+        engine->get(v.ref, v.value);
+        v.ref = 0;
+    }
+}
+
+void
+VersionedKVStore::release(VersionedValue &v)
+{
+    if (v.ref != 0) {
+        engine->release(v.ref);
+        v.ref = 0;
+    }
+}
+
+void
+VersionedKVStore::setHistory(StorageEngine *history)
+{
+    ASSERT(this->history == NULL);
+    this->history = history;
+}
 
 bool
-VersionedKVStore::inStore(const string &key)
+VersionedKVStore::hasHistory(keyid_t key) const
+{
+    return key < spilled.size() && spilled[key] != 0;
+}
+
+/*
+ * A key's history is one value:
+ *
+ *   count | count x (time, lastRead, op, expires, length, value bytes)
+ *
+ * with versions oldest first and integers in host order.
+ */
+void
+VersionedKVStore::readHistory(keyid_t key, VersionChain &chain) const
 {
-    return store.find(key) != store.end() && store[key].size() > 0;
+    string buf;
+    history->get(spilled[key], buf);
+    const char *p = buf.data();
+    auto take = [&](void *to, size_t n) {
+        memcpy(to, p, n);
+        p += n;
+    };
+
+    uint32_t count;
+    take(&count, sizeof(count));
+    chain.reserve(chain.size() + count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t f[6];
+        uint32_t length;
+        take(f, sizeof(f));
+        take(&length, sizeof(length));
+        VersionedValue v(Timestamp(f[0], f[1]), string(p, length), f[4]);
+        v.lastRead = Timestamp(f[2], f[3]);
+        v.expires = f[5];
+        p += length;
+        chain.push_back(std::move(v));
+    }
 }
 
 void
-VersionedKVStore::getValue(const string &key, const Timestamp &t, set<VersionedValue>::iterator &it)
+VersionedKVStore::dropHistory(keyid_t key)
 {
-    VersionedValue v(t);
-    it = store[key].upper_bound(v);
+    if (hasHistory(key)) {
+        history->release(spilled[key]);
+        spilled[key] = 0;
+    }
+}
 
-    // if there is no valid version at this timestamp
-    if (it == store[key].begin()) {
-        it = store[key].end();
+/* Moves the history of key back into its chain. */
+void
+VersionedKVStore::unspill(keyid_t key)
+{
+    VersionChain chain;
+    readHistory(key, chain);
+    dropHistory(key);
+    for (auto &v : chain) {
+        stash(v);
+    }
+    VersionChain &current = store[key];
+    chain.insert(chain.end(), std::make_move_iterator(current.begin()),
+                 std::make_move_iterator(current.end()));
+    current.swap(chain);
+}
+
+/*
+ * Moves the oldest versions of key to its history: those replaced
+ * before horizon, up to the first one read at or after it. The
+ * history is rewritten as a whole, leaving out versions below the one
+ * valid at floor.
+ */
+size_t
+VersionedKVStore::spill(keyid_t key, const Timestamp &horizon,
+                        const Timestamp &floor)
+{
+    VersionChain &chain = store[key];
+    auto keep = upper_bound(chain.begin(), chain.end(), VersionedValue(horizon));
+    if (keep == chain.begin()) {
+        return 0;
+    }
+    --keep;
+    auto end = chain.begin();
+    while (end != keep && end->lastRead < horizon) {
+        end++;
+    }
+    if (end == chain.begin()) {
+        return 0;
+    }
+    size_t moved = end - chain.begin();
+
+    VersionChain old;
+    if (hasHistory(key)) {
+        readHistory(key, old);
+        dropHistory(key);
+    }
+    for (auto it = chain.begin(); it != end; it++) {
+        VersionedValue v = *it;
+        unstash(v);
+        release(*it);
+        old.push_back(std::move(v));
+    }
+    chain.erase(chain.begin(), end);
+    if (chain.capacity() > 2 * chain.size()) {
+        chain.shrink_to_fit();
+    }
+
+    if (chain.front().time <= floor) {
+        old.clear();
     } else {
-        it--;
+        auto f = upper_bound(old.begin(), old.end(), VersionedValue(floor));
+        if (f != old.begin()) {
+            old.erase(old.begin(), f - 1);
+        }
+    }
+    if (old.empty()) {
+        return moved;
+    }
+
+    string buf;
+    auto put = [&](const void *from, size_t n) {
+        buf.append((const char *)from, n);
+    };
+    uint32_t count = old.size();
+    put(&count, sizeof(count));
+    for (auto &v : old) {
+        uint64_t f[6] = { v.time.getTimestamp(), v.time.getID(),
+                          v.lastRead.getTimestamp(), v.lastRead.getID(),
+                          v.op, v.expires };
+        uint32_t length = v.value.size();
+        put(f, sizeof(f));
+        put(&length, sizeof(length));
+        put(v.value.data(), length);
+    }
+    if (key >= spilled.size()) {
+        spilled.resize(store.size());
+    }
+    spilled[key] = history->put(buf);
+    return moved;
+}
+
+size_t
+VersionedKVStore::tier(const Timestamp &horizon, const Timestamp &floor,
+                       size_t maxKeys)
+{
+    ASSERT(history != NULL);
+    size_t moved = 0;
+    for (size_t n = 0; n < maxKeys && n < store.size(); n++) {
+        if (tierCursor >= store.size()) {
+            tierCursor = 0;
+        }
+        keyid_t key = tierCursor++;
+        if (store[key].size() > 1) {
+            moved += spill(key, horizon, floor);
+        }
+    }
+    return moved;
+}
+
+bool
+VersionedKVStore::lookup(const string &key, keyid_t &id)
+{
+    return find(key, id);
+}
+
+/* Finds the id of key, reading it in from the checkpoint if it is
+ * there and has not been read in yet. */
+bool
+VersionedKVStore::find(const string &key, keyid_t &id)
+{
+    if (keys.find(key, id)) {
+        return true;
+    }
+    size_t i;
+    if (checkpoint != NULL && checkpoint->find(key, i) && !faulted[i]) {
+        id = intern(key);
+        return true;
+    }
+    return false;
+}
+
+/* Reads in the versions of the i-th checkpoint key as key id. */
+void
+VersionedKVStore::fault(size_t i, keyid_t id)
+{
+    ASSERT(store[id].empty());
+    faulted[i] = true;
+    checkpoint->versions(i, store[id]);
+
+    for (auto &v : store[id]) {
+        stash(v);
+        if (v.expires != 0) {
+            uint64_t second = max(v.expires >> 32, wheelSecond);
+            wheel[second % EXPIRY_WHEEL_SLOTS].push_back(make_pair(v.expires, id));
+        }
+    }
+}
+
+/* Reads in the checkpoint keys in a range, up to the one that makes
+ * limit keys in the range live at now (all of them if limit is 0). */
+void
+VersionedKVStore::faultRange(const string &start, const string &end,
+                             size_t limit, const Timestamp &now)
+{
+    if (checkpoint == NULL) {
+        return;
+    }
+
+    size_t live = 0;
+    for (size_t i = checkpoint->seek(start); i < checkpoint->size(); i++) {
+        string key = checkpoint->key(i);
+        if (!inRange(key, start, end)) {
+            break;
+        }
+        keyid_t id;
+        if (!faulted[i]) {
+            id = intern(key);
+        } else if (!keys.find(key, id)) {
+            // read in and since dropped
+            continue;
+        }
+        const VersionChain *chain = getChain(id);
+        if (limit > 0 && chain != NULL && !chain->back().deleted() &&
+            !chain->back().expired(now) && ++live == limit) {
+            break;
+        }
+    }
+}
+
+bool
+VersionedKVStore::loadCheckpoint(const string &path, Timestamp &floor)
+{
+    if (checkpoint != NULL || keys.size() > 0) {
+        Warning("Checkpoint %s loaded into a non-empty store", path.c_str());
+        return false;
+    }
+
+    checkpoint = new Checkpoint();
+    if (!checkpoint->open(path)) {
+        delete checkpoint;
+        checkpoint = NULL;
+        return false;
+    }
+    faulted.assign(checkpoint->size(), false);
+    floor = checkpoint->floor();
+    return true;
+}
+
+bool
+VersionedKVStore::writeCheckpoint(const string &path, bool history) const
+{
+    Checkpoint::Writer writer;
+    if (!writer.open(path)) {
+        return false;
+    }
+
+    // without history, reads below the newest version left out would
+    // miss it
+    Timestamp floor = (checkpoint != NULL) ? checkpoint->floor() : Timestamp();
+    auto add = [&](const string &key, const VersionChain &chain) {
+        if (chain.empty()) {
+            return;
+        }
+        if (history) {
+            if (engine != NULL) {
+                VersionChain values(chain);
+                for (auto &v : values) {
+                    unstash(v);
+                }
+                writer.add(key, values.begin(), values.end());
+            } else {
+                writer.add(key, chain.begin(), chain.end());
+            }
+            return;
+        }
+        if (chain.size() > 1 || chain.back().deleted()) {
+            const Timestamp &t = chain.back().time;
+            if (t > floor) {
+                floor = t;
+            }
+        }
+        if (!chain.back().deleted()) {
+            VersionChain latest(1, chain.back());
+            unstash(latest.back());
+            writer.add(key, latest.begin(), latest.end());
+        }
+    };
+
+    // merge the interned keys with the checkpoint keys not read in
+    size_t i = 0, n = (checkpoint != NULL) ? checkpoint->size() : 0;
+    for (auto it = keys.seek(""); it != keys.end(); it++) {
+        for ( ; i < n && checkpoint->key(i) < *it->first; i++) {
+            if (!faulted[i]) {
+                VersionChain chain;
+                checkpoint->versions(i, chain);
+                add(checkpoint->key(i), chain);
+            }
+        }
+        // along with its history, from the oldest timestamp
+        const VersionChain *chain = getChain(it->second, Timestamp());
+        if (chain != NULL) {
+            add(*it->first, *chain);
+        }
+    }
+    for ( ; i < n; i++) {
+        if (!faulted[i]) {
+            VersionChain chain;
+            checkpoint->versions(i, chain);
+            add(checkpoint->key(i), chain);
+        }
+    }
+
+    writer.setFloor(floor);
+    return writer.close();
+}
+
+const string &
+VersionedKVStore::key(keyid_t id) const
+{
+    return keys.key(id);
+}
+
+bool
+VersionedKVStore::inRange(const string &key, const string &start,
+                          const string &end)
+{
+    return key >= start && (end.empty() || key < end);
+}
+
+void
+VersionedKVStore::keysInRange(const string &start, const string &end,
+                              vector<keyid_t> &ids)
+{
+    faultRange(start, end, 0, Timestamp());
+    for (auto it = keys.seek(start);
+         it != keys.end() && inRange(*it->first, start, end); it++) {
+        ids.push_back(it->second);
+    }
+}
+
+void
+VersionedKVStore::scan(const string &start, const string &end, size_t limit,
+                       vector<keyid_t> &ids, const Timestamp &now)
+{
+    faultRange(start, end, limit, now);
+    for (auto it = keys.seek(start);
+         it != keys.end() && inRange(*it->first, start, end); it++) {
+        if (limit > 0 && ids.size() == limit) {
+            break;
+        }
+        const VersionChain *chain = getChain(it->second);
+        if (chain != NULL && !chain->back().deleted() &&
+            !chain->back().expired(now)) {
+            ids.push_back(it->second);
+        }
+    }
+}
+
+/* Split the committed scan range containing key, if any, so that a
+ * range starts at key. */
+void
+VersionedKVStore::splitScan(const string &key)
+{
+    auto it = scans.upper_bound(key);
+    if (it == scans.begin()) {
+        return;
+    }
+    --it;
+    if (it->first < key && inRange(key, it->first, it->second.first)) {
+        scans[key] = it->second;
+        it->second.first = key;
+    }
+}
+
+/*
+ * Commit a scan of [start, end) by raising the last read timestamp of
+ * every part of the range to commit; the parts no earlier scan covered
+ * become new ranges.
+ */
+void
+VersionedKVStore::commitScan(const string &start, const string &end,
+                             const Timestamp &commit)
+{
+    splitScan(start);
+    if (!end.empty()) {
+        splitScan(end);
+    }
+
+    // the ranges inside [start, end) are now whole; fill the gaps
+    // between them
+    string next = start;
+    auto it = scans.lower_bound(start);
+    while (it != scans.end() && inRange(it->first, start, end)) {
+        if (next < it->first) {
+            scans.insert(it, make_pair(next, make_pair(it->first, commit)));
+        }
+        if (it->second.second < commit) {
+            it->second.second = commit;
+        }
+        next = it->second.first;
+        if (next.empty()) {
+            return;
+        }
+        it++;
+    }
+    if (end.empty() || next < end) {
+        scans[next] = make_pair(end, commit);
+    }
+}
+
+bool
+VersionedKVStore::getLastScan(const string &key, Timestamp &lastRead) const
+{
+    lastRead = scanFloor;
+
+    auto it = scans.upper_bound(key);
+    if (it != scans.begin()) {
+        --it;
+        if (inRange(key, it->first, it->second.first) &&
+            it->second.second > lastRead) {
+            lastRead = it->second.second;
+        }
+    }
+    return lastRead != Timestamp();
+}
+
+/* Returns the version chain for key, or NULL if there is no version
+ * of it. */
+const VersionedKVStore::VersionChain *
+VersionedKVStore::getChain(keyid_t key) const
+{
+    if (key >= store.size() || store[key].empty()) {
+        return NULL;
+    }
+    return &store[key];
+}
+
+/* As above, but with the versions in history too if t is older than
+ * the chain in memory. */
+const VersionedKVStore::VersionChain *
+VersionedKVStore::getChain(keyid_t key, const Timestamp &t) const
+{
+    const VersionChain *chain = getChain(key);
+    if (chain == NULL || !hasHistory(key) || !(t < chain->front().time)) {
+        return chain;
+    }
+    scratch.clear();
+    readHistory(key, scratch);
+    scratch.insert(scratch.end(), chain->begin(), chain->end());
+    return &scratch;
+}
+
+bool
+VersionedKVStore::inStore(keyid_t key)
+{
+    return getChain(key) != NULL;
+}
+
+/* Returns the version valid at timestamp t, or chain.end() if there is
+ * none. */
+VersionedKVStore::VersionChain::const_iterator
+VersionedKVStore::getValue(const VersionChain &chain, const Timestamp &t)
+{
+    auto it = upper_bound(chain.begin(), chain.end(), VersionedValue(t));
+
+    // if there is no valid version at this timestamp
+    if (it == chain.begin()) {
+        return chain.end();
+    }
+    return --it;
+}
+
+/* Insert a version, keeping the chain sorted. Commits mostly arrive in
+ * timestamp order, so this is usually an append. */
+void
+VersionedKVStore::insert(keyid_t key, VersionedValue v)
+{
+    VersionChain &chain = store[key];
+    if (hasHistory(key) && v < chain.front()) {
+        // older than the chain in memory
+        unspill(key);
+    }
+    if (chain.empty() || chain.back() < v) {
+        stash(v);
+        chain.push_back(std::move(v));
+        return;
+    }
+
+    auto it = lower_bound(chain.begin(), chain.end(), v);
+    // versions are unique by timestamp; ignore a duplicate
+    if (it->time != v.time) {
+        stash(v);
+        chain.insert(it, std::move(v));
     }
 }
 
@@ -60,11 +620,13 @@ VersionedKVStore::getValue(const string &key, const Timestamp &t, set<VersionedV
 /* Returns the most recent value and timestamp for given key.
  * Error if key does not exist. */
 bool
-VersionedKVStore::get(const string &key, VersionedValue &value)
+VersionedKVStore::get(keyid_t key, VersionedValue &value)
 {
     // check for existence of key in store
-    if (inStore(key)) {
-        value = *(store[key].rbegin());
+    const VersionChain *chain = getChain(key);
+    if (chain != NULL) {
+        value = chain->back();
+        unstash(value);
         return true;
     }
     return false;
@@ -73,31 +635,61 @@ VersionedKVStore::get(const string &key, VersionedValue &value)
 /* Returns the value valid at given timestamp.
  * Error if key did not exist at the timestamp. */
 bool
-VersionedKVStore::get(const string &key, const Timestamp &t, VersionedValue &value)
+VersionedKVStore::get(keyid_t key, const Timestamp &t, VersionedValue &value)
 {
-    if (inStore(key)) {
-        set<VersionedValue>::iterator it;
-        getValue(key, t, it);
-        if (it != store[key].end()) {
+    const VersionChain *chain = getChain(key, t);
+    if (chain != NULL) {
+        auto it = getValue(*chain, t);
+        if (it != chain->end()) {
 			value = *it;
+            unstash(value);
             return true;
         }
     }
     return false;
 }
 
+const VersionedValue *
+VersionedKVStore::peek(keyid_t key) const
+{
+    const VersionChain *chain = getChain(key);
+    return (chain != NULL) ? &chain->back() : NULL;
+}
+
+const VersionedValue *
+VersionedKVStore::peek(keyid_t key, const Timestamp &t) const
+{
+    const VersionChain *chain = getChain(key, t);
+    if (chain != NULL) {
+        auto it = getValue(*chain, t);
+        if (it != chain->end()) {
+            return &*it;
+        }
+    }
+    return NULL;
+}
+
 bool
-VersionedKVStore::getRange(const string &key, const Timestamp &t,
+VersionedKVStore::getRange(keyid_t key, const Timestamp &t,
 			   pair<Timestamp, Timestamp> &range)
 {
-    if (inStore(key)) {
-        set<VersionedValue>::iterator it;
-        getValue(key, t, it);
+    uint64_t expires;
+    return getRange(key, t, range, expires);
+}
 
-        if (it != store[key].end()) {
+bool
+VersionedKVStore::getRange(keyid_t key, const Timestamp &t,
+                           pair<Timestamp, Timestamp> &range, uint64_t &expires)
+{
+    const VersionChain *chain = getChain(key, t);
+    if (chain != NULL) {
+        auto it = getValue(*chain, t);
+
+        if (it != chain->end()) {
+            expires = (*it).expires;
             range.first = (*it).time;
             it++;
-            if (it != store[key].end()) {
+            if (it != chain->end()) {
                 range.second = (*it).time;
             }
             return true;
@@ -106,20 +698,77 @@ VersionedKVStore::getRange(const string &key, const Timestamp &t,
     return false;
 }
 
+/*
+ * Returns the versions of key starting from the one valid at timestamp
+ * t, oldest first.
+ */
+bool
+VersionedKVStore::getVersions(keyid_t key, const Timestamp &t,
+                              VersionChain::const_iterator &begin,
+                              VersionChain::const_iterator &end)
+{
+    const VersionChain *chain = getChain(key, t);
+    if (chain != NULL) {
+        begin = getValue(*chain, t);
+        end = chain->end();
+        return begin != end;
+    }
+    return false;
+}
+
+/*
+ * Returns the versions of key committed after timestamp t, oldest first.
+ */
+bool
+VersionedKVStore::getVersionsAfter(keyid_t key, const Timestamp &t,
+                                   VersionChain::const_iterator &begin,
+                                   VersionChain::const_iterator &end)
+{
+    const VersionChain *chain = getChain(key, t);
+    if (chain != NULL) {
+        begin = upper_bound(chain->begin(), chain->end(), VersionedValue(t));
+        end = chain->end();
+        return begin != end;
+    }
+    return false;
+}
+
 void
-VersionedKVStore::put(const string &key, const string &value, const Timestamp &t)
+VersionedKVStore::put(keyid_t key, const string &value, const Timestamp &t,
+                      uint64_t expires)
 {
-    // Key does not exist. Create a list and an entry.
-    store[key].insert(VersionedValue(t, value));
+    ASSERT(key < store.size());
+    VersionedValue v(t, value);
+    v.expires = expires;
+    insert(key, v);
+
+    if (expires != 0) {
+        // already expired ones go in the next slot to be expired
+        uint64_t second = max(expires >> 32, wheelSecond);
+        wheel[second % EXPIRY_WHEEL_SLOTS].push_back(make_pair(expires, key));
+    }
 }
 
 void
-VersionedKVStore::increment(const std::string &key, const Increment inc, const Timestamp &t)
+VersionedKVStore::remove(keyid_t key, const Timestamp &t)
 {
+    ASSERT(key < store.size());
+    insert(key, VersionedValue(t, "", TOMBSTONE));
+}
+
+void
+VersionedKVStore::increment(keyid_t key, const Increment inc, const Timestamp &t)
+{
+	ASSERT(key < store.size());
+	VersionChain &chain = store[key];
 	VersionedValue val;
-	get(key, val);
+	// a deleted or expired key starts over from the empty value
+	if (!chain.empty() && !chain.back().deleted() && !chain.back().expired(t)) {
+		val = chain.back();
+		unstash(val);
+	}
 	inc.apply(val.value);
-	store[key].insert(VersionedValue(t, val.value, inc.op));
+	insert(key, VersionedValue(t, val.value, inc.op));
 }
 
 
@@ -128,33 +777,36 @@ VersionedKVStore::increment(const std::string &key, const Increment inc, const T
  * the version of the key that the txn read.
  */
 void
-VersionedKVStore::commitGet(const string &key, const Timestamp &readTime, const Timestamp &commit)
+VersionedKVStore::commitGet(keyid_t key, const Timestamp &readTime, const Timestamp &commit)
 {
     // Hmm ... could read a key we don't have if we are behind ... do we commit this or wait for the log update?
-    if (inStore(key)) {
-        set<VersionedValue>::iterator it;
-        getValue(key, readTime, it);
+    if (key < store.size() && !store[key].empty()) {
+        VersionChain &chain = store[key];
+        if (hasHistory(key) && readTime < chain.front().time) {
+            // the version read is in history; it is read recently
+            // enough to be back in memory
+            unspill(key);
+        }
+        auto it = upper_bound(chain.begin(), chain.end(), VersionedValue(readTime));
         
-        if (it != store[key].end()) {
-            // figure out if anyone has read this version before
-            if (lastReads.find(key) != lastReads.end() &&
-                lastReads[key].find((*it).time) != lastReads[key].end()) {
-                if (lastReads[key][(*it).time] < commit) {
-                    lastReads[key][(*it).time] = commit;
-                }
+        if (it != chain.begin()) {
+            --it;
+            if (it->lastRead < commit) {
+                it->lastRead = commit;
             }
         }
     } // otherwise, ignore the read
 }
 
 bool
-VersionedKVStore::getLastRead(const string &key, Timestamp &lastRead)
+VersionedKVStore::getLastRead(keyid_t key, Timestamp &lastRead)
 {
-    if (inStore(key)) {
-        VersionedValue v = *(store[key].rbegin());
-        if (lastReads.find(key) != lastReads.end() &&
-            lastReads[key].find(v.time) != lastReads[key].end()) {
-            lastRead = lastReads[key][v.time];
+    const VersionChain *chain = getChain(key);
+    if (chain != NULL) {
+        const VersionedValue &v = chain->back();
+        // has anyone read this version before
+        if (v.lastRead != Timestamp()) {
+            lastRead = v.lastRead;
             return true;
         }
     }
@@ -165,19 +817,220 @@ VersionedKVStore::getLastRead(const string &key, Timestamp &lastRead)
  * Get the latest read for the time valid at timestamp t
  */
 bool
-VersionedKVStore::getLastRead(const string &key, const Timestamp &t, Timestamp &lastRead)
+VersionedKVStore::getLastRead(keyid_t key, const Timestamp &t, Timestamp &lastRead)
 {
-    if (inStore(key)) {
-        set<VersionedValue>::iterator it;
-        getValue(key, t, it);
-        ASSERT(it != store[key].end());
+    const VersionChain *chain = getChain(key, t);
+    if (chain != NULL) {
+        auto it = getValue(*chain, t);
 
         // figure out if anyone has read this version before
-        if (lastReads.find(key) != lastReads.end() &&
-            lastReads[key].find((*it).time) != lastReads[key].end()) {
-            lastRead = lastReads[key][(*it).time];
+        if (it != chain->end() && (*it).lastRead != Timestamp()) {
+            lastRead = (*it).lastRead;
             return true;
         }
     }
     return false;	
 }
+
+/*
+ * String-keyed versions of the above, for callers that have not
+ * interned their keys.
+ */
+bool
+VersionedKVStore::inStore(const string &key)
+{
+    keyid_t id;
+    return find(key, id) && inStore(id);
+}
+
+bool
+VersionedKVStore::get(const string &key, VersionedValue &value)
+{
+    keyid_t id;
+    return find(key, id) && get(id, value);
+}
+
+bool
+VersionedKVStore::get(const string &key, const Timestamp &t, VersionedValue &value)
+{
+    keyid_t id;
+    return find(key, id) && get(id, t, value);
+}
+
+bool
+VersionedKVStore::getRange(const string &key, const Timestamp &t,
+                           pair<Timestamp, Timestamp> &range)
+{
+    keyid_t id;
+    return find(key, id) && getRange(id, t, range);
+}
+
+bool
+VersionedKVStore::getLastRead(const string &key, Timestamp &lastRead)
+{
+    keyid_t id;
+    return find(key, id) && getLastRead(id, lastRead);
+}
+
+bool
+VersionedKVStore::getLastRead(const string &key, const Timestamp &t, Timestamp &lastRead)
+{
+    keyid_t id;
+    return find(key, id) && getLastRead(id, t, lastRead);
+}
+
+void
+VersionedKVStore::put(const string &key, const string &value, const Timestamp &t,
+                      uint64_t expires)
+{
+    put(intern(key), value, t, expires);
+}
+
+void
+VersionedKVStore::remove(const string &key, const Timestamp &t)
+{
+    remove(intern(key), t);
+}
+
+void
+VersionedKVStore::increment(const string &key, const Increment inc, const Timestamp &t)
+{
+    increment(intern(key), inc, t);
+}
+
+void
+VersionedKVStore::commitGet(const string &key, const Timestamp &readTime, const Timestamp &commit)
+{
+    keyid_t id;
+    if (find(key, id)) {
+        commitGet(id, readTime, commit);
+    }
+}
+
+/*
+ * Garbage collect versions that are no longer visible at or after the
+ * safe timestamp: for each key, everything older than the version
+ * valid at safe is dropped (along with its last read). Visits at most
+ * maxKeys keys, resuming where the previous call stopped, and returns
+ * the number of versions reclaimed.
+ */
+size_t
+VersionedKVStore::gc(const Timestamp &safe, size_t maxKeys,
+                     const function<bool (keyid_t)> &pinned)
+{
+    size_t reclaimed = 0;
+
+    // fold scans older than the safe point into the floor
+    for (auto it = scans.begin(); it != scans.end(); ) {
+        if (it->second.second < safe) {
+            if (it->second.second > scanFloor) {
+                scanFloor = it->second.second;
+            }
+            it = scans.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    if (store.empty()) {
+        return 0;
+    }
+
+    for (size_t n = 0; n < maxKeys && n < store.size(); n++) {
+        if (gcCursor >= store.size()) {
+            gcCursor = 0;
+        }
+        reclaimed += collect(gcCursor++, safe, pinned);
+    }
+
+    return reclaimed;
+}
+
+/*
+ * Collect the versions of key older than the version valid at safe. A
+ * key left with only a tombstone or an expired version below safe,
+ * that nobody read at or after safe, is dropped altogether.
+ */
+size_t
+VersionedKVStore::collect(keyid_t key, const Timestamp &safe,
+                          const function<bool (keyid_t)> &pinned)
+{
+    size_t reclaimed = 0;
+    VersionChain &chain = store[key];
+
+    auto keep = upper_bound(chain.begin(), chain.end(), VersionedValue(safe));
+    if (keep == chain.begin()) {
+        return 0;
+    }
+    --keep;
+    // history is older still
+    if (hasHistory(key)) {
+        dropHistory(key);
+        reclaimed++;
+    }
+    if (keep != chain.begin()) {
+        for (auto it = chain.begin(); it != keep; it++) {
+            release(*it);
+        }
+        reclaimed += keep - chain.begin();
+        chain.erase(chain.begin(), keep);
+        if (chain.capacity() > 2 * chain.size()) {
+            chain.shrink_to_fit();
+        }
+    }
+
+    // what is left is the version valid at safe and newer ones
+    const VersionedValue &v = chain.front();
+    if (chain.size() == 1 && (v.deleted() || v.expired(safe)) &&
+        v.lastRead < safe && (!pinned || !pinned(key))) {
+        reclaimed++;
+        release(chain.front());
+        VersionChain().swap(chain);
+        keys.erase(key);
+    }
+    return reclaimed;
+}
+
+/*
+ * Turn the expiry wheel up to safe, collecting the keys whose versions
+ * expired in the seconds passed. Stops after the slot in which maxKeys
+ * entries have been visited, and returns the number of versions
+ * reclaimed.
+ */
+size_t
+VersionedKVStore::expire(const Timestamp &safe, size_t maxKeys,
+                         const function<bool (keyid_t)> &pinned)
+{
+    size_t reclaimed = 0, visited = 0;
+
+    // only whole seconds; the current one may still be filling up
+    uint64_t until = safe.getTimestamp() >> 32;
+    // a full turn of the wheel visits every slot
+    if (until > wheelSecond + EXPIRY_WHEEL_SLOTS) {
+        wheelSecond = until - EXPIRY_WHEEL_SLOTS;
+    }
+
+    for ( ; wheelSecond < until && visited < maxKeys; wheelSecond++) {
+        auto &slot = wheel[wheelSecond % EXPIRY_WHEEL_SLOTS];
+        for (size_t i = 0; i < slot.size(); ) {
+            if (slot[i].first > safe.getTimestamp()) {
+                // a later turn
+                i++;
+                continue;
+            }
+            // the key may have been rewritten or dropped since; then
+            // this only collects what gc would
+            if (slot[i].second < store.size()) {
+                reclaimed += collect(slot[i].second, safe, pinned);
+            }
+            slot[i] = slot.back();
+            slot.pop_back();
+            visited++;
+        }
+        if (slot.capacity() > 2 * slot.size()) {
+            slot.shrink_to_fit();
+        }
+    }
+
+    return reclaimed;
+}
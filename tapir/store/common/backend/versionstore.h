@@ -35,25 +35,44 @@
 #include "tapir/lib/message.h"
 #include "tapir/store/common/timestamp.h"
 #include "tapir/store/common/increment.h"
+#include "tapir/store/common/backend/keytable.h"
+#include "tapir/store/common/backend/engine.h"
 
-#include <set>
+#include <functional>
 #include <map>
-#include <unordered_map>
+#include <vector>
+
+class Checkpoint;
 
 #define WRITE 0
 #define INCREMENT 1
 #define APPEND 2
+// a delete; the key has no value from this version on
+#define TOMBSTONE 3
+
+// Slots in the expiry wheel, one per second.
+#define EXPIRY_WHEEL_SLOTS 1024
 
 struct VersionedValue {
 	Timestamp time;
+	// commit timestamp of the latest transaction that read this version
+	Timestamp lastRead;
 	std::string value;
 	uint64_t op;
+	// time (in commit timestamp units) the version expires at, 0 if never
+	uint64_t expires;
+	// where the storage engine keeps value, 0 if it is kept here
+	valueref_t ref;
 
-	VersionedValue() : time(Timestamp()), value("tmp"), op(WRITE) { };
-	VersionedValue(Timestamp commit) : time(commit), value("tmp"), op(WRITE) { };
-	VersionedValue(Timestamp commit, std::string val) : time(commit), value(val), op(WRITE) { };
-	VersionedValue(Timestamp commit, std::string val, int operation) : time(commit), value(val), op(operation) { };
+	VersionedValue() : time(Timestamp()), value("tmp"), op(WRITE), expires(0), ref(0) { };
+	VersionedValue(Timestamp commit) : time(commit), value("tmp"), op(WRITE), expires(0), ref(0) { };
+	VersionedValue(Timestamp commit, std::string val) : time(commit), value(val), op(WRITE), expires(0), ref(0) { };
+	VersionedValue(Timestamp commit, std::string val, int operation) : time(commit), value(val), op(operation), expires(0), ref(0) { };
 
+	bool deleted() const { return op == TOMBSTONE; };
+	bool expired(const Timestamp &t) const {
+		return expires != 0 && t.getTimestamp() >= expires;
+	};
 
 	friend bool operator> (const VersionedValue &v1, const VersionedValue &v2) {
 		return v1.time > v2.time;
@@ -66,23 +85,178 @@ struct VersionedValue {
 class VersionedKVStore
 {
 public:
+    // Versions of a single key, sorted by commit timestamp.
+    typedef std::vector<VersionedValue> VersionChain;
+
     VersionedKVStore();
     ~VersionedKVStore();
 
+    // Keys are interned to dense ids; the id-based calls below skip
+    // hashing the key string entirely.
+    keyid_t intern(const std::string &key);
+    bool lookup(const std::string &key, keyid_t &id);
+    const std::string &key(keyid_t id) const;
+    // Number of keys held, deleted ones included until gc drops them.
+    // Keys of a loaded checkpoint count once they have been read in.
+    size_t size() const { return keys.size(); };
+    // Makes room for n keys, ahead of a bulk load.
+    void reserve(size_t n);
+
+    // Keeps values in engine from now on, moving the ones held so far
+    // there too. The engine must outlive the store.
+    void setEngine(StorageEngine *engine);
+
+    // Lets tier() move old versions out of memory into history, which
+    // holds all the moved versions of a key as one value. Reads below
+    // the oldest version left in memory fetch them back. History must
+    // outlive the store.
+    void setHistory(StorageEngine *history);
+
+    // Maps a checkpoint into an empty store. Its keys are read in one
+    // at a time, the first time each is interned, looked up or falls
+    // in a range read. Versions valid below floor may be missing.
+    bool loadCheckpoint(const std::string &path, Timestamp &floor);
+    // Writes every key to a checkpoint at path: all of its versions if
+    // history is set, otherwise just the latest, leaving deleted keys
+    // out.
+    bool writeCheckpoint(const std::string &path, bool history) const;
+
+    // Key ranges are [start, end); an empty end is unbounded.
+    static bool inRange(const std::string &key, const std::string &start,
+                        const std::string &end);
+
+    // Ids of all interned keys in the range, in key order.
+    void keysInRange(const std::string &start, const std::string &end,
+                     std::vector<keyid_t> &ids);
+    // Ids of the first limit keys in the range whose latest version is
+    // not a delete, nor expired at now (all of them if limit is 0), in
+    // key order.
+    void scan(const std::string &start, const std::string &end,
+              size_t limit, std::vector<keyid_t> &ids,
+              const Timestamp &now = Timestamp());
+    // Record a committed scan of the range, like commitGet.
+    void commitScan(const std::string &start, const std::string &end,
+                    const Timestamp &commit);
+    // Commit timestamp of the latest scan covering key.
+    bool getLastScan(const std::string &key, Timestamp &lastRead) const;
+
     bool get(const std::string &key, VersionedValue &value);
     bool get(const std::string &key, const Timestamp &t, VersionedValue &value);
     bool getRange(const std::string &key, const Timestamp &t, std::pair<Timestamp, Timestamp> &range);
-	void getValue(const std::string &key, const Timestamp &t, std::set<VersionedValue>::iterator &it);
     bool getLastRead(const std::string &key, Timestamp &readTime);
     bool getLastRead(const std::string &key, const Timestamp &t, Timestamp &readTime);
-    void put(const std::string &key, const std::string &value, const Timestamp &t);
+    void put(const std::string &key, const std::string &value, const Timestamp &t,
+             uint64_t expires = 0);
+    void remove(const std::string &key, const Timestamp &t);
 	void increment(const std::string &key, const Increment inc, const Timestamp &t);
     void commitGet(const std::string &key, const Timestamp &readTime, const Timestamp &commit);
-
-    /* Global store which keeps key -> (timestamp, value) list. */
-    std::unordered_map< std::string, std::set<VersionedValue> > store;
-    std::unordered_map< std::string, std::map< Timestamp, Timestamp > > lastReads;
     bool inStore(const std::string &key);
+
+    bool get(keyid_t key, VersionedValue &value);
+    bool get(keyid_t key, const Timestamp &t, VersionedValue &value);
+    bool getRange(keyid_t key, const Timestamp &t, std::pair<Timestamp, Timestamp> &range);
+    // The latest version, or the one valid at t, without reading its
+    // value in from the engine; NULL if there is none. A version from
+    // history is only good until the next call.
+    const VersionedValue *peek(keyid_t key) const;
+    const VersionedValue *peek(keyid_t key, const Timestamp &t) const;
+    // As above, along with when the version expires (0 if never).
+    bool getRange(keyid_t key, const Timestamp &t, std::pair<Timestamp, Timestamp> &range,
+                  uint64_t &expires);
+    // The versions returned here and by getVersionsAfter carry no
+    // value if there is an engine and, like peek(), may come from
+    // history.
+    bool getVersions(keyid_t key, const Timestamp &t,
+                     VersionChain::const_iterator &begin,
+                     VersionChain::const_iterator &end);
+    bool getVersionsAfter(keyid_t key, const Timestamp &t,
+                          VersionChain::const_iterator &begin,
+                          VersionChain::const_iterator &end);
+    bool getLastRead(keyid_t key, Timestamp &readTime);
+    bool getLastRead(keyid_t key, const Timestamp &t, Timestamp &readTime);
+    // A version with a non-zero expires disappears at that time; the
+    // expiry wheel picks it up once it has.
+    void put(keyid_t key, const std::string &value, const Timestamp &t,
+             uint64_t expires = 0);
+    // Deletes key at t by adding a tombstone version; get() returns
+    // tombstones like any other version.
+    void remove(keyid_t key, const Timestamp &t);
+	void increment(keyid_t key, const Increment inc, const Timestamp &t);
+    void commitGet(keyid_t key, const Timestamp &readTime, const Timestamp &commit);
+    bool inStore(keyid_t key);
+
+    // Keys for which pinned returns true are never dropped, as the
+    // caller still refers to them by id.
+    size_t gc(const Timestamp &safe, size_t maxKeys,
+              const std::function<bool (keyid_t)> &pinned =
+                  std::function<bool (keyid_t)>());
+    // Moves to history the versions of up to maxKeys keys, resuming
+    // where the previous call stopped, that were replaced before
+    // horizon and not read at or after it; those gc would drop below
+    // floor are dropped instead. Returns the number of versions moved.
+    size_t tier(const Timestamp &horizon, const Timestamp &floor,
+                size_t maxKeys);
+    // Like gc, but only for keys with a version that expired by safe,
+    // as found on the expiry wheel.
+    size_t expire(const Timestamp &safe, size_t maxKeys,
+                  const std::function<bool (keyid_t)> &pinned =
+                      std::function<bool (keyid_t)>());
+
+private:
+    KeyTable keys;
+
+    /* Global store which keeps key id -> (timestamp, value) list. */
+    std::vector<VersionChain> store;
+
+    // Key id at which the next gc() slice resumes.
+    keyid_t gcCursor;
+
+    // Expiry wheel: (expiry time, key id) in the slot of the second it
+    // expires in; entries a turn or more ahead wait in the same slot.
+    // Seconds before wheelSecond have been expired.
+    std::vector<std::vector<std::pair<uint64_t, keyid_t>>> wheel;
+    uint64_t wheelSecond;
+
+    // Committed scans, as disjoint ranges: start -> (end, commit
+    // timestamp of the latest scan of the range). Ranges last read
+    // below the gc safe point are folded into scanFloor.
+    std::map<std::string, std::pair<std::string, Timestamp>> scans;
+    Timestamp scanFloor;
+
+    // Loaded checkpoint, and which of its keys have been read in; a
+    // key read in and then dropped is not read in again.
+    Checkpoint *checkpoint;
+    std::vector<bool> faulted;
+
+    StorageEngine *engine;
+
+    // History of each key, by key id (0 if none); it holds versions
+    // older than any in the key's chain.
+    StorageEngine *history;
+    std::vector<valueref_t> spilled;
+    keyid_t tierCursor;
+    // a chain read back in from history
+    mutable VersionChain scratch;
+
+    const VersionChain *getChain(keyid_t key) const;
+    const VersionChain *getChain(keyid_t key, const Timestamp &t) const;
+    bool hasHistory(keyid_t key) const;
+    void readHistory(keyid_t key, VersionChain &chain) const;
+    void dropHistory(keyid_t key);
+    void unspill(keyid_t key);
+    size_t spill(keyid_t key, const Timestamp &horizon, const Timestamp &floor);
+    static VersionChain::const_iterator getValue(const VersionChain &chain, const Timestamp &t);
+    void insert(keyid_t key, VersionedValue v);
+    void stash(VersionedValue &v);
+    void unstash(VersionedValue &v) const;
+    void release(VersionedValue &v);
+    size_t collect(keyid_t key, const Timestamp &safe,
+                   const std::function<bool (keyid_t)> &pinned);
+    void splitScan(const std::string &key);
+    bool find(const std::string &key, keyid_t &id);
+    void fault(size_t i, keyid_t id);
+    void faultRange(const std::string &start, const std::string &end,
+                    size_t limit, const Timestamp &now);
 };
 
 #endif  /* _VERSIONED_KV_STORE_H_ */
@@ -0,0 +1,117 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/compression.cc:
+ *   Transparent compression of large values
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/compression.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+using namespace std;
+
+static const char MAGIC[3] = { '\0', 'T', 'Z' };
+static const char METHOD_STORED = '0';
+static const char METHOD_ZLIB = '1';
+static const size_t HEADER_SIZE = sizeof(MAGIC) + 1 + sizeof(uint32_t);
+
+static bool
+IsEncoded(const string &value)
+{
+    return value.size() >= sizeof(MAGIC) &&
+        memcmp(value.data(), MAGIC, sizeof(MAGIC)) == 0;
+}
+
+static string
+Header(char method, uint32_t length)
+{
+    string header(MAGIC, sizeof(MAGIC));
+    header.push_back(method);
+    header.append((const char *)&length, sizeof(length));
+    return header;
+}
+
+string
+EncodeValue(const string &value, size_t threshold)
+{
+    if (threshold > 0 && value.size() >= threshold && value.size() <= UINT32_MAX) {
+        // fast rather than small: the point is fewer bytes held and
+        // sent, not the last of them
+        uLongf length = compressBound(value.size());
+        string out = Header(METHOD_ZLIB, value.size());
+        out.resize(HEADER_SIZE + length);
+        if (compress2((Bytef *)&out[HEADER_SIZE], &length,
+                      (const Bytef *)value.data(), value.size(),
+                      Z_BEST_SPEED) == Z_OK &&
+            HEADER_SIZE + length < value.size()) {
+            out.resize(HEADER_SIZE + length);
+            return out;
+        }
+    }
+    if (IsEncoded(value)) {
+        return Header(METHOD_STORED, value.size()) + value;
+    }
+    return value;
+}
+
+bool
+DecodeValue(string &value)
+{
+    if (!IsEncoded(value)) {
+        return true;
+    }
+    if (value.size() < HEADER_SIZE) {
+        return false;
+    }
+
+    uint32_t length;
+    memcpy(&length, &value[sizeof(MAGIC) + 1], sizeof(length));
+    switch (value[sizeof(MAGIC)]) {
+    case METHOD_STORED:
+        if (value.size() - HEADER_SIZE != length) {
+            return false;
+        }
+        value.erase(0, HEADER_SIZE);
+        return true;
+
+    case METHOD_ZLIB:
+    {
+        string out(length, '\0');
+        uLongf n = length;
+        if (uncompress((Bytef *)&out[0], &n,
+                       (const Bytef *)&value[HEADER_SIZE],
+                       value.size() - HEADER_SIZE) != Z_OK || n != length) {
+            return false;
+        }
+        value.swap(out);
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
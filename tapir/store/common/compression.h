@@ -0,0 +1,54 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/compression.h:
+ *   Transparent compression of large values
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+#include <string>
+
+// Default size from which clients that compress values do so.
+#define COMPRESS_MIN_BYTES 4096
+
+/*
+ * Stored values are either the value as is, or a header followed by
+ * the value compressed with zlib:
+ *
+ *   "\0TZ" | method | raw length (4 bytes) | payload
+ *
+ * A value that happens to start like a header is always wrapped, with
+ * the stored method, so decoding any encoded value gives it back.
+ */
+
+// Encodes value for storage, compressed if it is at least threshold
+// bytes long and compression shrinks it.
+std::string EncodeValue(const std::string &value, size_t threshold);
+
+// Decodes a stored value in place; false if it is corrupt.
+bool DecodeValue(std::string &value);
+
+#endif /* _COMPRESSION_H_ */
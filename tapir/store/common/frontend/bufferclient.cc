@@ -32,7 +32,7 @@
 
 using namespace std;
 
-BufferClient::BufferClient(TxnClient* txnclient) : txn()
+BufferClient::BufferClient(TxnClient* txnclient) : txn(), snapshotReads(false)
 {
     this->txnclient = txnclient;
 }
@@ -46,22 +46,47 @@ BufferClient::Begin(uint64_t tid)
     // Initialize data structures.
     txn = Transaction();
     this->tid = tid;
+    snapshotReads = false;
     txnclient->Begin(tid);
 }
 
+/* Begins a read-only transaction. */
+void
+BufferClient::BeginRO(uint64_t tid, const Timestamp &timestamp)
+{
+    txn = Transaction();
+    this->tid = tid;
+    snapshotReads = true;
+    txnclient->BeginRO(tid, timestamp);
+}
+
+/* Begins a snapshot-isolated transaction. It reads like a read-only
+ * one, and its snapshot goes along with its prepare. */
+void
+BufferClient::BeginSnapshot(uint64_t tid, const Timestamp &timestamp)
+{
+    BeginRO(tid, timestamp);
+    txn.setSnapshot(timestamp);
+}
+
 /* Get value for a key.
  * Returns 0 on success, else -1. */
 void
 BufferClient::Get(const string &key, Promise *promise)
 {
     // Read your own writes, check the write set first.
+    if (txn.getDeleteSet().find(key) != txn.getDeleteSet().end()) {
+        promise->Reply(REPLY_FAIL);
+        return;
+    }
     if (txn.getWriteSet().find(key) != txn.getWriteSet().end()) {
         promise->Reply(REPLY_OK, (txn.getWriteSet().find(key))->second);
         return;
     }
 
-    // Consistent reads, check the read set.
-    if (txn.getReadSet().find(key) != txn.getReadSet().end()) {
+    // Consistent reads, check the read set. (A transaction reading a
+    // snapshot reads everything at it, so it just reads again.)
+    if (!snapshotReads && txn.getReadSet().find(key) != txn.getReadSet().end()) {
         // read from the server at same timestamp.
         txnclient->Get(tid, key, (txn.getReadSet().find(key))->second, promise);
         return;
@@ -78,13 +103,132 @@ BufferClient::Get(const string &key, Promise *promise)
     }
 }
 
+/* Get several keys in one request. Keys in the write set are not sent,
+ * and keys in the read set are read again at the same version, as in
+ * Get. */
+void
+BufferClient::MultiGet(const vector<string> &keys, Promise *promise)
+{
+    vector<string> reads;
+    map<string, Timestamp> readTimes;
+    for (const string &key : keys) {
+        if (txn.getWriteSet().find(key) != txn.getWriteSet().end()) {
+            continue;
+        }
+        reads.push_back(key);
+        auto r = txn.getReadSet().find(key);
+        if (!snapshotReads && r != txn.getReadSet().end()) {
+            readTimes[key] = r->second;
+        }
+    }
+
+    if (reads.empty()) {
+        promise->Reply(REPLY_OK, KeyValues());
+        return;
+    }
+    txnclient->MultiGet(tid, reads, readTimes, promise);
+}
+
+/* Wait for a multi-get and add the keys read to the read set. Keys that
+ * were not found are left out of values. */
+int
+BufferClient::FinishMultiGet(const vector<string> &keys, Promise *promise,
+                             KeyValues &values)
+{
+    int status = promise->GetReply();
+    if (status != REPLY_OK) {
+        return status;
+    }
+    values = promise->GetValues();
+
+    for (auto &v : values) {
+        if (txn.getReadSet().find(v.first) == txn.getReadSet().end()) {
+            txn.addReadSet(v.first, v.second.first);
+        }
+    }
+
+    // Read your own writes.
+    for (const string &key : keys) {
+        auto w = txn.getWriteSet().find(key);
+        if (txn.getDeleteSet().find(key) != txn.getDeleteSet().end()) {
+            values.erase(key);
+        } else if (w != txn.getWriteSet().end()) {
+            values[key] = make_pair(Timestamp(), w->second);
+        }
+    }
+    return REPLY_OK;
+}
+
+void
+BufferClient::Scan(const string &start, const string &end, size_t limit,
+                   Promise *promise)
+{
+    txnclient->Scan(tid, start, end, limit, promise);
+}
+
+/* Wait for a scan and add it to the read set: each key found, and the
+ * range itself so that keys inserted into it fail the prepare. If the
+ * scan stopped at limit, the range only reaches up to the last key. */
+int
+BufferClient::FinishScan(const string &start, const string &end, size_t limit,
+                         Promise *promise, KeyValues &values)
+{
+    int status = promise->GetReply();
+    if (status != REPLY_OK) {
+        return status;
+    }
+    values = promise->GetValues();
+
+    for (auto &v : values) {
+        // an earlier read of the key stays; if the two differ, that
+        // read fails validation anyway
+        if (txn.getReadSet().find(v.first) == txn.getReadSet().end()) {
+            txn.addReadSet(v.first, v.second.first);
+        }
+    }
+
+    string covered = end;
+    if (limit > 0 && values.size() == limit) {
+        covered = values.rbegin()->first + '\0';
+    }
+    txn.addRangeSet(start, covered);
+
+    // Read your own writes.
+    for (auto &w : txn.getWriteSet()) {
+        if (!VersionedKVStore::inRange(w.first, start, covered)) {
+            continue;
+        }
+        if (txn.getDeleteSet().find(w.first) != txn.getDeleteSet().end()) {
+            values.erase(w.first);
+        } else {
+            values[w.first] = make_pair(Timestamp(), w.second);
+        }
+    }
+    return REPLY_OK;
+}
+
 /* Set value for a key. (Always succeeds).
  * Returns 0 on success, else -1. */
 void
 BufferClient::Put(const string &key, const string &value, Promise *promise)
+{
+    Put(key, value, 0, promise);
+}
+
+void
+BufferClient::Put(const string &key, const string &value, uint64_t ttlMs,
+                  Promise *promise)
 {
     // Update the write set.
-    txn.addWriteSet(key, value);
+    txn.addWriteSet(key, value, ttlMs);
+    promise->Reply(REPLY_OK);
+}
+
+/* Add a delete of a key to the write set. (Always succeeds). */
+void
+BufferClient::Delete(const string &key, Promise *promise)
+{
+    txn.addDeleteSet(key);
     promise->Reply(REPLY_OK);
 }
 
@@ -46,11 +46,37 @@ public:
     // Begin a transaction with given tid.
     void Begin(uint64_t tid);
 
+    // Begin a read-only transaction reading a snapshot at timestamp.
+    void BeginRO(uint64_t tid, const Timestamp &timestamp);
+
+    // Begin a snapshot-isolated transaction reading a snapshot at
+    // timestamp.
+    void BeginSnapshot(uint64_t tid, const Timestamp &timestamp);
+
     // Get value corresponding to key.
     void Get(const string &key, Promise *promise = NULL);
 
-    // Put value for given key.
+    // Get several keys without waiting for the reply; FinishMultiGet
+    // with the same promise then adds what was read to the read set.
+    void MultiGet(const std::vector<string> &keys, Promise *promise);
+    int FinishMultiGet(const std::vector<string> &keys, Promise *promise,
+                       KeyValues &values);
+
+    // Scan up to limit keys in [start, end) without waiting for the
+    // reply; FinishScan with the same promise then adds what was found
+    // to the transaction, so scans of several shards can overlap.
+    void Scan(const string &start, const string &end, size_t limit,
+              Promise *promise);
+    int FinishScan(const string &start, const string &end, size_t limit,
+                   Promise *promise, KeyValues &values);
+
+    // Put value for given key, for ttlMs after commit if ttlMs is set.
     void Put(const string &key, const string &value, Promise *promise = NULL);
+    void Put(const string &key, const string &value, uint64_t ttlMs,
+             Promise *promise = NULL);
+
+    // Delete given key.
+    void Delete(const string &key, Promise *promise = NULL);
 
     // Prepare (Spanner requires a prepare timestamp)
     void Prepare(const Timestamp &timestamp = Timestamp(), Promise *promise = NULL); 
@@ -70,6 +96,9 @@ private:
 
     // Unique transaction id to keep track of ongoing transaction.
     uint64_t tid;
+
+    // Whether the ongoing transaction reads a snapshot.
+    bool snapshotReads;
 };
 
 #endif /* _BUFFER_CLIENT_H_ */
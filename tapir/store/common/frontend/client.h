@@ -30,6 +30,9 @@ public:
     // Set the value for the given key.
     virtual int Put(const std::string &key, const std::string &value) = 0;
 
+    // Delete the given key.
+    virtual int Delete(const std::string &key) = 0;
+
     // Commit all Get(s) and Put(s) since Begin().
     virtual bool Commit() = 0;
     
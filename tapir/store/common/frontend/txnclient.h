@@ -38,7 +38,9 @@
 #include "tapir/store/common/backend/versionstore.h"
 
 #include <string>
+#include <map>
 #include <set>
+#include <vector>
 
 #define DEFAULT_TIMEOUT_MS 250
 #define DEFAULT_MULTICAST_TIMEOUT_MS 500
@@ -46,6 +48,7 @@
 // Timeouts for various operations
 #define GET_TIMEOUT 250
 #define GET_RETRIES 3
+#define SCAN_TIMEOUT 1000
 // Only used for QWStore
 #define PUT_TIMEOUT 250
 #define PREPARE_TIMEOUT 1000
@@ -53,6 +56,12 @@
 
 #define COMMIT_TIMEOUT 1000
 #define COMMIT_RETRIES 5
+// Prepares turned away by overloaded replicas are retried this many
+// times on top, after a backoff that doubles from COMMIT_BACKOFF_US up
+// to COMMIT_MAX_BACKOFF_US, or the wait the replicas ask for if longer.
+#define COMMIT_OVERLOAD_RETRIES 10
+#define COMMIT_BACKOFF_US 1000
+#define COMMIT_MAX_BACKOFF_US 200000
 
 #define ABORT_TIMEOUT 1000
 #define RETRY_TIMEOUT 500000
@@ -81,6 +90,20 @@ public:
                      const Timestamp &timestamp,
                      Promise *promise = NULL) = 0;
 
+    // Get several keys at once, those in readTimes at the version read
+    // there and the rest at their latest version.
+    virtual void MultiGet(uint64_t id,
+                          const std::vector<std::string> &keys,
+                          const std::map<std::string, Timestamp> &readTimes,
+                          Promise *promise = NULL) = 0;
+
+    // Get the latest values of up to limit keys in [start, end).
+    virtual void Scan(uint64_t id,
+                      const std::string &start,
+                      const std::string &end,
+                      size_t limit,
+                      Promise *promise = NULL) = 0;
+
     // Set the value for the given key.
     virtual void Put(uint64_t id,
                      const std::string &key,
@@ -96,6 +96,14 @@ Promise::Reply(int r, Timestamp t, string v)
     ReplyInternal(r);
 }
 
+void
+Promise::Reply(int r, const KeyValues &vs)
+{
+    lock_guard<mutex> l(lock);
+    values = vs;
+    ReplyInternal(r);
+}
+
 // Functions for getting a reply from the promise
 int
 Promise::GetReply()
@@ -126,3 +134,13 @@ Promise::GetValue()
     }
     return value;
 }
+
+KeyValues
+Promise::GetValues()
+{
+    unique_lock<mutex> l(lock);
+    while(!done) {
+        cv.wait(l);
+    }
+    return values;
+}
@@ -48,6 +48,7 @@ private:
     int reply;
     Timestamp timestamp;
     std::string value;
+    KeyValues values;
     std::mutex lock;
     std::condition_variable cv;
 
@@ -63,6 +64,7 @@ public:
     void Reply(int r, Timestamp t);
     void Reply(int r, std::string v);
     void Reply(int r, Timestamp t, std::string v);
+    void Reply(int r, const KeyValues &vs);
 
     // Return configured timeout
     int GetTimeout();
@@ -71,6 +73,7 @@ public:
     int GetReply();
     Timestamp GetTimestamp();
     std::string GetValue();
+    KeyValues GetValues();
 };
 
 #endif /* _PROMISE_H_ */
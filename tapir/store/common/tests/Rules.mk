@@ -0,0 +1,11 @@
+d := $(dir $(lastword $(MAKEFILE_LIST)))
+
+#
+# gtest-based tests
+#
+GTEST_SRCS += $(addprefix $(d), \
+		compression-test.cc)
+
+$(d)compression-test: $(o)compression-test.o $(LIB-message) $(LIB-store-common) $(GTEST_MAIN)
+
+TEST_BINS += $(d)compression-test
@@ -0,0 +1,82 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/common/tests/compression-test.cc
+ *   test cases for value compression
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/compression.h"
+
+#include <gtest/gtest.h>
+
+TEST(Compression, SmallValuesAsIs)
+{
+    std::string value = "small";
+    EXPECT_EQ(value, EncodeValue(value, COMPRESS_MIN_BYTES));
+    EXPECT_EQ(value, EncodeValue(value, 0));
+
+    std::string stored = value;
+    EXPECT_TRUE(DecodeValue(stored));
+    EXPECT_EQ(value, stored);
+}
+
+TEST(Compression, RoundTrip)
+{
+    std::string doc;
+    for (int i = 0; i < 5000; i++) {
+        doc += "{\"id\": " + std::to_string(i) + ", \"name\": \"item\"},";
+    }
+
+    std::string stored = EncodeValue(doc, COMPRESS_MIN_BYTES);
+    EXPECT_LT(stored.size(), doc.size() / 4);
+    EXPECT_TRUE(DecodeValue(stored));
+    EXPECT_EQ(doc, stored);
+
+    // off unless asked for
+    EXPECT_EQ(doc, EncodeValue(doc, 0));
+}
+
+TEST(Compression, Incompressible)
+{
+    std::string noise;
+    uint32_t x = 1;
+    for (int i = 0; i < 8192; i++) {
+        x = x * 1103515245 + 12345;
+        noise.push_back((char)(x >> 24));
+    }
+    EXPECT_EQ(noise, EncodeValue(noise, 1024));
+}
+
+TEST(Compression, LooksEncoded)
+{
+    // a value that starts like a header is wrapped, and comes back
+    std::string value("\0TZ1garbage", 11);
+    std::string stored = EncodeValue(value, 0);
+    EXPECT_NE(value, stored);
+    EXPECT_TRUE(DecodeValue(stored));
+    EXPECT_EQ(value, stored);
+
+    std::string corrupt("\0TZ1\xff\xff\x00\x00junk", 12);
+    EXPECT_FALSE(DecodeValue(corrupt));
+}
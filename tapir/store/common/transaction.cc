@@ -22,13 +22,25 @@ Transaction::Transaction(const TransactionMessage &msg)
 
     for (int i = 0; i < msg.writeset_size(); i++) {
         WriteMessage writeMsg = msg.writeset(i);
-		addWriteSet(writeMsg.key(), writeMsg.value());
+        if (writeMsg.deleted()) {
+            addDeleteSet(writeMsg.key());
+        } else {
+            addWriteSet(writeMsg.key(), writeMsg.value(), writeMsg.ttl());
+        }
     }
 
     for (int i = 0; i < msg.incrementset_size(); i++) {
         IncrementMessage incMsg = msg.incrementset(i);
 		addIncrementSet(incMsg.key(), Increment(incMsg.value(), incMsg.op()));
     }
+
+    for (int i = 0; i < msg.rangeset_size(); i++) {
+        addRangeSet(msg.rangeset(i).start(), msg.rangeset(i).end());
+    }
+
+    if (msg.has_snapshot()) {
+        snapshot = Timestamp(msg.snapshot());
+    }
 }
 
 Transaction::~Transaction() { 
@@ -46,6 +58,18 @@ Transaction::getWriteSet() const
     return writeSet;
 }
 
+const unordered_set<string>&
+Transaction::getDeleteSet() const
+{
+    return deleteSet;
+}
+
+const unordered_map<string, uint64_t>&
+Transaction::getTTLSet() const
+{
+    return ttlSet;
+}
+
 const unordered_map<string, std::vector<Increment>>&
 Transaction::getIncrementSet() const
 {
@@ -61,21 +85,60 @@ Transaction::addReadSet(const string &key,
 
 void
 Transaction::addWriteSet(const string &key,
-                         const string &value)
+                         const string &value,
+                         uint64_t ttlMs)
 {
     writeSet[key] = value;
+    deleteSet.erase(key);
+    if (ttlMs > 0) {
+        ttlSet[key] = ttlMs;
+    } else {
+        ttlSet.erase(key);
+    }
 	//we are overwriting the increments we previously did
 	incrementSet[key].clear();
 }
 
+/* A delete goes in the write set, so it is validated as a write. */
+void
+Transaction::addDeleteSet(const string &key)
+{
+    addWriteSet(key, "");
+    deleteSet.insert(key);
+}
+
 void
 Transaction::addIncrementSet(const string &key,
                              const Increment inc)
 {
-	auto list = incrementSet[key];
+	auto &list = incrementSet[key];
 	list.push_back(inc);	
 }
 
+const vector<pair<string, string>>&
+Transaction::getRangeSet() const
+{
+    return rangeSet;
+}
+
+void
+Transaction::addRangeSet(const string &start, const string &end)
+{
+    rangeSet.push_back(make_pair(start, end));
+}
+
+const Timestamp&
+Transaction::getSnapshot() const
+{
+    return snapshot;
+}
+
+void
+Transaction::setSnapshot(const Timestamp &snapshot)
+{
+    this->snapshot = snapshot;
+}
+
 void
 Transaction::serialize(TransactionMessage *msg) const
 {
@@ -89,6 +152,13 @@ Transaction::serialize(TransactionMessage *msg) const
         WriteMessage *writeMsg = msg->add_writeset();
         writeMsg->set_key(write.first);
         writeMsg->set_value(write.second);
+        if (deleteSet.find(write.first) != deleteSet.end()) {
+            writeMsg->set_deleted(true);
+        }
+        auto ttl = ttlSet.find(write.first);
+        if (ttl != ttlSet.end()) {
+            writeMsg->set_ttl(ttl->second);
+        }
     }
 
 	for (auto incList : incrementSet) {
@@ -99,4 +169,14 @@ Transaction::serialize(TransactionMessage *msg) const
 			incMsg->set_op(inc.op);
 		}
 	}
+
+    for (auto &range : rangeSet) {
+        RangeMessage *rangeMsg = msg->add_rangeset();
+        rangeMsg->set_start(range.first);
+        rangeMsg->set_end(range.second);
+    }
+
+    if (snapshot.isValid()) {
+        snapshot.serialize(msg->mutable_snapshot());
+    }
 }
@@ -15,9 +15,15 @@
 #include "tapir/store/common/common-proto.pb.h"
 #include "tapir/store/common/increment.h"
 
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+// Values read for a set of keys, with the timestamps of the versions
+// read, in key order.
+typedef std::map<std::string, std::pair<Timestamp, std::string>> KeyValues;
+
 // Reply types
 #define REPLY_OK 0
 #define REPLY_FAIL 1
@@ -25,7 +31,9 @@
 #define REPLY_ABSTAIN 3
 #define REPLY_TIMEOUT 4
 #define REPLY_NETWORK_FAILURE 5
-#define REPLY_MAX 6
+// turned away by admission control; retry after the given wait
+#define REPLY_OVERLOADED 6
+#define REPLY_MAX 7
 
 class Transaction {
 private:
@@ -37,9 +45,22 @@ private:
     // map between key and value(s)
     std::unordered_map<std::string, std::string> writeSet;
 
+    // keys in the write set that are deleted rather than written
+    std::unordered_set<std::string> deleteSet;
+
+    // time to live (ms) of the keys in the write set that have one
+    std::unordered_map<std::string, uint64_t> ttlSet;
+
 	// map between key and what to increment by
 	std::unordered_map<std::string, std::vector<Increment>> incrementSet;
 
+    // key ranges [start, end) scanned; the keys found are in the
+    // read set, the ranges guard against keys inserted into them
+    std::vector<std::pair<std::string, std::string>> rangeSet;
+
+    // timestamp of the snapshot the reads came from, if any
+    Timestamp snapshot;
+
 public:
     Transaction();
     Transaction(const TransactionMessage &msg);
@@ -47,11 +68,19 @@ public:
 
     const std::unordered_map<std::string, Timestamp>& getReadSet() const;
     const std::unordered_map<std::string, std::string>& getWriteSet() const;
+    const std::unordered_set<std::string>& getDeleteSet() const;
+    const std::unordered_map<std::string, uint64_t>& getTTLSet() const;
 	const std::unordered_map<std::string, std::vector<Increment>>& getIncrementSet() const;
+    const std::vector<std::pair<std::string, std::string>>& getRangeSet() const;
     
     void addReadSet(const std::string &key, const Timestamp &readTime);
-    void addWriteSet(const std::string &key, const std::string &value);
+    void addWriteSet(const std::string &key, const std::string &value,
+                     uint64_t ttlMs = 0);
+    void addDeleteSet(const std::string &key);
 	void addIncrementSet(const std::string &key, const Increment inc);
+    void addRangeSet(const std::string &start, const std::string &end);
+    const Timestamp &getSnapshot() const;
+    void setSnapshot(const Timestamp &snapshot);
     void serialize(TransactionMessage *msg) const;
 };
 
@@ -0,0 +1,219 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * common/transactionview.cc:
+ *   Read-only view of a transaction over its wire format.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/common/transactionview.h"
+
+using namespace std;
+using google::protobuf::Arena;
+
+TransactionView::TransactionView()
+    : msg(&TransactionMessage::default_instance()) { }
+
+TransactionView::TransactionView(shared_ptr<Arena> arena,
+                                 const TransactionMessage *msg)
+    : arena(arena), msg(msg) { }
+
+TransactionView::TransactionView(const Transaction &txn)
+    : arena(make_shared<Arena>())
+{
+    TransactionMessage *m = Arena::CreateMessage<TransactionMessage>(arena.get());
+    txn.serialize(m);
+    msg = m;
+}
+
+TransactionView::~TransactionView() { }
+
+size_t
+TransactionView::readSetSize() const
+{
+    return sel ? sel->reads.size() : msg->readset_size();
+}
+
+const string &
+TransactionView::readKey(size_t i) const
+{
+    return msg->readset(sel ? sel->reads[i] : i).key();
+}
+
+Timestamp
+TransactionView::readTime(size_t i) const
+{
+    return Timestamp(msg->readset(sel ? sel->reads[i] : i).readtime());
+}
+
+size_t
+TransactionView::writeSetSize() const
+{
+    return sel ? sel->writes.size() : msg->writeset_size();
+}
+
+const string &
+TransactionView::writeKey(size_t i) const
+{
+    return msg->writeset(sel ? sel->writes[i] : i).key();
+}
+
+const string &
+TransactionView::writeValue(size_t i) const
+{
+    return msg->writeset(sel ? sel->writes[i] : i).value();
+}
+
+bool
+TransactionView::writeDeleted(size_t i) const
+{
+    return msg->writeset(sel ? sel->writes[i] : i).deleted();
+}
+
+uint64_t
+TransactionView::writeTTL(size_t i) const
+{
+    return msg->writeset(sel ? sel->writes[i] : i).ttl();
+}
+
+size_t
+TransactionView::incrementSetSize() const
+{
+    return sel ? sel->incs.size() : msg->incrementset_size();
+}
+
+const string &
+TransactionView::incrementKey(size_t i) const
+{
+    return msg->incrementset(sel ? sel->incs[i] : i).key();
+}
+
+uint64_t
+TransactionView::incrementOp(size_t i) const
+{
+    return msg->incrementset(sel ? sel->incs[i] : i).op();
+}
+
+Increment
+TransactionView::increment(size_t i) const
+{
+    const IncrementMessage &inc = msg->incrementset(sel ? sel->incs[i] : i);
+    return Increment(inc.value(), inc.op());
+}
+
+size_t
+TransactionView::rangeSetSize() const
+{
+    return msg->rangeset_size();
+}
+
+const string &
+TransactionView::rangeStart(size_t i) const
+{
+    return msg->rangeset(i).start();
+}
+
+const string &
+TransactionView::rangeEnd(size_t i) const
+{
+    return msg->rangeset(i).end();
+}
+
+Timestamp
+TransactionView::snapshot() const
+{
+    if (!msg->has_snapshot()) {
+        return Timestamp();
+    }
+    return Timestamp(msg->snapshot());
+}
+
+bool
+TransactionView::empty() const
+{
+    return readSetSize() == 0 && writeSetSize() == 0 &&
+        incrementSetSize() == 0 && rangeSetSize() == 0;
+}
+
+void
+TransactionView::split(unsigned int n,
+                       const function<unsigned int (const string &)> &group,
+                       vector<TransactionView> &parts) const
+{
+    vector<shared_ptr<Selection>> sels(n);
+    for (auto &s : sels) {
+        s = make_shared<Selection>();
+    }
+
+    for (size_t i = 0; i < readSetSize(); i++) {
+        sels[group(readKey(i))]->reads.push_back(sel ? sel->reads[i] : i);
+    }
+    for (size_t i = 0; i < writeSetSize(); i++) {
+        sels[group(writeKey(i))]->writes.push_back(sel ? sel->writes[i] : i);
+    }
+    for (size_t i = 0; i < incrementSetSize(); i++) {
+        sels[group(incrementKey(i))]->incs.push_back(sel ? sel->incs[i] : i);
+    }
+
+    parts.clear();
+    for (auto &s : sels) {
+        TransactionView part(arena, msg);
+        part.sel = s;
+        parts.push_back(part);
+    }
+}
+
+void
+TransactionView::serialize(TransactionMessage *m) const
+{
+    if (!sel) {
+        m->CopyFrom(*msg);
+    } else {
+        toTransaction().serialize(m);
+    }
+}
+
+Transaction
+TransactionView::toTransaction() const
+{
+    Transaction txn;
+
+    for (size_t i = 0; i < readSetSize(); i++) {
+        txn.addReadSet(readKey(i), readTime(i));
+    }
+    for (size_t i = 0; i < writeSetSize(); i++) {
+        if (writeDeleted(i)) {
+            txn.addDeleteSet(writeKey(i));
+        } else {
+            txn.addWriteSet(writeKey(i), writeValue(i), writeTTL(i));
+        }
+    }
+    for (size_t i = 0; i < incrementSetSize(); i++) {
+        txn.addIncrementSet(incrementKey(i), increment(i));
+    }
+    for (size_t i = 0; i < rangeSetSize(); i++) {
+        txn.addRangeSet(rangeStart(i), rangeEnd(i));
+    }
+    txn.setSnapshot(snapshot());
+    return txn;
+}
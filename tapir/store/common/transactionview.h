@@ -0,0 +1,111 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * common/transactionview.h:
+ *   Read-only view of a transaction over its wire format.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _TRANSACTION_VIEW_H_
+#define _TRANSACTION_VIEW_H_
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/message.h"
+#include "tapir/store/common/timestamp.h"
+#include "tapir/store/common/transaction.h"
+#include "tapir/store/common/common-proto.pb.h"
+#include "tapir/store/common/increment.h"
+
+#include <google/protobuf/arena.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * A transaction as received on the wire. The parsed message lives in
+ * an arena shared by all copies of the view, so holding on to a
+ * transaction (e.g., in the prepared set) costs a reference count
+ * rather than a deep copy, and reading it builds no hash maps.
+ */
+class TransactionView {
+public:
+    TransactionView();
+    // msg must have been allocated on arena (or outlive the view).
+    TransactionView(std::shared_ptr<google::protobuf::Arena> arena,
+                    const TransactionMessage *msg);
+    // Copies txn into a fresh arena.
+    TransactionView(const Transaction &txn);
+    ~TransactionView();
+
+    size_t readSetSize() const;
+    const std::string &readKey(size_t i) const;
+    Timestamp readTime(size_t i) const;
+
+    size_t writeSetSize() const;
+    const std::string &writeKey(size_t i) const;
+    const std::string &writeValue(size_t i) const;
+    bool writeDeleted(size_t i) const;
+    // ms the written value lives for, 0 for ever
+    uint64_t writeTTL(size_t i) const;
+
+    size_t incrementSetSize() const;
+    const std::string &incrementKey(size_t i) const;
+    uint64_t incrementOp(size_t i) const;
+    Increment increment(size_t i) const;
+
+    // Ranges are not split up, so every piece of a split view has them.
+    size_t rangeSetSize() const;
+    const std::string &rangeStart(size_t i) const;
+    const std::string &rangeEnd(size_t i) const;
+
+    // Invalid unless the transaction read from a snapshot.
+    Timestamp snapshot() const;
+
+    bool empty() const;
+
+    // Splits the view into n views sharing the same message, op by op,
+    // according to group(key).
+    void split(unsigned int n,
+               const std::function<unsigned int (const std::string &)> &group,
+               std::vector<TransactionView> &parts) const;
+
+    Transaction toTransaction() const;
+    // Writes the ops of this view to msg.
+    void serialize(TransactionMessage *msg) const;
+
+private:
+    // Indices of the ops in a view produced by split().
+    struct Selection {
+        std::vector<int> reads;
+        std::vector<int> writes;
+        std::vector<int> incs;
+    };
+
+    std::shared_ptr<google::protobuf::Arena> arena;
+    const TransactionMessage *msg;
+    std::shared_ptr<Selection> sel;
+};
+
+#endif /* _TRANSACTION_VIEW_H_ */
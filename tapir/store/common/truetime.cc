@@ -59,3 +59,15 @@ TrueTime::GetTimeAndError(uint64_t &time, uint64_t &error)
    time = GetTime();
    error = simError;
 }
+
+uint64_t
+TrueTime::ToMicros(uint64_t time)
+{
+    return (time >> 32) * 1000000 + (time & 0xffffffff);
+}
+
+uint64_t
+TrueTime::FromMicros(uint64_t us)
+{
+    return ((us / 1000000) << 32) | (us % 1000000);
+}
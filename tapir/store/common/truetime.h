@@ -24,6 +24,11 @@ class TrueTime
     uint64_t GetTime();
     void GetTimeAndError(uint64_t &time, uint64_t &error);
 
+    // Times are (seconds << 32 | microseconds); convert to and from
+    // plain microseconds for arithmetic.
+    static uint64_t ToMicros(uint64_t time);
+    static uint64_t FromMicros(uint64_t us);
+
 private:
 	uint64_t simError;
 	uint64_t simSkew;
@@ -1,14 +1,18 @@
 d := $(dir $(lastword $(MAKEFILE_LIST)))
 
 SRCS += $(addprefix $(d), client.cc shardclient.cc \
-	server.cc store.cc)
+	server.cc store.cc partitionedstore.cc terminator.cc loader.cc \
+	admission.cc)
 
 PROTOS += $(addprefix $(d), tapir-proto.proto)
 
-OBJS-tapir-store := $(LIB-message) $(LIB-store-common) $(LIB-store-backend) \
-	$(o)tapir-proto.o $(o)store.o
+OBJS-tapir-store := $(LIB-message) $(LIB-wal) $(LIB-store-common) $(LIB-store-backend) \
+	$(o)tapir-proto.o $(o)store.o $(o)partitionedstore.o $(o)loader.o \
+	$(o)admission.o
 
 OBJS-tapir-client := $(OBJS-ir-client)  $(LIB-udptransport) $(LIB-store-frontend) $(LIB-store-common) $(o)tapir-proto.o \
 		$(o)shardclient.o $(o)client.o
 
-OBJS-tapir-server := $(o)server.o
+OBJS-tapir-server := $(o)server.o $(o)terminator.o
+
+include $(d)tests/Rules.mk
@@ -0,0 +1,70 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/admission.cc:
+ *   Admission control for prepares
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/tapirstore/admission.h"
+
+#include <algorithm>
+
+namespace tapirstore {
+
+using namespace std;
+
+AdmissionControl::AdmissionControl(size_t maxPrepared, uint64_t maxLatency)
+    : maxPrepared(maxPrepared), maxLatency(maxLatency), latency(0),
+      rejected(0) { }
+
+bool
+AdmissionControl::Admit(size_t prepared, uint64_t &retryAfter)
+{
+    // how far over the tighter of the two limits the replica is
+    double load = 0;
+    if (maxPrepared > 0) {
+        load = max(load, (double)prepared / maxPrepared);
+    }
+    if (maxLatency > 0) {
+        load = max(load, latency / maxLatency);
+    }
+    if (load < 1) {
+        return true;
+    }
+
+    rejected++;
+    latency *= 1 - ADMIT_LATENCY_WEIGHT;
+
+    double wait = max(latency, (double)ADMIT_MIN_RETRY_US) * load;
+    retryAfter = (uint64_t)min(wait, (double)ADMIT_MAX_RETRY_US);
+    return false;
+}
+
+void
+AdmissionControl::Done(uint64_t us)
+{
+    latency += ADMIT_LATENCY_WEIGHT * ((double)us - latency);
+}
+
+} // namespace tapirstore
@@ -0,0 +1,83 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/admission.h:
+ *   Admission control for prepares
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _TAPIR_ADMISSION_H_
+#define _TAPIR_ADMISSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Default limits: prepared transactions held, and average time a
+// prepare takes, in us.
+#define ADMIT_MAX_PREPARED 4096
+#define ADMIT_MAX_LATENCY_US 2000
+
+// Weight of the latest prepare in the average latency.
+#define ADMIT_LATENCY_WEIGHT 0.05
+
+// Bounds on the wait a rejected client is told to back off for, in us.
+#define ADMIT_MIN_RETRY_US 1000
+#define ADMIT_MAX_RETRY_US 100000
+
+namespace tapirstore {
+
+/*
+ * Sheds prepares once the replica falls behind. A prepare is turned
+ * away while the prepared set is over its limit, or prepares take
+ * longer than the latency limit on average; each one turned away
+ * also decays the average, so that prepares are let in again to
+ * measure it once the load is gone. A limit of 0 is not checked.
+ */
+class AdmissionControl
+{
+public:
+    AdmissionControl(size_t maxPrepared = ADMIT_MAX_PREPARED,
+                     uint64_t maxLatency = ADMIT_MAX_LATENCY_US);
+
+    // Whether to run a prepare while prepared transactions are held;
+    // if not, retryAfter is set to how long (in us) the client should
+    // wait before trying again, more the further over the limits the
+    // replica is.
+    bool Admit(size_t prepared, uint64_t &retryAfter);
+    // An admitted prepare took us microseconds.
+    void Done(uint64_t us);
+
+    // Average prepare time, in us, and prepares turned away so far.
+    double Latency() const { return latency; };
+    uint64_t Rejected() const { return rejected; };
+
+private:
+    size_t maxPrepared;
+    uint64_t maxLatency;
+    double latency;
+    uint64_t rejected;
+};
+
+} // namespace tapirstore
+
+#endif /* _TAPIR_ADMISSION_H_ */
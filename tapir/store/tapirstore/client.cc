@@ -37,7 +37,10 @@ using namespace std;
 
 Client::Client(const string configPath, int nShards,
                 int closestReplica, TrueTime timeServer)
-    : nshards(nShards), transport(0.0, 0.0, 0, false), timeServer(timeServer)
+    : nshards(nShards), readOnly(false), snapshotReads(false),
+      hasIsolation(false),
+      transport(0.0, 0.0, 0, false),
+      timeServer(timeServer), compressAbove(0)
 {
     // Initialize all state here;
     client_id = 0;
@@ -48,8 +51,11 @@ Client::Client(const string configPath, int nShards,
         client_id = dis(gen);
     }
     t_id = (client_id/10000)*10000;
+    backoffRand.seed(client_id);
 
     bclient.reserve(nshards);
+    sclient.reserve(nshards);
+    closed.resize(nshards);
 
     Debug("Initializing Tapir client with id [%lu] %lu", client_id, nshards);
 
@@ -58,6 +64,7 @@ Client::Client(const string configPath, int nShards,
         string shardConfigPath = configPath + to_string(i) + ".config";
         ShardClient *shardclient = new ShardClient(shardConfigPath,
                 &transport, client_id, i, closestReplica);
+        sclient.push_back(shardclient);
         bclient[i] = new BufferClient(shardclient);
     }
 
@@ -96,6 +103,58 @@ Client::Begin()
     Debug("BEGIN [%lu]", t_id + 1);
     t_id++;
     participants.clear();
+    readOnly = false;
+    snapshotReads = false;
+    hasIsolation = false;
+}
+
+/* Begins a transaction at the given isolation level. The level goes
+ * along with the transaction's prepare, so transactions that only need
+ * serializability do not pay for linearizable checks on replicas that
+ * run txn-l, and the other way around. */
+void
+Client::Begin(Isolation isolation)
+{
+    if (isolation == ISOLATION_SNAPSHOT) {
+        BeginSnapshot();
+        return;
+    }
+
+    Begin();
+    hasIsolation = true;
+    this->isolation = isolation;
+}
+
+/* Begins a read-only transaction. Every read is served at the same
+ * snapshot timestamp, so the reads are consistent with each other as
+ * they come back; the commit checks that no write has landed under
+ * them since. */
+void
+Client::BeginRO()
+{
+    Debug("BEGIN READ-ONLY [%lu]", t_id + 1);
+    t_id++;
+    participants.clear();
+    readOnly = true;
+    snapshotReads = true;
+    hasIsolation = false;
+    snapshot = Timestamp(timeServer.GetTime(), client_id);
+}
+
+/* Begins a snapshot-isolated transaction. It reads the snapshot like a
+ * read-only one, but can also write; its prepare then only checks for
+ * writes committed after the snapshot. */
+void
+Client::BeginSnapshot()
+{
+    Debug("BEGIN SNAPSHOT [%lu]", t_id + 1);
+    t_id++;
+    participants.clear();
+    readOnly = false;
+    snapshotReads = true;
+    hasIsolation = true;
+    isolation = ISOLATION_SNAPSHOT;
+    snapshot = Timestamp(timeServer.GetTime(), client_id);
 }
 
 /* Returns the value corresponding to the supplied key. */
@@ -110,15 +169,34 @@ Client::Get(const string &key, string &value)
     // If needed, add this shard to set of participants and send BEGIN.
     if (participants.find(i) == participants.end()) {
         participants.insert(i);
-        bclient[i]->Begin(t_id);
+        if (readOnly) {
+            bclient[i]->BeginRO(t_id, snapshot);
+        } else if (snapshotReads) {
+            bclient[i]->BeginSnapshot(t_id, snapshot);
+        } else {
+            bclient[i]->Begin(t_id);
+        }
     }
 
-    // Send the GET operation to appropriate shard.
-    Promise promise(GET_TIMEOUT);
+    // Send the GET operation to appropriate shard. A snapshot read
+    // retries while a write below the snapshot is still prepared.
+    int status;
+    for (int tries = 0; ; tries++) {
+        Promise promise(GET_TIMEOUT);
 
-    bclient[i]->Get(key, &promise);
-    value = promise.GetValue();
-    return promise.GetReply();
+        bclient[i]->Get(key, &promise);
+        value = promise.GetValue();
+        status = promise.GetReply();
+        if (!snapshotReads || status != REPLY_RETRY || tries == GET_RETRIES) {
+            break;
+        }
+        Debug("GET [%lu : %s] RETRY behind prepared write", t_id, key.c_str());
+        usleep(GET_TIMEOUT * 1000 / GET_RETRIES);
+    }
+    if (status == REPLY_OK) {
+        status = Decode(key, value);
+    }
+    return status;
 }
 
 string
@@ -129,45 +207,251 @@ Client::Get(const string &key)
     return value;
 }
 
+/* Bounded-staleness read, at a timestamp a quorum of the shard's
+ * replicas has closed: nothing can commit at or below it any more, so
+ * the value needs no validation; it only has to be recent enough. The
+ * shard is asked for its closed timestamp again once the one we know
+ * is too old. */
+int
+Client::GetStale(const string &key, string &value, uint64_t maxStalenessMs)
+{
+    Debug("GET STALE [%s]", key.c_str());
+
+    int i = key_to_shard(key, nshards);
+
+    for (int tries = 0; tries < GET_RETRIES; tries++) {
+        uint64_t now = TrueTime::ToMicros(timeServer.GetTime());
+        if (TrueTime::ToMicros(closed[i].getTimestamp()) +
+            maxStalenessMs * 1000 < now) {
+            Promise promise(GET_TIMEOUT);
+            sclient[i]->GetClosed(&promise);
+            int status = promise.GetReply();
+            if (status != REPLY_OK) {
+                return status;
+            }
+            if (promise.GetTimestamp() > closed[i]) {
+                closed[i] = promise.GetTimestamp();
+            }
+
+            uint64_t c = TrueTime::ToMicros(closed[i].getTimestamp());
+            if (c + maxStalenessMs * 1000 < now) {
+                // the replicas lag behind
+                Debug("GET STALE [%s] too stale by %lu us", key.c_str(),
+                      now - c - maxStalenessMs * 1000);
+                continue;
+            }
+        }
+
+        Promise promise(GET_TIMEOUT);
+        sclient[i]->GetStale(key, closed[i], tries, &promise);
+        int status = promise.GetReply();
+        if (status == REPLY_RETRY) {
+            // this replica has not closed it yet; try another one
+            continue;
+        }
+        if (status != REPLY_OK) {
+            return status;
+        }
+        value = promise.GetValue();
+        return Decode(key, value);
+    }
+    return REPLY_RETRY;
+}
+
+/* Reads several keys. The keys are grouped by shard and each shard is
+ * sent its keys in one request, all shards at once. Shards whose
+ * snapshot reads have to wait behind a prepared write are asked again. */
+int
+Client::MultiGet(const vector<string> &keys, KeyValues &values)
+{
+    Debug("MULTI_GET [%lu : %lu keys]", t_id, keys.size());
+
+    map<int, vector<string>> pending;
+    for (const string &key : keys) {
+        pending[key_to_shard(key, nshards)].push_back(key);
+    }
+
+    for (auto &p : pending) {
+        int i = p.first;
+        if (participants.find(i) == participants.end()) {
+            participants.insert(i);
+            if (readOnly) {
+                bclient[i]->BeginRO(t_id, snapshot);
+            } else if (snapshotReads) {
+                bclient[i]->BeginSnapshot(t_id, snapshot);
+            } else {
+                bclient[i]->Begin(t_id);
+            }
+        }
+    }
+
+    int status = REPLY_OK;
+    for (int tries = 0; ; tries++) {
+        map<int, Promise *> promises;
+        for (auto &p : pending) {
+            promises[p.first] = new Promise(GET_TIMEOUT);
+            bclient[p.first]->MultiGet(p.second, promises[p.first]);
+        }
+
+        status = REPLY_OK;
+        for (auto &p : promises) {
+            KeyValues vals;
+            int s = bclient[p.first]->FinishMultiGet(pending[p.first],
+                                                     p.second, vals);
+            if (s == REPLY_OK) {
+                values.insert(vals.begin(), vals.end());
+                pending.erase(p.first);
+            } else {
+                status = s;
+            }
+            delete p.second;
+        }
+
+        if (pending.empty() || !snapshotReads || status != REPLY_RETRY ||
+            tries == GET_RETRIES) {
+            break;
+        }
+        Debug("MULTI_GET [%lu] RETRY behind prepared write", t_id);
+        usleep(GET_TIMEOUT * 1000 / GET_RETRIES);
+    }
+    if (Decode(values) != REPLY_OK) {
+        status = REPLY_FAIL;
+    }
+    return status;
+}
+
+/* Scans a key range. Keys are hashed to shards, so the range is spread
+ * over all of them: every shard is sent the scan at once and becomes a
+ * participant, as each has to validate the range at prepare. */
+int
+Client::Scan(const string &start, const string &end, size_t limit,
+             KeyValues &values)
+{
+    Debug("SCAN [%lu : %s, %s]", t_id, start.c_str(), end.c_str());
+
+    if (snapshotReads) {
+        Warning("SCAN [%lu] in a snapshot transaction is not supported", t_id);
+        return REPLY_FAIL;
+    }
+
+    vector<Promise *> promises;
+    for (uint64_t i = 0; i < nshards; i++) {
+        if (participants.find(i) == participants.end()) {
+            participants.insert(i);
+            bclient[i]->Begin(t_id);
+        }
+        promises.push_back(new Promise(SCAN_TIMEOUT));
+        bclient[i]->Scan(start, end, limit, promises.back());
+    }
+
+    int status = REPLY_OK;
+    for (uint64_t i = 0; i < nshards; i++) {
+        KeyValues vals;
+        int s = bclient[i]->FinishScan(start, end, limit, promises[i], vals);
+        if (s != REPLY_OK) {
+            status = s;
+        }
+        values.insert(vals.begin(), vals.end());
+        delete promises[i];
+    }
+
+    if (limit > 0 && values.size() > limit) {
+        auto it = values.begin();
+        advance(it, limit);
+        values.erase(it, values.end());
+    }
+    if (Decode(values) != REPLY_OK) {
+        status = REPLY_FAIL;
+    }
+    return status;
+}
+
 /* Sets the value corresponding to the supplied key. */
 int
 Client::Put(const string &key, const string &value)
+{
+    return Put(key, value, 0);
+}
+
+int
+Client::Put(const string &key, const string &value, uint64_t ttlMs)
 {
     Debug("PUT [%lu : %s]", t_id, key.c_str());
 
+    if (readOnly) {
+        Warning("PUT [%lu : %s] in a read-only transaction", t_id, key.c_str());
+        return REPLY_FAIL;
+    }
+
     // Contact the appropriate shard to set the value.
     int i = key_to_shard(key, nshards);
 
     // If needed, add this shard to set of participants and send BEGIN.
     if (participants.find(i) == participants.end()) {
         participants.insert(i);
-        bclient[i]->Begin(t_id);
+        if (snapshotReads) {
+            bclient[i]->BeginSnapshot(t_id, snapshot);
+        } else {
+            bclient[i]->Begin(t_id);
+        }
     }
 
     Promise promise(PUT_TIMEOUT);
 
-    // Buffering, so no need to wait.
-    bclient[i]->Put(key, value, &promise);
+    // Buffering, so no need to wait. Replicas hold and send the value
+    // as encoded here.
+    bclient[i]->Put(key, EncodeValue(value, compressAbove), ttlMs, &promise);
+    return promise.GetReply();
+}
+
+/* Deletes the key; like a write, it only takes effect at commit. */
+int
+Client::Delete(const string &key)
+{
+    Debug("DELETE [%lu : %s]", t_id, key.c_str());
+
+    if (readOnly) {
+        Warning("DELETE [%lu : %s] in a read-only transaction", t_id, key.c_str());
+        return REPLY_FAIL;
+    }
+
+    int i = key_to_shard(key, nshards);
+
+    if (participants.find(i) == participants.end()) {
+        participants.insert(i);
+        if (snapshotReads) {
+            bclient[i]->BeginSnapshot(t_id, snapshot);
+        } else {
+            bclient[i]->Begin(t_id);
+        }
+    }
+
+    Promise promise(PUT_TIMEOUT);
+    bclient[i]->Delete(key, &promise);
     return promise.GetReply();
 }
 
 int
-Client::Prepare(Timestamp &timestamp)
+Client::Prepare(Timestamp &timestamp, uint64_t &retryAfter)
 {
     // 1. Send commit-prepare to all shards.
-    uint64_t proposed = 0;
     list<Promise *> promises;
 
     Debug("PREPARE [%lu] at %lu", t_id, timestamp.getTimestamp());
     ASSERT(participants.size() > 0);
 
     for (auto p : participants) {
+        sclient[p]->SetParticipants(participants);
+        if (hasIsolation) {
+            sclient[p]->SetIsolation(isolation);
+        }
         promises.push_back(new Promise(PREPARE_TIMEOUT));
         bclient[p]->Prepare(timestamp, promises.back());
     }
 
     int status = REPLY_OK;
-    uint64_t ts;
+    bool overloaded = false;
+    uint64_t ts = 0;
     // 3. If all votes YES, send commit to all shards.
     // If any abort, then abort. Collect any retry timestamps.
     for (auto p : promises) {
@@ -183,28 +467,41 @@ Client::Prepare(Timestamp &timestamp)
             return REPLY_FAIL;
         case REPLY_RETRY:
             status = REPLY_RETRY;
-                if (proposed > ts) {
-                    ts = proposed;
-                }
-                break;
+            if (proposed > ts) {
+                ts = proposed;
+            }
+            break;
         case REPLY_TIMEOUT:
             status = REPLY_RETRY;
             break;
         case REPLY_ABSTAIN:
             // just ignore abstains
             break;
+        case REPLY_OVERLOADED:
+            // the shard shed the prepare; wait as long as the busiest
+            // one asks
+            overloaded = true;
+            if (proposed > retryAfter) {
+                retryAfter = proposed;
+            }
+            break;
         default:
             break;
         }
         delete p;
     }
 
+    if (overloaded) {
+        Debug("OVERLOADED [%lu] for %lu us", t_id, retryAfter);
+        return REPLY_OVERLOADED;
+    }
+
     if (status == REPLY_RETRY) {
-        uint64_t now = timeServer.GetTime();
-        if (now > proposed) {
-            timestamp.setTimestamp(now);
-        } else {
-            timestamp.setTimestamp(proposed);
+        // at the proposed timestamp, unless the clock or the hints the
+        // GETs brought back are past it
+        timestamp = CommitTimestamp();
+        if (ts > timestamp.getTimestamp()) {
+            timestamp.setTimestamp(ts);
         }
         Debug("RETRY [%lu] at [%lu]", t_id, timestamp.getTimestamp());
     }
@@ -217,12 +514,47 @@ Client::Prepare(Timestamp &timestamp)
 bool
 Client::Commit()
 {
+    if (readOnly) {
+        // The reads commit if every shard finds them still valid at the
+        // snapshot; recorded there, writes below the snapshot can no
+        // longer commit.
+        Debug("COMMIT READ-ONLY [%lu]", t_id);
+        list<Promise *> promises;
+        for (auto p : participants) {
+            promises.push_back(new Promise(PREPARE_TIMEOUT));
+            bclient[p]->Commit(0, promises.back());
+        }
+
+        bool committed = true;
+        for (auto p : promises) {
+            if (p->GetReply() != REPLY_OK) {
+                committed = false;
+            }
+            delete p;
+        }
+        Debug("COMMIT READ-ONLY [%lu] %s", t_id,
+              committed ? "OK" : "ABORT");
+        return committed;
+    }
+
     // Implementing 2 Phase Commit
-    Timestamp timestamp(timeServer.GetTime(), client_id);
+    Timestamp timestamp = CommitTimestamp();
     int status;
+    int overloads = 0;
 
     for (retries = 0; retries < COMMIT_RETRIES; retries++) {
-        status = Prepare(timestamp);
+        uint64_t retryAfter = 0;
+        status = Prepare(timestamp, retryAfter);
+        if (status == REPLY_OVERLOADED &&
+            overloads < COMMIT_OVERLOAD_RETRIES) {
+            // nothing conflicted, so this is not one of the retries;
+            // come back once the shards have caught up, at a fresh
+            // timestamp
+            Backoff(overloads++, retryAfter);
+            timestamp = CommitTimestamp();
+            retries--;
+            continue;
+        }
         if (status == REPLY_RETRY) {
             continue;
         } else {
@@ -244,6 +576,35 @@ Client::Commit()
     return false;
 }
 
+/* The clock, but above the reads and prepared writes the GETs saw on
+ * the keys read, rather than be told to retry above them. */
+Timestamp
+Client::CommitTimestamp()
+{
+    Timestamp timestamp(timeServer.GetTime(), client_id);
+    for (auto p : participants) {
+        Timestamp hint = sclient[p]->GetHint();
+        if (hint.getTimestamp() >= timestamp.getTimestamp()) {
+            timestamp.setTimestamp(hint.getTimestamp() + 1);
+        }
+    }
+    return timestamp;
+}
+
+/* Wait out an overloaded prepare: back off exponentially, but at least
+ * as long as the replicas asked, with jitter so that clients turned
+ * away together do not all come back together. */
+void
+Client::Backoff(int overloads, uint64_t retryAfter)
+{
+    uint64_t wait = (uint64_t)COMMIT_BACKOFF_US << overloads;
+    wait = max(wait, retryAfter);
+    wait = min(wait, (uint64_t)COMMIT_MAX_BACKOFF_US);
+
+    uniform_int_distribution<uint64_t> dis(wait / 2, wait + wait / 2);
+    usleep(dis(backoffRand));
+}
+
 /* Aborts the ongoing transaction. */
 void
 Client::Abort()
@@ -263,4 +624,33 @@ Client::Stats()
     return v;
 }
 
+void
+Client::SetCompression(size_t threshold)
+{
+    compressAbove = threshold;
+}
+
+/* Decompress a value read, if it was stored compressed. */
+int
+Client::Decode(const string &key, string &value)
+{
+    if (!DecodeValue(value)) {
+        Warning("Corrupt compressed value of key %s", key.c_str());
+        return REPLY_FAIL;
+    }
+    return REPLY_OK;
+}
+
+int
+Client::Decode(KeyValues &values)
+{
+    int status = REPLY_OK;
+    for (auto &kv : values) {
+        if (Decode(kv.first, kv.second.second) != REPLY_OK) {
+            status = REPLY_FAIL;
+        }
+    }
+    return status;
+}
+
 } // namespace tapirstore
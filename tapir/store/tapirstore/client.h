@@ -37,6 +37,7 @@
 #include "tapir/lib/configuration.h"
 #include "tapir/lib/udptransport.h"
 #include "tapir/replication/ir/client.h"
+#include "tapir/store/common/compression.h"
 #include "tapir/store/common/timestamp.h"
 #include "tapir/store/common/truetime.h"
 #include "tapir/store/common/frontend/client.h"
@@ -44,6 +45,7 @@
 #include "tapir/store/tapirstore/shardclient.h"
 #include "tapir/store/tapirstore/tapir-proto.pb.h"
 
+#include <random>
 #include <thread>
 
 namespace tapirstore {
@@ -57,14 +59,43 @@ public:
 
     // Overriding functions from ::Client.
     void Begin();
+    // Begin a transaction validated at the given isolation level,
+    // whatever level the replicas run at.
+    void Begin(Isolation isolation);
+    // Begin a read-only transaction; it reads a snapshot and commits in
+    // one round that validates and records the reads, without a
+    // prepare and a commit.
+    void BeginRO();
+    // Begin a snapshot-isolated transaction; it reads a snapshot and
+    // only conflicts with writes. Same as Begin(ISOLATION_SNAPSHOT).
+    void BeginSnapshot();
     int Get(const std::string &key, std::string &value);
     // Interface added for Java bindings
     std::string Get(const std::string &key);
+    // Read key outside of any transaction from any replica, as of at
+    // most maxStalenessMs ago.
+    int GetStale(const std::string &key, std::string &value,
+                 uint64_t maxStalenessMs);
+    // Read several keys, with one request per shard they are on, sent
+    // to all of them at once. Keys that are not found are left out.
+    int MultiGet(const std::vector<std::string> &keys, KeyValues &values);
+    // Read up to limit keys in [start, end) (all of them if limit is 0;
+    // an empty end is unbounded), one request per shard. Keys inserted
+    // into the range before the transaction commits make it abort.
+    int Scan(const std::string &start, const std::string &end,
+             size_t limit, KeyValues &values);
     int Put(const std::string &key, const std::string &value);
+    // Put a value that disappears ttlMs after the transaction commits.
+    int Put(const std::string &key, const std::string &value, uint64_t ttlMs);
+    int Delete(const std::string &key);
     bool Commit();
     void Abort();
     std::vector<int> Stats();
 
+    // Compress values of at least threshold bytes on Put (0, the
+    // default, for none). Values read are decompressed either way.
+    void SetCompression(size_t threshold);
+
 private:
     // Unique ID for this client.
     uint64_t client_id;
@@ -81,6 +112,17 @@ private:
     // List of participants in the ongoing transaction.
     std::set<int> participants;
 
+    // Whether the ongoing transaction is read-only or reads a snapshot,
+    // and its snapshot.
+    bool readOnly;
+    bool snapshotReads;
+    Timestamp snapshot;
+
+    // Whether the ongoing transaction picked an isolation level (or
+    // gets the replicas' own), and the level.
+    bool hasIsolation;
+    Isolation isolation;
+
     // Transport used by IR client proxies.
     UDPTransport transport;
     
@@ -90,11 +132,36 @@ private:
     // Buffering client for each shard.
     std::vector<BufferClient *> bclient;
 
+    // Shard client under each buffering client.
+    std::vector<ShardClient *> sclient;
+
+    // Latest timestamp a quorum of each shard's replicas is known to
+    // have closed, for bounded-staleness reads.
+    std::vector<Timestamp> closed;
+
     // TrueTime server.
     TrueTime timeServer;
 
-    // Prepare function
-    int Prepare(Timestamp &timestamp);
+    // Size from which values are compressed, 0 if they are not.
+    size_t compressAbove;
+
+    int Decode(const std::string &key, std::string &value);
+    int Decode(KeyValues &values);
+
+    // Jitter for commit backoffs.
+    std::mt19937_64 backoffRand;
+
+    // Prepare function; on REPLY_OVERLOADED, retryAfter is the longest
+    // wait (in us) a shard asked for.
+    int Prepare(Timestamp &timestamp, uint64_t &retryAfter);
+
+    // A commit timestamp from the clock, raised above the hints the
+    // participants' GETs returned.
+    Timestamp CommitTimestamp();
+
+    // Sleep before retrying a prepare turned away for the given
+    // number of times in a row.
+    void Backoff(int overloads, uint64_t retryAfter);
 
     // Runs the transport event loop.
     void run_client();
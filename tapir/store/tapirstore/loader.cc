@@ -0,0 +1,197 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/loader.cc:
+ *   Parallel bulk loader for initial data sets
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#include "tapir/store/tapirstore/loader.h"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace tapirstore {
+
+using namespace std;
+
+// valueLength of a line without a value
+static const uint32_t NO_VALUE = UINT32_MAX;
+
+BulkLoader::BulkLoader(TxnStore *store, unsigned int shard,
+                       unsigned int nShards, unsigned int nThreads)
+    : store(store), shard(shard), nShards(nShards),
+      nThreads(nThreads > 0 ? nThreads : 1), loaded(0), lines(0) { }
+
+/* Same as ::Client::key_to_shard, without making a string first. */
+uint64_t
+BulkLoader::KeyToShard(const char *key, size_t length, uint64_t nShards)
+{
+    uint64_t hash = 5381;
+    for (size_t i = 0; i < length; i++) {
+        hash = ((hash << 5) + hash) + (uint64_t)key[i];
+    }
+    return hash % nShards;
+}
+
+/* Find the lines of this shard in [begin, end), which starts and ends
+ * on a line boundary. */
+void
+BulkLoader::Split(const char *begin, const char *end, const char *base,
+                  vector<Line> &found, size_t &count)
+{
+    count = 0;
+    while (begin < end) {
+        const char *eol = (const char *)memchr(begin, '\n', end - begin);
+        if (eol == NULL) {
+            eol = end;
+        }
+        if (eol > begin) {
+            count++;
+            const char *tab = (const char *)memchr(begin, '\t', eol - begin);
+            const char *keyEnd = (tab != NULL) ? tab : eol;
+
+            if (KeyToShard(begin, keyEnd - begin, nShards) == shard) {
+                Line line;
+                line.offset = begin - base;
+                line.keyLength = keyEnd - begin;
+                line.valueLength = (tab != NULL) ? eol - tab - 1 : NO_VALUE;
+                found.push_back(line);
+            }
+        }
+        begin = eol + 1;
+    }
+}
+
+bool
+BulkLoader::Load(const string &path, size_t maxKeys, const Timestamp &timestamp)
+{
+    auto start = chrono::steady_clock::now();
+    loaded = lines = 0;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        Warning("Could not read keys from %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    size_t length = st.st_size;
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+    void *m = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        Warning("Could not map %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    const char *base = (const char *)m;
+    const char *end = base + length;
+    madvise(m, length, MADV_SEQUENTIAL);
+
+    // stop after maxKeys lines
+    if (maxKeys > 0) {
+        const char *p = base;
+        for (size_t n = 0; n < maxKeys && p < end; n++) {
+            const char *eol = (const char *)memchr(p, '\n', end - p);
+            p = (eol != NULL) ? eol + 1 : end;
+        }
+        end = p;
+    }
+
+    // one chunk per thread, each ending on a line boundary
+    vector<const char *> bounds(1, base);
+    for (unsigned int t = 1; t < nThreads; t++) {
+        const char *p = max(bounds.back(), base + (end - base) * t / nThreads);
+        const char *eol = (p < end) ? (const char *)memchr(p, '\n', end - p) : NULL;
+        bounds.push_back((eol != NULL) ? eol + 1 : end);
+    }
+    bounds.push_back(end);
+
+    vector<vector<Line>> found(nThreads);
+    vector<size_t> counts(nThreads);
+    vector<thread> threads;
+    for (unsigned int t = 0; t < nThreads; t++) {
+        threads.push_back(thread([&, t]() {
+            // expect about an even share of the keys
+            found[t].reserve((bounds[t + 1] - bounds[t]) / 16 / nShards);
+            Split(bounds[t], bounds[t + 1], base, found[t], counts[t]);
+        }));
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    size_t total = 0;
+    for (unsigned int t = 0; t < nThreads; t++) {
+        total += found[t].size();
+        lines += counts[t];
+    }
+    store->Reserve(total);
+
+    vector<pair<string, string>> batch;
+    batch.reserve(LOAD_BATCH_KEYS);
+    for (auto &f : found) {
+        for (auto &line : f) {
+            const char *key = base + line.offset;
+            if (line.valueLength == NO_VALUE) {
+                batch.emplace_back(string(key, line.keyLength), "null");
+            } else {
+                batch.emplace_back(string(key, line.keyLength),
+                                   string(key + line.keyLength + 1,
+                                          line.valueLength));
+            }
+            if (batch.size() == LOAD_BATCH_KEYS) {
+                store->LoadBatch(batch, timestamp);
+                loaded += batch.size();
+                batch.clear();
+            }
+        }
+        vector<Line>().swap(f);
+    }
+    if (!batch.empty()) {
+        store->LoadBatch(batch, timestamp);
+        loaded += batch.size();
+    }
+    munmap(m, length);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    Notice("Loaded %lu of %lu keys from %s in %.2f s (%.0f keys/s, %u threads)",
+           loaded, lines, path.c_str(), seconds,
+           seconds > 0 ? loaded / seconds : 0.0, nThreads);
+    return true;
+}
+
+} // namespace tapirstore
@@ -0,0 +1,89 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/loader.h:
+ *   Parallel bulk loader for initial data sets
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+
+#ifndef _TAPIR_LOADER_H_
+#define _TAPIR_LOADER_H_
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/message.h"
+#include "tapir/store/common/timestamp.h"
+#include "tapir/store/common/backend/txnstore.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Keys handed to the store at a time.
+#define LOAD_BATCH_KEYS 65536
+
+namespace tapirstore {
+
+/*
+ * Loads the initial data set of a shard from a file with a key per
+ * line, optionally followed by a tab and its value ("null" if there is
+ * none). The file is mapped and cut into one chunk per thread; each
+ * thread finds the lines in its chunk and keeps those of this shard,
+ * by the same hash the client shards keys by. The store is then sized
+ * for all of them and filled in batches.
+ */
+class BulkLoader
+{
+public:
+    BulkLoader(TxnStore *store, unsigned int shard, unsigned int nShards,
+               unsigned int nThreads);
+
+    // Loads the keys of this shard among the first maxKeys lines of
+    // path (all of them if maxKeys is 0), at timestamp.
+    bool Load(const std::string &path, size_t maxKeys,
+              const Timestamp &timestamp = Timestamp());
+
+    // Keys of this shard loaded, and lines read, by the last Load.
+    size_t Loaded() const { return loaded; };
+    size_t Lines() const { return lines; };
+
+private:
+    // A line of this shard: its key at offset, then the value, if any.
+    struct Line {
+        uint64_t offset;
+        uint32_t keyLength;
+        uint32_t valueLength;
+    };
+
+    TxnStore *store;
+    unsigned int shard, nShards, nThreads;
+    size_t loaded, lines;
+
+    static uint64_t KeyToShard(const char *key, size_t length, uint64_t nShards);
+    void Split(const char *begin, const char *end, const char *base,
+               std::vector<Line> &found, size_t &count);
+};
+
+} // namespace tapirstore
+
+#endif /* _TAPIR_LOADER_H_ */
@@ -0,0 +1,769 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/partitionedstore.cc:
+ *   TAPIR store split into key-hash partitions, each executed by its
+ *   own worker thread.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/tapirstore/partitionedstore.h"
+#include "tapir/lib/hash.h"
+
+#include <algorithm>
+#include <pthread.h>
+
+namespace tapirstore {
+
+using namespace std;
+
+PartitionedStore::PartitionedStore(Isolation isolation, unsigned int nPartitions)
+    : isolation(isolation), log(NULL)
+{
+    ASSERT(nPartitions > 0);
+
+    unsigned int nCores = thread::hardware_concurrency();
+
+    for (unsigned int i = 0; i < nPartitions; i++) {
+        partitions.push_back(new Partition(isolation));
+    }
+
+    for (unsigned int i = 0; i < nPartitions; i++) {
+        Partition *p = partitions[i];
+        p->worker = new thread(&PartitionedStore::RunPartition, this, i);
+
+        // pin each partition to its own core
+        if (nCores > 0) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(i % nCores, &cpuset);
+            if (pthread_setaffinity_np(p->worker->native_handle(),
+                                       sizeof(cpu_set_t), &cpuset) != 0) {
+                Warning("Failed to pin partition %u to core %u", i, i % nCores);
+            }
+        }
+    }
+
+    Notice("Started %u store partitions", nPartitions);
+}
+
+PartitionedStore::~PartitionedStore()
+{
+    for (auto p : partitions) {
+        {
+            lock_guard<mutex> l(p->lock);
+            p->stopping = true;
+        }
+        p->cv.notify_one();
+        p->worker->join();
+        delete p->worker;
+        delete p;
+    }
+}
+
+unsigned int
+PartitionedStore::KeyToPartition(const string &key)
+{
+    // Use a different hash than the client's key_to_shard, otherwise
+    // all keys of a shard would land in the same few partitions.
+    return ::hash(key.data(), key.length(), 0) % partitions.size();
+}
+
+void
+PartitionedStore::Enqueue(unsigned int partition, function<void ()> op)
+{
+    Partition *p = partitions[partition];
+    {
+        lock_guard<mutex> l(p->lock);
+        p->ops.push_back(std::move(op));
+    }
+    p->cv.notify_one();
+}
+
+/* Worker loop for a partition. Operations run in the order they were
+ * enqueued, so a partition sees the same sequence of upcalls as the
+ * single store did. */
+void
+PartitionedStore::RunPartition(unsigned int partition)
+{
+    Partition *p = partitions[partition];
+
+    while (true) {
+        function<void ()> op;
+        {
+            unique_lock<mutex> l(p->lock);
+            while (p->ops.empty() && !p->stopping) {
+                p->cv.wait(l);
+            }
+            if (p->ops.empty()) {
+                return;
+            }
+            op = std::move(p->ops.front());
+            p->ops.pop_front();
+        }
+        op();
+    }
+}
+
+int
+PartitionedStore::Get(uint64_t id, const string &key, pair<Timestamp,string> &value)
+{
+    Partition *p = partitions[KeyToPartition(key)];
+    Promise promise;
+
+    Enqueue(KeyToPartition(key), [=, &promise]() {
+        pair<Timestamp, string> val;
+        int status = p->store.Get(id, key, val);
+        promise.Reply(status, val.first, val.second);
+    });
+
+    int status = promise.GetReply();
+    value.first = promise.GetTimestamp();
+    value.second = promise.GetValue();
+    return status;
+}
+
+int
+PartitionedStore::Get(uint64_t id, const string &key, const Timestamp &timestamp,
+                      pair<Timestamp,string> &value)
+{
+    Partition *p = partitions[KeyToPartition(key)];
+    Promise promise;
+
+    Enqueue(KeyToPartition(key), [=, &promise]() {
+        pair<Timestamp, string> val;
+        int status = p->store.Get(id, key, timestamp, val);
+        promise.Reply(status, val.first, val.second);
+    });
+
+    int status = promise.GetReply();
+    value.first = promise.GetTimestamp();
+    value.second = promise.GetValue();
+    return status;
+}
+
+int
+PartitionedStore::GetWithHints(uint64_t id, const string &key,
+                               pair<Timestamp,string> &value,
+                               Timestamp &lastRead, Timestamp &pendingWrite)
+{
+    Partition *p = partitions[KeyToPartition(key)];
+    Promise promise;
+
+    // the hints do not fit the promise; the worker fills them in
+    // before it replies
+    Enqueue(KeyToPartition(key), [=, &promise, &lastRead, &pendingWrite]() {
+        pair<Timestamp, string> val;
+        int status = p->store.GetWithHints(id, key, val, lastRead, pendingWrite);
+        promise.Reply(status, val.first, val.second);
+    });
+
+    int status = promise.GetReply();
+    value.first = promise.GetTimestamp();
+    value.second = promise.GetValue();
+    return status;
+}
+
+int
+PartitionedStore::GetSnapshot(uint64_t id, const string &key, const Timestamp &timestamp,
+                              pair<Timestamp,string> &value)
+{
+    Partition *p = partitions[KeyToPartition(key)];
+    Promise promise;
+
+    Enqueue(KeyToPartition(key), [=, &promise]() {
+        pair<Timestamp, string> val;
+        int status = p->store.GetSnapshot(id, key, timestamp, val);
+        promise.Reply(status, val.first, val.second);
+    });
+
+    int status = promise.GetReply();
+    value.first = promise.GetTimestamp();
+    value.second = promise.GetValue();
+    return status;
+}
+
+/* Keys are spread over the partitions by hash, so every partition
+ * scans the range, and the first limit keys of the union are kept. */
+int
+PartitionedStore::Scan(uint64_t id, const string &start, const string &end,
+                       size_t limit, KeyValues &values)
+{
+    vector<Promise *> promises;
+    for (unsigned int i = 0; i < partitions.size(); i++) {
+        Partition *p = partitions[i];
+        Promise *promise = new Promise();
+        Enqueue(i, [=]() {
+            KeyValues vals;
+            int status = p->store.Scan(id, start, end, limit, vals);
+            promise->Reply(status, vals);
+        });
+        promises.push_back(promise);
+    }
+
+    int status = REPLY_OK;
+    for (auto promise : promises) {
+        if (promise->GetReply() != REPLY_OK) {
+            status = promise->GetReply();
+        }
+        KeyValues vals = promise->GetValues();
+        values.insert(vals.begin(), vals.end());
+        delete promise;
+    }
+
+    if (limit > 0 && values.size() > limit) {
+        auto it = values.begin();
+        advance(it, limit);
+        values.erase(it, values.end());
+    }
+    return status;
+}
+
+int
+PartitionedStore::Prepare(uint64_t id, const Transaction &txn,
+                          const Timestamp &timestamp, Timestamp &proposed)
+{
+    return Prepare(id, TransactionView(txn), timestamp, proposed);
+}
+
+int
+PartitionedStore::Prepare(uint64_t id, const TransactionView &txn,
+                          const Timestamp &timestamp, Timestamp &proposed)
+{
+    return Prepare(id, txn, timestamp, isolation, proposed);
+}
+
+int
+PartitionedStore::Prepare(uint64_t id, const TransactionView &txn,
+                          const Timestamp &timestamp, Isolation isolation,
+                          Timestamp &proposed)
+{
+    PrepareRequest request;
+    request.id = id;
+    request.txn = txn;
+    request.timestamp = timestamp;
+    request.isolated = true;
+    request.isolation = isolation;
+
+    Promise promise;
+    PrepareAsync(request, [&]() { promise.Reply(request.status); });
+
+    int status = promise.GetReply();
+    if (status == REPLY_RETRY && request.proposed > proposed) {
+        proposed = request.proposed;
+    }
+    return status;
+}
+
+/* Prepare each partition's piece of the transaction in parallel; the
+ * worker that counts the last vote finishes the prepare. The
+ * transaction is prepared only if every partition prepared it;
+ * otherwise the pieces that did prepare are aborted again. The reads
+ * of a read-only transaction are validated the same way, but nothing
+ * stays prepared. */
+void
+PartitionedStore::PrepareAsync(PrepareRequest &request, function<void ()> done)
+{
+    uint64_t id = request.id;
+    Timestamp timestamp = request.timestamp;
+    Isolation isolation = request.isolated ? request.isolation : this->isolation;
+
+    // the pieces share the transaction's message; no ops are copied
+    vector<TransactionView> parts;
+    request.txn.split(partitions.size(),
+                      [this](const string &key) { return KeyToPartition(key); },
+                      parts);
+
+    size_t pending = 0;
+    for (auto &part : parts) {
+        if (!part.empty()) {
+            pending++;
+        }
+    }
+
+    bool readOnly = request.readOnly;
+    shared_ptr<Vote> vote;
+    if (readOnly) {
+        vote = make_shared<Vote>(&request, std::move(done));
+        vote->pending = pending;
+    } else {
+        lock_guard<mutex> l(votesLock);
+        // a retried prepare goes after the one it retries
+        PrepareRequest *r = &request;
+        if (Defer(id, [this, r, done]() { PrepareAsync(*r, done); })) {
+            return;
+        }
+        vote = make_shared<Vote>(&request, std::move(done));
+        vote->pending = pending;
+
+        // make sure any pieces from an earlier prepare of this
+        // transaction go away if this prepare no longer touches their
+        // partition
+        auto old = participants.find(id);
+        if (old != participants.end()) {
+            for (auto i : old->second.partitions) {
+                if (parts[i].empty()) {
+                    Partition *p = partitions[i];
+                    Enqueue(i, [=]() { p->store.Abort(id); });
+                }
+            }
+            participants.erase(old);
+        }
+
+        if (pending == 0) {
+            Prepared &prepared = participants[id];
+            prepared.txn = request.txn;
+            prepared.timestamp = timestamp;
+            prepared.readAt = Store::ReadAt(request.txn, timestamp, isolation);
+        } else {
+            voting[id] = vote;
+        }
+    }
+
+    if (pending == 0) {
+        request.status = REPLY_OK;
+        vote->done();
+        return;
+    }
+
+    for (unsigned int i = 0; i < parts.size(); i++) {
+        if (parts[i].empty()) {
+            continue;
+        }
+        Partition *p = partitions[i];
+        TransactionView t = parts[i];
+        Enqueue(i, [=]() {
+            Timestamp prop;
+            int status = readOnly
+                ? p->store.CommitReads(id, t, timestamp)
+                : p->store.Prepare(id, t, timestamp, isolation, prop);
+            CountVote(vote, i, status, prop);
+        });
+    }
+}
+
+/* Runs on the worker of the partition that voted. */
+void
+PartitionedStore::CountVote(const shared_ptr<Vote> &vote, unsigned int partition,
+                            int status, const Timestamp &proposed)
+{
+    uint64_t id = vote->request->id;
+    vector<function<void ()>> after;
+    {
+        lock_guard<mutex> l(votesLock);
+        switch (status) {
+        case REPLY_OK:
+            vote->ok.push_back(partition);
+            break;
+        case REPLY_FAIL:
+            vote->status = REPLY_FAIL;
+            break;
+        case REPLY_RETRY:
+            if (vote->status != REPLY_FAIL) {
+                vote->status = REPLY_RETRY;
+                if (proposed > vote->proposed) {
+                    vote->proposed = proposed;
+                }
+            }
+            break;
+        case REPLY_ABSTAIN:
+            vote->abstain = true;
+            break;
+        default:
+            Panic("Unexpected prepare reply %d", status);
+        }
+        if (--vote->pending > 0) {
+            return;
+        }
+
+        if (vote->status == REPLY_OK && vote->abstain) {
+            vote->status = REPLY_ABSTAIN;
+        }
+        if (vote->request->readOnly) {
+            // nothing was held prepared
+        } else if (vote->status == REPLY_OK) {
+            PrepareRequest *request = vote->request;
+            Isolation isolation = request->isolated ? request->isolation
+                                                    : this->isolation;
+            Prepared &prepared = participants[id];
+            prepared.partitions = vote->ok;
+            prepared.txn = request->txn;
+            prepared.timestamp = request->timestamp;
+            prepared.readAt = Store::ReadAt(request->txn, request->timestamp,
+                                            isolation);
+        } else {
+            // queued before anything put off until the votes were in
+            for (auto i : vote->ok) {
+                Partition *p = partitions[i];
+                Enqueue(i, [=]() { p->store.Abort(id); });
+            }
+        }
+        vote->request->status = vote->status;
+        if (vote->status == REPLY_RETRY) {
+            vote->request->proposed = vote->proposed;
+        }
+        if (!vote->request->readOnly) {
+            voting.erase(id);
+            after.swap(vote->after);
+        }
+    }
+    vote->done();
+    RunDeferred(id, after);
+}
+
+/* A prepare, commit or abort of a transaction whose votes are still
+ * being counted would race with the workers counting them, so it is
+ * put off rather than waited for; the worker that counts the last
+ * vote runs it. */
+bool
+PartitionedStore::Defer(uint64_t id, function<void ()> op)
+{
+    auto it = voting.find(id);
+    if (it == voting.end()) {
+        return false;
+    }
+    it->second->after.push_back(std::move(op));
+    return true;
+}
+
+void
+PartitionedStore::RunDeferred(uint64_t id, vector<function<void ()>> &ops)
+{
+    for (size_t n = 0; n < ops.size(); n++) {
+        ops[n]();
+
+        // a retried prepare has its own votes to count; the rest wait
+        // for those, ahead of anything that came in since
+        lock_guard<mutex> l(votesLock);
+        auto it = voting.find(id);
+        if (it != voting.end()) {
+            auto &after = it->second->after;
+            after.insert(after.begin(),
+                         make_move_iterator(ops.begin() + n + 1),
+                         make_move_iterator(ops.end()));
+            return;
+        }
+    }
+}
+
+void
+PartitionedStore::ForKey(const string &key, function<void (TxnStore &)> op)
+{
+    Partition *p = partitions[KeyToPartition(key)];
+    Enqueue(KeyToPartition(key), [=]() { op(p->store); });
+}
+
+void
+PartitionedStore::Commit(uint64_t id, uint64_t timestamp)
+{
+    CommitAsync(id, timestamp, []() { });
+}
+
+/* Commits and aborts need no reply, so they are queued and the caller
+ * moves on without waiting for the partitions. The whole transaction
+ * goes into the log as one record before any piece is queued, so
+ * recovery never finds it half committed; done follows the append, so
+ * a reply sent from it is held until the record is durable. */
+void
+PartitionedStore::CommitAsync(uint64_t id, uint64_t timestamp,
+                              function<void ()> done)
+{
+    Prepared prepared;
+    bool found;
+    {
+        lock_guard<mutex> l(votesLock);
+        // the commit may overtake this replica's own vote
+        if (Defer(id, [this, id, timestamp, done]() {
+                CommitAsync(id, timestamp, done);
+            })) {
+            return;
+        }
+        auto it = participants.find(id);
+        found = (it != participants.end());
+        if (found) {
+            prepared = std::move(it->second);
+            participants.erase(it);
+        }
+    }
+
+    if (found && log != NULL) {
+        log->Append(Store::CommitRecord(prepared.txn, prepared.timestamp,
+                                        prepared.readAt));
+    }
+
+    for (auto i : prepared.partitions) {
+        Partition *p = partitions[i];
+        Enqueue(i, [=]() { p->store.Commit(id, timestamp); });
+    }
+    done();
+}
+
+int
+PartitionedStore::CommitReads(uint64_t id, const TransactionView &txn,
+                              const Timestamp &timestamp)
+{
+    PrepareRequest request;
+    request.id = id;
+    request.txn = txn;
+    request.timestamp = timestamp;
+    request.readOnly = true;
+
+    Promise promise;
+    PrepareAsync(request, [&]() { promise.Reply(request.status); });
+    return promise.GetReply();
+}
+
+void
+PartitionedStore::Abort(uint64_t id, const Transaction &txn)
+{
+    lock_guard<mutex> l(votesLock);
+    if (Defer(id, [this, id]() { Abort(id); })) {
+        return;
+    }
+    auto it = participants.find(id);
+    if (it == participants.end()) {
+        return;
+    }
+
+    for (auto i : it->second.partitions) {
+        Partition *p = partitions[i];
+        Enqueue(i, [=]() { p->store.Abort(id); });
+    }
+    participants.erase(it);
+}
+
+void
+PartitionedStore::Load(const string &key, const string &value, const Timestamp &timestamp)
+{
+    Partition *p = partitions[KeyToPartition(key)];
+    Enqueue(KeyToPartition(key), [=]() {
+        p->store.Load(key, value, timestamp);
+    });
+}
+
+/* Split the batch by partition and load the pieces in parallel. */
+void
+PartitionedStore::LoadBatch(const vector<pair<string, string>> &values,
+                            const Timestamp &timestamp)
+{
+    vector<vector<pair<string, string>>> parts(partitions.size());
+    for (auto &kv : values) {
+        parts[KeyToPartition(kv.first)].push_back(kv);
+    }
+
+    ForAllPartitions([&](Store &store, unsigned int i) {
+        store.LoadBatch(parts[i], timestamp);
+        return true;
+    });
+}
+
+void
+PartitionedStore::Reserve(size_t n)
+{
+    // keys spread evenly, give or take
+    size_t share = n / partitions.size() + n / (8 * partitions.size()) + 1;
+    ForAllPartitions([=](Store &store, unsigned int i) {
+        store.Reserve(share);
+        return true;
+    });
+}
+
+void
+PartitionedStore::GC(const Timestamp &horizon, size_t slice)
+{
+    for (unsigned int i = 0; i < partitions.size(); i++) {
+        Partition *p = partitions[i];
+        Enqueue(i, [=]() { p->store.GC(horizon, slice); });
+    }
+}
+
+void
+PartitionedStore::Expire(const Timestamp &horizon, size_t slice)
+{
+    for (unsigned int i = 0; i < partitions.size(); i++) {
+        Partition *p = partitions[i];
+        Enqueue(i, [=]() { p->store.Expire(horizon, slice); });
+    }
+}
+
+void
+PartitionedStore::Tier(const Timestamp &horizon, size_t slice)
+{
+    for (unsigned int i = 0; i < partitions.size(); i++) {
+        Partition *p = partitions[i];
+        Enqueue(i, [=]() { p->store.Tier(horizon, slice); });
+    }
+}
+
+bool
+PartitionedStore::ForAllPartitions(function<bool (Store &, unsigned int)> op)
+{
+    vector<Promise *> promises;
+    for (unsigned int i = 0; i < partitions.size(); i++) {
+        Partition *p = partitions[i];
+        Promise *promise = new Promise();
+        Enqueue(i, [=]() {
+            promise->Reply(op(p->store, i) ? REPLY_OK : REPLY_FAIL);
+        });
+        promises.push_back(promise);
+    }
+
+    bool ok = true;
+    for (auto promise : promises) {
+        ok = (promise->GetReply() == REPLY_OK) && ok;
+        delete promise;
+    }
+    return ok;
+}
+
+/* Redo each logged commit piece by piece, on the partitions that now
+ * hold its keys. */
+void
+PartitionedStore::Recover(WriteAheadLog *log)
+{
+    ASSERT(this->log == NULL);
+    size_t n = 0;
+    log->Replay([&](const string &record) {
+        TransactionView txn;
+        Timestamp timestamp, readAt;
+        if (!Store::ParseCommit(record, txn, timestamp, readAt)) {
+            return;
+        }
+        vector<TransactionView> parts;
+        txn.split(partitions.size(),
+                  [this](const string &key) { return KeyToPartition(key); },
+                  parts);
+        for (unsigned int i = 0; i < parts.size(); i++) {
+            if (parts[i].empty()) {
+                continue;
+            }
+            Partition *p = partitions[i];
+            TransactionView t = parts[i];
+            Enqueue(i, [=]() { p->store.Redo(t, timestamp, readAt); });
+        }
+        n++;
+    });
+    // wait for the partitions to catch up
+    ForAllPartitions([](Store &store, unsigned int i) { return true; });
+    Notice("Recovered %lu commits from %s", n, log->Filename().c_str());
+}
+
+/* Only Commit logs, one record for the whole transaction; the
+ * partitions' stores do not log their pieces. */
+void
+PartitionedStore::SetLog(WriteAheadLog *log)
+{
+    this->log = log;
+}
+
+/* Each partition has its own engine in dir.<partition>, and an even
+ * share of the cache. */
+bool
+PartitionedStore::OpenEngine(const string &dir, size_t cacheBytes)
+{
+    size_t share = cacheBytes / partitions.size();
+    return ForAllPartitions([=](Store &store, unsigned int i) {
+        return store.OpenEngine(dir + "." + to_string(i), share);
+    });
+}
+
+bool
+PartitionedStore::OpenHistory(const string &dir)
+{
+    return ForAllPartitions([=](Store &store, unsigned int i) {
+        return store.OpenHistory(dir + "." + to_string(i));
+    });
+}
+
+/* Each partition has its own checkpoint file, path.<partition>. */
+bool
+PartitionedStore::LoadCheckpoint(const string &path)
+{
+    return ForAllPartitions([=](Store &store, unsigned int i) {
+        return store.LoadCheckpoint(path + "." + to_string(i));
+    });
+}
+
+bool
+PartitionedStore::WriteCheckpoint(const string &path, bool history)
+{
+    return ForAllPartitions([=](Store &store, unsigned int i) {
+        return store.WriteCheckpoint(path + "." + to_string(i), history);
+    });
+}
+
+/* The store is closed only as far as its least closed partition. */
+Timestamp
+PartitionedStore::Close(const Timestamp &bound)
+{
+    vector<Promise *> promises;
+    for (unsigned int i = 0; i < partitions.size(); i++) {
+        Partition *p = partitions[i];
+        Promise *promise = new Promise();
+        Enqueue(i, [=]() { promise->Reply(REPLY_OK, p->store.Close(bound)); });
+        promises.push_back(promise);
+    }
+
+    Timestamp closed = bound;
+    for (auto promise : promises) {
+        promise->GetReply();
+        if (promise->GetTimestamp() < closed) {
+            closed = promise->GetTimestamp();
+        }
+        delete promise;
+    }
+    return closed;
+}
+
+/* Every prepared transaction has its pieces in participants, so there
+ * is no need to ask the partitions. */
+size_t
+PartitionedStore::PreparedCount()
+{
+    lock_guard<mutex> l(votesLock);
+    return participants.size();
+}
+
+/* Each key is in one partition, so the partitions' top keys are simply
+ * put together. */
+void
+PartitionedStore::Contention(vector<ContentionEntry> &top, uint64_t &total,
+                             bool reset)
+{
+    mutex lock;
+    ForAllPartitions([&](Store &store, unsigned int i) {
+        vector<ContentionEntry> part;
+        uint64_t n = 0;
+        store.Contention(part, n, reset);
+        lock_guard<mutex> l(lock);
+        top.insert(top.end(), part.begin(), part.end());
+        total += n;
+        return true;
+    });
+    sort(top.begin(), top.end(),
+         [](const ContentionEntry &a, const ContentionEntry &b) {
+             return a.count > b.count;
+         });
+}
+
+} // namespace tapirstore
@@ -0,0 +1,163 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/partitionedstore.h:
+ *   TAPIR store split into key-hash partitions, each executed by its
+ *   own worker thread.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _TAPIR_PARTITIONED_STORE_H_
+#define _TAPIR_PARTITIONED_STORE_H_
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/message.h"
+#include "tapir/store/common/promise.h"
+#include "tapir/store/common/timestamp.h"
+#include "tapir/store/common/transaction.h"
+#include "tapir/store/common/backend/txnstore.h"
+#include "tapir/store/tapirstore/store.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace tapirstore {
+
+class PartitionedStore : public TxnStore {
+
+public:
+    PartitionedStore(Isolation isolation, unsigned int nPartitions);
+    ~PartitionedStore();
+
+    // Overriding from TxnStore
+    int Get(uint64_t id, const std::string &key, std::pair<Timestamp, std::string> &value);
+    int Get(uint64_t id, const std::string &key, const Timestamp &timestamp, std::pair<Timestamp, std::string> &value);
+    int GetWithHints(uint64_t id, const std::string &key, std::pair<Timestamp, std::string> &value, Timestamp &lastRead, Timestamp &pendingWrite);
+    int GetSnapshot(uint64_t id, const std::string &key, const Timestamp &timestamp, std::pair<Timestamp, std::string> &value);
+    int Scan(uint64_t id, const std::string &start, const std::string &end, size_t limit, KeyValues &values);
+    int Prepare(uint64_t id, const Transaction &txn, const Timestamp &timestamp, Timestamp &proposed);
+    int Prepare(uint64_t id, const TransactionView &txn, const Timestamp &timestamp, Timestamp &proposed);
+    int Prepare(uint64_t id, const TransactionView &txn, const Timestamp &timestamp, Isolation isolation, Timestamp &proposed);
+    void PrepareAsync(PrepareRequest &request, std::function<void ()> done);
+    void ForKey(const std::string &key, std::function<void (TxnStore &)> op);
+    void Commit(uint64_t id, uint64_t timestamp = 0);
+    void CommitAsync(uint64_t id, uint64_t timestamp, std::function<void ()> done);
+    int CommitReads(uint64_t id, const TransactionView &txn, const Timestamp &timestamp);
+    void Abort(uint64_t id, const Transaction &txn = Transaction());
+    void Load(const std::string &key, const std::string &value, const Timestamp &timestamp);
+    void LoadBatch(const std::vector<std::pair<std::string, std::string>> &values, const Timestamp &timestamp);
+    void Reserve(size_t n);
+    void GC(const Timestamp &horizon, size_t slice);
+    void Expire(const Timestamp &horizon, size_t slice);
+    void Recover(WriteAheadLog *log);
+    void SetLog(WriteAheadLog *log);
+    bool OpenEngine(const std::string &dir, size_t cacheBytes);
+    bool OpenHistory(const std::string &dir);
+    void Tier(const Timestamp &horizon, size_t slice);
+    bool LoadCheckpoint(const std::string &path);
+    bool WriteCheckpoint(const std::string &path, bool history);
+    Timestamp Close(const Timestamp &bound);
+    size_t PreparedCount();
+    void Contention(std::vector<ContentionEntry> &top, uint64_t &total, bool reset);
+
+private:
+    // A single partition: its own version store and prepared index,
+    // only ever touched from the partition's worker thread.
+    struct Partition {
+        Store store;
+        std::thread *worker;
+        std::deque<std::function<void ()>> ops;
+        std::mutex lock;
+        std::condition_variable cv;
+        bool stopping;
+
+        Partition(Isolation isolation)
+            : store(isolation), worker(NULL), stopping(false) { };
+    };
+
+    std::vector<Partition *> partitions;
+
+    // Isolation level for transactions that do not ask for one.
+    Isolation isolation;
+
+    // Write-ahead log the partitions share, if any.
+    WriteAheadLog *log;
+
+    // The votes on a prepare, counted by the partitions' workers as
+    // they come in.
+    struct Vote {
+        PrepareRequest *request;
+        std::function<void ()> done;
+        size_t pending;
+        int status;
+        bool abstain;
+        Timestamp proposed;
+        std::vector<unsigned int> ok;
+        // prepares, commits and aborts of the transaction that came in
+        // while its votes were being counted, in order
+        std::vector<std::function<void ()>> after;
+
+        Vote(PrepareRequest *request, std::function<void ()> done)
+            : request(request), done(std::move(done)), pending(0),
+              status(REPLY_OK), abstain(false) { };
+    };
+
+    // A prepared transaction: the partitions holding a piece of it, and
+    // what its commit record needs.
+    struct Prepared {
+        std::vector<unsigned int> partitions;
+        TransactionView txn;
+        Timestamp timestamp;
+        Timestamp readAt;
+    };
+
+    // Each prepared transaction, and the transactions whose votes are
+    // still coming in.
+    std::unordered_map<uint64_t, Prepared> participants;
+    std::unordered_map<uint64_t, std::shared_ptr<Vote>> voting;
+    std::mutex votesLock;
+
+    unsigned int KeyToPartition(const std::string &key);
+    void CountVote(const std::shared_ptr<Vote> &vote, unsigned int partition,
+                   int status, const Timestamp &proposed);
+    // With votesLock held, puts op off until id's votes are all in;
+    // false if none are being counted.
+    bool Defer(uint64_t id, std::function<void ()> op);
+    // Runs the ops put off until id's votes were in, in order.
+    void RunDeferred(uint64_t id, std::vector<std::function<void ()>> &ops);
+    void Enqueue(unsigned int partition, std::function<void ()> op);
+    void RunPartition(unsigned int partition);
+    // Runs op on every partition's worker and waits; true if op
+    // returned true on all of them.
+    bool ForAllPartitions(std::function<bool (Store &, unsigned int)> op);
+};
+
+} // namespace tapirstore
+
+#endif /* _TAPIR_PARTITIONED_STORE_H_ */
@@ -31,18 +31,69 @@
 
 #include "tapir/store/tapirstore/server.h"
 
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_set>
+
 namespace tapirstore {
 
 using namespace std;
 using namespace proto;
 
-Server::Server(bool linearizable)
+static volatile sig_atomic_t contentionDumpRequested = 0;
+
+Server::Server(Isolation isolation, unsigned int nPartitions)
+    : partitioned(nPartitions > 1),
+      gcTimeout(NULL), gcRetention(0), expiryTimeout(NULL),
+      tierTimeout(NULL), tierWindow(0),
+      checkpointTimeout(NULL), checkpointHistory(false),
+      transport(NULL), terminator(NULL),
+      leaseMs(0), replicaIdx(0), nReplicas(1), outcomeTimeout(NULL),
+      closeTimeout(NULL), closeLag(0), admission(NULL), preparing(0),
+      contentionTimeout(NULL), contentionInterval(0), contentionElapsed(0),
+      replica(NULL)
 {
-	store = new Store(linearizable);
+    if (partitioned) {
+        store = new PartitionedStore(isolation, nPartitions);
+    } else {
+        store = new Store(isolation);
+    }
 }
 
 Server::~Server()
 {
+    if (gcTimeout != NULL) {
+        delete gcTimeout;
+    }
+    if (expiryTimeout != NULL) {
+        delete expiryTimeout;
+    }
+    if (tierTimeout != NULL) {
+        delete tierTimeout;
+    }
+    if (checkpointTimeout != NULL) {
+        delete checkpointTimeout;
+    }
+    if (outcomeTimeout != NULL) {
+        delete outcomeTimeout;
+    }
+    if (closeTimeout != NULL) {
+        delete closeTimeout;
+    }
+    if (terminator != NULL) {
+        delete terminator;
+    }
+    if (admission != NULL) {
+        delete admission;
+    }
+    if (contentionTimeout != NULL) {
+        delete contentionTimeout;
+    }
     delete store;
 }
 
@@ -52,49 +103,121 @@ Server::setIRReplica(replication::ir::IRReplica *replica)
 	this->replica = replica;
 }
 
+void
+Server::SetTransport(Transport *transport)
+{
+    this->transport = transport;
+}
+
 void
 Server::ExecInconsistentUpcall(const string &str1)
 {
     Debug("Received Inconsistent Request: %s",  str1.c_str());
 
-    Request request;
+    // on an arena, as the store may hold on to a transaction in it
+    auto arena = make_shared<google::protobuf::Arena>();
+    Request &request =
+        *google::protobuf::Arena::CreateMessage<Request>(arena.get());
 
     request.ParseFromString(str1);
 
     switch (request.op()) {
     case tapirstore::proto::Request::COMMIT:
         store->Commit(request.txnid(), request.commit().timestamp());
+        Decided(request.txnid(), TXN_COMMITTED);
         break;
     case tapirstore::proto::Request::ABORT:
-        store->Abort(request.txnid(), Transaction(request.abort().txn()));
+        // the store only needs the id; skip rebuilding the transaction
+        store->Abort(request.txnid());
+        Decided(request.txnid(), TXN_ABORTED);
         break;
     default:
         Panic("Unrecognized inconsisternt operation.");
     }
 }
 
+/* With a partitioned store, a commit may have to wait for this
+ * replica's own vote on the transaction; rather than blocking the
+ * transport loop on it, the confirmation goes out once the store has
+ * logged the commit. */
+void
+Server::ExecInconsistentUpcallAsync(const string &str1, function<void ()> done)
+{
+    if (!partitioned || transport == NULL) {
+        IRAppReplica::ExecInconsistentUpcallAsync(str1, done);
+        return;
+    }
+
+    Request request;
+    request.ParseFromString(str1);
+    if (request.op() != tapirstore::proto::Request::COMMIT) {
+        IRAppReplica::ExecInconsistentUpcallAsync(str1, done);
+        return;
+    }
+
+    store->CommitAsync(request.txnid(), request.commit().timestamp(),
+                       [this, done]() { transport->Timer(0, done); });
+    Decided(request.txnid(), TXN_COMMITTED);
+}
+
 void
 Server::ExecConsensusUpcall(const string &str1, string &str2)
 {
     Debug("Received Consensus Request: %s", str1.c_str());
 
-    Request request;
+    // Parse onto an arena that the store keeps alive for as long as
+    // it holds the transaction, so the prepared set refers to the
+    // received message instead of a copy of it.
+    auto arena = make_shared<google::protobuf::Arena>();
+    Request &request =
+        *google::protobuf::Arena::CreateMessage<Request>(arena.get());
     Reply reply;
     int status;
     Timestamp proposed;
+    uint64_t retryAfter = 0;
 
     request.ParseFromString(str1);
 
     switch (request.op()) {
     case tapirstore::proto::Request::PREPARE:
-        status = store->Prepare(request.txnid(),
-                                Transaction(request.prepare().txn()),
-                                Timestamp(request.prepare().timestamp()),
-                                proposed);
-        reply.set_status(status);
+        if (AdmitPrepare(request, 0, status, retryAfter)) {
+            TransactionView txn(arena, &request.prepare().txn());
+            Timestamp timestamp(request.prepare().timestamp());
+            auto start = chrono::steady_clock::now();
+            if (request.prepare().has_isolation()) {
+                status = store->Prepare(request.txnid(), txn, timestamp,
+                                        (Isolation)request.prepare().isolation(),
+                                        proposed);
+            } else {
+                status = store->Prepare(request.txnid(), txn, timestamp,
+                                        proposed);
+            }
+            if (admission != NULL) {
+                admission->Done(chrono::duration_cast<chrono::microseconds>(
+                    chrono::steady_clock::now() - start).count());
+            }
+            Prepared(request, status);
+        }
+        PrepareReply(status, proposed, retryAfter, str2);
+        break;
+    case tapirstore::proto::Request::STATUS:
+    {
+        bool finalized = false;
+        reply.set_status(Status(request.txnid(), proposed, finalized));
         if (proposed.isValid()) {
             proposed.serialize(reply.mutable_timestamp());
         }
+        if (finalized) {
+            reply.set_finalized(true);
+        }
+        reply.SerializeToString(&str2);
+        break;
+    }
+    case tapirstore::proto::Request::COMMIT_READS:
+        reply.set_status(
+            store->CommitReads(request.txnid(),
+                               TransactionView(arena, &request.commitreads().txn()),
+                               Timestamp(request.commitreads().timestamp())));
         reply.SerializeToString(&str2);
         break;
     default:
@@ -103,6 +226,256 @@ Server::ExecConsensusUpcall(const string &str1, string &str2)
 
 }
 
+/* Prepares of the batch go to the store together, in runs that end at
+ * the first op of another kind, or a second prepare of the same
+ * transaction, so that ops still take effect in the order received. */
+void
+Server::ExecConsensusUpcallBatch(const vector<string> &ops,
+                                 vector<string> &results)
+{
+    results.resize(ops.size());
+
+    vector<PrepareRequest> batch;
+    vector<const Request *> requests;
+    vector<size_t> slots;
+    unordered_set<uint64_t> txnids;
+
+    auto prepareBatch = [&]() {
+        if (batch.empty()) {
+            return;
+        }
+        auto start = chrono::steady_clock::now();
+        store->PrepareBatch(batch);
+        if (admission != NULL) {
+            uint64_t us = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start).count();
+            for (size_t i = 0; i < batch.size(); i++) {
+                admission->Done(us / batch.size());
+            }
+        }
+        for (size_t i = 0; i < batch.size(); i++) {
+            Prepared(*requests[i], batch[i].status);
+            PrepareReply(batch[i].status, batch[i].proposed, 0,
+                         results[slots[i]]);
+        }
+        batch.clear();
+        requests.clear();
+        slots.clear();
+        txnids.clear();
+    };
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        // each prepare keeps its own arena alive, as it would alone
+        auto arena = make_shared<google::protobuf::Arena>();
+        Request &request =
+            *google::protobuf::Arena::CreateMessage<Request>(arena.get());
+        request.ParseFromString(ops[i]);
+
+        if (request.op() != tapirstore::proto::Request::PREPARE ||
+            txnids.count(request.txnid()) > 0) {
+            prepareBatch();
+        }
+        if (request.op() != tapirstore::proto::Request::PREPARE) {
+            ExecConsensusUpcall(ops[i], results[i]);
+            continue;
+        }
+
+        int status;
+        uint64_t retryAfter = 0;
+        if (!AdmitPrepare(request, batch.size(), status, retryAfter)) {
+            PrepareReply(status, Timestamp(), retryAfter, results[i]);
+            continue;
+        }
+
+        batch.push_back(PrepareFor(arena, request));
+        requests.push_back(&request);
+        slots.push_back(i);
+        txnids.insert(request.txnid());
+    }
+    prepareBatch();
+}
+
+/* A prepare, or the reads of a read-only transaction, go to the
+ * partitions and the transport loop moves on; the worker that counts
+ * the last vote sends the rest of the op back to the loop. Other ops
+ * finish right away. */
+void
+Server::ExecConsensusUpcallAsync(const string &str1,
+                                 function<void (const string &)> done)
+{
+    if (!partitioned || transport == NULL) {
+        IRAppReplica::ExecConsensusUpcallAsync(str1, done);
+        return;
+    }
+
+    auto arena = make_shared<google::protobuf::Arena>();
+    Request *request =
+        google::protobuf::Arena::CreateMessage<Request>(arena.get());
+    request->ParseFromString(str1);
+
+    if (request->op() == tapirstore::proto::Request::COMMIT_READS) {
+        auto reads = make_shared<PrepareRequest>();
+        reads->id = request->txnid();
+        reads->txn = TransactionView(arena, &request->commitreads().txn());
+        reads->timestamp = Timestamp(request->commitreads().timestamp());
+        reads->readOnly = true;
+        store->PrepareAsync(*reads, [this, arena, reads, done]() {
+            transport->Timer(0, [reads, done]() {
+                Reply reply;
+                reply.set_status(reads->status);
+                string str2;
+                reply.SerializeToString(&str2);
+                done(str2);
+            });
+        });
+        return;
+    }
+
+    if (request->op() != tapirstore::proto::Request::PREPARE) {
+        IRAppReplica::ExecConsensusUpcallAsync(str1, done);
+        return;
+    }
+
+    int status;
+    uint64_t retryAfter = 0;
+    if (!AdmitPrepare(*request, preparing, status, retryAfter)) {
+        string str2;
+        PrepareReply(status, Timestamp(), retryAfter, str2);
+        done(str2);
+        return;
+    }
+
+    auto prepare = make_shared<PrepareRequest>(PrepareFor(arena, *request));
+    auto start = chrono::steady_clock::now();
+    preparing++;
+    // request lives on arena, so both go along to the reply
+    store->PrepareAsync(*prepare, [this, arena, request, prepare, start, done]() {
+        transport->Timer(0, [this, arena, request, prepare, start, done]() {
+            preparing--;
+            if (admission != NULL) {
+                admission->Done(chrono::duration_cast<chrono::microseconds>(
+                    chrono::steady_clock::now() - start).count());
+            }
+
+            int outcome;
+            if (GetOutcome(request->txnid(), outcome)) {
+                // committed, aborted or fenced off by a terminator while
+                // the partitions were voting
+                if (outcome != TXN_COMMITTED && prepare->status == REPLY_OK) {
+                    store->Abort(request->txnid());
+                }
+                prepare->status =
+                    (outcome == TXN_COMMITTED) ? REPLY_OK : REPLY_FAIL;
+            } else {
+                Prepared(*request, prepare->status);
+            }
+
+            string str2;
+            PrepareReply(prepare->status, prepare->proposed, 0, str2);
+            done(str2);
+        });
+    });
+}
+
+/* Whether a prepare should go on to the store, with pending more ahead
+ * of it; if not, status (and retryAfter) is its outcome. */
+bool
+Server::AdmitPrepare(const Request &request, size_t pending, int &status,
+                     uint64_t &retryAfter)
+{
+    if (GetOutcome(request.txnid(), status)) {
+        // decided by a terminator (or fenced off by one) while this
+        // prepare was on its way
+        status = (status == TXN_COMMITTED) ? REPLY_OK : REPLY_FAIL;
+        return false;
+    }
+    if (admission != NULL &&
+        !admission->Admit(store->PreparedCount() + pending, retryAfter)) {
+        // shed the prepare before it adds to the backlog; the client
+        // retries it once the replica has caught up
+        status = REPLY_OVERLOADED;
+        return false;
+    }
+    return true;
+}
+
+/* Keep the lease and the vote of a prepare that went to the store up
+ * to date. */
+void
+Server::Prepared(const Request &request, int status)
+{
+    if (terminator != NULL) {
+        DropLease(request.txnid());
+        if (status == REPLY_OK) {
+            AddLease(request.txnid(), request.prepare());
+        }
+        Vote &vote = votes[request.txnid()];
+        vote.status = status;
+        vote.timestamp = Timestamp(request.prepare().timestamp());
+        vote.finalized = false;
+    }
+}
+
+/* Once the client's decision on a prepare is final, STATUS answers
+ * with it rather than with this replica's own vote. */
+void
+Server::FinalizeConsensusUpcall(const string &str1, const string &str2)
+{
+    if (terminator == NULL) {
+        return;
+    }
+
+    RequestHeader request;
+    request.ParseFromString(str1);
+    if (request.op() != tapirstore::proto::Request::PREPARE) {
+        return;
+    }
+    Reply reply;
+    reply.ParseFromString(str2);
+
+    Timestamp timestamp(request.prepare().timestamp());
+    auto it = votes.find(request.txnid());
+    if (it != votes.end() && it->second.timestamp > timestamp) {
+        // an earlier round of the prepare
+        return;
+    }
+    Vote &vote = votes[request.txnid()];
+    vote.status = reply.status();
+    vote.timestamp = timestamp;
+    vote.finalized = true;
+}
+
+/* The store's view of a PREPARE request parsed onto arena. */
+PrepareRequest
+Server::PrepareFor(const shared_ptr<google::protobuf::Arena> &arena,
+                   const Request &request)
+{
+    PrepareRequest r;
+    r.id = request.txnid();
+    r.txn = TransactionView(arena, &request.prepare().txn());
+    r.timestamp = Timestamp(request.prepare().timestamp());
+    if (request.prepare().has_isolation()) {
+        r.isolated = true;
+        r.isolation = (Isolation)request.prepare().isolation();
+    }
+    return r;
+}
+
+void
+Server::PrepareReply(int status, const Timestamp &proposed,
+                     uint64_t retryAfter, string &str)
+{
+    Reply reply;
+    reply.set_status(status);
+    if (proposed.isValid()) {
+        proposed.serialize(reply.mutable_timestamp());
+    }
+    if (status == REPLY_OVERLOADED) {
+        reply.set_retryafter(retryAfter);
+    }
+    reply.SerializeToString(&str);
+}
+
 void
 Server::UnloggedUpcall(const string &str1, string &str2)
 {
@@ -116,29 +489,191 @@ Server::UnloggedUpcall(const string &str1, string &str2)
 
     switch (request.op()) {
     case tapirstore::proto::Request::GET:
-        if (request.get().has_timestamp()) {
-            pair<Timestamp, string> val;
-            status = store->Get(request.txnid(), request.get().key(),
-                               request.get().timestamp(), val);
-            if (status == 0) {
-                reply.set_value(val.second);
-            }
+    case tapirstore::proto::Request::MULTI_GET:
+    {
+        const Timestamp *closed =
+            (closeTimeout != NULL) ? &closedTimestamp : NULL;
+        vector<const GetMessage *> gets = Gets(request);
+        vector<GetResult> results(gets.size());
+        for (size_t i = 0; i < gets.size(); i++) {
+            Get(*store, request.txnid(), *gets[i], closed, results[i]);
+        }
+        GetReply(request, results, closed, str2);
+        break;
+    }
+    case tapirstore::proto::Request::CLOSED:
+        if (closeTimeout != NULL) {
+            reply.set_status(REPLY_OK);
+            closedTimestamp.serialize(reply.mutable_closed());
         } else {
-            pair<Timestamp, string> val;
-            status = store->Get(request.txnid(), request.get().key(), val);
-            if (status == 0) {
-                reply.set_value(val.second);
-                val.first.serialize(reply.mutable_timestamp());
-            }
+            reply.set_status(REPLY_FAIL);
+        }
+        reply.SerializeToString(&str2);
+        break;
+    case tapirstore::proto::Request::SCAN:
+    {
+        KeyValues values;
+        status = store->Scan(request.txnid(), request.scan().start(),
+                             request.scan().end(), request.scan().limit(),
+                             values);
+        for (auto &v : values) {
+            ValueMessage *value = reply.add_values();
+            value->set_key(v.first);
+            value->set_value(v.second.second);
+            v.second.first.serialize(value->mutable_timestamp());
         }
         reply.set_status(status);
         reply.SerializeToString(&str2);
         break;
+    }
     default:
         Panic("Unrecognized Unlogged request.");
     }
 }
 
+/* Each GET goes to the partition holding its key, and the worker that
+ * serves the last one sends the reply back to the transport loop. */
+void
+Server::UnloggedUpcallAsync(const string &str1,
+                            function<void (const string &)> done)
+{
+    if (!partitioned || transport == NULL) {
+        IRAppReplica::UnloggedUpcallAsync(str1, done);
+        return;
+    }
+
+    auto request = make_shared<Request>();
+    request->ParseFromString(str1);
+
+    vector<const GetMessage *> gets = Gets(*request);
+    if (gets.empty()) {
+        IRAppReplica::UnloggedUpcallAsync(str1, done);
+        return;
+    }
+
+    // the workers read the closed timestamp as it is now
+    bool closing = (closeTimeout != NULL);
+    Timestamp closed = closedTimestamp;
+    auto results = make_shared<vector<GetResult>>(gets.size());
+    auto remaining = make_shared<atomic<size_t>>(gets.size());
+
+    for (size_t i = 0; i < gets.size(); i++) {
+        const GetMessage *get = gets[i];
+        store->ForKey(get->key(), [=](TxnStore &store) {
+            Get(store, request->txnid(), *get, closing ? &closed : NULL,
+                (*results)[i]);
+            if (--*remaining > 0) {
+                return;
+            }
+            transport->Timer(0, [=]() {
+                string str2;
+                GetReply(*request, *results, closing ? &closed : NULL, str2);
+                done(str2);
+            });
+        });
+    }
+}
+
+/* Serve a single GET: a bounded-staleness read, a snapshot read, a
+ * read at a given version, or a read of the latest version. Only the
+ * last is by a transaction that has yet to pick its commit timestamp,
+ * so only it comes with hints for one. closed is the closed timestamp,
+ * NULL if there is none. */
+void
+Server::Get(TxnStore &store, uint64_t id, const GetMessage &get,
+            const Timestamp *closed, GetResult &result)
+{
+    if (get.stale()) {
+        // nothing can commit at or below a timestamp a quorum has
+        // closed any more; once we have closed it too, nothing is left
+        // prepared below it either, so what we have there is final
+        if (closed == NULL) {
+            result.status = REPLY_FAIL;
+        } else if (Timestamp(get.timestamp()) > *closed) {
+            result.status = REPLY_RETRY;
+        } else {
+            result.status = store.Get(id, get.key(), get.timestamp(),
+                                      result.value);
+        }
+    } else if (get.snapshot()) {
+        result.status = store.GetSnapshot(id, get.key(), get.timestamp(),
+                                          result.value);
+    } else if (get.has_timestamp()) {
+        result.status = store.Get(id, get.key(), get.timestamp(), result.value);
+    } else {
+        result.status = store.GetWithHints(id, get.key(), result.value,
+                                           result.lastRead,
+                                           result.pendingWrite);
+    }
+}
+
+/* The reads of a GET or MULTI_GET request, none for any other. */
+vector<const GetMessage *>
+Server::Gets(const Request &request)
+{
+    vector<const GetMessage *> gets;
+    if (request.op() == tapirstore::proto::Request::GET) {
+        gets.push_back(&request.get());
+    } else if (request.op() == tapirstore::proto::Request::MULTI_GET) {
+        for (const auto &get : request.gets()) {
+            gets.push_back(&get);
+        }
+    }
+    return gets;
+}
+
+void
+Server::GetReply(const Request &request, const vector<GetResult> &results,
+                 const Timestamp *closed, string &str)
+{
+    Reply reply;
+    int status;
+
+    if (request.op() == tapirstore::proto::Request::GET) {
+        const GetResult &r = results[0];
+        status = r.status;
+        if (status == 0) {
+            reply.set_value(r.value.second);
+            // a read at a given version already knows its timestamp
+            if (!request.get().has_timestamp() || request.get().snapshot()) {
+                r.value.first.serialize(reply.mutable_timestamp());
+            }
+        }
+        if (r.lastRead.isValid()) {
+            r.lastRead.serialize(reply.mutable_lastread());
+        }
+        if (r.pendingWrite.isValid()) {
+            r.pendingWrite.serialize(reply.mutable_pendingwrite());
+        }
+    } else {
+        // keys that are not found are left out; any other failure
+        // (a snapshot read that has to retry) fails the whole request
+        status = REPLY_OK;
+        for (size_t i = 0; i < results.size(); i++) {
+            const GetResult &r = results[i];
+            if (r.status == REPLY_OK) {
+                ValueMessage *value = reply.add_values();
+                value->set_key(request.gets(i).key());
+                value->set_value(r.value.second);
+                r.value.first.serialize(value->mutable_timestamp());
+                if (r.lastRead.isValid()) {
+                    r.lastRead.serialize(value->mutable_lastread());
+                }
+                if (r.pendingWrite.isValid()) {
+                    r.pendingWrite.serialize(value->mutable_pendingwrite());
+                }
+            } else if (r.status != REPLY_FAIL) {
+                status = r.status;
+            }
+        }
+    }
+    reply.set_status(status);
+    if (closed != NULL) {
+        closed->serialize(reply.mutable_closed());
+    }
+    reply.SerializeToString(&str);
+}
+
 void
 Server::Sync(const std::map<opid_t, RecordEntry>& record)
 {
@@ -159,6 +694,486 @@ Server::Load(const string &key, const string &value, const Timestamp timestamp)
     store->Load(key, value, timestamp);
 }
 
+void
+Server::StartGC(Transport *transport, uint64_t intervalMs, uint64_t retention)
+{
+    ASSERT(gcTimeout == NULL);
+    gcRetention = retention;
+    gcTimeout = new Timeout(transport, intervalMs, [this]() { GC(); });
+    gcTimeout->Start();
+}
+
+/* The start of the retention window. Nothing newer is collected, so
+ * snapshot reads within the window still find their version. */
+bool
+Server::Horizon(Timestamp &horizon)
+{
+    uint64_t now = timeServer.GetTime();
+    uint64_t window = gcRetention << 32; // seconds, in TrueTime format
+
+    if (now <= window) {
+        return false;
+    }
+    horizon = Timestamp(now - window);
+    return true;
+}
+
+/* Run one bounded GC slice. */
+void
+Server::GC()
+{
+    Timestamp horizon;
+    if (Horizon(horizon)) {
+        store->GC(horizon, GC_SLICE_KEYS);
+    }
+}
+
+void
+Server::StartExpiry(Transport *transport, uint64_t intervalMs, uint64_t retention)
+{
+    ASSERT(expiryTimeout == NULL);
+    gcRetention = retention;
+    expiryTimeout = new Timeout(transport, intervalMs, [this]() { Expire(); });
+    expiryTimeout->Start();
+}
+
+/* Turn the expiry wheel. Expiry times follow from commit timestamps,
+ * so every replica drops the same keys on its own, without a round of
+ * consensus; reads already hide them before they are dropped. */
+void
+Server::Expire()
+{
+    Timestamp horizon;
+    if (Horizon(horizon)) {
+        store->Expire(horizon, EXPIRY_SLICE_KEYS);
+    }
+}
+
+bool
+Server::BulkLoad(const string &path, size_t maxKeys, unsigned int shard,
+                 unsigned int nShards, unsigned int nThreads)
+{
+    BulkLoader loader(store, shard, nShards, nThreads);
+    return loader.Load(path, maxKeys);
+}
+
+void
+Server::SetLog(WriteAheadLog *log)
+{
+    store->Recover(log);
+    store->SetLog(log);
+}
+
+/* The log only holds commits, so a transaction prepared before a restart
+ * is only in the IR record: a retried PREPARE gets the recorded OK from
+ * it, and the COMMIT that follows has to find the transaction prepared
+ * in the store. */
+void
+Server::RecoverPrepared()
+{
+    // the latest prepare of each transaction, unless a COMMIT or ABORT
+    // of it has been executed since; it replaced any earlier one
+    unordered_set<uint64_t> decided;
+    unordered_map<uint64_t, const RecordEntry *> latest;
+    vector<const RecordEntry *> reads;
+    for (const auto &e : replica->GetRecord().Entries()) {
+        const RecordEntry &entry = e.second;
+        Request request;
+        request.ParseFromString(entry.request.op());
+
+        if (entry.type == replication::ir::proto::RECORD_TYPE_INCONSISTENT) {
+            // tentative ops have not been executed yet
+            if (entry.state == replication::ir::proto::RECORD_STATE_FINALIZED &&
+                (request.op() == tapirstore::proto::Request::COMMIT ||
+                 request.op() == tapirstore::proto::Request::ABORT)) {
+                decided.insert(request.txnid());
+            }
+        } else if (request.op() == tapirstore::proto::Request::PREPARE) {
+            auto it = latest.find(request.txnid());
+            if (it == latest.end() ||
+                it->second->opid.second < entry.opid.second) {
+                latest[request.txnid()] = &entry;
+            }
+        } else if (request.op() == tapirstore::proto::Request::COMMIT_READS) {
+            reads.push_back(&entry);
+        }
+    }
+
+    vector<PrepareRequest> batch;
+    vector<const Request *> requests;
+    vector<const RecordEntry *> entries;
+    for (const auto &l : latest) {
+        if (decided.count(l.first) > 0) {
+            continue;
+        }
+        Reply reply;
+        reply.ParseFromString(l.second->result);
+        if (reply.status() != REPLY_OK) {
+            if (terminator != NULL) {
+                Vote &vote = votes[l.first];
+                vote.status = reply.status();
+                vote.finalized = (l.second->state ==
+                                  replication::ir::proto::RECORD_STATE_FINALIZED);
+                Request request;
+                request.ParseFromString(l.second->request.op());
+                vote.timestamp = Timestamp(request.prepare().timestamp());
+            }
+            continue;
+        }
+        auto arena = make_shared<google::protobuf::Arena>();
+        Request &request =
+            *google::protobuf::Arena::CreateMessage<Request>(arena.get());
+        request.ParseFromString(l.second->request.op());
+        batch.push_back(PrepareFor(arena, request));
+        requests.push_back(&request);
+        entries.push_back(l.second);
+    }
+
+    store->PrepareBatch(batch);
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (batch[i].status != REPLY_OK) {
+            Warning("[%lu] Recovered prepare failed again with %d",
+                    batch[i].id, batch[i].status);
+        }
+        Prepared(*requests[i], batch[i].status);
+        if (terminator != NULL) {
+            // the vote is the one recorded, final or not
+            Vote &vote = votes[batch[i].id];
+            vote.status = REPLY_OK;
+            vote.finalized = (entries[i]->state ==
+                              replication::ir::proto::RECORD_STATE_FINALIZED);
+        }
+    }
+    if (!batch.empty()) {
+        Notice("Prepared %zu transactions again from the IR record",
+               batch.size());
+    }
+
+    // reads this replica validated must keep holding writes off
+    for (auto entry : reads) {
+        Reply reply;
+        reply.ParseFromString(entry->result);
+        if (reply.status() != REPLY_OK) {
+            continue;
+        }
+        auto arena = make_shared<google::protobuf::Arena>();
+        Request &request =
+            *google::protobuf::Arena::CreateMessage<Request>(arena.get());
+        request.ParseFromString(entry->request.op());
+        store->CommitReads(request.txnid(),
+                           TransactionView(arena, &request.commitreads().txn()),
+                           Timestamp(request.commitreads().timestamp()));
+    }
+}
+
+bool
+Server::OpenEngine(const string &dir, size_t cacheBytes)
+{
+    return store->OpenEngine(dir, cacheBytes);
+}
+
+bool
+Server::StartTiering(Transport *transport, uint64_t intervalMs,
+                     uint64_t windowMs, const string &dir)
+{
+    ASSERT(tierTimeout == NULL);
+    if (!store->OpenHistory(dir)) {
+        return false;
+    }
+    tierWindow = (windowMs << 32) / 1000; // in TrueTime format
+    tierTimeout = new Timeout(transport, intervalMs, [this]() { Tier(); });
+    tierTimeout->Start();
+    return true;
+}
+
+/* Move one slice of keys' old versions to disk. */
+void
+Server::Tier()
+{
+    uint64_t now = timeServer.GetTime();
+    if (now > tierWindow) {
+        store->Tier(Timestamp(now - tierWindow), TIER_SLICE_KEYS);
+    }
+}
+
+bool
+Server::LoadCheckpoint(const string &path)
+{
+    return store->LoadCheckpoint(path);
+}
+
+void
+Server::StartCheckpoints(Transport *transport, uint64_t intervalMs,
+                         const string &path, bool history)
+{
+    ASSERT(checkpointTimeout == NULL);
+    checkpointPath = path;
+    checkpointHistory = history;
+    checkpointTimeout = new Timeout(transport, intervalMs,
+                                    [this]() { WriteCheckpoint(); });
+    checkpointTimeout->Start();
+}
+
+/* A checkpoint holds committed state only; on restart, the replica
+ * recovers what was prepared since through IR as usual. The commits in
+ * the log are all in the checkpoint, so the log starts over with just
+ * the IR record. */
+void
+Server::WriteCheckpoint()
+{
+    if (!store->WriteCheckpoint(checkpointPath, checkpointHistory)) {
+        Warning("Failed to write checkpoint %s", checkpointPath.c_str());
+        return;
+    }
+    if (replica != NULL) {
+        replica->ResetLog();
+    }
+}
+
+void
+Server::StartTermination(Transport *transport, uint64_t leaseMs,
+                         const string &configPrefix, unsigned int nShards,
+                         int replicaIdx, int nReplicas)
+{
+    ASSERT(terminator == NULL);
+    this->transport = transport;
+    this->leaseMs = leaseMs;
+    this->replicaIdx = replicaIdx;
+    this->nReplicas = nReplicas;
+    terminator = new Terminator(configPrefix, nShards, transport);
+
+    outcomeTimeout = new Timeout(transport,
+                                 leaseMs * OUTCOME_RETENTION_LEASES,
+                                 [this]() {
+        oldOutcomes.swap(outcomes);
+        outcomes.clear();
+    });
+    outcomeTimeout->Start();
+}
+
+void
+Server::StartClosing(Transport *transport, uint64_t lagMs)
+{
+    ASSERT(closeTimeout == NULL);
+    closeLag = lagMs;
+    Close();
+    uint64_t interval = lagMs / CLOSE_STEPS;
+    closeTimeout = new Timeout(transport, interval > 0 ? interval : 1,
+                               [this]() { Close(); });
+    closeTimeout->Start();
+}
+
+void
+Server::SetAdmission(size_t maxPrepared, uint64_t maxLatencyUs)
+{
+    ASSERT(admission == NULL);
+    admission = new AdmissionControl(maxPrepared, maxLatencyUs);
+}
+
+void
+Server::StartContention(Transport *transport, uint64_t intervalMs,
+                        const string &path)
+{
+    ASSERT(contentionTimeout == NULL);
+    contentionPath = path;
+    contentionInterval = intervalMs;
+    contentionTimeout = new Timeout(transport, CONTENTION_POLL_MS,
+                                    [this]() { PollContention(); });
+    contentionTimeout->Start();
+}
+
+void
+Server::RequestContentionDump()
+{
+    contentionDumpRequested = 1;
+}
+
+void
+Server::PollContention()
+{
+    if (contentionDumpRequested) {
+        contentionDumpRequested = 0;
+        WriteContention(contentionPath + ".live", false);
+    }
+
+    contentionElapsed += CONTENTION_POLL_MS;
+    if (contentionElapsed >= contentionInterval) {
+        contentionElapsed = 0;
+        rename(contentionPath.c_str(), (contentionPath + ".1").c_str());
+        WriteContention(contentionPath, true);
+    }
+}
+
+/* Write the contended keys, most conflicts first, one per line: the
+ * key, its conflicts, how many of those may be another key's, and the
+ * conflicts of each class. */
+bool
+Server::WriteContention(const string &path, bool reset)
+{
+    vector<ContentionEntry> top;
+    uint64_t total = 0;
+    store->Contention(top, total, reset);
+
+    string tmpPath = path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (file == NULL) {
+        Warning("Failed to open %s: %s", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    fprintf(file, "# %lu conflicts over %lu ms, %lu keys tracked\n",
+            total, reset ? contentionInterval : contentionElapsed, top.size());
+    fprintf(file, "# key\tcount\terror");
+    for (int c = 0; c < CONFLICT_CLASSES; c++) {
+        fprintf(file, "\t%s", ContentionTracker::name(c));
+    }
+    fprintf(file, "\n");
+    for (auto &e : top) {
+        fprintf(file, "%s\t%lu\t%lu", e.key.c_str(), e.count, e.error);
+        for (int c = 0; c < CONFLICT_CLASSES; c++) {
+            fprintf(file, "\t%lu", e.conflicts[c]);
+        }
+        fprintf(file, "\n");
+    }
+
+    bool ok = (fclose(file) == 0);
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        Warning("Failed to write %s", path.c_str());
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    if (reset && !top.empty()) {
+        Notice("%lu prepare conflicts, %lu on hottest key %s",
+               total, top[0].count, top[0].key.c_str());
+    }
+    return true;
+}
+
+/* Advance the closed timestamp to the clock minus the lag, or as far
+ * as the prepared transactions allow. */
+void
+Server::Close()
+{
+    uint64_t now = TrueTime::ToMicros(timeServer.GetTime());
+    uint64_t lag = closeLag * 1000;
+
+    if (now <= lag) {
+        return;
+    }
+    Timestamp closed = store->Close(Timestamp(TrueTime::FromMicros(now - lag)));
+    if (closed > closedTimestamp) {
+        closedTimestamp = closed;
+    }
+}
+
+/* Arm the lease of a freshly prepared transaction. The replicas of the
+ * shard take turns: the one the transaction id points at goes first,
+ * each next one a lease later, so a single replica normally does the
+ * work and the others only step in if it is gone too. */
+void
+Server::AddLease(uint64_t id, const PrepareMessage &prepare)
+{
+    Lease &lease = leases[id];
+    lease.timestamp = Timestamp(prepare.timestamp());
+    lease.participants.assign(prepare.participants().begin(),
+                              prepare.participants().end());
+
+    int rank = (replicaIdx - (int)(id % nReplicas) + nReplicas) % nReplicas;
+    lease.timer = transport->Timer(leaseMs * (1 + rank),
+                                   [this, id]() { LeaseExpired(id); });
+}
+
+void
+Server::DropLease(uint64_t id)
+{
+    auto it = leases.find(id);
+    if (it != leases.end()) {
+        transport->CancelTimer(it->second.timer);
+        leases.erase(it);
+    }
+}
+
+void
+Server::LeaseExpired(uint64_t id)
+{
+    auto it = leases.find(id);
+    if (it == leases.end()) {
+        return;
+    }
+    Lease &lease = it->second;
+
+    if (lease.participants.empty()) {
+        // prepared by a client that does not name its participants
+        Warning("[%lu] lease expired; no participants to terminate with", id);
+        leases.erase(it);
+        return;
+    }
+
+    Debug("[%lu] lease expired", id);
+    terminator->Terminate(id, lease.participants, lease.timestamp);
+
+    // keep trying until the outcome reaches us
+    lease.timer = transport->Timer(leaseMs,
+                                   [this, id]() { LeaseExpired(id); });
+}
+
+void
+Server::Decided(uint64_t id, int status)
+{
+    if (terminator == NULL) {
+        return;
+    }
+    DropLease(id);
+    votes.erase(id);
+    outcomes[id] = status;
+}
+
+bool
+Server::GetOutcome(uint64_t id, int &status)
+{
+    auto it = outcomes.find(id);
+    if (it == outcomes.end()) {
+        it = oldOutcomes.find(id);
+        if (it == oldOutcomes.end()) {
+            return false;
+        }
+    }
+    status = it->second;
+    return true;
+}
+
+/* Answer a terminator's STATUS request with this replica's vote on
+ * the latest prepare, or the client's decision on it once that is
+ * final. A transaction this replica has not voted to prepare is fenced
+ * off, so that a prepare still on its way from the client fails rather
+ * than racing with the termination. */
+int
+Server::Status(uint64_t id, Timestamp &timestamp, bool &finalized)
+{
+    int status;
+    if (GetOutcome(id, status)) {
+        return status;
+    }
+
+    auto it = votes.find(id);
+    if (it != votes.end()) {
+        const Vote &vote = it->second;
+        if (vote.status == REPLY_OK) {
+            timestamp = vote.timestamp;
+            finalized = vote.finalized;
+            return TXN_PREPARED;
+        }
+        if (vote.finalized && vote.status == REPLY_FAIL) {
+            // the client aborts it
+            return TXN_ABORTED;
+        }
+    }
+
+    outcomes[id] = TXN_UNKNOWN;
+    return TXN_UNKNOWN;
+}
+
 } // namespace tapirstore
 
 
@@ -166,14 +1181,30 @@ int
 main(int argc, char **argv)
 {
     int index = -1;
-    unsigned int myShard = 0, maxShard = 1, nKeys = 1;
+    unsigned int myShard = 0, maxShard = 1, nKeys = 1, nPartitions = 1;
+    unsigned int nLoadThreads = std::thread::hardware_concurrency();
+    uint64_t gcInterval = 0, gcRetention = 10, leaseMs = 0, closeLag = 0;
+    uint64_t expiryInterval = 0, checkpointInterval = 0;
+    uint64_t logWindow = WAL_WINDOW_US, engineCacheMB = ENGINE_CACHE_MB;
+    uint64_t tierWindow = TIER_WINDOW_MS;
+    uint64_t admitPrepared = ADMIT_MAX_PREPARED;
+    uint64_t admitLatency = ADMIT_MAX_LATENCY_US;
+    bool admit = false;
+    uint64_t contentionInterval = CONTENTION_INTERVAL_MS;
+    const char *contentionPath = NULL;
+    bool checkpointHistory = false;
+    bool batching = false;
     const char *configPath = NULL;
     const char *keyPath = NULL;
-    bool linearizable = true;
+    const char *checkpointPath = NULL;
+    const char *logPath = NULL;
+    const char *engineDir = NULL;
+    const char *historyDir = NULL;
+    Isolation isolation = ISOLATION_LINEARIZABLE;
 
     // Parse arguments
     int opt;
-    while ((opt = getopt(argc, argv, "c:i:m:e:s:f:n:N:k:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:i:m:e:s:f:n:N:k:p:g:r:l:L:x:C:W:Hj:w:d:D:M:T:t:a:A:K:R:b")) != -1) {
         switch (opt) {
         case 'c':
             configPath = optarg;
@@ -193,9 +1224,11 @@ main(int argc, char **argv)
         case 'm':
         {
             if (strcasecmp(optarg, "txn-l") == 0) {
-                linearizable = true;
+                isolation = ISOLATION_LINEARIZABLE;
             } else if (strcasecmp(optarg, "txn-s") == 0) {
-                linearizable = false;
+                isolation = ISOLATION_SERIALIZABLE;
+            } else if (strcasecmp(optarg, "txn-si") == 0) {
+                isolation = ISOLATION_SNAPSHOT;
             } else {
                 fprintf(stderr, "unknown mode '%s'\n", optarg);
             }
@@ -235,12 +1268,211 @@ main(int argc, char **argv)
             break;
         }
 
+        case 'p':
+        {
+            char *strtolPtr;
+            nPartitions = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0') || (nPartitions == 0))
+            {
+                fprintf(stderr, "option -p requires a positive numeric arg\n");
+            }
+            break;
+        }
+
+        case 'g':
+        {
+            char *strtolPtr;
+            gcInterval = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -g requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'r':
+        {
+            char *strtolPtr;
+            gcRetention = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -r requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'x':
+        {
+            char *strtolPtr;
+            expiryInterval = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -x requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'l':
+        {
+            char *strtolPtr;
+            leaseMs = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -l requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'L':
+        {
+            char *strtolPtr;
+            closeLag = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -L requires a numeric arg\n");
+            }
+            break;
+        }
+
         case 'f':   // Load keys from file
         {
             keyPath = optarg;
             break;
         }
 
+        case 'j':
+        {
+            char *strtolPtr;
+            nLoadThreads = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0') || (nLoadThreads == 0))
+            {
+                fprintf(stderr, "option -j requires a positive numeric arg\n");
+            }
+            break;
+        }
+
+        case 'w':   // Write-ahead log
+        {
+            logPath = optarg;
+            break;
+        }
+
+        case 'd':
+        {
+            char *strtolPtr;
+            logWindow = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -d requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'D':   // Keep values on disk
+        {
+            engineDir = optarg;
+            break;
+        }
+
+        case 'M':
+        {
+            char *strtolPtr;
+            engineCacheMB = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -M requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'T':   // Keep version history on disk
+        {
+            historyDir = optarg;
+            break;
+        }
+
+        case 't':
+        {
+            char *strtolPtr;
+            tierWindow = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -t requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'a':   // Admission control
+        {
+            char *strtolPtr;
+            admitPrepared = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -a requires a numeric arg\n");
+            }
+            admit = true;
+            break;
+        }
+
+        case 'A':
+        {
+            char *strtolPtr;
+            admitLatency = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -A requires a numeric arg\n");
+            }
+            admit = true;
+            break;
+        }
+
+        case 'K':   // Contention telemetry
+        {
+            contentionPath = optarg;
+            break;
+        }
+
+        case 'R':
+        {
+            char *strtolPtr;
+            contentionInterval = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0') ||
+                (contentionInterval == 0))
+            {
+                fprintf(stderr, "option -R requires a positive numeric arg\n");
+            }
+            break;
+        }
+
+        case 'C':   // Start from (and write) a checkpoint
+        {
+            checkpointPath = optarg;
+            break;
+        }
+
+        case 'W':
+        {
+            char *strtolPtr;
+            checkpointInterval = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -W requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'H':
+        {
+            checkpointHistory = true;
+            break;
+        }
+
+        case 'b':   // Batch the prepares read together
+        {
+            batching = true;
+            break;
+        }
+
         default:
             fprintf(stderr, "Unknown argument %s\n", argv[optind]);
         }
@@ -268,37 +1500,96 @@ main(int argc, char **argv)
 
     UDPTransport transport(0.0, 0.0, 0);
 
-    tapirstore::Server server(linearizable);
+    tapirstore::Server server(isolation, nPartitions);
+
+    // the store and the IR record share one log
+    WriteAheadLog *log = NULL;
+    if (logPath) {
+        log = new WriteAheadLog(logPath, logWindow);
+    }
 
-    replication::ir::IRReplica replica(config, index, &transport, &server);
+    replication::ir::IRReplica replica(config, index, &transport, &server, log);
 
 	server.setIRReplica(&replica);
+    server.SetTransport(&transport);
+    replica.SetBatching(batching);
 
-    if (keyPath) {
-        string key;
-        std::ifstream in;
-        in.open(keyPath);
-        if (!in) {
+    if (engineDir && !server.OpenEngine(engineDir, engineCacheMB << 20)) {
+        fprintf(stderr, "Could not open storage engine in: %s\n", engineDir);
+        exit(0);
+    }
+
+    // a checkpoint already holds the keys
+    bool restored = checkpointPath && server.LoadCheckpoint(checkpointPath);
+
+    if (keyPath && !restored) {
+        if (!server.BulkLoad(keyPath, nKeys, myShard, maxShard, nLoadThreads)) {
             fprintf(stderr, "Could not read keys from: %s\n", keyPath);
             exit(0);
         }
+    }
 
-        for (unsigned int i = 0; i < nKeys; i++) {
-            getline(in, key);
+    if (log != NULL) {
+        server.SetLog(log);
+    }
 
-            uint64_t hash = 5381;
-            const char* str = key.c_str();
-            for (unsigned int j = 0; j < key.length(); j++) {
-                hash = ((hash << 5) + hash) + (uint64_t)str[j];
-            }
+    if (gcInterval > 0) {
+        server.StartGC(&transport, gcInterval, gcRetention);
+    }
 
-            if (hash % maxShard == myShard) {
-                server.Load(key, "null", Timestamp());
-            }
+    if (historyDir &&
+        !server.StartTiering(&transport, TIER_INTERVAL_MS, tierWindow, historyDir)) {
+        fprintf(stderr, "Could not open version history in: %s\n", historyDir);
+        exit(0);
+    }
+
+    if (expiryInterval > 0) {
+        server.StartExpiry(&transport, expiryInterval, gcRetention);
+    }
+
+    if (checkpointInterval > 0) {
+        if (!checkpointPath) {
+            fprintf(stderr, "option -W requires -C\n");
+            exit(1);
         }
-        in.close();
+        server.StartCheckpoints(&transport, checkpointInterval,
+                                checkpointPath, checkpointHistory);
+    }
+
+    if (admit) {
+        server.SetAdmission(admitPrepared, admitLatency);
     }
 
+    if (contentionPath) {
+        server.StartContention(&transport, contentionInterval, contentionPath);
+        signal(SIGUSR1, [](int) {
+            tapirstore::Server::RequestContentionDump();
+        });
+    }
+
+    if (closeLag > 0) {
+        server.StartClosing(&transport, closeLag);
+    }
+
+    if (leaseMs > 0) {
+        // shard configurations are named like the client expects them,
+        // <prefix><shard>.config
+        string path(configPath);
+        string suffix = std::to_string(myShard) + ".config";
+        if (path.length() < suffix.length() ||
+            path.compare(path.length() - suffix.length(),
+                         suffix.length(), suffix) != 0) {
+            fprintf(stderr, "option -l requires the configuration file "
+                    "to be named <prefix>%u.config\n", myShard);
+            exit(1);
+        }
+        server.StartTermination(&transport, leaseMs,
+                                path.substr(0, path.length() - suffix.length()),
+                                maxShard, index, config.n);
+    }
+
+    server.RecoverPrepared();
+
     transport.Run();
 
     return 0;
@@ -36,8 +36,43 @@
 #include "tapir/store/common/timestamp.h"
 #include "tapir/store/common/truetime.h"
 #include "tapir/store/tapirstore/store.h"
+#include "tapir/store/tapirstore/partitionedstore.h"
+#include "tapir/store/tapirstore/loader.h"
+#include "tapir/store/tapirstore/admission.h"
+#include "tapir/store/tapirstore/terminator.h"
 #include "tapir/store/tapirstore/tapir-proto.pb.h"
 
+// Keys visited per garbage collection slice.
+#define GC_SLICE_KEYS 4096
+
+// Expired keys visited per expiry tick.
+#define EXPIRY_SLICE_KEYS 4096
+
+// Default group-commit window of the write-ahead log, in us.
+#define WAL_WINDOW_US 200
+
+// Versions are moved to history in slices of this many keys, every
+// interval.
+#define TIER_SLICE_KEYS 4096
+#define TIER_INTERVAL_MS 100
+
+// Default time a replaced version stays in memory, in ms.
+#define TIER_WINDOW_MS 1000
+
+// Default cache of the on-disk storage engine, in MB.
+#define ENGINE_CACHE_MB 1024
+
+// Contended keys are written out this often by default, in ms, and a
+// dump asked for by signal is picked up within the poll interval.
+#define CONTENTION_INTERVAL_MS 60000
+#define CONTENTION_POLL_MS 100
+
+// Decided transactions are remembered for this many leases.
+#define OUTCOME_RETENTION_LEASES 10
+
+// The closed timestamp advances this many times per close lag.
+#define CLOSE_STEPS 4
+
 namespace tapirstore {
 
 using opid_t = replication::ir::opid_t;
@@ -46,19 +81,37 @@ using RecordEntry = replication::ir::RecordEntry;
 class Server : public replication::ir::IRAppReplica
 {
 public:
-    Server(bool linearizable);
+    Server(Isolation isolation, unsigned int nPartitions = 1);
     virtual ~Server();
 
 	void setIRReplica(replication::ir::IRReplica *replica);
 
     // Invoke inconsistent operation, no return value
     void ExecInconsistentUpcall(const string &str1) override;
+    void ExecInconsistentUpcallAsync(
+        const string &str1, std::function<void ()> done) override;
 
     // Invoke consensus operation
     void ExecConsensusUpcall(const string &str1, string &str2) override;
+    void ExecConsensusUpcallBatch(const std::vector<string> &ops,
+                                  std::vector<string> &results) override;
+    void ExecConsensusUpcallAsync(
+        const string &str1,
+        std::function<void (const string &)> done) override;
+
+    void FinalizeConsensusUpcall(const string &str1,
+                                 const string &str2) override;
 
     // Invoke unreplicated operation
     void UnloggedUpcall(const string &str1, string &str2) override;
+    void UnloggedUpcallAsync(
+        const string &str1,
+        std::function<void (const string &)> done) override;
+
+    // With a partitioned store, finish prepares, commits and gets on the
+    // transport loop once the partitions are done with them, instead
+    // of waiting for them.
+    void SetTransport(Transport *transport);
 
     // Sync
     void Sync(const std::map<opid_t, RecordEntry>& record) override;
@@ -71,8 +124,175 @@ public:
 
     void Load(const string &key, const string &value, const Timestamp timestamp);
 
+    // Load the keys of this shard among the first maxKeys lines of
+    // path, parsing the file with nThreads threads.
+    bool BulkLoad(const std::string &path, size_t maxKeys, unsigned int shard,
+                  unsigned int nShards, unsigned int nThreads);
+
+    // Redo the commits in log on top of what has been loaded, and log
+    // commits to it from now on.
+    void SetLog(WriteAheadLog *log);
+
+    // Prepare again the transactions that the IR record recovered from
+    // the log prepared, and that have not been committed or aborted
+    // since, and record again the reads of read-only transactions it
+    // validated. Call before serving, after SetLog and StartTermination.
+    void RecoverPrepared();
+
+    // Keep values on disk under dir, with the cacheBytes most recently
+    // used in memory.
+    bool OpenEngine(const std::string &dir, size_t cacheBytes);
+
+    // Move versions replaced more than windowMs ago, and not read
+    // since, to history under dir, a slice every interval ms on the
+    // transport loop.
+    bool StartTiering(Transport *transport, uint64_t intervalMs,
+                      uint64_t windowMs, const std::string &dir);
+
+    // Start from the checkpoint at path instead of an empty store.
+    bool LoadCheckpoint(const std::string &path);
+
+    // Write a checkpoint to path every interval ms on the transport
+    // loop, with all retained versions if history is set.
+    void StartCheckpoints(Transport *transport, uint64_t intervalMs,
+                          const std::string &path, bool history);
+
+    // Start collecting versions older than the retention window (in
+    // seconds), one slice every interval ms on the transport loop.
+    void StartGC(Transport *transport, uint64_t intervalMs, uint64_t retention);
+
+    // Turn the expiry wheel every interval ms on the transport loop,
+    // dropping keys whose TTL ran out before the retention window.
+    void StartExpiry(Transport *transport, uint64_t intervalMs, uint64_t retention);
+
+    // Give prepared transactions a lease of leaseMs; once it runs out,
+    // terminate the transaction with the other participants. Shard
+    // configurations are read from <configPrefix><shard>.config.
+    void StartTermination(Transport *transport, uint64_t leaseMs,
+                          const std::string &configPrefix,
+                          unsigned int nShards, int replicaIdx, int nReplicas);
+
+    // Keep a closed timestamp lagMs behind the clock, advertised on
+    // GET and CLOSED replies and used to serve bounded-staleness reads.
+    void StartClosing(Transport *transport, uint64_t lagMs);
+
+    // Turn prepares away with REPLY_OVERLOADED while more than
+    // maxPrepared transactions are prepared, or prepares take longer
+    // than maxLatencyUs on average (0 for no limit).
+    void SetAdmission(size_t maxPrepared, uint64_t maxLatencyUs);
+
+    // Every interval ms, write the keys prepares conflicted on most
+    // in that time to path, keeping the previous file as path.1, and
+    // start counting again. A dump of the counts so far goes to
+    // path.live on RequestContentionDump().
+    void StartContention(Transport *transport, uint64_t intervalMs,
+                         const std::string &path);
+    // Safe to call from a signal handler.
+    static void RequestContentionDump();
+
 private:
 	TxnStore *store;
+	bool partitioned;
+
+	// a single GET, served by the store holding its key
+	struct GetResult {
+	    int status;
+	    std::pair<Timestamp, std::string> value;
+	    Timestamp lastRead, pendingWrite;
+	};
+
+	static void Get(TxnStore &store, uint64_t id, const proto::GetMessage &get,
+	                const Timestamp *closed, GetResult &result);
+	static std::vector<const proto::GetMessage *> Gets(
+	    const proto::Request &request);
+	static void GetReply(const proto::Request &request,
+	                     const std::vector<GetResult> &results,
+	                     const Timestamp *closed, std::string &str);
+
+	// garbage collection
+	Timeout *gcTimeout;
+	uint64_t gcRetention;
+	TrueTime timeServer;
+
+	bool Horizon(Timestamp &horizon);
+	void GC();
+
+	// expiry of keys with a TTL
+	Timeout *expiryTimeout;
+
+	void Expire();
+
+	// moving old versions to disk
+	Timeout *tierTimeout;
+	uint64_t tierWindow;
+
+	void Tier();
+
+	// periodic checkpoints
+	Timeout *checkpointTimeout;
+	std::string checkpointPath;
+	bool checkpointHistory;
+
+	void WriteCheckpoint();
+
+	// termination of abandoned transactions
+	struct Lease {
+	    int timer;
+	    Timestamp timestamp;
+	    std::vector<int> participants;
+	};
+	Transport *transport;
+	Terminator *terminator;
+	uint64_t leaseMs;
+	int replicaIdx, nReplicas;
+	Timeout *outcomeTimeout;
+	std::unordered_map<uint64_t, Lease> leases;
+	// decided transactions (TXN_*), in two generations
+	std::unordered_map<uint64_t, int> outcomes, oldOutcomes;
+	// the vote on each undecided transaction's latest prepare
+	struct Vote {
+	    int status;
+	    Timestamp timestamp;
+	    bool finalized;
+	};
+	std::unordered_map<uint64_t, Vote> votes;
+
+	void AddLease(uint64_t id, const proto::PrepareMessage &prepare);
+	void DropLease(uint64_t id);
+	void LeaseExpired(uint64_t id);
+	void Decided(uint64_t id, int status);
+	bool GetOutcome(uint64_t id, int &status);
+	int Status(uint64_t id, Timestamp &timestamp, bool &finalized);
+
+	// closed timestamps
+	Timeout *closeTimeout;
+	uint64_t closeLag;
+	Timestamp closedTimestamp;
+
+	void Close();
+
+	// admission control of prepares, NULL if there is none
+	AdmissionControl *admission;
+	// prepares still with the store's partitions
+	size_t preparing;
+
+	bool AdmitPrepare(const proto::Request &request, size_t pending,
+	                  int &status, uint64_t &retryAfter);
+	void Prepared(const proto::Request &request, int status);
+	static PrepareRequest PrepareFor(
+	    const std::shared_ptr<google::protobuf::Arena> &arena,
+	    const proto::Request &request);
+	static void PrepareReply(int status, const Timestamp &proposed,
+	                         uint64_t retryAfter, std::string &str);
+
+	// contention telemetry
+	Timeout *contentionTimeout;
+	std::string contentionPath;
+	uint64_t contentionInterval;
+	uint64_t contentionElapsed;
+
+	void PollContention();
+	bool WriteContention(const std::string &path, bool reset);
 
 	// for sending notifications we need to know our parent
 	replication::ir::IRReplica *replica;
@@ -31,6 +31,8 @@
 
 #include "tapir/store/tapirstore/shardclient.h"
 
+#include <algorithm>
+
 namespace tapirstore {
 
 using namespace std;
@@ -39,23 +41,24 @@ using namespace proto;
 ShardClient::ShardClient(const string &configPath,
                        Transport *transport, uint64_t client_id, int
                        shard, int closestReplica)
-    : client_id(client_id), transport(transport), shard(shard)
+    : client_id(client_id), transport(transport), shard(shard),
+      hasIsolation(false), snapshotReads(false), prepared(false), closest(closestReplica != -1)
 {
     ifstream configStream(configPath);
     if (configStream.fail()) {
         Panic("Unable to read configuration file: %s\n", configPath.c_str());
     }
 
-    transport::Configuration config(configStream);
-    this->config = &config;
+    config = new transport::Configuration(configStream);
 
-    client = new replication::ir::IRClient(config, transport, client_id);
+    client = new replication::ir::IRClient(*config, transport, client_id);
 
     if (closestReplica == -1) {
-        replica = client_id % config.n;
+        replica = client_id % config->n;
     } else {
         replica = closestReplica;
     }
+    staleReplica = replica;
     Debug("Sending unlogged to replica %i", replica);
 
     waiting = NULL;
@@ -65,6 +68,7 @@ ShardClient::ShardClient(const string &configPath,
 ShardClient::~ShardClient()
 {
     delete client;
+    delete config;
 }
 
 void
@@ -78,6 +82,23 @@ ShardClient::Begin(uint64_t id)
         delete blockingBegin;
         blockingBegin = NULL;
     }
+    hasIsolation = false;
+    snapshotReads = false;
+    prepared = false;
+    hint = Timestamp();
+}
+
+/* Begins a transaction whose GETs read the snapshot at timestamp. If
+ * it never prepares (it is read-only), its commit validates the reads
+ * at the snapshot instead of preparing. */
+void
+ShardClient::BeginRO(uint64_t id, const Timestamp timestamp)
+{
+    Debug("[shard %i] BEGIN READ-ONLY: %lu", shard, id);
+
+    Begin(id);
+    snapshotReads = true;
+    snapshot = timestamp;
 }
 
 void
@@ -92,6 +113,10 @@ ShardClient::Get(uint64_t id, const string &key, Promise *promise)
     request.set_op(Request::GET);
     request.set_txnid(id);
     request.mutable_get()->set_key(key);
+    if (snapshotReads) {
+        request.mutable_get()->set_snapshot(true);
+        snapshot.serialize(request.mutable_get()->mutable_timestamp());
+    }
     request.SerializeToString(&request_str);
 
     // set to 1 second by default
@@ -143,6 +168,151 @@ ShardClient::Get(uint64_t id, const string &key,
     });
 }
 
+void
+ShardClient::GetClosed(Promise *promise)
+{
+    Debug("[shard %i] Sending CLOSED", shard);
+
+    string request_str;
+    Request request;
+    request.set_op(Request::CLOSED);
+    request.set_txnid(0);
+    request.SerializeToString(&request_str);
+
+    int timeout = promise->GetTimeout();
+    auto q = make_shared<ClosedQuorum>(promise);
+
+    transport->Timer(0, [=]() {
+        for (int r = 0; r < config->n; r++) {
+            client->InvokeUnlogged(r,
+                                   request_str,
+                                   bind(&ShardClient::ClosedCallback,
+                                        this, q,
+                                        placeholders::_2),
+                                   bind(&ShardClient::ClosedTimeout,
+                                        this, q),
+                                   timeout); // timeout in ms
+        }
+    });
+}
+
+void
+ShardClient::GetStale(const string &key, const Timestamp &timestamp,
+                      int attempt, Promise *promise)
+{
+    // Any replica that closed timestamp will do; without a closest
+    // one, spread the reads.
+    int r;
+    if (closest) {
+        r = (replica + attempt) % config->n;
+    } else {
+        r = staleReplica;
+        staleReplica = (staleReplica + 1) % config->n;
+    }
+    Debug("[shard %i] Sending stale GET [%s] to %d", shard, key.c_str(), r);
+
+    string request_str;
+    Request request;
+    request.set_op(Request::GET);
+    request.set_txnid(0);
+    request.mutable_get()->set_key(key);
+    request.mutable_get()->set_stale(true);
+    timestamp.serialize(request.mutable_get()->mutable_timestamp());
+    request.SerializeToString(&request_str);
+
+    int timeout = (promise != NULL) ? promise->GetTimeout() : 1000;
+
+    transport->Timer(0, [=]() {
+        waiting = promise;
+        client->InvokeUnlogged(r,
+                               request_str,
+                               bind(&ShardClient::GetStaleCallback,
+                                    this,
+                                    placeholders::_1,
+                                    placeholders::_2),
+                               bind(&ShardClient::GetTimeout,
+                                    this),
+                               timeout); // timeout in ms
+    });
+}
+
+/* Sends all the GETs of a multi-get in one request; snapshot reads
+ * stay at the snapshot, and keys read before are read at that version. */
+void
+ShardClient::MultiGet(uint64_t id, const vector<string> &keys,
+                      const map<string, Timestamp> &readTimes,
+                      Promise *promise)
+{
+    Debug("[shard %i] Sending MULTI_GET [%lu : %lu keys]", shard, id,
+          keys.size());
+
+    string request_str;
+    Request request;
+    request.set_op(Request::MULTI_GET);
+    request.set_txnid(id);
+    for (const string &key : keys) {
+        GetMessage *get = request.add_gets();
+        get->set_key(key);
+        if (snapshotReads) {
+            get->set_snapshot(true);
+            snapshot.serialize(get->mutable_timestamp());
+        } else {
+            auto t = readTimes.find(key);
+            if (t != readTimes.end()) {
+                t->second.serialize(get->mutable_timestamp());
+            }
+        }
+    }
+    request.SerializeToString(&request_str);
+
+    int timeout = (promise != NULL) ? promise->GetTimeout() : 1000;
+
+    transport->Timer(0, [=]() {
+        waiting = promise;
+        client->InvokeUnlogged(replica,
+                               request_str,
+                               bind(&ShardClient::ValuesCallback,
+                                    this,
+                                    placeholders::_1,
+                                    placeholders::_2),
+                               bind(&ShardClient::GetTimeout,
+                                    this),
+                               timeout); // timeout in ms
+    });
+}
+
+void
+ShardClient::Scan(uint64_t id, const string &start, const string &end,
+                  size_t limit, Promise *promise)
+{
+    Debug("[shard %i] Sending SCAN [%lu : %s, %s]", shard, id,
+          start.c_str(), end.c_str());
+
+    string request_str;
+    Request request;
+    request.set_op(Request::SCAN);
+    request.set_txnid(id);
+    request.mutable_scan()->set_start(start);
+    request.mutable_scan()->set_end(end);
+    request.mutable_scan()->set_limit(limit);
+    request.SerializeToString(&request_str);
+
+    int timeout = (promise != NULL) ? promise->GetTimeout() : 1000;
+
+    transport->Timer(0, [=]() {
+        waiting = promise;
+        client->InvokeUnlogged(replica,
+                               request_str,
+                               bind(&ShardClient::ValuesCallback,
+                                    this,
+                                    placeholders::_1,
+                                    placeholders::_2),
+                               bind(&ShardClient::GetTimeout,
+                                    this),
+                               timeout); // timeout in ms
+    });
+}
+
 void
 ShardClient::Put(uint64_t id,
                const string &key,
@@ -158,6 +328,7 @@ ShardClient::Prepare(uint64_t id, const Transaction &txn,
                     const Timestamp &timestamp, Promise *promise)
 {
     Debug("[shard %i] Sending PREPARE [%lu]", shard, id);
+    prepared = true;
 
     // create prepare request
     string request_str;
@@ -166,6 +337,12 @@ ShardClient::Prepare(uint64_t id, const Transaction &txn,
     request.set_txnid(id);
     txn.serialize(request.mutable_prepare()->mutable_txn());
     timestamp.serialize(request.mutable_prepare()->mutable_timestamp());
+    for (int p : participants) {
+        request.mutable_prepare()->add_participants(p);
+    }
+    if (hasIsolation) {
+        request.mutable_prepare()->set_isolation(isolation);
+    }
     request.SerializeToString(&request_str);
 
     transport->Timer(0, [=]() {
@@ -186,6 +363,8 @@ ShardClient::TapirDecide(const std::map<std::string, std::size_t> &results)
     // If a majority say prepare_ok,
     int ok_count = 0;
     Timestamp ts = 0;
+    bool overloaded = false;
+    uint64_t retryAfter = 0;
     string final_reply_str;
     Reply final_reply;
 
@@ -205,11 +384,21 @@ ShardClient::TapirDecide(const std::map<std::string, std::size_t> &results)
 	    if (t > ts) {
 		ts = t;
 	    }
+	} else if (reply.status() == REPLY_OVERLOADED) {
+	    overloaded = true;
+	    if (reply.retryafter() > retryAfter) {
+		retryAfter = reply.retryafter();
+	    }
 	}
     }
 
     if (ok_count >= config->QuorumSize()) {
 	final_reply.set_status(REPLY_OK);
+    } else if (overloaded) {
+       // no quorum without the replicas that shed the prepare, so
+       // wait for the slowest of them
+       final_reply.set_status(REPLY_OVERLOADED);
+       final_reply.set_retryafter(retryAfter);
     } else {
        final_reply.set_status(REPLY_RETRY);
        ts.serialize(final_reply.mutable_timestamp());
@@ -228,8 +417,29 @@ ShardClient::Commit(uint64_t id, const Transaction &txn,
     // create commit request
     string request_str;
     Request request;
-    request.set_op(Request::COMMIT);
     request.set_txnid(id);
+    if (snapshotReads && !prepared) {
+        // nothing was prepared; the replicas validate the reads at the
+        // snapshot and record them, and the promise gets whether a
+        // quorum of them did
+        request.set_op(Request::COMMIT_READS);
+        txn.serialize(request.mutable_commitreads()->mutable_txn());
+        snapshot.serialize(request.mutable_commitreads()->mutable_timestamp());
+        request.SerializeToString(&request_str);
+
+        transport->Timer(0, [=]() {
+            waiting = promise;
+            client->InvokeConsensus(
+                request_str,
+                bind(&ShardClient::TapirDecide, this,
+                    placeholders::_1),
+                bind(&ShardClient::PrepareCallback, this,
+                    placeholders::_1,
+                    placeholders::_2));
+        });
+        return;
+    }
+    request.set_op(Request::COMMIT);
     request.mutable_commit()->set_timestamp(timestamp.getTimestamp());
     request.SerializeToString(&request_str);
 
@@ -249,6 +459,11 @@ ShardClient::Abort(uint64_t id, const Transaction &txn, Promise *promise)
 {
     Debug("[shard %i] Sending ABORT [%lu]", shard, id);
 
+    if (snapshotReads && !prepared) {
+        // nothing was prepared, so there is nothing to undo
+        return;
+    }
+
     // create abort request
     string request_str;
     Request request;
@@ -268,6 +483,19 @@ ShardClient::Abort(uint64_t id, const Transaction &txn, Promise *promise)
     });
 }
 
+void
+ShardClient::SetParticipants(const set<int> &participants)
+{
+    this->participants = participants;
+}
+
+void
+ShardClient::SetIsolation(Isolation isolation)
+{
+    hasIsolation = true;
+    this->isolation = isolation;
+}
+
 void
 ShardClient::GetTimeout()
 {
@@ -290,6 +518,12 @@ ShardClient::GetCallback(const string &request_str, const string &reply_str)
     if (waiting != NULL) {
         Promise *w = waiting;
         waiting = NULL;
+        if (reply.has_lastread()) {
+            AddHint(reply.lastread());
+        }
+        if (reply.has_pendingwrite()) {
+            AddHint(reply.pendingwrite());
+        }
         if (reply.has_timestamp()) {
             w->Reply(reply.status(), Timestamp(reply.timestamp()), reply.value());
         } else {
@@ -298,6 +532,99 @@ ShardClient::GetCallback(const string &request_str, const string &reply_str)
     }
 }
 
+/* Callback from a shard replica on a bounded-staleness get. */
+void
+ShardClient::GetStaleCallback(const string &request_str, const string &reply_str)
+{
+    Reply reply;
+    reply.ParseFromString(reply_str);
+
+    Debug("[shard %lu:%i] stale GET callback [%d]", client_id, shard, reply.status());
+    if (waiting != NULL) {
+        Promise *w = waiting;
+        waiting = NULL;
+        w->Reply(reply.status(), reply.value());
+    }
+}
+
+/* Callback from a shard replica with its closed timestamp. */
+void
+ShardClient::ClosedCallback(shared_ptr<ClosedQuorum> q, const string &reply_str)
+{
+    Reply reply;
+    reply.ParseFromString(reply_str);
+
+    if (q->done) {
+        return;
+    }
+    if (reply.status() == REPLY_OK && reply.has_closed()) {
+        q->closed.push_back(Timestamp(reply.closed()));
+    } else {
+        q->failed++;
+    }
+    FinishClosed(*q);
+}
+
+void
+ShardClient::ClosedTimeout(shared_ptr<ClosedQuorum> q)
+{
+    if (q->done) {
+        return;
+    }
+    q->failed++;
+    FinishClosed(*q);
+}
+
+/* A quorum closed the lowest of the timestamps it answered with. */
+void
+ShardClient::FinishClosed(ClosedQuorum &q)
+{
+    int quorum = config->QuorumSize();
+    if ((int)q.closed.size() >= quorum) {
+        q.done = true;
+        q.promise->Reply(REPLY_OK,
+                         *min_element(q.closed.begin(), q.closed.end()));
+    } else if (q.failed > config->n - quorum) {
+        q.done = true;
+        q.promise->Reply(REPLY_FAIL);
+    }
+}
+
+/* Callback from a shard replica on scan or multi-get completion. */
+void
+ShardClient::ValuesCallback(const string &request_str, const string &reply_str)
+{
+    Reply reply;
+    reply.ParseFromString(reply_str);
+
+    Debug("[shard %lu:%i] values callback [%d] %d keys", client_id, shard,
+          reply.status(), reply.values_size());
+    if (waiting != NULL) {
+        Promise *w = waiting;
+        waiting = NULL;
+        KeyValues values;
+        for (const auto &v : reply.values()) {
+            values[v.key()] = make_pair(Timestamp(v.timestamp()), v.value());
+            if (v.has_lastread()) {
+                AddHint(v.lastread());
+            }
+            if (v.has_pendingwrite()) {
+                AddHint(v.pendingwrite());
+            }
+        }
+        w->Reply(reply.status(), values);
+    }
+}
+
+void
+ShardClient::AddHint(const TimestampMessage &t)
+{
+    Timestamp ts(t);
+    if (ts > hint) {
+        hint = ts;
+    }
+}
+
 /* Callback from a shard replica on prepare operation completion. */
 void
 ShardClient::PrepareCallback(const string &request_str, const string &reply_str)
@@ -310,7 +637,10 @@ ShardClient::PrepareCallback(const string &request_str, const string &reply_str)
     if (waiting != NULL) {
         Promise *w = waiting;
         waiting = NULL;
-        if (reply.has_timestamp()) {
+        if (reply.status() == REPLY_OVERLOADED) {
+            // the timestamp carries the wait, in us
+            w->Reply(reply.status(), Timestamp(reply.retryafter()));
+        } else if (reply.has_timestamp()) {
             w->Reply(reply.status(), Timestamp(reply.timestamp()));
         } else {
             w->Reply(reply.status(), Timestamp());
@@ -39,11 +39,15 @@
 #include "tapir/replication/ir/client.h"
 #include "tapir/store/common/timestamp.h"
 #include "tapir/store/common/transaction.h"
+#include "tapir/store/common/backend/txnstore.h"
 #include "tapir/store/common/frontend/txnclient.h"
 #include "tapir/store/tapirstore/tapir-proto.pb.h"
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 namespace tapirstore {
 
@@ -69,6 +73,15 @@ public:
             const std::string &key,
             const Timestamp &timestamp,
             Promise *promise = NULL);
+    void MultiGet(uint64_t id,
+                  const std::vector<std::string> &keys,
+                  const std::map<std::string, Timestamp> &readTimes,
+                  Promise *promise = NULL);
+    void Scan(uint64_t id,
+              const std::string &start,
+              const std::string &end,
+              size_t limit,
+              Promise *promise = NULL);
     void Put(uint64_t id,
 	     const std::string &key,
 	     const std::string &value,
@@ -85,17 +98,62 @@ public:
                const Transaction &txn,
                Promise *promise = NULL);
 
+    // Ask every replica for its closed timestamp. The promise gets the
+    // lowest a quorum answered with: nothing can commit at or below it
+    // any more.
+    void GetClosed(Promise *promise);
+
+    // Read key at timestamp, which a quorum has closed, outside of any
+    // transaction. A replica that has not closed timestamp itself yet
+    // answers RETRY; each attempt goes to another replica.
+    void GetStale(const std::string &key, const Timestamp &timestamp,
+                  int attempt, Promise *promise);
+
+    // Shards taking part in the ongoing transaction, sent along with
+    // its prepare so replicas can terminate it if we go away.
+    void SetParticipants(const std::set<int> &participants);
+
+    // Isolation level the ongoing transaction asks its prepare to be
+    // validated at; without one, the replicas use their own.
+    void SetIsolation(Isolation isolation);
+
+    // Latest read or prepared write of the keys the ongoing
+    // transaction read here, as the replicas told it on GET replies;
+    // a prepare below it would likely be told to retry.
+    Timestamp GetHint() const { return hint; };
+
 private:
     uint64_t client_id; // Unique ID for this client.
     Transport *transport; // Transport layer.
     transport::Configuration *config;
     int shard; // which shard this client accesses
     int replica; // which replica to use for reads
+    std::set<int> participants; // shards in the ongoing transaction
+    bool hasIsolation; // whether the ongoing transaction picked a level
+    Isolation isolation; // and if so, which one
+    bool snapshotReads; // whether the ongoing transaction reads a snapshot
+    Timestamp snapshot; // and if so, the timestamp it reads at
+    bool prepared; // whether the ongoing transaction sent a prepare
+    int staleReplica; // next replica for bounded-staleness reads
+    Timestamp hint; // latest read or prepared write seen by GETs
+    bool closest; // whether the read replica was picked by the caller
 
     replication::ir::IRClient *client; // Client proxy.
     Promise *waiting; // waiting thread
     Promise *blockingBegin; // block until finished
 
+    // The closed timestamps replicas answered a GetClosed with, until
+    // a quorum has answered or too many replicas could not.
+    struct ClosedQuorum {
+        Promise *promise;
+        std::vector<Timestamp> closed;
+        int failed;
+        bool done;
+
+        ClosedQuorum(Promise *promise)
+            : promise(promise), failed(0), done(false) { };
+    };
+
     /* Tapir's Decide Function. */
     std::string TapirDecide(const std::map<std::string, std::size_t> &results);
 
@@ -104,10 +162,18 @@ private:
 
     /* Callbacks for hearing back from a shard for an operation. */
     void GetCallback(const std::string &, const std::string &);
+    void GetStaleCallback(const std::string &, const std::string &);
+    void ClosedCallback(std::shared_ptr<ClosedQuorum> q, const std::string &);
+    void ClosedTimeout(std::shared_ptr<ClosedQuorum> q);
+    void FinishClosed(ClosedQuorum &q);
+    void ValuesCallback(const std::string &, const std::string &);
     void PrepareCallback(const std::string &, const std::string &);
     void CommitCallback(const std::string &, const std::string &);
     void AbortCallback(const std::string &, const std::string &);
 
+    /* Raise hint to a timestamp from a GET reply. */
+    void AddHint(const TimestampMessage &t);
+
     /* Helper Functions for starting and finishing requests */
     void StartRequest();
     void WaitForResponse();
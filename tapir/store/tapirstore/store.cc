@@ -30,14 +30,22 @@
  **********************************************************************/
 
 #include "tapir/store/tapirstore/store.h"
+#include "tapir/store/tapirstore/tapir-proto.pb.h"
+
+#include <algorithm>
 
 namespace tapirstore {
 
 using namespace std;
 
-Store::Store(bool linearizable) : linearizable(linearizable), store() { }
+Store::Store(Isolation isolation)
+    : isolation(isolation), log(NULL), engine(NULL), history(NULL), store() { }
 
-Store::~Store() { }
+Store::~Store()
+{
+    delete engine;
+    delete history;
+}
 
 int
 Store::Get(uint64_t id, const string &key, pair<Timestamp,string> &value)
@@ -45,8 +53,10 @@ Store::Get(uint64_t id, const string &key, pair<Timestamp,string> &value)
     Debug("[%lu] GET %s", id, key.c_str());
 
 	VersionedValue val;
+    // a deleted or expired key is not found
     bool ret = store.get(key, val);
-    if (ret) {
+    if (ret && !val.deleted() &&
+        (val.expires == 0 || !val.expired(Timestamp(clock.GetTime())))) {
         Debug("Value: %s at <%lu, %lu>", value.second.c_str(), value.first.getTimestamp(), value.first.getID());
 		value.first = val.time;
 		value.second = val.value;
@@ -56,6 +66,34 @@ Store::Get(uint64_t id, const string &key, pair<Timestamp,string> &value)
     }
 }
 
+/* The hints let a client pick a commit timestamp that its prepare does
+ * not have to retry above. */
+int
+Store::GetWithHints(uint64_t id, const string &key, pair<Timestamp,string> &value,
+                    Timestamp &lastRead, Timestamp &pendingWrite)
+{
+    int status = Get(id, key, value);
+
+    keyid_t k;
+    if (store.lookup(key, k)) {
+        store.getLastRead(k, lastRead);
+        const PreparedTimes *pw = GetPrepared(pWrites, k);
+        if (pw != NULL) {
+            pendingWrite = pw->rbegin()->first;
+        }
+        const PreparedTimes *pi = GetPrepared(pIncs, k);
+        if (pi != NULL && pi->rbegin()->first > pendingWrite) {
+            pendingWrite = pi->rbegin()->first;
+        }
+    }
+    Timestamp lastScan;
+    if (store.getLastScan(key, lastScan) && lastScan > lastRead) {
+        lastRead = lastScan;
+    }
+
+    return status;
+}
+
 int
 Store::Get(uint64_t id, const string &key, const Timestamp &timestamp, pair<Timestamp,string> &value)
 {
@@ -63,7 +101,7 @@ Store::Get(uint64_t id, const string &key, const Timestamp &timestamp, pair<Time
 
 	VersionedValue val;
     bool ret = store.get(key, timestamp, val);
-    if (ret) {
+    if (ret && !val.deleted() && !val.expired(timestamp)) {
 		value.first = val.time;
 		value.second = val.value;
         return REPLY_OK;
@@ -72,57 +110,258 @@ Store::Get(uint64_t id, const string &key, const Timestamp &timestamp, pair<Time
     }
 }
 
+/* Read key as of timestamp for a read-only transaction. The version
+ * returned must stay the one valid at timestamp, so the read is refused
+ * while a write below timestamp is prepared, and it is recorded right
+ * away so that writes below timestamp no longer prepare here. */
+int
+Store::GetSnapshot(uint64_t id, const string &key, const Timestamp &timestamp, pair<Timestamp,string> &value)
+{
+    Debug("[%lu] GET SNAPSHOT %s at <%lu, %lu>", id, key.c_str(), timestamp.getTimestamp(), timestamp.getID());
+
+    if (timestamp < gcWatermark) {
+        // the version valid at timestamp may be gone
+        return REPLY_FAIL;
+    }
+
+    keyid_t kid;
+    if (!store.lookup(key, kid)) {
+        return REPLY_FAIL;
+    }
+
+    const PreparedTimes *pw = GetPrepared(pWrites, kid);
+    const PreparedTimes *pi = GetPrepared(pIncs, kid);
+    if ((pw != NULL && pw->begin()->first < timestamp) ||
+        (pi != NULL && pi->begin()->first < timestamp)) {
+        Debug("[%lu] RETRY snapshot behind prepared key:%s", id, key.c_str());
+        return REPLY_RETRY;
+    }
+
+    VersionedValue val;
+    if (!store.get(kid, timestamp, val)) {
+        return REPLY_FAIL;
+    }
+    store.commitGet(kid, val.time, timestamp);
+    // the delete is recorded as read too, so the key stays deleted
+    // at timestamp
+    if (val.deleted() || val.expired(timestamp)) {
+        return REPLY_FAIL;
+    }
+
+    value.first = val.time;
+    value.second = val.value;
+    return REPLY_OK;
+}
+
+/* Read the latest versions of the keys in a range. The caller adds
+ * each key found to its read set, and the range itself, so that keys
+ * inserted into the range later are caught at prepare. */
+int
+Store::Scan(uint64_t id, const string &start, const string &end, size_t limit,
+            KeyValues &values)
+{
+    Debug("[%lu] SCAN [%s, %s) limit %lu", id, start.c_str(), end.c_str(), limit);
+
+    vector<keyid_t> keys;
+    store.scan(start, end, limit, keys, Timestamp(clock.GetTime()));
+    for (auto key : keys) {
+        VersionedValue val;
+        store.get(key, val);
+        values[store.key(key)] = make_pair(val.time, val.value);
+    }
+    return REPLY_OK;
+}
+
 int
 Store::Prepare(uint64_t id, const Transaction &txn, const Timestamp &timestamp, Timestamp &proposedTimestamp)
+{
+    return Prepare(id, TransactionView(txn), timestamp, proposedTimestamp);
+}
+
+int
+Store::Prepare(uint64_t id, const TransactionView &txn, const Timestamp &timestamp, Timestamp &proposedTimestamp)
+{
+    return Prepare(id, txn, timestamp, isolation, proposedTimestamp);
+}
+
+/* Prepare txn at the isolation level it asked for, so transactions at
+ * different levels can share the store. */
+int
+Store::Prepare(uint64_t id, const TransactionView &txn, const Timestamp &timestamp,
+               Isolation isolation, Timestamp &proposedTimestamp)
 {   
     Debug("[%lu] START PREPARE", id);
 
-    if (prepared.find(id) != prepared.end()) {
-        if (prepared[id].first == timestamp) {
+    int status;
+    if (!CheckPrepared(id, timestamp, status, proposedTimestamp)) {
+        return status;
+    }
+
+    // look the transaction's keys up once; all checks below use the
+    // ids, and keys are only interned if it prepares
+    PreparedTxn ptxn;
+    LookupKeys(txn, ptxn);
+
+    return Validate(id, txn, timestamp, isolation, ptxn, proposedTimestamp);
+}
+
+/* Prepare a batch of transactions received together. The keys of the
+ * whole batch are looked up in one pass, and the transactions validated
+ * in timestamp order, the order they serialize in, so that each is
+ * checked against the earlier ones of the batch rather than the later. */
+void
+Store::PrepareBatch(vector<PrepareRequest> &batch)
+{
+    vector<PreparedTxn> ptxns(batch.size());
+    vector<size_t> order;
+    order.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (batch[i].timestamp > closed) {
+            LookupKeys(batch[i].txn, ptxns[i]);
+        }
+        order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [&batch](size_t a, size_t b) {
+        return batch[a].timestamp < batch[b].timestamp;
+    });
+
+    for (size_t i : order) {
+        PrepareRequest &r = batch[i];
+        Debug("[%lu] START PREPARE", r.id);
+        if (CheckPrepared(r.id, r.timestamp, r.status, r.proposed)) {
+            // keys an earlier transaction of the batch interned
+            LookupKeys(r.txn, ptxns[i]);
+            r.status = Validate(r.id, r.txn, r.timestamp,
+                                r.isolated ? r.isolation : isolation,
+                                ptxns[i], r.proposed);
+        }
+    }
+}
+
+/* Whether a prepare of id at timestamp still has to be validated; if
+ * not, status is its outcome, and proposed where to retry it. */
+bool
+Store::CheckPrepared(uint64_t id, const Timestamp &timestamp, int &status,
+                     Timestamp &proposed)
+{
+    auto p = prepared.find(id);
+    if (p != prepared.end()) {
+        if (p->second.timestamp == timestamp) {
             Warning("[%lu] Already Prepared!", id);
-            return REPLY_OK;
+            status = REPLY_OK;
+            return false;
         } else {
             // run the checks again for a new timestamp
-            prepared.erase(id);
+            RemovePrepared(id);
         }
     }
 
+    if (timestamp <= closed) {
+        // readers may have been told nothing commits here, if a quorum
+        // closed it; not a FAIL, so that a quorum that did not close it
+        // can still prepare it
+        Debug("[%lu] RETRY below closed timestamp", id);
+        proposed = closed;
+        status = REPLY_RETRY;
+        return false;
+    }
+    return true;
+}
+
+/* Run the checks for txn, whose keys are interned in ptxn, and add it
+ * to the prepared set if they pass. */
+int
+Store::Validate(uint64_t id, const TransactionView &txn, const Timestamp &timestamp,
+                Isolation isolation, PreparedTxn &ptxn, Timestamp &proposedTimestamp)
+{
+    int status;
+    ptxn.readAt = ReadAt(txn, timestamp, isolation);
+    if (isolation == ISOLATION_SNAPSHOT && txn.snapshot().isValid()) {
+        status = CheckSnapshot(id, txn, ptxn, timestamp, proposedTimestamp);
+    } else {
+        status = CheckSerializable(id, txn, ptxn, timestamp,
+                                   isolation == ISOLATION_LINEARIZABLE,
+                                   proposedTimestamp);
+    }
+    if (status != REPLY_OK) {
+        return status;
+    }
+
+    // Otherwise, prepare this transaction for commit
+    ptxn.timestamp = timestamp;
+    ptxn.txn = txn;
+    AddPrepared(id, ptxn);
+    Debug("[%lu] PREPARED TO COMMIT", id);
+
+    return REPLY_OK;
+}
+
+/* OCC checks for linearizable and serializable transactions: the read
+ * set has to still be valid at timestamp and nobody may have read the
+ * written keys after it. */
+int
+Store::CheckSerializable(uint64_t id, const TransactionView &txn,
+                         const PreparedTxn &ptxn, const Timestamp &timestamp,
+                         bool linearizable, Timestamp &proposedTimestamp)
+{
     // do OCC checks
-    unordered_map<string, set<Timestamp>> pWrites;
-    GetPreparedWrites(pWrites);
-    unordered_map<string, set<Timestamp>> pReads;
-    GetPreparedReads(pReads);
-	unordered_map<string, set<Timestamp>> pIncs;
-	GetPreparedIncrements(pIncs);
 
     // check for conflicts with the read set
-    for (auto &read : txn.getReadSet()) {
+    for (size_t n = 0; n < txn.readSetSize(); n++) {
+        keyid_t key = ptxn.reads[n];
+        Timestamp readTime = txn.readTime(n);
         pair<Timestamp, Timestamp> range;
-        bool ret = store.getRange(read.first, read.second, range);
+        uint64_t expires;
+        bool ret = store.getRange(key, readTime, range, expires);
 
-        // if we don't have this key then no conflicts for read
-        if (!ret) continue;
+        if (!ret) {
+            // the version we read has been garbage collected (or the
+            // key deleted and dropped), so we can no longer tell
+            // whether it is still valid
+            if (readTime < gcWatermark) {
+                Debug("[%lu] ABORT read version of key:%s collected",
+                      id, txn.readKey(n).c_str());
+                contention.add(txn.readKey(n), CONFLICT_ABORT_RW);
+                return REPLY_FAIL;
+            }
+
+            // if we don't have this key then no conflicts for read
+            continue;
+        }
 
         // if we don't have this version then no conflicts for read
-        if (range.first != read.second) continue;
+        if (range.first != readTime) continue;
+
+        // the version read expires before timestamp
+        if (expires != 0 && timestamp.getTimestamp() >= expires) {
+            Debug("[%lu] ABORT read version of key:%s expired",
+                  id, txn.readKey(n).c_str());
+            contention.add(txn.readKey(n), CONFLICT_ABORT_RW);
+            return REPLY_FAIL;
+        }
+
+        const PreparedTimes *pw = GetPrepared(pWrites, key);
+        const PreparedTimes *pi = GetPrepared(pIncs, key);
 
         // if the value is still valid
         if (!range.second.isValid()) {
             // check pending writes.
-            if ( pWrites.find(read.first) != pWrites.end() && 
+            if ( pw != NULL &&
                  (linearizable || 
-                  pWrites[read.first].upper_bound(timestamp) != pWrites[read.first].begin()) ) {
+                  pw->upper_bound(timestamp) != pw->begin()) ) {
                 Debug("[%lu] ABSTAIN rw conflict w/ prepared key:%s",
-                      id, read.first.c_str());
+                      id, txn.readKey(n).c_str());
+                contention.add(txn.readKey(n), CONFLICT_ABSTAIN_RW);
                 return REPLY_ABSTAIN;
             }
 
 			// check pending increments.
-			if ( pIncs.find(read.first) != pIncs.end() &&
+			if ( pi != NULL &&
 			     (linearizable ||
-				  pIncs[read.first].upper_bound(timestamp) != pIncs[read.first].begin() )) {
+				  pi->upper_bound(timestamp) != pi->begin() )) {
 			    Debug("[%lu] ABSTAIN ri conflict w/ prepared key:%s",
-				     id, read.first.c_str());
+				     id, txn.readKey(n).c_str());
+				contention.add(txn.readKey(n), CONFLICT_ABSTAIN_RW);
 				return REPLY_ABSTAIN;
 			}
 
@@ -135,51 +374,57 @@ Store::Prepare(uint64_t id, const Transaction &txn, const Timestamp &timestamp,
              */
             ASSERT(timestamp > range.first);
             Debug("[%lu] ABORT rw conflict key:%s",
-                  id, read.first.c_str());
+                  id, txn.readKey(n).c_str());
+            contention.add(txn.readKey(n), CONFLICT_ABORT_RW);
             return REPLY_FAIL;
         } else {
             /* there may be a pending write in the past.  check
              * pending writes again.  If proposed transaction is
              * earlier, abstain
              */
-            if (pWrites.find(read.first) != pWrites.end()) {
-                for (auto &writeTime : pWrites[read.first]) {
-                    if (writeTime > range.first && 
-                        writeTime < timestamp) {
-                        Debug("[%lu] ABSTAIN rw conflict w/ prepared key:%s",
-                              id, read.first.c_str());
-                        return REPLY_ABSTAIN;
-                    }
+            if (pw != NULL) {
+                auto it = pw->upper_bound(range.first);
+                if (it != pw->end() && it->first < timestamp) {
+                    Debug("[%lu] ABSTAIN rw conflict w/ prepared key:%s",
+                          id, txn.readKey(n).c_str());
+                    contention.add(txn.readKey(n), CONFLICT_ABSTAIN_RW);
+                    return REPLY_ABSTAIN;
                 }
             }
-			if (pIncs.find(read.first) != pIncs.end()) {
-                for (auto &incTime : pIncs[read.first]) {
-                    if (incTime > range.first && 
-                        incTime < timestamp) {
-                        Debug("[%lu] ABSTAIN ri conflict w/ prepared key:%s",
-                              id, read.first.c_str());
-                        return REPLY_ABSTAIN;
-                    }
+			if (pi != NULL) {
+                auto it = pi->upper_bound(range.first);
+                if (it != pi->end() && it->first < timestamp) {
+                    Debug("[%lu] ABSTAIN ri conflict w/ prepared key:%s",
+                          id, txn.readKey(n).c_str());
+                    contention.add(txn.readKey(n), CONFLICT_ABSTAIN_RW);
+                    return REPLY_ABSTAIN;
                 }
             }
 
         }
     }
 
+    int status = CheckRanges(id, txn, ptxn, timestamp, linearizable);
+    if (status != REPLY_OK) {
+        return status;
+    }
+
     // check for conflicts with the write set
-    for (auto &write : txn.getWriteSet()) {
-        VersionedValue val;
+    for (size_t n = 0; n < txn.writeSetSize(); n++) {
+        keyid_t key = ptxn.writes[n];
         // if this key is in the store
-        if ( store.get(write.first, val) ) {
+        const VersionedValue *val = store.peek(key);
+        if (val != NULL) {
             Timestamp lastRead;
             bool ret;
 
             // if the last committed write/inc is bigger than the timestamp,
             // then can't accept in linearizable
-            if ( linearizable && val.time > timestamp ) {
+            if ( linearizable && val->time > timestamp ) {
                 Debug("[%lu] RETRY ww conflict w/ prepared key:%s", 
-                      id, write.first.c_str());
-                proposedTimestamp = val.time;
+                      id, txn.writeKey(n).c_str());
+                proposedTimestamp = val->time;
+                contention.add(txn.writeKey(n), CONFLICT_RETRY_WW);
                 return REPLY_RETRY;	                    
             }
 
@@ -189,76 +434,88 @@ Store::Prepare(uint64_t id, const Transaction &txn, const Timestamp &timestamp,
             // if linearizable mode, then we get the timestamp of the last
             // read ever on this object
             if (linearizable) {
-                ret = store.getLastRead(write.first, lastRead);
+                ret = store.getLastRead(key, lastRead);
             } else {
                 // otherwise, we get the last read for the version that is being written
-                ret = store.getLastRead(write.first, timestamp, lastRead);
+                ret = store.getLastRead(key, timestamp, lastRead);
             }
 
             // if this key is in the store and has been read before
             if (ret && lastRead > timestamp) {
                 Debug("[%lu] RETRY wr conflict w/ prepared key:%s", 
-                      id, write.first.c_str());
+                      id, txn.writeKey(n).c_str());
                 proposedTimestamp = lastRead;
+                contention.add(txn.writeKey(n), CONFLICT_RETRY_WR);
                 return REPLY_RETRY; 
             }
         }
 
+        // the key may be new to a range someone scanned
+        status = CheckScans(id, txn.writeKey(n), timestamp, proposedTimestamp);
+        if (status != REPLY_OK) {
+            return status;
+        }
+
 
         // if there is a pending write for this key, greater than the
         // proposed timestamp, retry
-        if ( linearizable &&
-             pWrites.find(write.first) != pWrites.end()) {
-            set<Timestamp>::iterator it = pWrites[write.first].upper_bound(timestamp);
-            if ( it != pWrites[write.first].end() ) {
-                Debug("[%lu] RETRY ww conflict w/ prepared key:%s",
-                      id, write.first.c_str());
-                proposedTimestamp = *it;
-                return REPLY_RETRY;
+        if (linearizable) {
+            const PreparedTimes *pw = GetPrepared(pWrites, key);
+            if (pw != NULL) {
+                auto it = pw->upper_bound(timestamp);
+                if ( it != pw->end() ) {
+                    Debug("[%lu] RETRY ww conflict w/ prepared key:%s",
+                          id, txn.writeKey(n).c_str());
+                    proposedTimestamp = it->first;
+                    contention.add(txn.writeKey(n), CONFLICT_RETRY_WW);
+                    return REPLY_RETRY;
+                }
             }
-        }
-		if ( linearizable &&
-             pIncs.find(write.first) != pIncs.end()) {
-            set<Timestamp>::iterator it = pIncs[write.first].upper_bound(timestamp);
-            if ( it != pIncs[write.first].end() ) {
-                Debug("[%lu] RETRY wi conflict w/ prepared key:%s",
-                      id, write.first.c_str());
-                proposedTimestamp = *it;
-                return REPLY_RETRY;
+            const PreparedTimes *pi = GetPrepared(pIncs, key);
+            if (pi != NULL) {
+                auto it = pi->upper_bound(timestamp);
+                if ( it != pi->end() ) {
+                    Debug("[%lu] RETRY wi conflict w/ prepared key:%s",
+                          id, txn.writeKey(n).c_str());
+                    proposedTimestamp = it->first;
+                    contention.add(txn.writeKey(n), CONFLICT_RETRY_WW);
+                    return REPLY_RETRY;
+                }
             }
         }
 
 
         //if there is a pending read for this key, greater than the
         //propsed timestamp, abstain
-        if ( pReads.find(write.first) != pReads.end() &&
-             pReads[write.first].upper_bound(timestamp) != pReads[write.first].end() ) {
+        const PreparedTimes *pr = GetPrepared(pReads, key);
+        if ( pr != NULL &&
+             pr->upper_bound(timestamp) != pr->end() ) {
             Debug("[%lu] ABSTAIN wr conflict w/ prepared key:%s", 
-                  id, write.first.c_str());
+                  id, txn.writeKey(n).c_str());
+            contention.add(txn.writeKey(n), CONFLICT_ABSTAIN_WR);
             return REPLY_ABSTAIN;
         }
     }
 
     // check for conflicts with the increment set
-    for (auto &inc : txn.getIncrementSet()) {
+    for (size_t n = 0; n < txn.incrementSetSize(); n++) {
+        keyid_t key = ptxn.incs[n];
         
-		set<VersionedValue>::iterator it;
-		store.getValue(inc.first, timestamp, it);
 		// if there exists a committed write of distince increment op
 		// of bigger timestamp, then can't accept in linearizable
-		if (linearizable) {
+		VersionedKVStore::VersionChain::const_iterator it, end;
+		if (linearizable && store.getVersions(key, timestamp, it, end)) {
 			Timestamp suggest;
-			for( ; it != store.store[inc.first].end(); it++) {
-				for(auto i : inc.second) {
-					if((*it).op != i.op) {
-						suggest = (*it).time;
-					}
+			for( ; it != end; it++) {
+				if((*it).op != txn.incrementOp(n)) {
+					suggest = (*it).time;
 				}
 			}
 			if(suggest.isValid()) {
 				Debug("[%lu] RETRY iw conflict w/ prepared key:%s", 
-						id, inc.first.c_str());
+						id, txn.incrementKey(n).c_str());
 				proposedTimestamp = suggest;
+				contention.add(txn.incrementKey(n), CONFLICT_RETRY_WW);
 				return REPLY_RETRY;
 			}
 		}
@@ -272,81 +529,263 @@ Store::Prepare(uint64_t id, const Transaction &txn, const Timestamp &timestamp,
 		bool ret;
 
 		if (linearizable) {
-			ret = store.getLastRead(inc.first, lastRead);
+			ret = store.getLastRead(key, lastRead);
 		} else {
 			// otherwise, we get the last read for the version that is being written
-			ret = store.getLastRead(inc.first, timestamp, lastRead);
+			ret = store.getLastRead(key, timestamp, lastRead);
 		}
 
 		// if this key is in the store and has been read before
 		if (ret && lastRead > timestamp) {
 			Debug("[%lu] RETRY ir conflict w/ prepared key:%s", 
-					id, inc.first.c_str());
+					id, txn.incrementKey(n).c_str());
 			proposedTimestamp = lastRead;
+			contention.add(txn.incrementKey(n), CONFLICT_RETRY_WR);
 			return REPLY_RETRY; 
 		}
 
-		// if there is a pending write for this key, greater than the
-        // proposed timestamp, retry
-        if ( linearizable &&
-             pWrites.find(inc.first) != pWrites.end()) {
-            set<Timestamp>::iterator it = pWrites[inc.first].upper_bound(timestamp);
-            if ( it != pWrites[inc.first].end() ) {
-                Debug("[%lu] RETRY iw conflict w/ prepared key:%s",
-                      id, inc.first.c_str());
-                proposedTimestamp = *it;
-                return REPLY_RETRY;
-            }
-        }
-
+		status = CheckScans(id, txn.incrementKey(n), timestamp, proposedTimestamp);
+		if (status != REPLY_OK) {
+			return status;
+		}
 
-        // if there is a pending increment of distinct increment op 
-		// for this key, greater than the proposed timestamp, retry
-        if ( linearizable &&
-             pIncs.find(inc.first) != pIncs.end()) {
-            set<Timestamp>::iterator it = pIncs[inc.first].upper_bound(timestamp);
-			Timestamp suggest;
-			for( ; it != pIncs[inc.first].end() ; it++) {
-				//find increment op of operation at iterator
-				vector<Increment> incList;
-				for(auto p : prepared) {
-					if(p.second.first == *it) {
-						auto temp = p.second.second.getIncrementSet();
-						incList = temp[inc.first];
-						break;
-					}
+		if (linearizable) {
+			// if there is a pending write for this key, greater than the
+			// proposed timestamp, retry
+			const PreparedTimes *pw = GetPrepared(pWrites, key);
+			if (pw != NULL) {
+				auto it = pw->upper_bound(timestamp);
+				if ( it != pw->end() ) {
+					Debug("[%lu] RETRY iw conflict w/ prepared key:%s",
+						  id, txn.incrementKey(n).c_str());
+					proposedTimestamp = it->first;
+					contention.add(txn.incrementKey(n), CONFLICT_RETRY_WW);
+					return REPLY_RETRY;
 				}
-				for(auto pinc : incList) {
-					for(auto i : inc.second) {
-						if(pinc.op != i.op) {
-							suggest = *it;
+			}
+
+			// if there is a pending increment of distinct increment op
+			// for this key, greater than the proposed timestamp, retry
+			const PreparedTimes *pi = GetPrepared(pIncs, key);
+			if (pi != NULL) {
+				Timestamp suggest;
+				for (auto it = pi->upper_bound(timestamp); it != pi->end(); it++) {
+					// resolve the increment ops of the prepared transaction
+					const PreparedTxn &pt = prepared[it->second];
+					for (size_t j = 0; j < pt.incs.size(); j++) {
+						if (pt.incs[j] == key &&
+						    pt.txn.incrementOp(j) != txn.incrementOp(n)) {
+							suggest = it->first;
 						}
 					}
 				}
+				if (suggest.isValid()) {
+					Debug("[%lu] RETRY ww conflict w/ prepared key:%s",
+						  id, txn.incrementKey(n).c_str());
+					proposedTimestamp = suggest;
+					contention.add(txn.incrementKey(n), CONFLICT_RETRY_WW);
+					return REPLY_RETRY;
+				}
 			}
-			if(suggest.isValid()) {
-				Debug("[%lu] RETRY ww conflict w/ prepared key:%s",
-                   	  id, inc.first.c_str());
-				proposedTimestamp = suggest;
-	            return REPLY_RETRY;
-			}
-
-        }
+		}
 
 
         //if there is a pending read for this key, greater than the
         //propsed timestamp, abstain
-        if ( pReads.find(inc.first) != pReads.end() &&
-             pReads[inc.first].upper_bound(timestamp) != pReads[inc.first].end() ) {
+        const PreparedTimes *pr = GetPrepared(pReads, key);
+        if ( pr != NULL &&
+             pr->upper_bound(timestamp) != pr->end() ) {
             Debug("[%lu] ABSTAIN wr conflict w/ prepared key:%s", 
-                  id, inc.first.c_str());
+                  id, txn.incrementKey(n).c_str());
+            contention.add(txn.incrementKey(n), CONFLICT_ABSTAIN_WR);
             return REPLY_ABSTAIN;
         }
     }
 
-    // Otherwise, prepare this transaction for commit
-    prepared[id] = make_pair(timestamp, txn);
-    Debug("[%lu] PREPARED TO COMMIT", id);
+    return REPLY_OK;
+}
+
+/* Phantom checks for the ranges txn scanned: a key in a range that the
+ * scan did not find (so it is not in the read set) must not have been
+ * written since, and must not be about to be. */
+int
+Store::CheckRanges(uint64_t id, const TransactionView &txn,
+                   const PreparedTxn &ptxn, const Timestamp &timestamp,
+                   bool linearizable)
+{
+    if (txn.rangeSetSize() == 0) {
+        return REPLY_OK;
+    }
+
+    vector<keyid_t> found(ptxn.reads);
+    sort(found.begin(), found.end());
+
+    for (size_t n = 0; n < txn.rangeSetSize(); n++) {
+        vector<keyid_t> keys;
+        store.keysInRange(txn.rangeStart(n), txn.rangeEnd(n), keys);
+
+        for (auto key : keys) {
+            if (binary_search(found.begin(), found.end(), key)) {
+                continue;
+            }
+
+            // a committed version the scan did not see; in serializable
+            // mode only one below timestamp matters, and a delete is
+            // no version at all
+            const VersionedValue *val = linearizable ? store.peek(key)
+                                                     : store.peek(key, timestamp);
+            if (val != NULL && !val->deleted() && !val->expired(timestamp)) {
+                Debug("[%lu] ABORT phantom key:%s", id, store.key(key).c_str());
+                contention.add(store.key(key), CONFLICT_ABORT_PHANTOM);
+                return REPLY_FAIL;
+            }
+
+            const PreparedTimes *pw = GetPrepared(pWrites, key);
+            const PreparedTimes *pi = GetPrepared(pIncs, key);
+            if ((pw != NULL && (linearizable || pw->begin()->first < timestamp)) ||
+                (pi != NULL && (linearizable || pi->begin()->first < timestamp))) {
+                Debug("[%lu] ABSTAIN phantom w/ prepared key:%s",
+                      id, store.key(key).c_str());
+                contention.add(store.key(key), CONFLICT_ABSTAIN_RW);
+                return REPLY_ABSTAIN;
+            }
+        }
+    }
+
+    return REPLY_OK;
+}
+
+/* Checks a key written at timestamp against the ranges scanned by
+ * committed and prepared transactions after timestamp. */
+int
+Store::CheckScans(uint64_t id, const string &key, const Timestamp &timestamp,
+                  Timestamp &proposedTimestamp)
+{
+    Timestamp lastScan;
+    if (store.getLastScan(key, lastScan) && lastScan > timestamp) {
+        Debug("[%lu] RETRY wr conflict w/ scan key:%s", id, key.c_str());
+        proposedTimestamp = lastScan;
+        contention.add(key, CONFLICT_RETRY_WR);
+        return REPLY_RETRY;
+    }
+
+    for (auto it = pScans.upper_bound(timestamp); it != pScans.end(); it++) {
+        const TransactionView &scan = prepared[it->second].txn;
+        for (size_t n = 0; n < scan.rangeSetSize(); n++) {
+            if (VersionedKVStore::inRange(key, scan.rangeStart(n),
+                                          scan.rangeEnd(n))) {
+                Debug("[%lu] ABSTAIN wr conflict w/ prepared scan key:%s",
+                      id, key.c_str());
+                contention.add(key, CONFLICT_ABSTAIN_WR);
+                return REPLY_ABSTAIN;
+            }
+        }
+    }
+
+    return REPLY_OK;
+}
+
+/* Checks for a snapshot-isolated transaction. Its reads all came from
+ * its snapshot, so they need no validation; it only aborts if another
+ * transaction wrote one of its keys after the snapshot (first committer
+ * wins). Increments with the same op commute and do not conflict. */
+int
+Store::CheckSnapshot(uint64_t id, const TransactionView &txn,
+                     const PreparedTxn &ptxn, const Timestamp &timestamp,
+                     Timestamp &proposedTimestamp)
+{
+    const Timestamp snapshot = txn.snapshot();
+
+    if (timestamp <= snapshot) {
+        proposedTimestamp = snapshot;
+        return REPLY_RETRY;
+    }
+
+    for (size_t n = 0; n < txn.writeSetSize(); n++) {
+        int status = CheckSnapshotKey(id, txn.writeKey(n), ptxn.writes[n],
+                                      NOT_INCREMENT, snapshot,
+                                      timestamp, proposedTimestamp);
+        if (status != REPLY_OK) {
+            return status;
+        }
+    }
+
+    for (size_t n = 0; n < txn.incrementSetSize(); n++) {
+        int status = CheckSnapshotKey(id, txn.incrementKey(n), ptxn.incs[n],
+                                      txn.incrementOp(n), snapshot,
+                                      timestamp, proposedTimestamp);
+        if (status != REPLY_OK) {
+            return status;
+        }
+    }
+
+    return REPLY_OK;
+}
+
+/* Checks a single key written (op NOT_INCREMENT) or incremented by a
+ * snapshot-isolated transaction. */
+int
+Store::CheckSnapshotKey(uint64_t id, const string &name, keyid_t key, uint64_t op,
+                        const Timestamp &snapshot, const Timestamp &timestamp,
+                        Timestamp &proposedTimestamp)
+{
+    // a version committed after the snapshot is a lost update
+    VersionedKVStore::VersionChain::const_iterator it, end;
+    if (store.getVersionsAfter(key, snapshot, it, end)) {
+        for ( ; it != end; it++) {
+            if (op == NOT_INCREMENT || (*it).op != op) {
+                Debug("[%lu] ABORT ww conflict after snapshot key:%s",
+                      id, name.c_str());
+                contention.add(name, CONFLICT_ABORT_WW);
+                return REPLY_FAIL;
+            }
+        }
+    }
+
+    // so is a prepared one, if it commits
+    const PreparedTimes *pw = GetPrepared(pWrites, key);
+    if (pw != NULL) {
+        Debug("[%lu] ABSTAIN ww conflict w/ prepared key:%s", id, name.c_str());
+        contention.add(name, CONFLICT_ABSTAIN_WW);
+        return REPLY_ABSTAIN;
+    }
+    const PreparedTimes *pi = GetPrepared(pIncs, key);
+    if (pi != NULL) {
+        for (auto p = pi->begin(); p != pi->end(); p++) {
+            const PreparedTxn &pt = prepared[p->second];
+            for (size_t j = 0; j < pt.incs.size(); j++) {
+                if (pt.incs[j] == key &&
+                    (op == NOT_INCREMENT ||
+                     pt.txn.incrementOp(j) != op)) {
+                    Debug("[%lu] ABSTAIN wi conflict w/ prepared key:%s",
+                          id, name.c_str());
+                    contention.add(name, CONFLICT_ABSTAIN_WW);
+                    return REPLY_ABSTAIN;
+                }
+            }
+        }
+    }
+
+    // a snapshot that has already been read past timestamp must not
+    // change under its reader
+    Timestamp lastRead;
+    if (store.getLastRead(key, timestamp, lastRead) && lastRead > timestamp) {
+        Debug("[%lu] RETRY wr conflict w/ snapshot key:%s", id, name.c_str());
+        proposedTimestamp = lastRead;
+        contention.add(name, CONFLICT_RETRY_WR);
+        return REPLY_RETRY;
+    }
+    int status = CheckScans(id, name, timestamp, proposedTimestamp);
+    if (status != REPLY_OK) {
+        return status;
+    }
+
+    const PreparedTimes *pr = GetPrepared(pReads, key);
+    if (pr != NULL && pr->upper_bound(timestamp) != pr->end()) {
+        Debug("[%lu] ABSTAIN wr conflict w/ prepared key:%s", id, name.c_str());
+        contention.add(name, CONFLICT_ABSTAIN_WR);
+        return REPLY_ABSTAIN;
+    }
 
     return REPLY_OK;
 }
@@ -359,39 +798,112 @@ Store::Commit(uint64_t id, uint64_t timestamp)
     
     // Nope. might not find it
     //ASSERT(prepared.find(id) != prepared.end());
+    auto p = prepared.find(id);
+    if (p == prepared.end()) {
+        return;
+    }
 
-    pair<Timestamp, Transaction> p = prepared[id];
-
-    Commit(p.first, p.second);
+    Commit(p->second);
 
-    prepared.erase(id);
+    RemovePrepared(id);
 }
 
 void
-Store::Commit(const Timestamp &timestamp, const Transaction &txn)
+Store::Commit(const PreparedTxn &ptxn)
 {
+    const Timestamp &timestamp = ptxn.timestamp;
+    const TransactionView &txn = ptxn.txn;
+
+    if (log != NULL) {
+        // made durable along with the IR record before the commit is
+        // acknowledged
+        log->Append(CommitRecord(txn, timestamp, ptxn.readAt));
+    }
+
     // updated timestamp of last committed read for the read set
-    for (auto &read : txn.getReadSet()) {
-        store.commitGet(read.first, // key
-                        read.second, // timestamp of read version
-                        timestamp); // commit timestamp
+    for (size_t n = 0; n < txn.readSetSize(); n++) {
+        store.commitGet(ptxn.reads[n], // key
+                        txn.readTime(n), // timestamp of read version
+                        ptxn.readAt); // commit (or snapshot) timestamp
     }
 
-    // insert writes into versioned key-value store
-    for (auto &write : txn.getWriteSet()) {
-        store.put(write.first, // key
-                  write.second, // value
-                  timestamp); // timestamp
+    // insert writes (and deletes) into versioned key-value store
+    for (size_t n = 0; n < txn.writeSetSize(); n++) {
+        if (txn.writeDeleted(n)) {
+            store.remove(ptxn.writes[n], timestamp);
+            continue;
+        }
+        uint64_t ttl = txn.writeTTL(n);
+        store.put(ptxn.writes[n], // key
+                  txn.writeValue(n), // value
+                  timestamp, // timestamp
+                  // expiry, counted from the commit timestamp so that
+                  // every replica agrees on it
+                  ttl > 0 ? TrueTime::FromMicros(
+                      TrueTime::ToMicros(timestamp.getTimestamp()) + ttl * 1000) : 0);
     }
 
 	// perform all increments on the key-value store
-	for (auto &incList : txn.getIncrementSet()) {
-		for (auto inc : incList.second) {
-			store.increment(incList.first,
-							inc,
-							timestamp);
-		}
+	for (size_t n = 0; n < txn.incrementSetSize(); n++) {
+		store.increment(ptxn.incs[n],
+						txn.increment(n),
+						timestamp);
 	}
+
+    // and record the scanned ranges like the reads
+    for (size_t n = 0; n < txn.rangeSetSize(); n++) {
+        store.commitScan(txn.rangeStart(n), txn.rangeEnd(n), ptxn.readAt);
+    }
+}
+
+/* Validate the reads of a read-only transaction at timestamp, its
+ * snapshot, and record them if they hold. A read fails if a write of
+ * its key committed after the version read, and abstains while one is
+ * prepared there, below the snapshot; once recorded, such writes have
+ * to retry above it. */
+int
+Store::CommitReads(uint64_t id, const TransactionView &txn, const Timestamp &timestamp)
+{
+    Debug("[%lu] COMMIT READS", id);
+
+    for (size_t n = 0; n < txn.readSetSize(); n++) {
+        Timestamp readTime = txn.readTime(n);
+        keyid_t key;
+        if (!store.lookup(txn.readKey(n), key)) {
+            continue;
+        }
+
+        VersionedValue val;
+        if (store.get(key, timestamp, val) && val.time > readTime) {
+            Debug("[%lu] ABORT snapshot read of key:%s overwritten",
+                  id, txn.readKey(n).c_str());
+            contention.add(txn.readKey(n), CONFLICT_ABORT_RW);
+            return REPLY_FAIL;
+        }
+
+        const PreparedTimes *pw = GetPrepared(pWrites, key);
+        const PreparedTimes *pi = GetPrepared(pIncs, key);
+        for (const PreparedTimes *p : { pw, pi }) {
+            if (p == NULL) {
+                continue;
+            }
+            auto it = p->upper_bound(readTime);
+            if (it != p->end() && it->first < timestamp) {
+                Debug("[%lu] ABSTAIN snapshot read w/ prepared key:%s",
+                      id, txn.readKey(n).c_str());
+                contention.add(txn.readKey(n), CONFLICT_ABSTAIN_RW);
+                return REPLY_ABSTAIN;
+            }
+        }
+    }
+
+    for (size_t n = 0; n < txn.readSetSize(); n++) {
+        store.commitGet(txn.readKey(n), txn.readTime(n), timestamp);
+    }
+    for (size_t n = 0; n < txn.rangeSetSize(); n++) {
+        store.commitScan(txn.rangeStart(n), txn.rangeEnd(n), timestamp);
+    }
+    return REPLY_OK;
 }
 
 void
@@ -400,7 +912,7 @@ Store::Abort(uint64_t id, const Transaction &txn)
     Debug("[%lu] ABORT", id);
     
     if (prepared.find(id) != prepared.end()) {
-        prepared.erase(id);
+        RemovePrepared(id);
     }
 }
 
@@ -411,36 +923,422 @@ Store::Load(const string &key, const string &value, const Timestamp &timestamp)
 }
 
 void
-Store::GetPreparedWrites(unordered_map<string, set<Timestamp>> &writes)
+Store::LoadBatch(const vector<pair<string, string>> &values,
+                 const Timestamp &timestamp)
+{
+    for (auto &kv : values) {
+        store.put(kv.first, kv.second, timestamp);
+    }
+}
+
+void
+Store::Reserve(size_t n)
 {
-    // gather up the set of all writes that are currently prepared
-    for (auto &t : prepared) {
-        for (auto &write : t.second.second.getWriteSet()) {
-            writes[write.first].insert(t.second.first);
+    store.reserve(store.size() + n);
+}
+
+/* The safe point for reclaiming versions: the horizon, lowered to the
+ * oldest prepare or read timestamp in the prepared set. Versions below
+ * the returned watermark may be gone from then on. */
+Timestamp
+Store::SafePoint(const Timestamp &horizon)
+{
+    Timestamp safe = horizon;
+
+    if (!preparedOldest.empty() && *preparedOldest.begin() < safe) {
+        safe = *preparedOldest.begin();
+    }
+
+    if (safe > gcWatermark) {
+        gcWatermark = safe;
+    }
+    return gcWatermark;
+}
+
+/* Whether the prepared set refers to key by id, so that it must not be
+ * dropped. */
+bool
+Store::Pinned(keyid_t key) const
+{
+    return pReads.count(key) > 0 || pWrites.count(key) > 0 ||
+        pIncs.count(key) > 0;
+}
+
+/* Reclaim versions that no prepared transaction can still need. */
+void
+Store::GC(const Timestamp &horizon, size_t slice)
+{
+    Timestamp safe = SafePoint(horizon);
+
+    size_t reclaimed = store.gc(safe, slice, [this](keyid_t key) {
+        return Pinned(key);
+    });
+    if (reclaimed > 0) {
+        Debug("GC reclaimed %lu versions below <%lu, %lu>", reclaimed,
+              safe.getTimestamp(), safe.getID());
+    }
+}
+
+/* Drop the keys that expired below the safe point, without waiting
+ * for the GC sweep to come round to them. */
+void
+Store::Expire(const Timestamp &horizon, size_t slice)
+{
+    Timestamp safe = SafePoint(horizon);
+
+    size_t reclaimed = store.expire(safe, slice, [this](keyid_t key) {
+        return Pinned(key);
+    });
+    if (reclaimed > 0) {
+        Debug("EXPIRE reclaimed %lu versions below <%lu, %lu>", reclaimed,
+              safe.getTimestamp(), safe.getID());
+    }
+}
+
+string
+Store::CommitRecord(const TransactionView &txn, const Timestamp &timestamp,
+                    const Timestamp &readAt)
+{
+    proto::LogCommitMessage msg;
+    txn.serialize(msg.mutable_txn());
+    timestamp.serialize(msg.mutable_timestamp());
+    readAt.serialize(msg.mutable_readat());
+    string record(1, STORE_LOG_COMMIT);
+    msg.AppendToString(&record);
+    return record;
+}
+
+bool
+Store::ParseCommit(const string &record, TransactionView &txn,
+                   Timestamp &timestamp, Timestamp &readAt)
+{
+    if (record.empty() || record[0] != STORE_LOG_COMMIT) {
+        return false;
+    }
+    auto arena = make_shared<google::protobuf::Arena>();
+    auto msg = google::protobuf::Arena::CreateMessage<proto::LogCommitMessage>(arena.get());
+    if (!msg->ParseFromArray(record.data() + 1, record.size() - 1)) {
+        Panic("Corrupt commit record in log");
+    }
+    txn = TransactionView(arena, &msg->txn());
+    timestamp = Timestamp(msg->timestamp());
+    readAt = Timestamp(msg->readat());
+    return true;
+}
+
+Timestamp
+Store::ReadAt(const TransactionView &txn, const Timestamp &timestamp,
+              Isolation isolation)
+{
+    if (isolation == ISOLATION_SNAPSHOT && txn.snapshot().isValid()) {
+        // its reads are recorded at its snapshot rather than its commit
+        return txn.snapshot();
+    }
+    return timestamp;
+}
+
+/* Apply a commit read back from the log, as Commit did. */
+void
+Store::Redo(const TransactionView &txn, const Timestamp &timestamp,
+            const Timestamp &readAt)
+{
+    PreparedTxn ptxn;
+    ptxn.timestamp = timestamp;
+    ptxn.readAt = readAt;
+    ptxn.txn = txn;
+    InternKeys(txn, ptxn);
+    Commit(ptxn);
+}
+
+/* Redo the commits in the log, on top of whatever was loaded. Writes
+ * are idempotent by timestamp, so commits already in a checkpoint
+ * change nothing. */
+void
+Store::Recover(WriteAheadLog *log)
+{
+    ASSERT(this->log == NULL);
+    size_t n = 0;
+    log->Replay([&](const string &record) {
+        TransactionView txn;
+        Timestamp timestamp, readAt;
+        if (ParseCommit(record, txn, timestamp, readAt)) {
+            Redo(txn, timestamp, readAt);
+            n++;
         }
+    });
+    Notice("Recovered %lu commits from %s", n, log->Filename().c_str());
+}
+
+void
+Store::SetLog(WriteAheadLog *log)
+{
+    this->log = log;
+}
+
+/* Keep values on disk from now on. Their versions stay in memory, so
+ * Prepare never waits for the disk. */
+bool
+Store::OpenEngine(const string &dir, size_t cacheBytes)
+{
+    ASSERT(engine == NULL);
+    LogEngine *e = new LogEngine(dir, cacheBytes);
+    if (!e->open()) {
+        delete e;
+        return false;
     }
+    engine = e;
+    store.setEngine(engine);
+    Notice("Keeping values in %s, with a %lu MB cache", dir.c_str(),
+           cacheBytes >> 20);
+    return true;
+}
+
+/* Keep old versions on disk from now on; reads of them read them back
+ * in, so nothing changes but where they are. */
+bool
+Store::OpenHistory(const string &dir)
+{
+    ASSERT(history == NULL);
+    LogEngine *h = new LogEngine(dir, HISTORY_CACHE_BYTES);
+    if (!h->open()) {
+        delete h;
+        return false;
+    }
+    history = h;
+    store.setHistory(history);
+    Notice("Keeping version history in %s", dir.c_str());
+    return true;
+}
+
+/* Move the versions replaced before horizon to history, leaving out
+ * those GC would reclaim. */
+void
+Store::Tier(const Timestamp &horizon, size_t slice)
+{
+    size_t moved = store.tier(horizon, gcWatermark, slice);
+    if (moved > 0) {
+        Debug("TIER moved %lu versions below <%lu, %lu>", moved,
+              horizon.getTimestamp(), horizon.getID());
+    }
+}
+
+/* Start from a checkpoint. Versions it left out are treated like
+ * garbage collected ones. */
+bool
+Store::LoadCheckpoint(const string &path)
+{
+    Timestamp floor;
+    if (!store.loadCheckpoint(path, floor)) {
+        return false;
+    }
+    if (floor > gcWatermark) {
+        gcWatermark = floor;
+    }
+    Notice("Loaded checkpoint %s", path.c_str());
+    return true;
+}
+
+/* Write the committed state to a checkpoint; prepared transactions
+ * are left to replica recovery. */
+bool
+Store::WriteCheckpoint(const string &path, bool history)
+{
+    return store.writeCheckpoint(path, history);
+}
+
+/* Close the store at bound: nothing at or below it prepares any more.
+ * The closed timestamp also stays below every transaction that is
+ * still prepared, as those may yet commit. */
+Timestamp
+Store::Close(const Timestamp &bound)
+{
+    if (bound > closed) {
+        closed = bound;
+    }
+
+    if (!preparedTimes.empty() && *preparedTimes.begin() <= closed) {
+        return Timestamp(preparedTimes.begin()->getTimestamp() - 1, 0);
+    }
+    return closed;
+}
+
+size_t
+Store::PreparedCount()
+{
+    return prepared.size();
 }
 
 void
-Store::GetPreparedReads(unordered_map<string, set<Timestamp>> &reads)
+Store::Contention(vector<ContentionEntry> &top, uint64_t &total, bool reset)
 {
-    // gather up the set of all writes that are currently prepared
-    for (auto &t : prepared) {
-        for (auto &read : t.second.second.getReadSet()) {
-            reads[read.first].insert(t.second.first);
+    contention.top(top);
+    total += contention.total();
+    if (reset) {
+        contention.clear();
+    }
+}
+
+/* Look up the ids of the keys of txn, op by op, KEY_NONE for those that
+ * are not interned; ids already in ptxn are kept. */
+void
+Store::LookupKeys(const TransactionView &txn, PreparedTxn &ptxn)
+{
+    ptxn.reads.resize(txn.readSetSize(), KEY_NONE);
+    for (size_t n = 0; n < txn.readSetSize(); n++) {
+        if (ptxn.reads[n] == KEY_NONE) {
+            LookupKey(txn.readKey(n), ptxn.reads[n]);
+        }
+    }
+    ptxn.writes.resize(txn.writeSetSize(), KEY_NONE);
+    for (size_t n = 0; n < txn.writeSetSize(); n++) {
+        if (ptxn.writes[n] == KEY_NONE) {
+            LookupKey(txn.writeKey(n), ptxn.writes[n]);
+        }
+    }
+    ptxn.incs.resize(txn.incrementSetSize(), KEY_NONE);
+    for (size_t n = 0; n < txn.incrementSetSize(); n++) {
+        if (ptxn.incs[n] == KEY_NONE) {
+            LookupKey(txn.incrementKey(n), ptxn.incs[n]);
         }
     }
 }
 
 void
-Store::GetPreparedIncrements(unordered_map<string, set<Timestamp>> &incs)
+Store::LookupKey(const string &key, keyid_t &id)
 {
-	// gather up the set of all increments that are currently prepared
-	for (auto &t : prepared) {
-		for (auto &incList : t.second.second.getIncrementSet()) {
-			incs[incList.first].insert(t.second.first);
-		}
-	}
+    if (!store.lookup(key, id)) {
+        id = KEY_NONE;
+    }
+}
+
+/* Intern the keys of txn that ptxn has no id for yet. */
+void
+Store::InternKeys(const TransactionView &txn, PreparedTxn &ptxn)
+{
+    ptxn.reads.resize(txn.readSetSize(), KEY_NONE);
+    for (size_t n = 0; n < txn.readSetSize(); n++) {
+        if (ptxn.reads[n] == KEY_NONE) {
+            ptxn.reads[n] = store.intern(txn.readKey(n));
+        }
+    }
+    ptxn.writes.resize(txn.writeSetSize(), KEY_NONE);
+    for (size_t n = 0; n < txn.writeSetSize(); n++) {
+        if (ptxn.writes[n] == KEY_NONE) {
+            ptxn.writes[n] = store.intern(txn.writeKey(n));
+        }
+    }
+    ptxn.incs.resize(txn.incrementSetSize(), KEY_NONE);
+    for (size_t n = 0; n < txn.incrementSetSize(); n++) {
+        if (ptxn.incs[n] == KEY_NONE) {
+            ptxn.incs[n] = store.intern(txn.incrementKey(n));
+        }
+    }
+}
+
+/* Add a transaction to the prepared set and index its read, write and
+ * increment keys, interning those new to the store. */
+void
+Store::AddPrepared(uint64_t id, PreparedTxn &ptxn)
+{
+    const Timestamp &timestamp = ptxn.timestamp;
+
+    InternKeys(ptxn.txn, ptxn);
+
+    ptxn.oldest = timestamp;
+    for (size_t n = 0; n < ptxn.txn.readSetSize(); n++) {
+        Timestamp readTime = ptxn.txn.readTime(n);
+        if (readTime < ptxn.oldest) {
+            ptxn.oldest = readTime;
+        }
+    }
+
+    for (auto key : ptxn.reads) {
+        pReads[key].insert(make_pair(ptxn.readAt, id));
+    }
+    for (auto key : ptxn.writes) {
+        pWrites[key].insert(make_pair(timestamp, id));
+    }
+    for (auto key : ptxn.incs) {
+        pIncs[key].insert(make_pair(timestamp, id));
+    }
+
+    if (ptxn.txn.rangeSetSize() > 0) {
+        pScans.insert(make_pair(ptxn.readAt, id));
+    }
+
+    preparedTimes.insert(timestamp);
+    preparedOldest.insert(ptxn.oldest);
+    prepared[id] = ptxn;
+}
+
+static void
+Unindex(unordered_map<keyid_t, multimap<Timestamp, uint64_t>> &index,
+        keyid_t key, const Timestamp &timestamp, uint64_t id)
+{
+    auto k = index.find(key);
+    if (k == index.end()) {
+        return;
+    }
+
+    auto range = k->second.equal_range(timestamp);
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == id) {
+            k->second.erase(it);
+            break;
+        }
+    }
+
+    // drop empty entries so the index only holds keys with prepared ops
+    if (k->second.empty()) {
+        index.erase(k);
+    }
+}
+
+/* Remove a transaction from the prepared set and the per-key index. */
+void
+Store::RemovePrepared(uint64_t id)
+{
+    auto p = prepared.find(id);
+    if (p == prepared.end()) {
+        return;
+    }
+
+    const PreparedTxn &ptxn = p->second;
+
+    for (auto key : ptxn.reads) {
+        Unindex(pReads, key, ptxn.readAt, id);
+    }
+    for (auto key : ptxn.writes) {
+        Unindex(pWrites, key, ptxn.timestamp, id);
+    }
+    for (auto key : ptxn.incs) {
+        Unindex(pIncs, key, ptxn.timestamp, id);
+    }
+    if (ptxn.txn.rangeSetSize() > 0) {
+        auto range = pScans.equal_range(ptxn.readAt);
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second == id) {
+                pScans.erase(it);
+                break;
+            }
+        }
+    }
+    preparedTimes.erase(preparedTimes.find(ptxn.timestamp));
+    preparedOldest.erase(preparedOldest.find(ptxn.oldest));
+
+    prepared.erase(p);
+}
+
+/* Returns the prepared timestamps for key in index, or NULL if there
+ * are none. */
+const Store::PreparedTimes *
+Store::GetPrepared(const PreparedIndex &index, keyid_t key) const
+{
+    auto it = index.find(key);
+    if (it == index.end()) {
+        return NULL;
+    }
+    return &it->second;
 }
 
 } // namespace tapirstore
@@ -34,42 +34,174 @@
 
 #include "tapir/lib/assert.h"
 #include "tapir/lib/message.h"
+#include "tapir/lib/wal.h"
 #include "tapir/store/common/timestamp.h"
 #include "tapir/store/common/transaction.h"
+#include "tapir/store/common/transactionview.h"
+#include "tapir/store/common/truetime.h"
 #include "tapir/store/common/backend/txnstore.h"
+#include "tapir/store/common/backend/logengine.h"
 #include "tapir/store/common/backend/versionstore.h"
 
+#include <map>
 #include <set>
 #include <unordered_map>
+#include <vector>
+
+// Tag of the commit records a store writes to its log.
+#define STORE_LOG_COMMIT 'c'
+
+// Cache of version history read back from disk.
+#define HISTORY_CACHE_BYTES (16 << 20)
 
 namespace tapirstore {
 
 class Store : public TxnStore {
 
 public:
-    Store(bool linearizable);
+    Store(Isolation isolation);
     ~Store();
 
     // Overriding from TxnStore
     void Begin(uint64_t id);
     int Get(uint64_t id, const std::string &key, std::pair<Timestamp, std::string> &value);
     int Get(uint64_t id, const std::string &key, const Timestamp &timestamp, std::pair<Timestamp, std::string> &value);
+    int GetWithHints(uint64_t id, const std::string &key, std::pair<Timestamp, std::string> &value, Timestamp &lastRead, Timestamp &pendingWrite);
+    int GetSnapshot(uint64_t id, const std::string &key, const Timestamp &timestamp, std::pair<Timestamp, std::string> &value);
+    int Scan(uint64_t id, const std::string &start, const std::string &end, size_t limit, KeyValues &values);
     int Prepare(uint64_t id, const Transaction &txn, const Timestamp &timestamp, Timestamp &proposed);
+    int Prepare(uint64_t id, const TransactionView &txn, const Timestamp &timestamp, Timestamp &proposed);
+    int Prepare(uint64_t id, const TransactionView &txn, const Timestamp &timestamp, Isolation isolation, Timestamp &proposed);
+    void PrepareBatch(std::vector<PrepareRequest> &batch);
     void Commit(uint64_t id, uint64_t timestamp = 0);
+    int CommitReads(uint64_t id, const TransactionView &txn, const Timestamp &timestamp);
     void Abort(uint64_t id, const Transaction &txn = Transaction());
     void Load(const std::string &key, const std::string &value, const Timestamp &timestamp);
+    void LoadBatch(const std::vector<std::pair<std::string, std::string>> &values, const Timestamp &timestamp);
+    void Reserve(size_t n);
+    void GC(const Timestamp &horizon, size_t slice);
+    void Expire(const Timestamp &horizon, size_t slice);
+    void Recover(WriteAheadLog *log);
+    void SetLog(WriteAheadLog *log);
+    bool OpenEngine(const std::string &dir, size_t cacheBytes);
+    bool OpenHistory(const std::string &dir);
+    void Tier(const Timestamp &horizon, size_t slice);
+    bool LoadCheckpoint(const std::string &path);
+    bool WriteCheckpoint(const std::string &path, bool history);
+    Timestamp Close(const Timestamp &bound);
+    size_t PreparedCount();
+    void Contention(std::vector<ContentionEntry> &top, uint64_t &total, bool reset);
+
+    // Build a commit record for the log, parse one back, and redo it.
+    static std::string CommitRecord(const TransactionView &txn,
+                                    const Timestamp &timestamp,
+                                    const Timestamp &readAt);
+    static bool ParseCommit(const std::string &record, TransactionView &txn,
+                            Timestamp &timestamp, Timestamp &readAt);
+    void Redo(const TransactionView &txn, const Timestamp &timestamp,
+              const Timestamp &readAt);
+
+    // The timestamp txn's reads are recorded at when it commits at
+    // timestamp under isolation: its snapshot, if it has one and runs
+    // under ISOLATION_SNAPSHOT, else timestamp.
+    static Timestamp ReadAt(const TransactionView &txn,
+                            const Timestamp &timestamp, Isolation isolation);
 
 private:
-    // Are we running in linearizable (vs serializable) mode?
-    bool linearizable;
-
-	// TODO: comment this.
-    std::unordered_map<uint64_t, std::pair<Timestamp, Transaction>> prepared;
-    
-    void GetPreparedWrites(std::unordered_map< std::string, std::set<Timestamp> > &writes);
-    void GetPreparedReads(std::unordered_map< std::string, std::set<Timestamp> > &reads);
-    void GetPreparedIncrements(std::unordered_map< std::string, std::set<Timestamp> > &incs);
-    void Commit(const Timestamp &timestamp, const Transaction &txn);
+    // Isolation level for transactions that do not ask for one; under
+    // ISOLATION_SNAPSHOT, transactions without a snapshot are still
+    // validated as serializable.
+    Isolation isolation;
+
+    // A prepared transaction, with the interned ids of the keys of its
+    // read, write and increment ops (in the view's order). While it is
+    // validated, keys not interned yet are KEY_NONE.
+    struct PreparedTxn {
+        Timestamp timestamp;
+        // the timestamp its reads are recorded at: its own timestamp,
+        // or its snapshot if it is snapshot-isolated
+        Timestamp readAt;
+        TransactionView txn;
+        // the oldest of its timestamp and the versions it read
+        Timestamp oldest;
+        std::vector<keyid_t> reads;
+        std::vector<keyid_t> writes;
+        std::vector<keyid_t> incs;
+    };
+
+    // Prepared but not yet committed/aborted transactions, by txn id.
+    std::unordered_map<uint64_t, PreparedTxn> prepared;
+
+    // Per-key index over the prepared set: key id -> prepare timestamp
+    // -> id of the prepared transaction. Maintained in place on
+    // Prepare/Commit/Abort, so validation only touches the keys in the
+    // incoming transaction.
+    typedef std::multimap<Timestamp, uint64_t> PreparedTimes;
+    typedef std::unordered_map<keyid_t, PreparedTimes> PreparedIndex;
+    PreparedIndex pWrites;
+    PreparedIndex pReads;
+    PreparedIndex pIncs;
+
+    // Prepared transactions that scanned key ranges, by the timestamp
+    // their reads are recorded at.
+    PreparedTimes pScans;
+
+    // Timestamps of the prepared set, oldest first.
+    std::multiset<Timestamp> preparedTimes;
+
+    // Oldest timestamps of the prepared set (see PreparedTxn), oldest
+    // first; versions above the first are still needed.
+    std::multiset<Timestamp> preparedOldest;
+
+    // Transactions at or below this timestamp are told to retry above.
+    Timestamp closed;
+
+    // Versions older than this may have been garbage collected.
+    Timestamp gcWatermark;
+
+    // Latest reads hide versions that have expired by this clock.
+    TrueTime clock;
+
+    // Write-ahead log of committed transactions, if any.
+    WriteAheadLog *log;
+
+    // Where values are kept, if not in memory.
+    LogEngine *engine;
+
+    // Where old versions are kept, if not in memory.
+    LogEngine *history;
+
+    // Keys prepares failed on, and why.
+    ContentionTracker contention;
+
+    void LookupKeys(const TransactionView &txn, PreparedTxn &ptxn);
+    void LookupKey(const std::string &key, keyid_t &id);
+    void InternKeys(const TransactionView &txn, PreparedTxn &ptxn);
+    bool CheckPrepared(uint64_t id, const Timestamp &timestamp, int &status,
+                       Timestamp &proposed);
+    int Validate(uint64_t id, const TransactionView &txn,
+                 const Timestamp &timestamp, Isolation isolation,
+                 PreparedTxn &ptxn, Timestamp &proposed);
+    int CheckSerializable(uint64_t id, const TransactionView &txn,
+                          const PreparedTxn &ptxn, const Timestamp &timestamp,
+                          bool linearizable, Timestamp &proposed);
+    int CheckRanges(uint64_t id, const TransactionView &txn,
+                    const PreparedTxn &ptxn, const Timestamp &timestamp,
+                    bool linearizable);
+    int CheckScans(uint64_t id, const std::string &key,
+                   const Timestamp &timestamp, Timestamp &proposed);
+    int CheckSnapshot(uint64_t id, const TransactionView &txn,
+                      const PreparedTxn &ptxn, const Timestamp &timestamp,
+                      Timestamp &proposed);
+    int CheckSnapshotKey(uint64_t id, const std::string &name, keyid_t key,
+                         uint64_t op, const Timestamp &snapshot,
+                         const Timestamp &timestamp, Timestamp &proposed);
+    Timestamp SafePoint(const Timestamp &horizon);
+    bool Pinned(keyid_t key) const;
+    void AddPrepared(uint64_t id, PreparedTxn &ptxn);
+    void RemovePrepared(uint64_t id);
+    const PreparedTimes *GetPrepared(const PreparedIndex &index, keyid_t key) const;
+    void Commit(const PreparedTxn &ptxn);
 
 protected:
     // Data store
@@ -0,0 +1,231 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/terminator.cc:
+ *   Cooperative termination of transactions abandoned by their client.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/tapirstore/terminator.h"
+
+namespace tapirstore {
+
+using namespace std;
+using namespace proto;
+
+Terminator::Terminator(const string &configPrefix, unsigned int nShards,
+                       Transport *transport)
+    : lastRound(0)
+{
+    for (unsigned int i = 0; i < nShards; i++) {
+        string configPath = configPrefix + to_string(i) + ".config";
+        ifstream configStream(configPath);
+        if (configStream.fail()) {
+            Panic("Unable to read configuration file: %s\n", configPath.c_str());
+        }
+        configs.push_back(new transport::Configuration(configStream));
+        clients.push_back(new replication::ir::IRClient(*configs.back(),
+                                                        transport));
+    }
+}
+
+Terminator::~Terminator()
+{
+    for (auto c : clients) {
+        delete c;
+    }
+    for (auto c : configs) {
+        delete c;
+    }
+}
+
+void
+Terminator::Terminate(uint64_t id, const vector<int> &participants,
+                      const Timestamp &timestamp)
+{
+    Debug("[%lu] TERMINATE with %lu participants", id, participants.size());
+
+    Round &r = rounds[id];
+    r.round = ++lastRound;
+    r.participants = participants;
+    r.timestamp = timestamp;
+    r.status.assign(participants.size(), -1);
+    r.waiting = participants.size();
+
+    string request_str;
+    Request request;
+    request.set_op(Request::STATUS);
+    request.set_txnid(id);
+    request.SerializeToString(&request_str);
+
+    uint64_t round = r.round;
+    for (size_t n = 0; n < participants.size(); n++) {
+        int shard = participants[n];
+        if (shard < 0 || (size_t)shard >= clients.size()) {
+            Warning("[%lu] unknown participant shard %d", id, shard);
+            rounds.erase(id);
+            return;
+        }
+        clients[shard]->InvokeConsensus(
+            request_str,
+            bind(&Terminator::StatusDecide, this, shard,
+                 placeholders::_1),
+            [=](const string &, const string &reply_str) {
+                StatusCallback(id, round, n, reply_str);
+            });
+    }
+}
+
+/* Merge the replicas' answers for one shard into its vote. */
+string
+Terminator::StatusDecide(int shard, const map<string, size_t> &results)
+{
+    const transport::Configuration &config = *configs[shard];
+    // replicas a fast quorum leaves out
+    size_t outside = config.n - config.FastQuorumSize();
+    size_t answers = 0;
+    map<Timestamp, size_t> prepared;
+    bool final = false;
+    Timestamp finalized;
+    Reply final_reply;
+    string final_reply_str;
+
+    for (auto &result : results) {
+        Reply reply;
+        reply.ParseFromString(result.first);
+        answers += result.second;
+
+        switch (reply.status()) {
+        case TXN_COMMITTED:
+        case TXN_ABORTED:
+            // only ever set by a decision; one replica is enough
+            return result.first;
+        case TXN_PREPARED:
+            prepared[Timestamp(reply.timestamp())] += result.second;
+            if (reply.finalized() &&
+                (!final || finalized < Timestamp(reply.timestamp()))) {
+                final = true;
+                finalized = Timestamp(reply.timestamp());
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    final_reply.set_status(TXN_UNKNOWN);
+    if (final) {
+        final_reply.set_status(TXN_PREPARED);
+        finalized.serialize(final_reply.mutable_timestamp());
+    } else {
+        for (auto &p : prepared) {
+            if (answers - p.second <= outside) {
+                final_reply.set_status(TXN_PREPARED);
+                p.first.serialize(final_reply.mutable_timestamp());
+            }
+        }
+    }
+    final_reply.SerializeToString(&final_reply_str);
+    return final_reply_str;
+}
+
+void
+Terminator::StatusCallback(uint64_t id, uint64_t round, size_t n,
+                           const string &reply_str)
+{
+    auto it = rounds.find(id);
+    if (it == rounds.end() || it->second.round != round) {
+        // superseded by a newer round
+        return;
+    }
+    Round &r = it->second;
+
+    Reply reply;
+    reply.ParseFromString(reply_str);
+    Debug("[%lu] STATUS from shard %d: %d", id, r.participants[n],
+          reply.status());
+
+    if (r.status[n] == -1) {
+        r.waiting--;
+    }
+    r.status[n] = reply.status();
+
+    switch (reply.status()) {
+    case TXN_COMMITTED:
+        Finish(id, true);
+        return;
+    case TXN_ABORTED:
+    case TXN_UNKNOWN:
+        Finish(id, false);
+        return;
+    case TXN_PREPARED:
+        if (Timestamp(reply.timestamp()) != r.timestamp) {
+            // the client is still retrying at another timestamp
+            Debug("[%lu] prepared at another timestamp; try later", id);
+            rounds.erase(it);
+            return;
+        }
+        break;
+    default:
+        Debug("[%lu] shard %d undecided; try later", id, r.participants[n]);
+        rounds.erase(it);
+        return;
+    }
+
+    if (r.waiting == 0) {
+        // prepared everywhere at the same timestamp
+        Finish(id, true);
+    }
+}
+
+/* Send the outcome to every participant. Like the client's COMMIT and
+ * ABORT these are inconsistent operations, so no reply is awaited. */
+void
+Terminator::Finish(uint64_t id, bool commit)
+{
+    auto it = rounds.find(id);
+    ASSERT(it != rounds.end());
+
+    Debug("[%lu] TERMINATED: %s", id, commit ? "COMMIT" : "ABORT");
+
+    string request_str;
+    Request request;
+    request.set_txnid(id);
+    if (commit) {
+        request.set_op(Request::COMMIT);
+        request.mutable_commit()->set_timestamp(it->second.timestamp.getTimestamp());
+    } else {
+        request.set_op(Request::ABORT);
+        request.mutable_abort()->mutable_txn();
+    }
+    request.SerializeToString(&request_str);
+
+    for (int shard : it->second.participants) {
+        clients[shard]->InvokeInconsistent(
+            request_str,
+            [](const string &, const string &) { });
+    }
+    rounds.erase(it);
+}
+
+} // namespace tapirstore
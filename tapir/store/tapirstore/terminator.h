@@ -0,0 +1,108 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/terminator.h:
+ *   Cooperative termination of transactions abandoned by their client.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#ifndef _TAPIR_TERMINATOR_H_
+#define _TAPIR_TERMINATOR_H_
+
+#include "tapir/lib/assert.h"
+#include "tapir/lib/configuration.h"
+#include "tapir/lib/message.h"
+#include "tapir/lib/transport.h"
+#include "tapir/replication/ir/client.h"
+#include "tapir/store/common/timestamp.h"
+#include "tapir/store/tapirstore/tapir-proto.pb.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Status of a transaction at a replica, as answered to STATUS requests.
+#define TXN_UNKNOWN     0 // never prepared here; now fenced off
+#define TXN_PREPARED    1
+#define TXN_COMMITTED   2
+#define TXN_ABORTED     3
+
+namespace tapirstore {
+
+/* Finishes a prepared transaction whose client went away. Every
+ * participant shard is asked for the transaction's status and, like
+ * the client, the terminator decides each shard's vote on the latest
+ * prepare from the answers of a quorum of its replicas:
+ *
+ *  - committed or aborted anywhere: finish it the same way;
+ *  - the client's decision on the prepare is final at a replica: it
+ *    stands;
+ *  - otherwise, the prepare is OK only if the client could have seen
+ *    it OK on the fast path, i.e. no more replicas of the quorum
+ *    answered otherwise than a fast quorum leaves out. The client
+ *    cannot have decided on it yet on the slow path.
+ *
+ * The transaction commits if every shard's vote is OK at the same
+ * timestamp, and aborts if any shard's is not. Answering a STATUS
+ * fences the transaction off at a replica that did not vote OK, so
+ * the client can no longer get that shard to prepare it; a vote of
+ * another round is tried again later.
+ *
+ * All calls must come from the transport's thread. */
+class Terminator
+{
+public:
+    // Shard i's configuration is read from <configPrefix><i>.config.
+    Terminator(const std::string &configPrefix, unsigned int nShards,
+               Transport *transport);
+    ~Terminator();
+
+    // Start a termination round for transaction id, prepared at
+    // timestamp. A new round replaces any round still running.
+    void Terminate(uint64_t id, const std::vector<int> &participants,
+                   const Timestamp &timestamp);
+
+private:
+    struct Round {
+        uint64_t round;
+        std::vector<int> participants;
+        Timestamp timestamp;
+        std::vector<int> status; // per participant, -1 until known
+        size_t waiting;
+    };
+
+    std::vector<transport::Configuration *> configs;
+    std::vector<replication::ir::IRClient *> clients;
+    std::unordered_map<uint64_t, Round> rounds;
+    uint64_t lastRound;
+
+    std::string StatusDecide(int shard,
+        const std::map<std::string, std::size_t> &results);
+    void StatusCallback(uint64_t id, uint64_t round, size_t n,
+                        const std::string &reply_str);
+    void Finish(uint64_t id, bool commit);
+};
+
+} // namespace tapirstore
+
+#endif /* _TAPIR_TERMINATOR_H_ */
@@ -0,0 +1,11 @@
+d := $(dir $(lastword $(MAKEFILE_LIST)))
+
+#
+# gtest-based tests
+#
+GTEST_SRCS += $(addprefix $(d), \
+		store-test.cc)
+
+$(d)store-test: $(o)store-test.o $(OBJS-tapir-store) $(GTEST_MAIN)
+
+TEST_BINS += $(d)store-test
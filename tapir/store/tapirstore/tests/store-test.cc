@@ -0,0 +1,1051 @@
+// -*- mode: c++; c-file-style: "k&r"; c-basic-offset: 4 -*-
+/***********************************************************************
+ *
+ * store/tapirstore/tests/store-test.cc:
+ *   test cases for the TAPIR transactional store
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **********************************************************************/
+
+#include "tapir/store/tapirstore/store.h"
+#include "tapir/store/tapirstore/partitionedstore.h"
+#include "tapir/store/tapirstore/loader.h"
+#include "tapir/store/tapirstore/admission.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+using namespace tapirstore;
+
+TEST(TapirStore, PrepareConflictsWithPrepared)
+{
+    Store store(ISOLATION_LINEARIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    store.Load("x", "0", Timestamp(1, 1));
+
+    // txn 1 writes x
+    Transaction t1;
+    t1.addWriteSet("x", "1");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+
+    // txn 2 read the current version of x, conflicts with the pending write
+    Transaction t2;
+    t2.addReadSet("x", Timestamp(1, 1));
+    EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(2, t2, Timestamp(11, 2), proposed));
+
+    // once txn 1 aborts, txn 2 no longer conflicts
+    store.Abort(1);
+    EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(11, 2), proposed));
+
+    // and txn 1 now retries behind the pending read
+    EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    store.Commit(2);
+    EXPECT_EQ(REPLY_OK, store.Prepare(3, t1, Timestamp(12, 3), proposed));
+    store.Commit(3);
+
+    EXPECT_EQ(REPLY_OK, store.Get(4, "x", val));
+    EXPECT_EQ("1", val.second);
+    EXPECT_EQ(Timestamp(12, 3), val.first);
+}
+
+TEST(TapirStore, PrepareRetriesBehindPreparedWrite)
+{
+    Store store(ISOLATION_LINEARIZABLE);
+    Timestamp proposed;
+
+    Transaction t1;
+    t1.addWriteSet("y", "1");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(20, 1), proposed));
+
+    // a second write below the pending one is asked to retry above it
+    Transaction t2;
+    t2.addWriteSet("y", "2");
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(2, t2, Timestamp(15, 2), proposed));
+    EXPECT_EQ(Timestamp(20, 1), proposed);
+
+    // re-preparing at a new timestamp replaces the old index entries
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(15, 2), proposed));
+}
+
+// Counts the keys of the version store underneath.
+class KeyCountingStore : public Store
+{
+public:
+    KeyCountingStore(Isolation isolation) : Store(isolation) { };
+    size_t Keys() const { return store.size(); };
+};
+
+TEST(TapirStore, PrepareInternsOnlyPrepared)
+{
+    KeyCountingStore store(ISOLATION_LINEARIZABLE);
+    Timestamp proposed;
+
+    store.Load("x", "0", Timestamp(1, 1));
+    Transaction t1;
+    t1.addWriteSet("x", "1");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+
+    // prepares that do not go through leave no keys behind
+    Transaction t2;
+    t2.addReadSet("x", Timestamp(1, 1));
+    t2.addWriteSet("new", "2");
+    EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(2, t2, Timestamp(11, 2), proposed));
+    store.Close(Timestamp(20, 0));
+    Transaction t3;
+    t3.addWriteSet("other", "3");
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(3, t3, Timestamp(15, 3), proposed));
+    EXPECT_EQ(1u, store.Keys());
+
+    // one that does interns its new keys, and commits them
+    EXPECT_EQ(REPLY_OK, store.Prepare(3, t3, Timestamp(30, 3), proposed));
+    EXPECT_EQ(2u, store.Keys());
+    store.Commit(3);
+    std::pair<Timestamp, std::string> val;
+    EXPECT_EQ(REPLY_OK, store.Get(4, "other", val));
+    EXPECT_EQ("3", val.second);
+}
+
+TEST(TapirStore, PartitionedPrepareCommit)
+{
+    PartitionedStore store(ISOLATION_LINEARIZABLE, 4);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    for (int i = 0; i < 16; i++) {
+        store.Load("k" + std::to_string(i), "0", Timestamp(1, 1));
+    }
+
+    // txn 1 writes every key, so it spans all partitions
+    Transaction t1;
+    for (int i = 0; i < 16; i++) {
+        t1.addWriteSet("k" + std::to_string(i), "1");
+    }
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+
+    // txn 2 reads one key and writes another, conflicts on the read
+    Transaction t2;
+    t2.addReadSet("k3", Timestamp(1, 1));
+    t2.addWriteSet("x", "2");
+    EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(2, t2, Timestamp(11, 2), proposed));
+
+    // the piece of txn 2 that did prepare was rolled back
+    Transaction t3;
+    t3.addWriteSet("x", "3");
+    EXPECT_EQ(REPLY_OK, store.Prepare(3, t3, Timestamp(12, 3), proposed));
+    store.Commit(3);
+
+    store.Commit(1);
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(REPLY_OK, store.Get(4, "k" + std::to_string(i), val));
+        EXPECT_EQ("1", val.second);
+        EXPECT_EQ(Timestamp(10, 1), val.first);
+    }
+    EXPECT_EQ(REPLY_OK, store.Get(4, "x", val));
+    EXPECT_EQ("3", val.second);
+}
+
+TEST(TapirStore, PartitionedPrepareAsync)
+{
+    // outlives the store, whose workers finish the prepare
+    PrepareRequest r;
+    PartitionedStore store(ISOLATION_LINEARIZABLE, 4);
+    std::pair<Timestamp, std::string> val;
+
+    Transaction t1;
+    for (int i = 0; i < 16; i++) {
+        store.Load("k" + std::to_string(i), "0", Timestamp(1, 1));
+        t1.addWriteSet("k" + std::to_string(i), "1");
+    }
+
+    r.id = 1;
+    r.txn = TransactionView(t1);
+    r.timestamp = Timestamp(10, 1);
+    store.PrepareAsync(r, []() { });
+
+    // the commit is put off until the votes it overtook are in
+    Promise committed;
+    store.CommitAsync(1, 0, [&]() { committed.Reply(REPLY_OK); });
+    committed.GetReply();
+    EXPECT_EQ(REPLY_OK, r.status);
+    EXPECT_EQ(0, store.PreparedCount());
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(REPLY_OK, store.Get(2, "k" + std::to_string(i), val));
+        EXPECT_EQ("1", val.second);
+    }
+}
+
+TEST(TapirStore, PartitionedDefersUntilVoted)
+{
+    PrepareRequest r1, r2;
+    PartitionedStore store(ISOLATION_LINEARIZABLE, 4);
+    std::pair<Timestamp, std::string> val;
+
+    Transaction t1;
+    for (int i = 0; i < 16; i++) {
+        t1.addWriteSet("k" + std::to_string(i), "1");
+    }
+
+    // hold up one partition so the first prepare's votes stay out
+    Promise hold, held;
+    store.ForKey("k0", [&](TxnStore &) {
+        held.Reply(REPLY_OK);
+        hold.GetReply();
+    });
+    held.GetReply();
+
+    r1.id = 1;
+    r1.txn = TransactionView(t1);
+    r1.timestamp = Timestamp(10, 1);
+    store.PrepareAsync(r1, []() { });
+
+    // a retry and the commit come in meanwhile, and return right away
+    Promise prepared, committed;
+    r2.id = 1;
+    r2.txn = TransactionView(t1);
+    r2.timestamp = Timestamp(20, 1);
+    store.PrepareAsync(r2, [&]() { prepared.Reply(r2.status); });
+    store.CommitAsync(1, 0, [&]() { committed.Reply(REPLY_OK); });
+
+    hold.Reply(REPLY_OK);
+    EXPECT_EQ(REPLY_OK, prepared.GetReply());
+    committed.GetReply();
+    EXPECT_EQ(REPLY_OK, r1.status);
+    EXPECT_EQ(0, store.PreparedCount());
+    // committed at the timestamp of the retry
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(REPLY_OK, store.Get(2, "k" + std::to_string(i), val));
+        EXPECT_EQ("1", val.second);
+        EXPECT_EQ(Timestamp(20, 1), val.first);
+    }
+}
+
+TEST(TapirStore, GCKeepsVersionsNeededByPrepared)
+{
+    Store store(ISOLATION_LINEARIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    store.Load("x", "a", Timestamp(10, 1));
+    store.Load("x", "b", Timestamp(20, 1));
+    store.Load("y", "c", Timestamp(10, 1));
+
+    // a prepared transaction that read x at 20 holds back the safe point
+    Transaction t1;
+    t1.addReadSet("x", Timestamp(20, 1));
+    t1.addWriteSet("y", "d");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(30, 1), proposed));
+
+    store.Load("x", "e", Timestamp(40, 1));
+    store.GC(Timestamp(100, 0), 100);
+    EXPECT_EQ(REPLY_FAIL, store.Get(2, "x", Timestamp(15, 1), val));
+    EXPECT_EQ(REPLY_OK, store.Get(2, "x", Timestamp(25, 1), val));
+    EXPECT_EQ("b", val.second);
+    store.Commit(1);
+
+    // once nothing holds it back, old versions go away
+    store.GC(Timestamp(100, 0), 100);
+    EXPECT_EQ(REPLY_FAIL, store.Get(3, "x", Timestamp(25, 1), val));
+    EXPECT_EQ(REPLY_OK, store.Get(3, "x", val));
+    EXPECT_EQ("e", val.second);
+
+    // a transaction that read a collected version cannot prepare
+    Transaction t2;
+    t2.addReadSet("x", Timestamp(20, 1));
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(4, t2, Timestamp(110, 4), proposed));
+}
+
+TEST(TapirStore, PrepareFromWireView)
+{
+    Store store(ISOLATION_SERIALIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    Transaction txn;
+    txn.addWriteSet("a", "1");
+    txn.addIncrementSet("b", Increment("5", 1));
+    TransactionMessage wire;
+    txn.serialize(&wire);
+    std::string buf;
+    wire.SerializeToString(&buf);
+
+    {
+        // the store holds on to the arena after the caller drops it
+        auto arena = std::make_shared<google::protobuf::Arena>();
+        TransactionMessage *msg =
+            google::protobuf::Arena::CreateMessage<TransactionMessage>(arena.get());
+        msg->ParseFromString(buf);
+        EXPECT_EQ(REPLY_OK, store.Prepare(1, TransactionView(arena, msg),
+                                          Timestamp(10, 1), proposed));
+    }
+    store.Commit(1);
+
+    EXPECT_EQ(REPLY_OK, store.Get(2, "a", val));
+    EXPECT_EQ("1", val.second);
+    EXPECT_EQ(REPLY_OK, store.Get(2, "b", val));
+    EXPECT_EQ(Timestamp(10, 1), val.first);
+}
+
+TEST(TapirStore, SnapshotReads)
+{
+    Store store(ISOLATION_SERIALIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    store.Load("x", "0", Timestamp(1, 1));
+
+    // a write below the snapshot is pending, so the snapshot can't be read
+    Transaction t1;
+    t1.addWriteSet("x", "1");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    EXPECT_EQ(REPLY_RETRY, store.GetSnapshot(2, "x", Timestamp(20, 2), val));
+
+    // one above it is no problem
+    EXPECT_EQ(REPLY_OK, store.GetSnapshot(2, "x", Timestamp(5, 2), val));
+    EXPECT_EQ("0", val.second);
+    EXPECT_EQ(Timestamp(1, 1), val.first);
+
+    store.Commit(1);
+    EXPECT_EQ(REPLY_OK, store.GetSnapshot(3, "x", Timestamp(20, 3), val));
+    EXPECT_EQ("1", val.second);
+    EXPECT_EQ(Timestamp(10, 1), val.first);
+
+    // the recorded reads push later writes below the snapshots up
+    Transaction t4;
+    t4.addReadSet("x", Timestamp(10, 1));
+    EXPECT_EQ(REPLY_OK, store.CommitReads(4, TransactionView(t4), Timestamp(30, 4)));
+
+    Transaction t5;
+    t5.addWriteSet("x", "2");
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(5, t5, Timestamp(25, 5), proposed));
+    EXPECT_EQ(Timestamp(30, 4), proposed);
+}
+
+TEST(TapirStore, SnapshotReadsValidated)
+{
+    Timestamp proposed;
+
+    for (int partitions = 0; partitions <= 2; partitions += 2) {
+        TxnStore *store;
+        if (partitions == 0) {
+            store = new Store(ISOLATION_SERIALIZABLE);
+        } else {
+            store = new PartitionedStore(ISOLATION_SERIALIZABLE, partitions);
+        }
+        store->Load("x", "0", Timestamp(1, 1));
+        store->Load("y", "0", Timestamp(1, 1));
+
+        // x and y were read at snapshot 20, then writes prepared under it
+        // on another replica's say-so
+        Transaction reads;
+        reads.addReadSet("x", Timestamp(1, 1));
+        reads.addReadSet("y", Timestamp(1, 1));
+
+        Transaction t1;
+        t1.addWriteSet("x", "1");
+        EXPECT_EQ(REPLY_OK, store->Prepare(1, t1, Timestamp(10, 1), proposed));
+        EXPECT_EQ(REPLY_ABSTAIN,
+                  store->CommitReads(2, TransactionView(reads), Timestamp(20, 2)));
+
+        // committed, the read is known to be stale
+        store->Commit(1);
+        EXPECT_EQ(REPLY_FAIL,
+                  store->CommitReads(2, TransactionView(reads), Timestamp(20, 2)));
+
+        // a write above the snapshot does not matter
+        Transaction t3;
+        t3.addWriteSet("y", "3");
+        EXPECT_EQ(REPLY_OK, store->Prepare(3, t3, Timestamp(30, 3), proposed));
+        Transaction ys;
+        ys.addReadSet("y", Timestamp(1, 1));
+        EXPECT_EQ(REPLY_OK,
+                  store->CommitReads(4, TransactionView(ys), Timestamp(20, 4)));
+        store->Abort(3);
+
+        // and once recorded, the reads keep writes under the snapshot off
+        Transaction t5;
+        t5.addWriteSet("y", "5");
+        EXPECT_EQ(REPLY_RETRY, store->Prepare(5, t5, Timestamp(15, 5), proposed));
+
+        delete store;
+    }
+}
+
+TEST(TapirStore, ClosedTimestamp)
+{
+    Store store(ISOLATION_SERIALIZABLE);
+    Timestamp proposed;
+
+    Transaction t1;
+    t1.addWriteSet("x", "1");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+
+    // the prepared transaction holds the closed timestamp back
+    Timestamp closed = store.Close(Timestamp(20));
+    EXPECT_TRUE(closed < Timestamp(10, 1));
+
+    // but nothing new prepares at or below the bound; it is told to
+    // come back above it
+    Transaction t2;
+    t2.addWriteSet("y", "1");
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(2, t2, Timestamp(15, 2), proposed));
+    EXPECT_EQ(Timestamp(20), proposed);
+    EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(25, 2), proposed));
+
+    store.Commit(1);
+    store.Abort(2);
+    EXPECT_EQ(Timestamp(20), store.Close(Timestamp(20)));
+
+    // and it never moves back
+    EXPECT_EQ(Timestamp(20), store.Close(Timestamp(5)));
+}
+
+TEST(TapirStore, SnapshotIsolation)
+{
+    Store store(ISOLATION_SNAPSHOT);
+    Timestamp proposed;
+
+    store.Load("x", "0", Timestamp(1, 1));
+    store.Load("y", "0", Timestamp(1, 1));
+
+    // t1 and t2 both read x and y at snapshot 5; t1 writes x, t2 writes y
+    Transaction t1, t2;
+    t1.setSnapshot(Timestamp(5, 1));
+    t1.addReadSet("x", Timestamp(1, 1));
+    t1.addReadSet("y", Timestamp(1, 1));
+    t1.addWriteSet("x", "1");
+    t2.setSnapshot(Timestamp(5, 2));
+    t2.addReadSet("x", Timestamp(1, 1));
+    t2.addReadSet("y", Timestamp(1, 1));
+    t2.addWriteSet("y", "2");
+
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    store.Commit(1);
+
+    // the read of x is stale, but only write-write conflicts count
+    EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(11, 2), proposed));
+    store.Commit(2);
+
+    // a write to x on the old snapshot loses to t1
+    Transaction t3;
+    t3.setSnapshot(Timestamp(5, 3));
+    t3.addWriteSet("x", "3");
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(3, t3, Timestamp(12, 3), proposed));
+
+    // while the same transaction is serializable, the stale read fails it
+    Store serializable(ISOLATION_SERIALIZABLE);
+    serializable.Load("x", "0", Timestamp(1, 1));
+    serializable.Load("y", "0", Timestamp(1, 1));
+    t1.setSnapshot(Timestamp());
+    t2.setSnapshot(Timestamp());
+    EXPECT_EQ(REPLY_OK, serializable.Prepare(1, t1, Timestamp(10, 1), proposed));
+    serializable.Commit(1);
+    EXPECT_EQ(REPLY_FAIL, serializable.Prepare(2, t2, Timestamp(11, 2), proposed));
+
+    // commuting increments on the old snapshot do not conflict
+    Transaction t4, t5;
+    t4.setSnapshot(Timestamp(20, 4));
+    t4.addIncrementSet("c", Increment("1", ADD));
+    t5.setSnapshot(Timestamp(20, 5));
+    t5.addIncrementSet("c", Increment("1", ADD));
+    EXPECT_EQ(REPLY_OK, store.Prepare(4, t4, Timestamp(21, 4), proposed));
+    store.Commit(4);
+    EXPECT_EQ(REPLY_OK, store.Prepare(5, t5, Timestamp(22, 5), proposed));
+}
+
+TEST(TapirStore, PerTransactionIsolation)
+{
+    Store store(ISOLATION_LINEARIZABLE);
+    Timestamp proposed;
+
+    store.Load("x", "0", Timestamp(10, 1));
+
+    // a write below the last committed one has to retry when linearizable
+    Transaction t1;
+    t1.addWriteSet("x", "1");
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(1, TransactionView(t1), Timestamp(5, 1),
+                                         proposed));
+    EXPECT_EQ(Timestamp(10, 1), proposed);
+
+    // but not if the transaction only asks for serializability
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, TransactionView(t1), Timestamp(5, 1),
+                                      ISOLATION_SERIALIZABLE, proposed));
+    store.Abort(1);
+
+    // a snapshot transaction is snapshot-isolated on request, whatever
+    // the store's own level: x changed after its snapshot, but it only
+    // wrote y
+    store.Load("x", "3", Timestamp(15, 3));
+    Transaction t2;
+    t2.setSnapshot(Timestamp(12, 2));
+    t2.addReadSet("x", Timestamp(10, 1));
+    t2.addWriteSet("y", "2");
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(2, TransactionView(t2), Timestamp(21, 2),
+                                        proposed));
+    EXPECT_EQ(REPLY_OK, store.Prepare(2, TransactionView(t2), Timestamp(21, 2),
+                                      ISOLATION_SNAPSHOT, proposed));
+}
+
+TEST(TapirStore, ScanPhantoms)
+{
+    Store store(ISOLATION_SERIALIZABLE);
+    Timestamp proposed;
+    KeyValues values;
+
+    store.Load("a", "1", Timestamp(1, 1));
+    store.Load("c", "3", Timestamp(1, 1));
+    store.Load("e", "5", Timestamp(1, 1));
+
+    EXPECT_EQ(REPLY_OK, store.Scan(1, "b", "f", 0, values));
+    ASSERT_EQ(2u, values.size());
+    EXPECT_EQ("3", values["c"].second);
+    EXPECT_EQ(Timestamp(1, 1), values["e"].first);
+
+    // txn 1 scanned [b, f) and writes z
+    Transaction t1;
+    t1.addReadSet("c", Timestamp(1, 1));
+    t1.addReadSet("e", Timestamp(1, 1));
+    t1.addRangeSet("b", "f");
+    t1.addWriteSet("z", "1");
+
+    // d is inserted below txn 1 in the meantime: a phantom
+    Transaction t2;
+    t2.addWriteSet("d", "4");
+    EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(5, 2), proposed));
+    EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    store.Commit(2);
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+
+    // scanning again sees it
+    Transaction t3 = t1;
+    t3.addReadSet("d", Timestamp(5, 2));
+    EXPECT_EQ(REPLY_OK, store.Prepare(3, t3, Timestamp(10, 3), proposed));
+
+    // an insert into the prepared scan below it waits
+    Transaction t4;
+    t4.addWriteSet("bb", "2");
+    EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(4, t4, Timestamp(8, 4), proposed));
+
+    // and once the scan commits, it retries above it
+    store.Commit(3);
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(4, t4, Timestamp(8, 4), proposed));
+    EXPECT_EQ(Timestamp(10, 3), proposed);
+    EXPECT_EQ(REPLY_OK, store.Prepare(4, t4, Timestamp(11, 4), proposed));
+
+    // keys outside the range are not affected
+    Transaction t5;
+    t5.addWriteSet("g", "7");
+    EXPECT_EQ(REPLY_OK, store.Prepare(5, t5, Timestamp(8, 5), proposed));
+}
+
+TEST(TapirStore, Delete)
+{
+    Store store(ISOLATION_SERIALIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+    KeyValues values;
+
+    store.Load("x", "0", Timestamp(1, 1));
+    store.Load("y", "0", Timestamp(1, 1));
+
+    // a delete conflicts with reads as a write does
+    Transaction t1;
+    t1.addReadSet("y", Timestamp(1, 1));
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    Transaction t2;
+    t2.addDeleteSet("y");
+    EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(2, t2, Timestamp(5, 2), proposed));
+    store.Commit(1);
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(2, t2, Timestamp(5, 2), proposed));
+    EXPECT_EQ(Timestamp(10, 1), proposed);
+
+    Transaction t3;
+    t3.addDeleteSet("x");
+    EXPECT_EQ(REPLY_OK, store.Prepare(3, t3, Timestamp(20, 3), proposed));
+    store.Commit(3);
+
+    // from then on the key is not found
+    EXPECT_EQ(REPLY_FAIL, store.Get(4, "x", val));
+    EXPECT_EQ(REPLY_OK, store.Get(4, "x", Timestamp(15, 0), val));
+    EXPECT_EQ("0", val.second);
+    store.Scan(4, "", "", 0, values);
+    EXPECT_EQ(1u, values.size());
+    EXPECT_EQ(1u, values.count("y"));
+
+    // and reads of the old version no longer validate
+    Transaction t5;
+    t5.addReadSet("x", Timestamp(1, 1));
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(5, t5, Timestamp(25, 5), proposed));
+
+    // past the gc horizon the key is dropped; it can be written again
+    store.GC(Timestamp(30, 0), 100);
+    EXPECT_EQ(REPLY_FAIL, store.Get(6, "x", Timestamp(15, 0), val));
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(5, t5, Timestamp(35, 5), proposed));
+    Transaction t6;
+    t6.addWriteSet("x", "6");
+    EXPECT_EQ(REPLY_OK, store.Prepare(6, t6, Timestamp(40, 6), proposed));
+    store.Commit(6);
+    EXPECT_EQ(REPLY_OK, store.Get(7, "x", val));
+    EXPECT_EQ("6", val.second);
+}
+
+TEST(TapirStore, TTL)
+{
+    Store store(ISOLATION_SERIALIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+    // timestamps are in TrueTime format, seconds in the upper half
+    const uint64_t sec = 1ull << 32;
+
+    // x lives for a second after commit, y for ever
+    Transaction t1;
+    t1.addWriteSet("x", "1", 1000);
+    t1.addWriteSet("y", "2");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10 * sec, 1), proposed));
+    store.Commit(1);
+
+    // long expired by now
+    EXPECT_EQ(REPLY_FAIL, store.Get(2, "x", val));
+    EXPECT_EQ(REPLY_OK, store.Get(2, "y", val));
+    EXPECT_EQ(REPLY_OK, store.Get(2, "x", Timestamp(10 * sec + 500000, 0), val));
+    EXPECT_EQ("1", val.second);
+    EXPECT_EQ(REPLY_FAIL, store.Get(2, "x", Timestamp(11 * sec, 0), val));
+
+    // a read of x only validates below its expiry
+    Transaction t3;
+    t3.addReadSet("x", Timestamp(10 * sec, 1));
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(3, t3, Timestamp(11 * sec, 3), proposed));
+    EXPECT_EQ(REPLY_OK, store.Prepare(4, t3, Timestamp(10 * sec + 1, 4), proposed));
+    store.Abort(4);
+
+    // the expiry wheel drops x, history and all
+    store.Expire(Timestamp(20 * sec, 0), 100);
+    EXPECT_EQ(REPLY_FAIL, store.Get(5, "x", Timestamp(10 * sec + 500000, 0), val));
+    EXPECT_EQ(REPLY_OK, store.Get(5, "y", val));
+}
+
+TEST(TapirStore, Checkpoint)
+{
+    const std::string path = "/tmp/store-test.checkpoint";
+    Store store(ISOLATION_SERIALIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    Transaction t1;
+    t1.addWriteSet("x", "1");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    store.Commit(1);
+    Transaction t2;
+    t2.addWriteSet("x", "2");
+    t2.addWriteSet("y", "3");
+    EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(20, 2), proposed));
+    store.Commit(2);
+    ASSERT_TRUE(store.WriteCheckpoint(path, false));
+
+    Store restored(ISOLATION_SERIALIZABLE);
+    ASSERT_TRUE(restored.LoadCheckpoint(path));
+    EXPECT_EQ(REPLY_OK, restored.Get(3, "x", val));
+    EXPECT_EQ("2", val.second);
+    EXPECT_EQ(Timestamp(20, 2), val.first);
+
+    // the old version of x was left out, so snapshots before it fail
+    // rather than miss it
+    EXPECT_EQ(REPLY_FAIL, restored.GetSnapshot(3, "x", Timestamp(15, 0), val));
+    EXPECT_EQ(REPLY_OK, restored.GetSnapshot(3, "y", Timestamp(25, 0), val));
+
+    // and it goes on taking transactions
+    Transaction t4;
+    t4.addReadSet("x", Timestamp(20, 2));
+    t4.addWriteSet("x", "4");
+    EXPECT_EQ(REPLY_OK, restored.Prepare(4, t4, Timestamp(30, 4), proposed));
+    restored.Commit(4);
+    EXPECT_EQ(REPLY_OK, restored.Get(5, "x", val));
+    EXPECT_EQ("4", val.second);
+
+    unlink(path.c_str());
+}
+
+TEST(TapirStore, BulkLoad)
+{
+    const std::string path = "/tmp/store-test.keys";
+    FILE *f = fopen(path.c_str(), "w");
+    ASSERT_TRUE(f != NULL);
+    for (int i = 0; i < 1000; i++) {
+        if (i % 2 == 0) {
+            fprintf(f, "key%d\n", i);
+        } else {
+            fprintf(f, "key%d\tvalue%d\n", i, i);
+        }
+    }
+    fclose(f);
+
+    // two shards' worth of keys, loaded into the partitions of one
+    PartitionedStore store(ISOLATION_SERIALIZABLE, 4);
+    BulkLoader loader(&store, 1, 2, 3);
+    ASSERT_TRUE(loader.Load(path, 900));
+    EXPECT_EQ(900u, loader.Lines());
+    EXPECT_GT(loader.Loaded(), 0u);
+    EXPECT_LT(loader.Loaded(), 900u);
+
+    size_t found = 0;
+    std::pair<Timestamp, std::string> val;
+    for (int i = 0; i < 1000; i++) {
+        std::string key = "key" + std::to_string(i);
+        uint64_t hash = 5381;
+        for (char c : key) {
+            hash = ((hash << 5) + hash) + (uint64_t)c;
+        }
+        bool mine = i < 900 && hash % 2 == 1;
+        EXPECT_EQ(mine ? REPLY_OK : REPLY_FAIL, store.Get(1, key, val));
+        if (mine) {
+            found++;
+            EXPECT_EQ(i % 2 == 0 ? "null" : "value" + std::to_string(i),
+                      val.second);
+        }
+    }
+    EXPECT_EQ(loader.Loaded(), found);
+
+    unlink(path.c_str());
+}
+
+TEST(TapirStore, WriteAheadLog)
+{
+    const std::string path = "/tmp/store-test.wal";
+    unlink(path.c_str());
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    {
+        WriteAheadLog log(path, 100);
+        Store store(ISOLATION_SERIALIZABLE);
+        store.Recover(&log);
+        store.SetLog(&log);
+
+        Transaction t1;
+        t1.addWriteSet("x", "1");
+        t1.addWriteSet("y", "2");
+        EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+        store.Commit(1);
+        Transaction t2;
+        t2.addReadSet("x", Timestamp(10, 1));
+        t2.addWriteSet("x", "3");
+        EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(20, 2), proposed));
+        store.Commit(2);
+        // aborted transactions leave nothing in the log
+        Transaction t3;
+        t3.addWriteSet("z", "4");
+        EXPECT_EQ(REPLY_OK, store.Prepare(3, t3, Timestamp(30, 3), proposed));
+        store.Abort(3, t3);
+
+        EXPECT_EQ(2u, log.Appended());
+        log.Sync(log.Appended());
+    }
+
+    WriteAheadLog log(path, 100);
+    Store restored(ISOLATION_SERIALIZABLE);
+    restored.Recover(&log);
+    restored.SetLog(&log);
+    EXPECT_EQ(REPLY_OK, restored.Get(4, "x", val));
+    EXPECT_EQ("3", val.second);
+    EXPECT_EQ(Timestamp(20, 2), val.first);
+    EXPECT_EQ(REPLY_OK, restored.GetSnapshot(4, "x", Timestamp(15, 0), val));
+    EXPECT_EQ("1", val.second);
+    EXPECT_EQ(REPLY_OK, restored.Get(4, "y", val));
+    EXPECT_EQ("2", val.second);
+    EXPECT_EQ(REPLY_FAIL, restored.Get(4, "z", val));
+
+    // and validates against the recovered versions
+    Transaction t5;
+    t5.addReadSet("x", Timestamp(10, 1));
+    t5.addWriteSet("w", "5");
+    EXPECT_NE(REPLY_OK, restored.Prepare(5, t5, Timestamp(25, 5), proposed));
+
+    unlink(path.c_str());
+}
+
+TEST(TapirStore, PartitionedWriteAheadLog)
+{
+    const std::string path = "/tmp/store-test.wal";
+    unlink(path.c_str());
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    {
+        WriteAheadLog log(path, 100);
+        PartitionedStore store(ISOLATION_SERIALIZABLE, 4);
+        store.Recover(&log);
+        store.SetLog(&log);
+
+        // txn 1 spans every partition, but is logged as one record
+        Transaction t1;
+        for (int i = 0; i < 16; i++) {
+            t1.addWriteSet("k" + std::to_string(i), "1");
+        }
+        EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+        store.Commit(1);
+        EXPECT_EQ(1u, log.Appended());
+
+        Transaction t2;
+        t2.addReadSet("k3", Timestamp(10, 1));
+        t2.addWriteSet("k3", "2");
+        t2.addWriteSet("k4", "2");
+        EXPECT_EQ(REPLY_OK, store.Prepare(2, t2, Timestamp(20, 2), proposed));
+        store.Commit(2);
+        EXPECT_EQ(2u, log.Appended());
+
+        // wait for the partitions before the log goes away
+        EXPECT_EQ(REPLY_OK, store.Get(3, "k4", val));
+        log.Sync(log.Appended());
+    }
+
+    WriteAheadLog log(path, 100);
+    PartitionedStore restored(ISOLATION_SERIALIZABLE, 4);
+    restored.Recover(&log);
+    restored.SetLog(&log);
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(REPLY_OK, restored.Get(4, "k" + std::to_string(i), val));
+        EXPECT_EQ(i == 3 || i == 4 ? "2" : "1", val.second);
+    }
+
+    unlink(path.c_str());
+}
+
+TEST(TapirStore, Engine)
+{
+    PartitionedStore store(ISOLATION_SERIALIZABLE, 2);
+    ASSERT_TRUE(store.OpenEngine("/tmp/store-test.engine", 1 << 20));
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    store.Load("x", "0", Timestamp());
+    Transaction t1;
+    t1.addReadSet("x", Timestamp());
+    t1.addWriteSet("x", "1");
+    t1.addWriteSet("y", "2");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(10, 1), proposed));
+    store.Commit(1, 10);
+    EXPECT_EQ(REPLY_OK, store.Get(2, "x", val));
+    EXPECT_EQ("1", val.second);
+    EXPECT_EQ(REPLY_OK, store.Get(2, "y", val));
+    EXPECT_EQ("2", val.second);
+    EXPECT_EQ(REPLY_OK, store.Get(2, "x", Timestamp(5, 0), val));
+    EXPECT_EQ("0", val.second);
+
+    // validation is the same as in memory
+    Transaction t3;
+    t3.addReadSet("x", Timestamp());
+    t3.addWriteSet("x", "3");
+    EXPECT_NE(REPLY_OK, store.Prepare(3, t3, Timestamp(20, 3), proposed));
+}
+
+TEST(TapirStore, History)
+{
+    Store store(ISOLATION_SERIALIZABLE);
+    ASSERT_TRUE(store.OpenHistory("/tmp/store-test.history"));
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+
+    for (uint64_t t = 1; t <= 4; t++) {
+        Transaction txn;
+        txn.addWriteSet("x", std::to_string(t));
+        EXPECT_EQ(REPLY_OK, store.Prepare(t, txn, Timestamp(t * 10, t), proposed));
+        store.Commit(t, t * 10);
+    }
+    store.Tier(Timestamp(35, 0), 100);
+
+    // time travel reads come from disk
+    EXPECT_EQ(REPLY_OK, store.Get(5, "x", Timestamp(15, 0), val));
+    EXPECT_EQ("1", val.second);
+    EXPECT_EQ(Timestamp(10, 1), val.first);
+
+    // and a read of an old version still validates against the
+    // versions after it
+    Transaction t6;
+    t6.addReadSet("x", Timestamp(10, 1));
+    t6.addWriteSet("y", "6");
+    EXPECT_EQ(REPLY_FAIL, store.Prepare(6, t6, Timestamp(50, 6), proposed));
+    Transaction t7;
+    t7.addReadSet("x", Timestamp(40, 4));
+    EXPECT_EQ(REPLY_OK, store.Prepare(7, t7, Timestamp(50, 7), proposed));
+}
+
+TEST(TapirStore, Admission)
+{
+    PartitionedStore store(ISOLATION_LINEARIZABLE, 2);
+    AdmissionControl admission(2, 1000);
+    Timestamp proposed;
+    uint64_t retryAfter = 0;
+
+    for (uint64_t id = 1; id <= 3; id++) {
+        Transaction txn;
+        txn.addWriteSet("k" + std::to_string(id), "1");
+        if (id <= 2) {
+            ASSERT_TRUE(admission.Admit(store.PreparedCount(), retryAfter));
+            EXPECT_EQ(REPLY_OK, store.Prepare(id, txn, Timestamp(10, id), proposed));
+        } else {
+            // the prepared set is full
+            EXPECT_FALSE(admission.Admit(store.PreparedCount(), retryAfter));
+            EXPECT_LE((uint64_t)ADMIT_MIN_RETRY_US, retryAfter);
+        }
+    }
+    EXPECT_EQ(2u, store.PreparedCount());
+
+    store.Commit(1);
+    store.Abort(2);
+    EXPECT_EQ(0u, store.PreparedCount());
+    EXPECT_TRUE(admission.Admit(store.PreparedCount(), retryAfter));
+
+    // slow prepares shut the door too, until the average decays
+    for (int i = 0; i < 100; i++) {
+        admission.Done(5000);
+    }
+    EXPECT_FALSE(admission.Admit(0, retryAfter));
+    EXPECT_GE((uint64_t)ADMIT_MAX_RETRY_US, retryAfter);
+    int rejected = 1;
+    while (!admission.Admit(0, retryAfter)) {
+        rejected++;
+    }
+    EXPECT_LT(1, rejected);
+    EXPECT_EQ((uint64_t)rejected + 1, admission.Rejected());
+}
+
+TEST(TapirStore, Contention)
+{
+    PartitionedStore store(ISOLATION_LINEARIZABLE, 2);
+    Timestamp proposed;
+    std::vector<ContentionEntry> top;
+    uint64_t total = 0;
+
+    store.Load("x", "0", Timestamp(1, 1));
+    Transaction t1;
+    t1.addWriteSet("x", "1");
+    t1.addWriteSet("y", "1");
+    EXPECT_EQ(REPLY_OK, store.Prepare(1, t1, Timestamp(20, 1), proposed));
+
+    // reads of x abstain on the pending write, writes of y retry
+    Transaction t2;
+    t2.addReadSet("x", Timestamp(1, 1));
+    Transaction t3;
+    t3.addWriteSet("y", "3");
+    for (uint64_t i = 0; i < 3; i++) {
+        EXPECT_EQ(REPLY_ABSTAIN, store.Prepare(2, t2, Timestamp(30 + i, 2), proposed));
+    }
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(3, t3, Timestamp(15, 3), proposed));
+
+    store.Contention(top, total, true);
+    EXPECT_EQ(4u, total);
+    ASSERT_EQ(2u, top.size());
+    EXPECT_EQ("x", top[0].key);
+    EXPECT_EQ(3u, top[0].count);
+    EXPECT_EQ(3u, top[0].conflicts[CONFLICT_ABSTAIN_RW]);
+    EXPECT_EQ("y", top[1].key);
+    EXPECT_EQ(1u, top[1].conflicts[CONFLICT_RETRY_WW]);
+
+    // the counts start over after a reset
+    top.clear();
+    total = 0;
+    store.Contention(top, total, false);
+    EXPECT_EQ(0u, total);
+    EXPECT_TRUE(top.empty());
+}
+
+TEST(TapirStore, GetHints)
+{
+    Store store(ISOLATION_LINEARIZABLE);
+    Timestamp proposed;
+    std::pair<Timestamp, std::string> val;
+    Timestamp lastRead, pendingWrite;
+
+    store.Load("x", "0", Timestamp(1, 1));
+    EXPECT_EQ(REPLY_OK, store.GetWithHints(2, "x", val, lastRead, pendingWrite));
+    EXPECT_FALSE(lastRead.isValid());
+    EXPECT_FALSE(pendingWrite.isValid());
+
+    // txn 3 reads x at 30, txn 4 prepares a write of it at 40
+    Transaction t3;
+    t3.addReadSet("x", Timestamp(1, 1));
+    EXPECT_EQ(REPLY_OK, store.Prepare(3, t3, Timestamp(30, 3), proposed));
+    store.Commit(3);
+    Transaction t4;
+    t4.addWriteSet("x", "4");
+    EXPECT_EQ(REPLY_OK, store.Prepare(4, t4, Timestamp(40, 4), proposed));
+
+    EXPECT_EQ(REPLY_OK, store.GetWithHints(5, "x", val, lastRead, pendingWrite));
+    EXPECT_EQ(Timestamp(30, 3), lastRead);
+    EXPECT_EQ(Timestamp(40, 4), pendingWrite);
+
+    // a write below either would retry; one above both does not have to
+    Transaction t5;
+    t5.addWriteSet("x", "5");
+    EXPECT_EQ(REPLY_RETRY, store.Prepare(5, t5, Timestamp(35, 5), proposed));
+    store.Abort(4);
+    EXPECT_EQ(REPLY_OK, store.Prepare(5, t5, Timestamp(41, 5), proposed));
+}
+
+TEST(TapirStore, PrepareBatch)
+{
+    Store store(ISOLATION_LINEARIZABLE);
+    store.Load("y", "0", Timestamp(1, 1));
+    Transaction t1, t2, t3;
+    t1.addWriteSet("y", "1");
+    t2.addWriteSet("y", "2");
+    t3.addReadSet("y", Timestamp(1, 1));
+
+    // received in the opposite order, the write at 15 would retry
+    // behind the one at 20; in a batch both prepare
+    std::vector<PrepareRequest> batch(3);
+    batch[0].id = 1;
+    batch[0].txn = TransactionView(t1);
+    batch[0].timestamp = Timestamp(20, 1);
+    batch[1].id = 2;
+    batch[1].txn = TransactionView(t2);
+    batch[1].timestamp = Timestamp(15, 2);
+    // and a read of y in between conflicts with the write below it
+    batch[2].id = 3;
+    batch[2].txn = TransactionView(t3);
+    batch[2].timestamp = Timestamp(17, 3);
+    batch[2].isolated = true;
+    batch[2].isolation = ISOLATION_SERIALIZABLE;
+    store.PrepareBatch(batch);
+    EXPECT_EQ(REPLY_OK, batch[0].status);
+    EXPECT_EQ(REPLY_OK, batch[1].status);
+    EXPECT_EQ(REPLY_ABSTAIN, batch[2].status);
+    EXPECT_EQ(2u, store.PreparedCount());
+
+    // a prepare already made is not made again, and one below the
+    // closed timestamp is told to retry above it
+    store.Close(Timestamp(10, 0));
+    std::vector<PrepareRequest> again(2);
+    again[0].id = 1;
+    again[0].txn = TransactionView(t1);
+    again[0].timestamp = Timestamp(20, 1);
+    again[1].id = 4;
+    again[1].txn = TransactionView(t3);
+    again[1].timestamp = Timestamp(5, 4);
+    store.PrepareBatch(again);
+    EXPECT_EQ(REPLY_OK, again[0].status);
+    EXPECT_EQ(REPLY_RETRY, again[1].status);
+    EXPECT_EQ(Timestamp(10, 0), again[1].proposed);
+    EXPECT_EQ(2u, store.PreparedCount());
+}